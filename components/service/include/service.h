@@ -38,6 +38,10 @@ extern "C" {
 
 esp_periph_set_handle_t periph_set_init(esp_periph_event_handle_t cb);
 
+/**
+ * Start buttons, touch and SD card without waiting for each other.
+ * The SD card is mounted in the background, PERIPH_ID_SDCARD events of the set tell when it is usable.
+ */
 esp_err_t periph_start_handle(esp_periph_set_handle_t set);
 
 display_service_handle_t display_service_init(void);
@@ -94,7 +94,10 @@ esp_periph_set_handle_t periph_set_init(esp_periph_event_handle_t cb)
     esp_periph_config_t periph_cfg = DEFAULT_ESP_PERIPH_SET_CONFIG();
     esp_periph_set_handle_t set = esp_periph_set_init(&periph_cfg);
     if (set != NULL) {
-        esp_periph_set_register_callback(set, cb, NULL);
+        // without callback, the events are read from the set event iface.
+        if (cb != NULL) {
+            esp_periph_set_register_callback(set, cb, NULL);
+        }
         return set;
     }
     return NULL;
@@ -102,6 +105,9 @@ esp_periph_set_handle_t periph_set_init(esp_periph_event_handle_t cb)
 
 esp_err_t periph_start_handle(esp_periph_set_handle_t set)
 {
+    esp_err_t ret = ESP_OK;
+
+    // each peripheral starts on its own, a failing one doesn't hold back the others.
     periph_button_cfg_t btn_cfg = {
         .gpio_mask = (1ULL << get_input_rec_id()) | (1ULL << get_input_mode_id()), //REC BTN & MODE BTN
     };
@@ -109,7 +115,7 @@ esp_err_t periph_start_handle(esp_periph_set_handle_t set)
     esp_err_t err = esp_periph_start(set, button_handle);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "ERROR periph start button [%d]", __LINE__);
-        return err;
+        ret = err;
     }
 
     // If enabled, the touch will consume a lot of CPU.
@@ -121,9 +127,10 @@ esp_err_t periph_start_handle(esp_periph_set_handle_t set)
     err = esp_periph_start(set, touch_periph);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "ERROR periph start touch [%d]", __LINE__);
-        return err;
+        ret = err;
     }
 
+    // the card mounts in the periph task, the result comes as a periph event.
     periph_sdcard_cfg_t sdcard_cfg = {
         .root = "/sdcard",
         .card_detect_pin = get_sdcard_intr_gpio(), //GPIO_NUM_34
@@ -132,13 +139,10 @@ esp_err_t periph_start_handle(esp_periph_set_handle_t set)
     err = esp_periph_start(set, sdcard_handle);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "ERROR periph start sdcard [%d]", __LINE__);
-        return err;
-    }
-    while (!periph_sdcard_is_mounted(sdcard_handle)) {
-        vTaskDelay(300 / portTICK_PERIOD_MS);
+        ret = err;
     }
 
-    return err;
+    return ret;
 }
 
 // esp_err_t wifi_service_cb(periph_service_handle_t handle, periph_service_event_t *evt, void *ctx)
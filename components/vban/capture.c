@@ -0,0 +1,352 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "capture.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vban.h"
+
+/** the file layout is the same for the board and the host tools, no implicit padding */
+_Static_assert(sizeof(struct capture_header_t) == 32, "capture header layout");
+_Static_assert(sizeof(struct capture_record_header_t) == 40, "capture record header layout");
+_Static_assert(sizeof(struct capture_index_entry_t) == 16, "capture index entry layout");
+_Static_assert(sizeof(struct capture_trailer_t) == 24, "capture trailer layout");
+
+struct capture_t
+{
+    FILE*                           file;
+    uint32_t                        offset;     /* end of the file */
+    uint32_t                        records;
+    uint32_t                        stride;
+    unsigned int                    index_size;
+    unsigned int                    entries;
+    struct capture_index_entry_t*   index;
+};
+
+/** the key a seek runs on */
+enum capture_key
+{
+    CAPTURE_KEY_TIME,
+    CAPTURE_KEY_FRAME,
+};
+
+static int capture_fail(capture_handle_t handle);
+static size_t capture_seek(struct capture_file_t const* file, enum capture_key key, int64_t value);
+static int64_t capture_record_key(struct capture_record_t const* record, enum capture_key key);
+
+int capture_open(capture_handle_t* handle, char const* path, struct capture_config_t const* config)
+{
+    struct capture_header_t header;
+
+    if ((handle == 0) || (path == 0) || (config == 0) || ((config->index_size & 1) != 0))
+    {
+        return -EINVAL;
+    }
+
+    *handle = calloc(1, sizeof(struct capture_t));
+    if (*handle == 0)
+    {
+        return -ENOMEM;
+    }
+
+    (*handle)->stride = 1;
+    (*handle)->index_size = (config->index_size != 0) ? config->index_size : CAPTURE_INDEX_SIZE;
+    (*handle)->index = malloc((*handle)->index_size * sizeof(struct capture_index_entry_t));
+    if ((*handle)->index == 0)
+    {
+        capture_close(handle);
+        return -ENOMEM;
+    }
+
+    (*handle)->file = fopen(path, "wb");
+    if ((*handle)->file == 0)
+    {
+        int ret = -errno;
+        capture_close(handle);
+        return ret;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+    header.version = CAPTURE_VERSION;
+    header.header_size = sizeof(header);
+    header.wall_us = config->wall_us;
+    header.mono_us = config->mono_us;
+    if (fwrite(&header, sizeof(header), 1, (*handle)->file) != 1)
+    {
+        int ret = capture_fail(*handle);
+        capture_close(handle);
+        return ret;
+    }
+    (*handle)->offset = sizeof(header);
+
+    return 0;
+}
+
+int capture_fail(capture_handle_t handle)
+{
+    /** a failed write leaves a record in pieces, nothing more goes after it */
+    int ret = (errno != 0) ? -errno : -EIO;
+    fclose(handle->file);
+    handle->file = 0;
+    return ret;
+}
+
+int capture_write(capture_handle_t handle, char const* buffer, size_t size, int64_t time_us,
+                  struct capture_source_t const* source)
+{
+    struct VBanHeader const* const hdr = (struct VBanHeader const*)buffer;
+    struct capture_record_header_t record;
+    unsigned int index;
+
+    if ((handle == 0) || (buffer == 0) || (size > UINT16_MAX))
+    {
+        return -EINVAL;
+    }
+
+    if (handle->file == 0)
+    {
+        return -EIO;
+    }
+
+    memset(&record, 0, sizeof(record));
+    record.time_us = time_us;
+    record.size = size;
+    if ((size >= VBAN_HEADER_SIZE) && (hdr->vban == VBAN_HEADER_FOURC))
+    {
+        record.nu_frame = hdr->nuFrame;
+    }
+    if (source != 0)
+    {
+        record.ip_version = source->ip_version;
+        record.port = source->port;
+        memcpy(record.ip, source->ip, sizeof(record.ip));
+    }
+
+    if ((handle->records % handle->stride) == 0)
+    {
+        if (handle->entries == handle->index_size)
+        {
+            /** keep the entries of even records, they are the ones of the doubled stride */
+            for (index = 0; index < handle->entries / 2; ++index)
+            {
+                handle->index[index] = handle->index[index * 2];
+            }
+            handle->entries /= 2;
+            handle->stride *= 2;
+        }
+        if ((handle->records % handle->stride) == 0)
+        {
+            handle->index[handle->entries].time_us = time_us;
+            handle->index[handle->entries].nu_frame = record.nu_frame;
+            handle->index[handle->entries].offset = handle->offset;
+            ++handle->entries;
+        }
+    }
+
+    if ((fwrite(&record, sizeof(record), 1, handle->file) != 1)
+        || ((size > 0) && (fwrite(buffer, size, 1, handle->file) != 1)))
+    {
+        return capture_fail(handle);
+    }
+    handle->offset += sizeof(record) + size;
+    ++handle->records;
+
+    return 0;
+}
+
+int capture_close(capture_handle_t* handle)
+{
+    struct capture_trailer_t trailer;
+    int ret = 0;
+
+    if (handle == 0)
+    {
+        return -EINVAL;
+    }
+
+    if (*handle == 0)
+    {
+        return 0;
+    }
+
+    if ((*handle)->file != 0)
+    {
+        memset(&trailer, 0, sizeof(trailer));
+        memcpy(trailer.magic, CAPTURE_INDEX_MAGIC, sizeof(trailer.magic));
+        trailer.entries = (*handle)->entries;
+        trailer.stride = (*handle)->stride;
+        trailer.records = (*handle)->records;
+        trailer.index_offset = (*handle)->offset;
+        if ((fwrite((*handle)->index, sizeof(struct capture_index_entry_t), (*handle)->entries, (*handle)->file)
+             != (*handle)->entries)
+            || (fwrite(&trailer, sizeof(trailer), 1, (*handle)->file) != 1))
+        {
+            ret = -EIO;
+        }
+        if (fclose((*handle)->file) != 0)
+        {
+            ret = -EIO;
+        }
+    }
+
+    free((*handle)->index);
+    free(*handle);
+    *handle = 0;
+
+    return ret;
+}
+
+int capture_map(struct capture_file_t* file, void const* base, size_t size)
+{
+    size_t index_size;
+
+    if ((file == 0) || (base == 0))
+    {
+        return -EINVAL;
+    }
+
+    memset(file, 0, sizeof(struct capture_file_t));
+    if (size < sizeof(struct capture_header_t))
+    {
+        return -EINVAL;
+    }
+
+    file->base = base;
+    file->size = size;
+    memcpy(&file->header, base, sizeof(struct capture_header_t));
+    if ((memcmp(file->header.magic, CAPTURE_MAGIC, sizeof(file->header.magic)) != 0)
+        || (file->header.version != CAPTURE_VERSION) || (file->header.header_size < sizeof(struct capture_header_t))
+        || (file->header.header_size > size))
+    {
+        return -EINVAL;
+    }
+    file->first = file->header.header_size;
+    file->end = size;
+
+    if (size >= file->first + sizeof(struct capture_trailer_t))
+    {
+        struct capture_trailer_t trailer;
+        memcpy(&trailer, file->base + size - sizeof(trailer), sizeof(trailer));
+        index_size = (size_t)trailer.entries * sizeof(struct capture_index_entry_t);
+        if ((memcmp(trailer.magic, CAPTURE_INDEX_MAGIC, sizeof(trailer.magic)) == 0) && (trailer.stride > 0)
+            && (trailer.index_offset >= file->first)
+            && (trailer.index_offset + index_size + sizeof(trailer) == size))
+        {
+            file->trailer = trailer;
+            file->end = trailer.index_offset;
+        }
+    }
+
+    return 0;
+}
+
+int capture_next(struct capture_file_t const* file, size_t* offset, struct capture_record_t* record)
+{
+    struct capture_record_header_t header;
+
+    if ((file == 0) || (offset == 0) || (record == 0))
+    {
+        return -EINVAL;
+    }
+
+    if (*offset + sizeof(header) > file->end)
+    {
+        /** the tail of a capture cut short is as good as the end */
+        return 0;
+    }
+
+    memcpy(&header, file->base + *offset, sizeof(header));
+    if (*offset + sizeof(header) + header.size > file->end)
+    {
+        return (file->trailer.entries > 0) ? -EINVAL : 0;
+    }
+
+    record->time_us = header.time_us;
+    record->nu_frame = header.nu_frame;
+    record->source.ip_version = header.ip_version;
+    record->source.port = header.port;
+    memcpy(record->source.ip, header.ip, sizeof(header.ip));
+    record->data = file->base + *offset + sizeof(header);
+    record->size = header.size;
+    *offset += sizeof(header) + header.size;
+
+    return 1;
+}
+
+int64_t capture_record_key(struct capture_record_t const* record, enum capture_key key)
+{
+    return (key == CAPTURE_KEY_TIME) ? record->time_us : (int64_t)record->nu_frame;
+}
+
+size_t capture_seek(struct capture_file_t const* file, enum capture_key key, int64_t value)
+{
+    struct capture_index_entry_t entry;
+    struct capture_record_t record;
+    size_t offset;
+    size_t found;
+    uint32_t low = 0;
+    uint32_t high;
+
+    if (file == 0)
+    {
+        return 0;
+    }
+
+    /** last entry before the value, then at most a stride of records to walk */
+    offset = file->first;
+    high = file->trailer.entries;
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        memcpy(&entry, file->base + file->trailer.index_offset + (size_t)middle * sizeof(entry), sizeof(entry));
+        if (((key == CAPTURE_KEY_TIME) ? entry.time_us : (int64_t)entry.nu_frame) < value)
+        {
+            offset = entry.offset;
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    found = offset;
+    while (capture_next(file, &offset, &record) > 0)
+    {
+        if (capture_record_key(&record, key) >= value)
+        {
+            return found;
+        }
+        found = offset;
+    }
+
+    return file->end;
+}
+
+size_t capture_seek_time(struct capture_file_t const* file, int64_t time_us)
+{
+    return capture_seek(file, CAPTURE_KEY_TIME, time_us);
+}
+
+size_t capture_seek_frame(struct capture_file_t const* file, uint32_t nu_frame)
+{
+    return capture_seek(file, CAPTURE_KEY_FRAME, nu_frame);
+}
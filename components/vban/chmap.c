@@ -0,0 +1,312 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "chmap.h"
+#include <errno.h>
+#include <string.h>
+#include "esp_log.h"
+
+static const char *TAG = "VBAN_CHMAP";
+
+static void chmap_gather(struct chmap_t const* chmap, char const* src, size_t in_stride, size_t sample_size,
+    size_t nb_samples, char* dst);
+static int chmap_mix(struct chmap_t const* chmap, char const* src, unsigned int in_channels, VBanBitResolution bit_fmt,
+    size_t nb_samples, char* dst);
+static int32_t chmap_gain(int16_t gain);
+static int32_t chmap_load24(char const* p);
+static void chmap_store24(char* p, int32_t value);
+
+int chmap_set_gather(struct chmap_t* chmap, unsigned int out_channels, uint16_t const* map)
+{
+    unsigned int index;
+
+    if ((chmap == 0) || ((out_channels != 0) && (map == 0)) || (out_channels > CHMAP_OUT_MAX_NB))
+    {
+        ESP_LOGE(TAG, "%s: invalid argument", __func__);
+        return -EINVAL;
+    }
+
+    for (index = 0; index < out_channels; ++index)
+    {
+        if (map[index] >= VBAN_CHANNELS_MAX_NB)
+        {
+            ESP_LOGE(TAG, "%s: invalid input channel %u", __func__, map[index]);
+            return -EINVAL;
+        }
+        chmap->map[index] = map[index];
+    }
+
+    chmap->mode         = (out_channels != 0) ? CHMAP_GATHER : CHMAP_NONE;
+    chmap->out_channels = out_channels;
+
+    return 0;
+}
+
+int chmap_set_mix(struct chmap_t* chmap, unsigned int in_channels, unsigned int out_channels, int16_t const* gains)
+{
+    unsigned int out;
+    unsigned int in;
+
+    if ((chmap == 0) || ((out_channels != 0) && (gains == 0)) || (out_channels > CHMAP_OUT_MAX_NB)
+        || (in_channels > VBAN_CHANNELS_MAX_NB) || ((out_channels != 0) && (in_channels == 0)))
+    {
+        ESP_LOGE(TAG, "%s: invalid argument", __func__);
+        return -EINVAL;
+    }
+
+    memcpy(chmap->gains, gains, out_channels * in_channels * sizeof(int16_t));
+    for (out = 0; out < out_channels; ++out)
+    {
+        /** a row that only routes one input is a copy, no rounding on the way */
+        chmap->bypass[out] = -1;
+        for (in = 0; in < in_channels; ++in)
+        {
+            if (gains[out * in_channels + in] == 0)
+            {
+                continue;
+            }
+            if ((gains[out * in_channels + in] != CHMAP_GAIN_UNITY) || (chmap->bypass[out] != -1))
+            {
+                chmap->bypass[out] = -1;
+                break;
+            }
+            chmap->bypass[out] = in;
+        }
+    }
+    chmap->mode         = (out_channels != 0) ? CHMAP_MIX : CHMAP_NONE;
+    chmap->in_channels  = in_channels;
+    chmap->out_channels = out_channels;
+
+    return 0;
+}
+
+int chmap_apply(struct chmap_t const* chmap, char const* src, unsigned int in_channels, VBanBitResolution bit_fmt,
+    size_t nb_samples, char* dst, size_t dst_size)
+{
+    size_t sample_size;
+    size_t out_size;
+    unsigned int index;
+
+    if ((chmap == 0) || (src == 0) || (dst == 0) || (bit_fmt >= VBAN_BITFMT_12_INT))
+    {
+        ESP_LOGE(TAG, "%s: invalid argument", __func__);
+        return -EINVAL;
+    }
+
+    sample_size = VBanBitResolutionSize[bit_fmt];
+
+    if (chmap->mode == CHMAP_NONE)
+    {
+        out_size = nb_samples * in_channels * sample_size;
+        if (out_size > dst_size)
+        {
+            return -ENOSPC;
+        }
+        memcpy(dst, src, out_size);
+        return out_size;
+    }
+
+    out_size = nb_samples * chmap->out_channels * sample_size;
+    if (out_size > dst_size)
+    {
+        return -ENOSPC;
+    }
+
+    if (chmap->mode == CHMAP_GATHER)
+    {
+        for (index = 0; index < chmap->out_channels; ++index)
+        {
+            if (chmap->map[index] >= in_channels)
+            {
+                ESP_LOGE(TAG, "%s: stream has no channel %u", __func__, chmap->map[index]);
+                return -EINVAL;
+            }
+        }
+        chmap_gather(chmap, src, in_channels * sample_size, sample_size, nb_samples, dst);
+        return out_size;
+    }
+
+    return (chmap_mix(chmap, src, in_channels, bit_fmt, nb_samples, dst) == 0) ? (int)out_size : -EINVAL;
+}
+
+void chmap_gather(struct chmap_t const* chmap, char const* src, size_t in_stride, size_t sample_size,
+    size_t nb_samples, char* dst)
+{
+    size_t const out_stride = chmap->out_channels * sample_size;
+    unsigned int channel;
+    size_t sample;
+
+    /** one strided pass per output channel, only the selected input columns are read */
+    for (channel = 0; channel < chmap->out_channels; ++channel)
+    {
+        char const* in = src + chmap->map[channel] * sample_size;
+        char* out = dst + channel * sample_size;
+
+        switch (sample_size)
+        {
+            case 2:
+                for (sample = 0; sample < nb_samples; ++sample, in += in_stride, out += out_stride)
+                {
+                    memcpy(out, in, 2);
+                }
+                break;
+
+            case 4:
+                for (sample = 0; sample < nb_samples; ++sample, in += in_stride, out += out_stride)
+                {
+                    memcpy(out, in, 4);
+                }
+                break;
+
+            default:
+                for (sample = 0; sample < nb_samples; ++sample, in += in_stride, out += out_stride)
+                {
+                    memcpy(out, in, sample_size);
+                }
+                break;
+        }
+    }
+}
+
+int32_t chmap_gain(int16_t gain)
+{
+    /** the full scale value stands for 1.0 so unity rows keep every bit */
+    return (gain == CHMAP_GAIN_UNITY) ? CHMAP_Q15_ONE : gain;
+}
+
+int32_t chmap_load24(char const* p)
+{
+    uint8_t const* b = (uint8_t const*)p;
+    return (int32_t)((uint32_t)b[0] << 8 | (uint32_t)b[1] << 16 | (uint32_t)b[2] << 24) >> 8;
+}
+
+void chmap_store24(char* p, int32_t value)
+{
+    p[0] = (char)(value & 0xFF);
+    p[1] = (char)((value >> 8) & 0xFF);
+    p[2] = (char)((value >> 16) & 0xFF);
+}
+
+int chmap_mix(struct chmap_t const* chmap, char const* src, unsigned int in_channels, VBanBitResolution bit_fmt,
+    size_t nb_samples, char* dst)
+{
+    size_t const sample_size = VBanBitResolutionSize[bit_fmt];
+    unsigned int const width = (in_channels < chmap->in_channels) ? in_channels : chmap->in_channels;
+    unsigned int out;
+    unsigned int in;
+    size_t sample;
+
+    for (sample = 0; sample < nb_samples; ++sample)
+    {
+        char const* row = src + sample * in_channels * sample_size;
+
+        for (out = 0; out < chmap->out_channels; ++out)
+        {
+            int16_t const* gain = &chmap->gains[out * chmap->in_channels];
+            int64_t acc = 0;
+            float facc = 0.0f;
+
+            if (chmap->bypass[out] >= 0)
+            {
+                if ((unsigned int)chmap->bypass[out] < width)
+                {
+                    memcpy(dst, row + chmap->bypass[out] * sample_size, sample_size);
+                }
+                else
+                {
+                    memset(dst, 0, sample_size);
+                }
+                dst += sample_size;
+                continue;
+            }
+
+            switch (bit_fmt)
+            {
+                case VBAN_BITFMT_16_INT:
+                {
+                    int16_t value;
+                    for (in = 0; in < width; ++in)
+                    {
+                        if (gain[in] != 0)
+                        {
+                            memcpy(&value, row + in * 2, 2);
+                            acc += (int32_t)value * chmap_gain(gain[in]);
+                        }
+                    }
+                    acc >>= 15;
+                    value = (acc > INT16_MAX) ? INT16_MAX : (acc < INT16_MIN) ? INT16_MIN : (int16_t)acc;
+                    memcpy(dst, &value, 2);
+                    break;
+                }
+
+                case VBAN_BITFMT_24_INT:
+                    for (in = 0; in < width; ++in)
+                    {
+                        if (gain[in] != 0)
+                        {
+                            acc += (int64_t)chmap_load24(row + in * 3) * chmap_gain(gain[in]);
+                        }
+                    }
+                    acc >>= 15;
+                    chmap_store24(dst, (acc > 0x7FFFFF) ? 0x7FFFFF : (acc < -0x800000) ? -0x800000 : (int32_t)acc);
+                    break;
+
+                case VBAN_BITFMT_32_INT:
+                {
+                    int32_t value;
+                    for (in = 0; in < width; ++in)
+                    {
+                        if (gain[in] != 0)
+                        {
+                            memcpy(&value, row + in * 4, 4);
+                            acc += (int64_t)value * chmap_gain(gain[in]);
+                        }
+                    }
+                    acc >>= 15;
+                    value = (acc > INT32_MAX) ? INT32_MAX : (acc < INT32_MIN) ? INT32_MIN : (int32_t)acc;
+                    memcpy(dst, &value, 4);
+                    break;
+                }
+
+                case VBAN_BITFMT_32_FLOAT:
+                {
+                    float value;
+                    for (in = 0; in < width; ++in)
+                    {
+                        if (gain[in] != 0)
+                        {
+                            memcpy(&value, row + in * 4, 4);
+                            facc += value * chmap_gain(gain[in]);
+                        }
+                    }
+                    facc /= 32768.0f;
+                    memcpy(dst, &facc, 4);
+                    break;
+                }
+
+                default:
+                    ESP_LOGE(TAG, "%s: bit format %d can't be mixed", __func__, bit_fmt);
+                    return -EINVAL;
+            }
+
+            dst += sample_size;
+        }
+    }
+
+    return 0;
+}
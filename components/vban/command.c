@@ -0,0 +1,260 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "command.h"
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+
+#include "esp_log.h"
+
+static const char *TAG = "VBAN_COMMAND";
+
+/**
+ * Longest key of the command table
+ */
+#define COMMAND_KEY_SIZE        8
+
+enum command_arg
+{
+    COMMAND_ARG_NONE,
+    COMMAND_ARG_INT,
+    COMMAND_ARG_BOOL,
+    COMMAND_ARG_TEXT,
+};
+
+struct command_desc_t
+{
+    char const*         key;
+    enum command_id     id;
+    enum command_arg    arg;
+    int                 min;
+    int                 max;
+};
+
+static struct command_desc_t const command_table[] =
+{
+    { "volume",     COMMAND_VOLUME,     COMMAND_ARG_INT,    0,  100 },
+    { "mute",       COMMAND_MUTE,       COMMAND_ARG_BOOL,   0,  1   },
+    { "stream",     COMMAND_STREAM,     COMMAND_ARG_TEXT,   1,  VBAN_STREAM_NAME_SIZE },
+    { "latency",    COMMAND_LATENCY,    COMMAND_ARG_INT,    0,  500 },
+    { "stats",      COMMAND_STATS,      COMMAND_ARG_NONE,   0,  0   },
+};
+
+#define COMMAND_TABLE_NB    (sizeof(command_table) / sizeof(command_table[0]))
+
+static int command_is_space(char c);
+static int command_is_end(char c);
+static struct command_desc_t const* command_find(char const* key, size_t size);
+static int command_parse_int(char const* value, size_t size, int* result);
+static int command_parse_bool(char const* value, size_t size, int* result);
+static int command_parse_one(char const* text, size_t size, struct command_t* command);
+
+int command_is_space(char c)
+{
+    return (c == ' ') || (c == '\t');
+}
+
+int command_is_end(char c)
+{
+    return (c == ';') || (c == '\n') || (c == '\r') || (c == '\0');
+}
+
+struct command_desc_t const* command_find(char const* key, size_t size)
+{
+    unsigned int index;
+
+    for (index = 0; index < COMMAND_TABLE_NB; ++index)
+    {
+        if ((strlen(command_table[index].key) == size) && (strncasecmp(command_table[index].key, key, size) == 0))
+        {
+            return &command_table[index];
+        }
+    }
+
+    return 0;
+}
+
+int command_parse_int(char const* value, size_t size, int* result)
+{
+    size_t index = 0;
+    int negative = 0;
+    int number = 0;
+
+    if ((size > 0) && ((value[0] == '-') || (value[0] == '+')))
+    {
+        negative = (value[0] == '-');
+        ++index;
+    }
+
+    /** at most 6 digits, every valid value is far below */
+    if ((index == size) || (size - index > 6))
+    {
+        return -EINVAL;
+    }
+
+    for (; index < size; ++index)
+    {
+        if ((value[index] < '0') || (value[index] > '9'))
+        {
+            return -EINVAL;
+        }
+        number = number * 10 + (value[index] - '0');
+    }
+
+    *result = negative ? -number : number;
+    return 0;
+}
+
+int command_parse_bool(char const* value, size_t size, int* result)
+{
+    if (((size == 2) && (strncasecmp(value, "on", 2) == 0)) || ((size == 4) && (strncasecmp(value, "true", 4) == 0))
+        || ((size == 1) && (value[0] == '1')))
+    {
+        *result = 1;
+        return 0;
+    }
+
+    if (((size == 3) && (strncasecmp(value, "off", 3) == 0)) || ((size == 5) && (strncasecmp(value, "false", 5) == 0))
+        || ((size == 1) && (value[0] == '0')))
+    {
+        *result = 0;
+        return 0;
+    }
+
+    return -EINVAL;
+}
+
+int command_parse_one(char const* text, size_t size, struct command_t* command)
+{
+    struct command_desc_t const* desc;
+    size_t key_size = 0;
+    size_t start;
+
+    /** key, then spaces or '=' before the value, trailing spaces are already trimmed */
+    while ((key_size < size) && !command_is_space(text[key_size]) && (text[key_size] != '='))
+    {
+        ++key_size;
+    }
+
+    desc = (key_size <= COMMAND_KEY_SIZE) ? command_find(text, key_size) : 0;
+    if (desc == 0)
+    {
+        ESP_LOGW(TAG, "%s: unknown command %.*s", __func__, (int)key_size, text);
+        return -ENOENT;
+    }
+
+    start = key_size;
+    while ((start < size) && (command_is_space(text[start]) || (text[start] == '=')))
+    {
+        ++start;
+    }
+    text += start;
+    size -= start;
+
+    memset(command, 0, sizeof(struct command_t));
+    command->id = desc->id;
+
+    switch (desc->arg)
+    {
+        case COMMAND_ARG_NONE:
+            if (size != 0)
+            {
+                ESP_LOGW(TAG, "%s: %s takes no value", __func__, desc->key);
+                return -EINVAL;
+            }
+            return 0;
+
+        case COMMAND_ARG_INT:
+            if ((command_parse_int(text, size, &command->value) != 0)
+                || (command->value < desc->min) || (command->value > desc->max))
+            {
+                ESP_LOGW(TAG, "%s: bad %s value %.*s", __func__, desc->key, (int)size, text);
+                return -EINVAL;
+            }
+            return 0;
+
+        case COMMAND_ARG_BOOL:
+            if (command_parse_bool(text, size, &command->value) != 0)
+            {
+                ESP_LOGW(TAG, "%s: bad %s value %.*s", __func__, desc->key, (int)size, text);
+                return -EINVAL;
+            }
+            return 0;
+
+        case COMMAND_ARG_TEXT:
+            if ((size < desc->min) || (size > desc->max))
+            {
+                ESP_LOGW(TAG, "%s: bad %s value %.*s", __func__, desc->key, (int)size, text);
+                return -EINVAL;
+            }
+            memcpy(command->text, text, size);
+            return 0;
+
+        default:
+            return -EINVAL;
+    }
+}
+
+int command_parse(char const* text, size_t size, command_handler_t handler, void* context)
+{
+    struct command_t command;
+    size_t begin = 0;
+    size_t end;
+    size_t last;
+    int nb = 0;
+
+    if ((text == 0) || (handler == 0))
+    {
+        ESP_LOGE(TAG, "%s: null pointer argument", __func__);
+        return -EINVAL;
+    }
+
+    while ((begin < size) && (nb < COMMAND_MAX_NB))
+    {
+        /** one command per separator, each byte is looked at a bounded number of times */
+        while ((begin < size) && (command_is_space(text[begin]) || (command_is_end(text[begin]) && (text[begin] != '\0'))))
+        {
+            ++begin;
+        }
+        if ((begin == size) || (text[begin] == '\0'))
+        {
+            break;
+        }
+
+        end = begin;
+        while ((end < size) && !command_is_end(text[end]))
+        {
+            ++end;
+        }
+        last = end;
+        while ((last > begin) && command_is_space(text[last - 1]))
+        {
+            --last;
+        }
+
+        if (command_parse_one(&text[begin], last - begin, &command) == 0)
+        {
+            handler(&command, context);
+            ++nb;
+        }
+        begin = end;
+    }
+
+    return nb;
+}
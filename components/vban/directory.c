@@ -0,0 +1,242 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "directory.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "packet.h"
+
+static const char *TAG = "VBAN_DIRECTORY";
+
+/**
+ * Packet rate measurement window
+ */
+#define DIRECTORY_RATE_WINDOW_US    1000000
+
+struct directory_slot_t
+{
+    struct directory_entry_t    entry;
+    uint32_t                    hash;
+    int64_t                     window_start_us;
+    uint32_t                    window_packets;
+};
+
+struct directory_t
+{
+    struct directory_slot_t     slots[DIRECTORY_ENTRIES_NB];
+    int64_t                     expiry_us;
+    struct directory_stats_t    stats;
+    SemaphoreHandle_t           lock;
+};
+
+static uint32_t directory_hash(char const* streamname, struct socket_address_t const* from);
+static int directory_is_live(directory_handle_t handle, struct directory_slot_t const* slot, int64_t now);
+
+int directory_init(directory_handle_t* handle, unsigned int expiry_ms)
+{
+    if ((handle == 0) || (expiry_ms == 0))
+    {
+        ESP_LOGE(TAG, "%s: invalid handle or expiry", __func__);
+        return -EINVAL;
+    }
+
+    *handle = calloc(1, sizeof(struct directory_t));
+    if (*handle == 0)
+    {
+        ESP_LOGE(TAG, "%s: could not allocate memory", __func__);
+        return -ENOMEM;
+    }
+
+    (*handle)->expiry_us = (int64_t)expiry_ms * 1000;
+    (*handle)->lock = xSemaphoreCreateMutex();
+    if ((*handle)->lock == 0)
+    {
+        ESP_LOGE(TAG, "%s: could not allocate memory", __func__);
+        directory_release(handle);
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+int directory_release(directory_handle_t* handle)
+{
+    if (handle == 0)
+    {
+        ESP_LOGE(TAG, "%s: null handle pointer", __func__);
+        return -EINVAL;
+    }
+
+    if (*handle != 0)
+    {
+        if ((*handle)->lock != 0)
+        {
+            vSemaphoreDelete((*handle)->lock);
+        }
+        free(*handle);
+        *handle = 0;
+    }
+
+    return 0;
+}
+
+uint32_t directory_hash(char const* streamname, struct socket_address_t const* from)
+{
+    unsigned char const* const addr = (unsigned char const*)from->data;
+    uint32_t hash = 2166136261u;
+    unsigned int index;
+
+    /** FNV-1a over the stream name and the raw sender address */
+    for (index = 0; (index < VBAN_STREAM_NAME_SIZE) && (streamname[index] != '\0'); ++index)
+    {
+        hash = (hash ^ (unsigned char)streamname[index]) * 16777619u;
+    }
+    for (index = 0; index < from->len; ++index)
+    {
+        hash = (hash ^ addr[index]) * 16777619u;
+    }
+
+    return hash;
+}
+
+int directory_is_live(directory_handle_t handle, struct directory_slot_t const* slot, int64_t now)
+{
+    return (slot->entry.last_seen_us != 0) && ((now - slot->entry.last_seen_us) < handle->expiry_us);
+}
+
+int directory_update(directory_handle_t handle, char const* buffer, size_t size, struct socket_address_t const* from)
+{
+    struct VBanHeader const* const hdr = PACKET_HEADER_PTR(buffer);
+    struct directory_slot_t* slot;
+    struct directory_slot_t* found = 0;
+    struct directory_slot_t* free_slot = 0;
+    struct directory_slot_t* oldest = 0;
+    unsigned int probe;
+    unsigned int sr_index;
+    int64_t now;
+    uint32_t hash;
+
+    if ((handle == 0) || (buffer == 0) || (from == 0) || (size < VBAN_HEADER_SIZE) || (hdr->vban != VBAN_HEADER_FOURC))
+    {
+        return -EINVAL;
+    }
+
+    now = esp_timer_get_time();
+    hash = directory_hash(hdr->streamname, from);
+
+    xSemaphoreTake(handle->lock, portMAX_DELAY);
+    for (probe = 0; probe < DIRECTORY_PROBES_NB; ++probe)
+    {
+        slot = &handle->slots[(hash + probe) & (DIRECTORY_ENTRIES_NB - 1)];
+        if (!directory_is_live(handle, slot, now))
+        {
+            /** expired entries are reused in place, nothing ever has to sweep the table */
+            free_slot = (free_slot != 0) ? free_slot : slot;
+            continue;
+        }
+        if ((slot->hash == hash) && (strncmp(slot->entry.streamname, hdr->streamname, VBAN_STREAM_NAME_SIZE) == 0)
+            && socket_address_match(&slot->entry.source, from))
+        {
+            found = slot;
+            break;
+        }
+        if ((oldest == 0) || (slot->entry.last_seen_us < oldest->entry.last_seen_us))
+        {
+            oldest = slot;
+        }
+    }
+
+    if (found == 0)
+    {
+        found = (free_slot != 0) ? free_slot : oldest;
+        if (free_slot == 0)
+        {
+            ++handle->stats.evicted;
+        }
+        memset(found, 0, sizeof(struct directory_slot_t));
+        found->hash = hash;
+        memcpy(found->entry.streamname, hdr->streamname, VBAN_STREAM_NAME_SIZE);
+        found->entry.source = *from;
+        found->window_start_us = now;
+    }
+
+    /** format fields follow the latest packet, a sender can change them any time */
+    found->entry.protocol = hdr->format_SR & VBAN_PROTOCOL_MASK;
+    found->entry.codec = hdr->format_bit & VBAN_CODEC_MASK;
+    found->entry.bit_fmt = hdr->format_bit & VBAN_BIT_RESOLUTION_MASK;
+    found->entry.channels = hdr->format_nbc + 1;
+    found->entry.samples = hdr->format_nbs + 1;
+    sr_index = hdr->format_SR & VBAN_SR_MASK;
+    found->entry.sample_rate = ((found->entry.protocol == VBAN_PROTOCOL_AUDIO) && (sr_index < VBAN_SR_MAXNUMBER))
+        ? VBanSRList[sr_index] : 0;
+
+    ++found->entry.packets;
+    ++found->window_packets;
+    if ((now - found->window_start_us) >= DIRECTORY_RATE_WINDOW_US)
+    {
+        found->entry.packet_rate = (uint32_t)(((int64_t)found->window_packets * 1000000) / (now - found->window_start_us));
+        found->window_packets = 0;
+        found->window_start_us = now;
+    }
+    found->entry.last_seen_us = now;
+    ++handle->stats.updates;
+    xSemaphoreGive(handle->lock);
+
+    return 0;
+}
+
+unsigned int directory_list(directory_handle_t handle, struct directory_entry_t* entries, unsigned int max_nb)
+{
+    unsigned int index;
+    unsigned int nb = 0;
+    int64_t now;
+
+    if ((handle == 0) || (entries == 0))
+    {
+        return 0;
+    }
+
+    now = esp_timer_get_time();
+    xSemaphoreTake(handle->lock, portMAX_DELAY);
+    for (index = 0; (index < DIRECTORY_ENTRIES_NB) && (nb < max_nb); ++index)
+    {
+        if (directory_is_live(handle, &handle->slots[index], now))
+        {
+            entries[nb++] = handle->slots[index].entry;
+        }
+    }
+    xSemaphoreGive(handle->lock);
+
+    return nb;
+}
+
+void directory_get_stats(directory_handle_t handle, struct directory_stats_t* stats)
+{
+    if ((handle == 0) || (stats == 0))
+    {
+        return;
+    }
+
+    *stats = handle->stats;
+}
@@ -0,0 +1,539 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fec.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "packet.h"
+#include "esp_log.h"
+
+static const char *TAG = "VBAN_FEC";
+
+struct fec_encoder_t
+{
+    unsigned int    group_size;
+    uint32_t        group;
+    unsigned int    count;
+    uint8_t         nbs_xor;
+    size_t          max_len;
+    struct fec_stats_t stats;
+    char            acc[VBAN_DATA_MAX_SIZE];
+    char            parity[VBAN_PROTOCOL_MAX_SIZE];
+};
+
+struct fec_slot_t
+{
+    uint32_t        nu;
+    size_t          size;
+    int             valid;
+    char            data[VBAN_PROTOCOL_MAX_SIZE];
+};
+
+struct fec_group_t
+{
+    uint32_t        id;
+    int             active;
+    int             closed;
+    int             protectable;        /* all frames of the group were expected */
+    uint32_t        expected;           /* bitmask of frames that should arrive */
+    uint32_t        received;           /* bitmask of frames that did arrive */
+    uint8_t         nbs_xor;
+    struct VBanHeader header;           /* template for rebuilt frames */
+    char            acc[VBAN_DATA_MAX_SIZE];
+};
+
+struct fec_decoder_t
+{
+    unsigned int        group_size;
+    int                 started;
+    uint32_t            next_release;
+    struct fec_stats_t  stats;
+    struct fec_group_t  groups[2];
+    struct fec_slot_t*  slots;          /* 2 groups worth of frames */
+};
+
+static void fec_xor(char* dst, char const* src, size_t size);
+static int fec_popcount(uint32_t mask);
+static struct fec_group_t* fec_decoder_group(fec_decoder_handle_t handle, uint32_t id, int create);
+static void fec_decoder_close_group(fec_decoder_handle_t handle, struct fec_group_t* group);
+static int fec_decoder_push_parity(fec_decoder_handle_t handle, char const* buffer, size_t size);
+
+void fec_xor(char* dst, char const* src, size_t size)
+{
+    while ((size >= sizeof(uint32_t)) && !((uintptr_t)dst & 3) && !((uintptr_t)src & 3))
+    {
+        *(uint32_t*)dst ^= *(uint32_t const*)src;
+        dst += sizeof(uint32_t);
+        src += sizeof(uint32_t);
+        size -= sizeof(uint32_t);
+    }
+
+    while (size--)
+    {
+        *dst++ ^= *src++;
+    }
+}
+
+int fec_popcount(uint32_t mask)
+{
+    int count = 0;
+    while (mask)
+    {
+        mask &= mask - 1;
+        ++count;
+    }
+    return count;
+}
+
+int fec_is_parity(char const* buffer, size_t size)
+{
+    struct VBanHeader const* const hdr = PACKET_HEADER_PTR(buffer);
+
+    if ((buffer == 0) || (size <= VBAN_HEADER_SIZE))
+    {
+        return 0;
+    }
+
+    return ((hdr->format_SR & VBAN_PROTOCOL_MASK) == VBAN_PROTOCOL_AUDIO)
+        && ((hdr->format_bit & VBAN_CODEC_MASK) == VBAN_CODEC_USER);
+}
+
+int fec_encoder_init(fec_encoder_handle_t* handle, unsigned int group_size)
+{
+    if (handle == 0)
+    {
+        ESP_LOGE(TAG, "%s: null handle pointer", __func__);
+        return -EINVAL;
+    }
+
+    if ((group_size < FEC_GROUP_SIZE_MIN) || (group_size > FEC_GROUP_SIZE_MAX))
+    {
+        ESP_LOGE(TAG, "%s: invalid group size %u", __func__, group_size);
+        return -EINVAL;
+    }
+
+    *handle = calloc(1, sizeof(struct fec_encoder_t));
+    if (*handle == 0)
+    {
+        ESP_LOGE(TAG, "%s: could not allocate memory", __func__);
+        return -ENOMEM;
+    }
+
+    (*handle)->group_size = group_size;
+
+    return 0;
+}
+
+int fec_encoder_release(fec_encoder_handle_t* handle)
+{
+    if (handle == 0)
+    {
+        ESP_LOGE(TAG, "%s: null handle pointer", __func__);
+        return -EINVAL;
+    }
+
+    free(*handle);
+    *handle = 0;
+
+    return 0;
+}
+
+int fec_encoder_add(fec_encoder_handle_t handle, char const* buffer, size_t size)
+{
+    struct VBanHeader const* const hdr = PACKET_HEADER_PTR(buffer);
+    struct VBanHeader* parity;
+    size_t const payload_size = PACKET_PAYLOAD_SIZE(size);
+    uint32_t group;
+    unsigned int index;
+
+    if ((handle == 0) || (buffer == 0) || (size <= VBAN_HEADER_SIZE) || (payload_size > VBAN_DATA_MAX_SIZE))
+    {
+        ESP_LOGE(TAG, "%s: invalid argument", __func__);
+        return -EINVAL;
+    }
+
+    parity = PACKET_HEADER_PTR(handle->parity);
+
+    group = hdr->nuFrame / handle->group_size;
+    index = hdr->nuFrame % handle->group_size;
+
+    if ((handle->count == 0) || (group != handle->group))
+    {
+        memset(handle->acc, 0, handle->max_len);
+        handle->group   = group;
+        handle->count   = 0;
+        handle->nbs_xor = 0;
+        handle->max_len = 0;
+    }
+
+    fec_xor(handle->acc, PACKET_PAYLOAD_PTR(buffer), payload_size);
+    handle->nbs_xor ^= hdr->format_nbs;
+    if (payload_size > handle->max_len)
+    {
+        handle->max_len = payload_size;
+    }
+    ++handle->count;
+
+    if (index != handle->group_size - 1)
+    {
+        return 0;
+    }
+
+    /** only a group we have seen completely can be protected */
+    if (handle->count != handle->group_size)
+    {
+        handle->count = 0;
+        return 0;
+    }
+
+    memcpy(parity, hdr, sizeof(struct VBanHeader));
+    parity->format_bit  = (hdr->format_bit & ~VBAN_CODEC_MASK) | VBAN_CODEC_USER;
+    parity->format_nbs  = handle->nbs_xor;
+    memcpy(PACKET_PAYLOAD_PTR(handle->parity), handle->acc, handle->max_len);
+
+    handle->count = 0;
+    ++handle->stats.parity_sent;
+
+    return sizeof(struct VBanHeader) + handle->max_len;
+}
+
+char const* fec_encoder_parity(fec_encoder_handle_t handle)
+{
+    return (handle != 0) ? handle->parity : 0;
+}
+
+int fec_decoder_init(fec_decoder_handle_t* handle, unsigned int group_size)
+{
+    if (handle == 0)
+    {
+        ESP_LOGE(TAG, "%s: null handle pointer", __func__);
+        return -EINVAL;
+    }
+
+    if ((group_size < FEC_GROUP_SIZE_MIN) || (group_size > FEC_GROUP_SIZE_MAX))
+    {
+        ESP_LOGE(TAG, "%s: invalid group size %u", __func__, group_size);
+        return -EINVAL;
+    }
+
+    *handle = calloc(1, sizeof(struct fec_decoder_t));
+    if (*handle == 0)
+    {
+        ESP_LOGE(TAG, "%s: could not allocate memory", __func__);
+        return -ENOMEM;
+    }
+
+    (*handle)->slots = calloc(2 * group_size, sizeof(struct fec_slot_t));
+    if ((*handle)->slots == 0)
+    {
+        ESP_LOGE(TAG, "%s: could not allocate memory", __func__);
+        free(*handle);
+        *handle = 0;
+        return -ENOMEM;
+    }
+
+    (*handle)->group_size = group_size;
+
+    return 0;
+}
+
+int fec_decoder_release(fec_decoder_handle_t* handle)
+{
+    if (handle == 0)
+    {
+        ESP_LOGE(TAG, "%s: null handle pointer", __func__);
+        return -EINVAL;
+    }
+
+    if (*handle != 0)
+    {
+        free((*handle)->slots);
+        free(*handle);
+        *handle = 0;
+    }
+
+    return 0;
+}
+
+void fec_decoder_reset(fec_decoder_handle_t handle)
+{
+    unsigned int index;
+
+    if (handle == 0)
+    {
+        return;
+    }
+
+    handle->started = 0;
+    handle->groups[0].active = 0;
+    handle->groups[1].active = 0;
+    for (index = 0; index < 2 * handle->group_size; ++index)
+    {
+        handle->slots[index].valid = 0;
+    }
+}
+
+struct fec_group_t* fec_decoder_group(fec_decoder_handle_t handle, uint32_t id, int create)
+{
+    struct fec_group_t* group = &handle->groups[id & 1];
+
+    if (group->active && (group->id == id))
+    {
+        return group;
+    }
+
+    if (!create)
+    {
+        return 0;
+    }
+
+    group->id           = id;
+    group->active       = 1;
+    group->closed       = 0;
+    group->protectable  = 1;
+    group->expected     = (1u << handle->group_size) - 1;
+    group->received     = 0;
+    group->nbs_xor      = 0;
+    memset(group->acc, 0, sizeof(group->acc));
+
+    return group;
+}
+
+void fec_decoder_close_group(fec_decoder_handle_t handle, struct fec_group_t* group)
+{
+    if ((group == 0) || group->closed)
+    {
+        return;
+    }
+
+    group->closed = 1;
+    handle->stats.unrecoverable += fec_popcount(group->expected & ~group->received);
+}
+
+int fec_decoder_push(fec_decoder_handle_t handle, char const* buffer, size_t size)
+{
+    struct VBanHeader const* const hdr = PACKET_HEADER_PTR(buffer);
+    size_t const payload_size = PACKET_PAYLOAD_SIZE(size);
+    struct fec_group_t* group;
+    struct fec_slot_t* slot;
+    uint32_t current;
+    uint32_t id;
+    unsigned int index;
+
+    if ((handle == 0) || (buffer == 0) || (size <= VBAN_HEADER_SIZE) || (size > VBAN_PROTOCOL_MAX_SIZE))
+    {
+        ESP_LOGE(TAG, "%s: invalid argument", __func__);
+        return -EINVAL;
+    }
+
+    if (fec_is_parity(buffer, size))
+    {
+        return fec_decoder_push_parity(handle, buffer, size);
+    }
+
+    id      = hdr->nuFrame / handle->group_size;
+    index   = hdr->nuFrame % handle->group_size;
+    current = handle->next_release / handle->group_size;
+
+    /** serial number arithmetic: the counter may wrap, or go back when the sender restarts */
+    if (handle->started && (((int32_t)(id - current) > 1)
+        || ((int32_t)(hdr->nuFrame - handle->next_release) < -(int32_t)(2 * handle->group_size))))
+    {
+        /** jump of more than the window either way (massive loss, sender restart): start over */
+        ESP_LOGW(TAG, "%s: frame %u too far from %u, resync", __func__, hdr->nuFrame, handle->next_release);
+        fec_decoder_close_group(handle, fec_decoder_group(handle, current, 0));
+        fec_decoder_close_group(handle, fec_decoder_group(handle, current + 1, 0));
+        fec_decoder_reset(handle);
+    }
+
+    if (!handle->started)
+    {
+        handle->started = 1;
+        handle->next_release = hdr->nuFrame;
+        current = id;
+        group = fec_decoder_group(handle, id, 1);
+        /** frames before the first one received are not expected, and can't be rebuilt */
+        group->expected &= ~((1u << index) - 1);
+        group->protectable = (index == 0);
+    }
+
+    if ((int32_t)(hdr->nuFrame - handle->next_release) < 0)
+    {
+        ++handle->stats.late;
+        return 0;
+    }
+
+    if (id == current + 1)
+    {
+        /** next group has started: no more hope for the current one */
+        fec_decoder_close_group(handle, fec_decoder_group(handle, current, 0));
+    }
+
+    group = fec_decoder_group(handle, id, 1);
+    if (group->received & (1u << index))
+    {
+        /** duplicate */
+        return 0;
+    }
+
+    slot = &handle->slots[hdr->nuFrame % (2 * handle->group_size)];
+    memcpy(slot->data, buffer, size);
+    slot->nu    = hdr->nuFrame;
+    slot->size  = size;
+    slot->valid = 1;
+
+    if (payload_size <= VBAN_DATA_MAX_SIZE)
+    {
+        fec_xor(group->acc, PACKET_PAYLOAD_PTR(buffer), payload_size);
+    }
+    group->nbs_xor ^= hdr->format_nbs;
+    group->received |= (1u << index);
+    memcpy(&group->header, hdr, sizeof(struct VBanHeader));
+
+    return 0;
+}
+
+int fec_decoder_push_parity(fec_decoder_handle_t handle, char const* buffer, size_t size)
+{
+    struct VBanHeader const* const hdr = PACKET_HEADER_PTR(buffer);
+    size_t const parity_size = PACKET_PAYLOAD_SIZE(size);
+    struct fec_group_t* group;
+    struct fec_slot_t* slot;
+    struct VBanHeader* rebuilt;
+    uint32_t missing;
+    unsigned int index = 0;
+    size_t payload_size;
+    uint8_t nbs;
+
+    if (!handle->started || ((hdr->nuFrame % handle->group_size) != handle->group_size - 1))
+    {
+        return 0;
+    }
+
+    group = fec_decoder_group(handle, hdr->nuFrame / handle->group_size, 0);
+    if ((group == 0) || group->closed)
+    {
+        /** group already released, parity is useless now */
+        return 0;
+    }
+
+    ++handle->stats.parity_received;
+
+    missing = group->expected & ~group->received;
+    if ((fec_popcount(missing) != 1) || !group->protectable)
+    {
+        fec_decoder_close_group(handle, group);
+        return 0;
+    }
+
+    while (!(missing & (1u << index)))
+    {
+        ++index;
+    }
+
+    nbs = group->nbs_xor ^ hdr->format_nbs;
+    payload_size = (nbs + 1) * (group->header.format_nbc + 1)
+        * VBanBitResolutionSize[group->header.format_bit & VBAN_BIT_RESOLUTION_MASK];
+
+    if ((payload_size > parity_size) || (payload_size > VBAN_DATA_MAX_SIZE))
+    {
+        ESP_LOGW(TAG, "%s: inconsistent parity for group %u", __func__, group->id);
+        fec_decoder_close_group(handle, group);
+        return 0;
+    }
+
+    fec_xor(group->acc, PACKET_PAYLOAD_PTR(buffer), parity_size);
+
+    slot = &handle->slots[(group->id * handle->group_size + index) % (2 * handle->group_size)];
+    rebuilt = PACKET_HEADER_PTR(slot->data);
+    memcpy(rebuilt, &group->header, sizeof(struct VBanHeader));
+    rebuilt->format_nbs = nbs;
+    rebuilt->nuFrame    = group->id * handle->group_size + index;
+    memcpy(PACKET_PAYLOAD_PTR(slot->data), group->acc, payload_size);
+    slot->nu    = rebuilt->nuFrame;
+    slot->size  = sizeof(struct VBanHeader) + payload_size;
+    slot->valid = 1;
+
+    group->received |= (1u << index);
+    ++handle->stats.recovered;
+    fec_decoder_close_group(handle, group);
+
+    return 0;
+}
+
+char const* fec_decoder_pop(fec_decoder_handle_t handle, size_t* size)
+{
+    struct fec_group_t* group;
+    struct fec_slot_t* slot;
+    unsigned int index;
+
+    if ((handle == 0) || (size == 0) || !handle->started)
+    {
+        return 0;
+    }
+
+    for (;;)
+    {
+        group = fec_decoder_group(handle, handle->next_release / handle->group_size, 0);
+        if (group == 0)
+        {
+            return 0;
+        }
+
+        index = handle->next_release % handle->group_size;
+        if (group->received & (1u << index))
+        {
+            slot = &handle->slots[handle->next_release % (2 * handle->group_size)];
+            ++handle->next_release;
+            if (!slot->valid)
+            {
+                continue;
+            }
+            slot->valid = 0;
+            *size = slot->size;
+            return slot->data;
+        }
+
+        if (!(group->expected & (1u << index)) || group->closed)
+        {
+            /** not expected, or lost for good: skip it */
+            ++handle->next_release;
+            continue;
+        }
+
+        /** hold back behind the gap */
+        return 0;
+    }
+}
+
+void fec_encoder_get_stats(fec_encoder_handle_t handle, struct fec_stats_t* stats)
+{
+    if ((handle != 0) && (stats != 0))
+    {
+        *stats = handle->stats;
+    }
+}
+
+void fec_decoder_get_stats(fec_decoder_handle_t handle, struct fec_stats_t* stats)
+{
+    if ((handle != 0) && (stats != 0))
+    {
+        *stats = handle->stats;
+    }
+}
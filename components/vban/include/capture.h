@@ -0,0 +1,195 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Capture file layout, little endian, no padding:
+ *
+ *   file header     struct capture_header_t
+ *   records         struct capture_record_header_t followed by the raw datagram, repeated
+ *   index           struct capture_index_entry_t, one every `stride` records
+ *   trailer         struct capture_trailer_t, at the very end
+ *
+ * Index and trailer are written on close. A capture cut short (power loss, card pulled)
+ * has none: its records still read in order, seeks fall back to a scan.
+ */
+#define CAPTURE_MAGIC           "VBCP"
+#define CAPTURE_INDEX_MAGIC     "VBCI"
+#define CAPTURE_VERSION         1
+
+/**
+ * Default number of index entries kept while writing
+ */
+#define CAPTURE_INDEX_SIZE      1024
+
+struct capture_header_t
+{
+    char        magic[4];
+    uint16_t    version;
+    uint16_t    header_size;
+    int64_t     wall_us;        /* wall clock when the capture started, 0 if unknown */
+    int64_t     mono_us;        /* record clock at the same instant */
+    uint32_t    flags;
+    uint32_t    reserved;
+};
+
+struct capture_record_header_t
+{
+    int64_t     time_us;        /* arrival, monotonic */
+    uint32_t    nu_frame;       /* copied from the VBAN header, 0 for other datagrams */
+    uint16_t    size;           /* datagram size */
+    uint16_t    port;           /* sender port */
+    uint8_t     ip[16];         /* sender address, IPv4 in the first 4 bytes */
+    uint8_t     ip_version;     /* 4, 6 or 0 if unknown */
+    uint8_t     reserved[7];    /* zero, up to the int64_t alignment */
+};
+
+struct capture_index_entry_t
+{
+    int64_t     time_us;
+    uint32_t    nu_frame;
+    uint32_t    offset;         /* of the record in the file */
+};
+
+struct capture_trailer_t
+{
+    char        magic[4];
+    uint32_t    entries;
+    uint32_t    stride;         /* records between two index entries */
+    uint32_t    records;
+    uint64_t    index_offset;
+};
+
+/**
+ * Sender of a captured datagram
+ */
+struct capture_source_t
+{
+    uint8_t     ip_version;
+    uint8_t     ip[16];
+    uint16_t    port;
+};
+
+/**
+ * Capture writer configuration structure.
+ * The index has a fixed size: once full, every other entry is dropped and the stride
+ * doubles, so the memory taken doesn't grow with the capture length.
+ */
+struct capture_config_t
+{
+    unsigned int    index_size;     /* even, 0 for CAPTURE_INDEX_SIZE */
+    int64_t         wall_us;
+    int64_t         mono_us;
+};
+
+/**
+ * Opaque handle type
+ */
+struct capture_t;
+typedef struct capture_t* capture_handle_t;
+
+/**
+ * Create a capture file
+ * @param handle handle pointer that will be allocated
+ * @param path file to create, replaced if it exists
+ * @param config configuration structure
+ * @return 0 upon success, negative value otherwise
+ */
+int capture_open(capture_handle_t* handle, char const* path, struct capture_config_t const* config);
+
+/**
+ * Append a datagram
+ * @param handle object handle
+ * @param buffer datagram, stored as it is
+ * @param size size of @p buffer
+ * @param time_us arrival time, monotonic
+ * @param source sender, may be null
+ * @return 0 upon success, negative value otherwise
+ */
+int capture_write(capture_handle_t handle, char const* buffer, size_t size, int64_t time_us,
+                  struct capture_source_t const* source);
+
+/**
+ * Write the index and close the file
+ * @param handle handle pointer that will be released
+ * @return 0 upon success, negative value otherwise
+ */
+int capture_close(capture_handle_t* handle);
+
+/**
+ * Capture file read from memory, a mapped file on the host. Holds no copy.
+ */
+struct capture_file_t
+{
+    char const*                 base;
+    size_t                      size;
+    struct capture_header_t     header;
+    struct capture_trailer_t    trailer;    /* entries is 0 without index */
+    size_t                      first;      /* offset of the first record */
+    size_t                      end;        /* end of the records */
+};
+
+/**
+ * A record of a capture file
+ */
+struct capture_record_t
+{
+    int64_t                 time_us;
+    uint32_t                nu_frame;
+    struct capture_source_t source;
+    char const*             data;       /* points into the file */
+    size_t                  size;
+};
+
+/**
+ * Check a capture file and find its index
+ * @param file reader to fill
+ * @param base file content
+ * @param size size of @p base
+ * @return 0 upon success, negative value otherwise
+ */
+int capture_map(struct capture_file_t* file, void const* base, size_t size);
+
+/**
+ * Read the record at @p offset and move past it
+ * @param file capture file
+ * @param offset record offset, capture_file_t first to start
+ * @param record record to fill
+ * @return 1 if a record was read, 0 at the end, negative value on a damaged record
+ */
+int capture_next(struct capture_file_t const* file, size_t* offset, struct capture_record_t* record);
+
+/**
+ * Find the first record that arrived at or after @p time_us, O(log n) with an index
+ * @return its offset, capture_file_t end if none
+ */
+size_t capture_seek_time(struct capture_file_t const* file, int64_t time_us);
+
+/**
+ * Find the first record with nuFrame at or after @p nu_frame.
+ * Expects growing frame numbers: a capture of one stream.
+ * @return its offset, capture_file_t end if none
+ */
+size_t capture_seek_frame(struct capture_file_t const* file, uint32_t nu_frame);
+
+#endif /*__CAPTURE_H__*/
@@ -0,0 +1,96 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CHMAP_H__
+#define __CHMAP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vban.h"
+
+/**
+ * Max number of output channels of a channel map
+ */
+#define CHMAP_OUT_MAX_NB        8
+
+/**
+ * Q15 one, the multiplier of a unity gain
+ */
+#define CHMAP_Q15_ONE           32768
+
+/**
+ * Unity gain of a mix matrix coefficient. Q15 one doesn't fit in an int16_t:
+ * the largest coefficient stands for it, and is exactly 1.0.
+ */
+#define CHMAP_GAIN_UNITY        INT16_MAX
+
+enum chmap_mode
+{
+    CHMAP_NONE,         /* payload is copied as is */
+    CHMAP_GATHER,       /* each output channel is one input channel */
+    CHMAP_MIX,          /* each output channel is a weighted sum of input channels */
+};
+
+/**
+ * Channel map applied between the packet payload and the output buffer.
+ * Unused input channels are never touched.
+ */
+struct chmap_t
+{
+    enum chmap_mode     mode;
+    unsigned int        out_channels;
+    unsigned int        in_channels;                                    /* mix matrix width */
+    uint16_t            map[CHMAP_OUT_MAX_NB];                          /* gather: input channel per output */
+    int16_t             gains[CHMAP_OUT_MAX_NB * VBAN_CHANNELS_MAX_NB]; /* mix: gains[out * in_channels + in] */
+    int16_t             bypass[CHMAP_OUT_MAX_NB];                       /* mix: input copied as is when a row is a single unity gain, -1 otherwise */
+};
+
+/**
+ * Configure a gather map
+ * @param chmap map to configure
+ * @param out_channels number of output channels, 0 to disable the map
+ * @param map input channel index for each output channel
+ * @return 0 upon success, negative value otherwise
+ */
+int chmap_set_gather(struct chmap_t* chmap, unsigned int out_channels, uint16_t const* map);
+
+/**
+ * Configure a mix matrix
+ * @param chmap map to configure
+ * @param in_channels number of input channels covered by @p gains
+ * @param out_channels number of output channels, 0 to disable the map
+ * @param gains Q15 gains, out_channels rows of in_channels values
+ * @return 0 upon success, negative value otherwise
+ */
+int chmap_set_mix(struct chmap_t* chmap, unsigned int in_channels, unsigned int out_channels, int16_t const* gains);
+
+/**
+ * Apply the map on interleaved samples
+ * @param chmap map to apply
+ * @param src interleaved input samples
+ * @param in_channels number of channels of @p src
+ * @param bit_fmt sample format of both input and output
+ * @param nb_samples number of samples per channel
+ * @param dst output buffer
+ * @param dst_size size of @p dst
+ * @return number of bytes written upon success, negative value otherwise
+ */
+int chmap_apply(struct chmap_t const* chmap, char const* src, unsigned int in_channels, VBanBitResolution bit_fmt,
+    size_t nb_samples, char* dst, size_t dst_size);
+
+#endif /*__CHMAP_H__*/
@@ -0,0 +1,77 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __COMMAND_H__
+#define __COMMAND_H__
+
+#include <stddef.h>
+#include "vban.h"
+
+/**
+ * Max number of commands run from one packet, the others are ignored
+ */
+#define COMMAND_MAX_NB          8
+
+/**
+ * Room for a text argument, a stream name
+ */
+#define COMMAND_TEXT_SIZE       (VBAN_STREAM_NAME_SIZE + 1)
+
+/**
+ * Commands of the VBAN-TEXT control channel.
+ * A packet holds "key value" or "key=value" commands separated by ';' or new lines,
+ * keys are case insensitive:
+ *   volume 0-100
+ *   mute on|off|1|0
+ *   stream NAME
+ *   latency 0-500 (ms, 0 for the fixed buffer sizes)
+ *   stats
+ */
+enum command_id
+{
+    COMMAND_VOLUME,
+    COMMAND_MUTE,
+    COMMAND_STREAM,
+    COMMAND_LATENCY,
+    COMMAND_STATS,
+};
+
+struct command_t
+{
+    enum command_id     id;
+    int                 value;                      /* volume, mute and latency */
+    char                text[COMMAND_TEXT_SIZE];    /* stream */
+};
+
+/**
+ * Called for each valid command of a packet, in order
+ */
+typedef void (*command_handler_t)(struct command_t const* command, void* context);
+
+/**
+ * Parse the text of a VBAN-TEXT packet.
+ * No allocation, one pass over @p text: safe to run from the receive path.
+ * @param text packet payload, not null terminated
+ * @param size size of @p text
+ * @param handler function called for each valid command
+ * @param context passed to @p handler
+ * @return number of commands run, negative value on invalid argument
+ */
+int command_parse(char const* text, size_t size, command_handler_t handler, void* context);
+
+#endif /*__COMMAND_H__*/
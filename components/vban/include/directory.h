@@ -0,0 +1,109 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DIRECTORY_H__
+#define __DIRECTORY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vban.h"
+#include "socket.h"
+
+/**
+ * Number of directory slots, a power of two
+ */
+#define DIRECTORY_ENTRIES_NB    32
+
+/**
+ * Slots looked at from the hashed one, bounds the cost of an update
+ */
+#define DIRECTORY_PROBES_NB     4
+
+/**
+ * Stream seen on the port, one per stream name and sender
+ */
+struct directory_entry_t
+{
+    char                    streamname[VBAN_STREAM_NAME_SIZE + 1];
+    struct socket_address_t source;
+    uint8_t                 protocol;       /* VBanProtocol */
+    uint8_t                 codec;          /* VBanCodec */
+    uint8_t                 bit_fmt;        /* VBanBitResolution */
+    uint16_t                channels;
+    uint16_t                samples;        /* samples per frame */
+    uint32_t                sample_rate;    /* 0 for other protocols than audio */
+    uint32_t                packets;
+    uint32_t                packet_rate;    /* packets per second, over the last second */
+    int64_t                 last_seen_us;
+};
+
+/**
+ * Directory statistics
+ */
+struct directory_stats_t
+{
+    uint32_t    updates;    /* packets recorded */
+    uint32_t    evicted;    /* live entries replaced because their probe window was full */
+};
+
+/**
+ * Opaque handle type
+ */
+struct directory_t;
+typedef struct directory_t* directory_handle_t;
+
+/**
+ * Allocate an empty directory
+ * @param handle handle pointer that will be allocated
+ * @param expiry_ms time after which a silent stream is dropped
+ * @return 0 upon success, negative value otherwise
+ */
+int directory_init(directory_handle_t* handle, unsigned int expiry_ms);
+
+/**
+ * Release the directory
+ * @param handle handle pointer that will be released
+ * @return 0 upon success, negative value otherwise
+ */
+int directory_release(directory_handle_t* handle);
+
+/**
+ * Record a received packet, in constant time
+ * @param handle object handle
+ * @param buffer pointer holding the packet
+ * @param size size of @p buffer data
+ * @param from sender address
+ * @return 0 upon success, negative value if this is not a vban packet
+ */
+int directory_update(directory_handle_t handle, char const* buffer, size_t size, struct socket_address_t const* from);
+
+/**
+ * Copy the streams seen within the expiry time
+ * @param handle object handle
+ * @param entries table to fill
+ * @param max_nb number of entries of @p entries
+ * @return number of entries filled
+ */
+unsigned int directory_list(directory_handle_t handle, struct directory_entry_t* entries, unsigned int max_nb);
+
+/**
+ * Get the directory statistics
+ */
+void directory_get_stats(directory_handle_t handle, struct directory_stats_t* stats);
+
+#endif /*__DIRECTORY_H__*/
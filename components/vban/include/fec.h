@@ -0,0 +1,141 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FEC_H__
+#define __FEC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vban.h"
+
+/**
+ * XOR parity forward error correction.
+ *
+ * Data frames are grouped by nuFrame: group = nuFrame / N, index = nuFrame % N.
+ * Once the sender has sent the N frames of a group it emits one parity frame,
+ * on the same stream name with codec VBAN_CODEC_USER:
+ *  - nuFrame is the nuFrame of the last data frame of the group,
+ *  - format_nbs is the XOR of the format_nbs of the N data frames,
+ *  - payload is the XOR of the N payloads, zero padded to the longest one.
+ * The receiver can rebuild any single lost frame of a group from the others.
+ */
+
+#define FEC_GROUP_SIZE_MIN      2
+#define FEC_GROUP_SIZE_MAX      16
+
+/**
+ * FEC statistics
+ */
+struct fec_stats_t
+{
+    uint32_t    parity_sent;        /* parity frames emitted by encoder */
+    uint32_t    parity_received;    /* parity frames accepted by decoder */
+    uint32_t    recovered;          /* lost frames rebuilt from parity */
+    uint32_t    unrecoverable;      /* lost frames that could not be rebuilt */
+    uint32_t    late;               /* frames received after their group was released */
+};
+
+/**
+ * Opaque handle types
+ */
+struct fec_encoder_t;
+typedef struct fec_encoder_t* fec_encoder_handle_t;
+
+struct fec_decoder_t;
+typedef struct fec_decoder_t* fec_decoder_handle_t;
+
+/**
+ * Return 1 if the packet is a fec parity frame, 0 otherwise.
+ * Packet must already be known as a vban packet of the right stream.
+ */
+int fec_is_parity(char const* buffer, size_t size);
+
+/**
+ * Allocate a fec encoder
+ * @param handle handle pointer that will be allocated
+ * @param group_size number of data frames protected by one parity frame
+ * @return 0 upon success, negative value otherwise
+ */
+int fec_encoder_init(fec_encoder_handle_t* handle, unsigned int group_size);
+
+/**
+ * Release the encoder
+ * @param handle handle pointer that will be released
+ * @return 0 upon success, negative value otherwise
+ */
+int fec_encoder_release(fec_encoder_handle_t* handle);
+
+/**
+ * Account a data frame that has just been sent.
+ * @param handle object handle
+ * @param buffer complete vban packet (header + payload)
+ * @param size packet size
+ * @return size of the parity packet to send (see fec_encoder_parity) when the group
+ *         is complete, 0 if nothing to send, negative value on error
+ */
+int fec_encoder_add(fec_encoder_handle_t handle, char const* buffer, size_t size);
+
+/**
+ * Get the parity packet built by the last fec_encoder_add() that returned a size
+ */
+char const* fec_encoder_parity(fec_encoder_handle_t handle);
+
+/**
+ * Allocate a fec decoder
+ * @param handle handle pointer that will be allocated
+ * @param group_size number of data frames protected by one parity frame
+ * @return 0 upon success, negative value otherwise
+ */
+int fec_decoder_init(fec_decoder_handle_t* handle, unsigned int group_size);
+
+/**
+ * Release the decoder
+ * @param handle handle pointer that will be released
+ * @return 0 upon success, negative value otherwise
+ */
+int fec_decoder_release(fec_decoder_handle_t* handle);
+
+/**
+ * Forget all pending frames, for instance after a format change.
+ */
+void fec_decoder_reset(fec_decoder_handle_t handle);
+
+/**
+ * Push a received packet, data or parity frame, into the decoder.
+ * Packet content is copied, @p buffer can be reused right after.
+ * @return 0 upon success, negative value otherwise
+ */
+int fec_decoder_push(fec_decoder_handle_t handle, char const* buffer, size_t size);
+
+/**
+ * Get the next in order data frame if any.
+ * Frames are released immediately while no loss is pending, and held back behind a
+ * gap only until the parity of the group (or the next group) arrives.
+ * @param handle object handle
+ * @param size where to store the packet size
+ * @return packet pointer, valid until next push, or 0 if no frame is ready
+ */
+char const* fec_decoder_pop(fec_decoder_handle_t handle, size_t* size);
+
+/**
+ * Get the encoder or decoder statistics
+ */
+void fec_encoder_get_stats(fec_encoder_handle_t handle, struct fec_stats_t* stats);
+void fec_decoder_get_stats(fec_decoder_handle_t handle, struct fec_stats_t* stats);
+
+#endif /*__FEC_H__*/
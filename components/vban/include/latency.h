@@ -0,0 +1,120 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Frames in flight between the two ends that can carry a tag, later frames go untagged
+ */
+#define LATENCY_TAGS_NB         64
+
+/**
+ * Histogram buckets, the last one also holds everything above
+ */
+#define LATENCY_BUCKETS         256
+#define LATENCY_BUCKET_US       1000
+
+struct latency_tag_t
+{
+    uint32_t    offset;     /* stream offset of the first byte of the frame */
+    int64_t     time_us;    /* arrival time */
+};
+
+/**
+ * Latency statistics
+ */
+struct latency_stats_t
+{
+    uint32_t    count;      /* frames measured */
+    uint32_t    untagged;   /* frames that found the tag queue full */
+    uint32_t    min_us;
+    uint32_t    p50_us;     /* bucket resolution */
+    uint32_t    p99_us;     /* bucket resolution */
+    uint32_t    max_us;
+};
+
+/**
+ * Latency tracer between a producer and a consumer of one byte stream, such as
+ * both ends of a ringbuffer. The producer tags each frame with its arrival time
+ * and the consumer records the delay when it reaches the first byte of the frame.
+ * Single producer, single consumer, no lock and no allocation: the structure is
+ * meant to be embedded in its owner.
+ */
+struct latency_t
+{
+    /** producer side */
+    uint32_t                produced;
+    uint32_t                head;
+    uint32_t                resync_at;
+    uint32_t                resync_seq;
+    uint32_t                untagged;
+    /** consumer side */
+    uint32_t                consumed;
+    uint32_t                tail;
+    uint32_t                resync_seen;
+    uint32_t                clear_seq;      /* bumped by latency_clear, from any task */
+    uint32_t                clear_seen;
+    struct latency_tag_t    tags[LATENCY_TAGS_NB];
+    /** histogram, written by the consumer */
+    uint32_t                count;
+    uint32_t                min_us;
+    uint32_t                max_us;
+    uint32_t                hist[LATENCY_BUCKETS];
+};
+
+/**
+ * Reset the tracer, while neither end runs
+ */
+void latency_init(struct latency_t* latency);
+
+/**
+ * Producer: the next @p size bytes are a frame that arrived at @p time_us
+ * @param latency tracer
+ * @param size frame size in bytes, as the consumer will see it
+ * @param time_us arrival time, esp_timer time
+ */
+void latency_tag(struct latency_t* latency, size_t size, int64_t time_us);
+
+/**
+ * Producer: the bytes given so far were dropped, the consumer goes on from the next ones
+ */
+void latency_resync(struct latency_t* latency);
+
+/**
+ * Consumer: @p size bytes were taken at @p time_us, record the frames they start
+ * @param latency tracer
+ * @param size bytes consumed
+ * @param time_us consumption time, esp_timer time
+ */
+void latency_consume(struct latency_t* latency, size_t size, int64_t time_us);
+
+/**
+ * Restart the histogram, from any task. Applied on the next consumption.
+ */
+void latency_clear(struct latency_t* latency);
+
+/**
+ * Get the latency statistics, from any task
+ */
+void latency_get_stats(struct latency_t const* latency, struct latency_stats_t* stats);
+
+#endif /*__LATENCY_H__*/
@@ -0,0 +1,129 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NETSIM_H__
+#define __NETSIM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Probabilities are given in parts per million
+ */
+#define NETSIM_PPM              1000000
+
+/**
+ * Network impairment configuration structure.
+ * Each datagram goes through, in order:
+ *  - loss: Gilbert-Elliott two state chain, moving from good to bad with @p ge_p_ppm and
+ *    back with @p ge_r_ppm. A datagram is lost with @p loss_ppm in the good state and
+ *    @p ge_bad_loss_ppm in the bad one. Leave ge_p_ppm at 0 for plain random loss.
+ *  - duplication with @p duplicate_ppm, the copy leaves right after the original
+ *  - delay of @p delay_us plus a uniform jitter up to @p jitter_us
+ *  - reordering: with @p reorder_ppm a datagram is held @p reorder_us more, later ones overtake it
+ *  - rate limit: datagrams leave no faster than @p rate_bps, queued behind each other
+ * A datagram that finds the queue full is dropped.
+ */
+struct netsim_config_t
+{
+    uint32_t        seed;           /* same seed, same impairments for the same traffic */
+    uint32_t        loss_ppm;
+    uint32_t        ge_p_ppm;
+    uint32_t        ge_r_ppm;
+    uint32_t        ge_bad_loss_ppm;
+    uint32_t        duplicate_ppm;
+    uint32_t        delay_us;
+    uint32_t        jitter_us;
+    uint32_t        reorder_ppm;
+    uint32_t        reorder_us;
+    uint32_t        rate_bps;       /* 0 for no limit */
+    unsigned int    depth;          /* datagrams held at once */
+    size_t          max_size;       /* largest datagram */
+    size_t          meta_size;      /* caller data kept with each datagram, such as its sender */
+};
+
+/**
+ * Network impairment statistics
+ */
+struct netsim_stats_t
+{
+    uint32_t    pushed;
+    uint32_t    popped;
+    uint32_t    lost;           /* dropped by the loss model */
+    uint32_t    lost_bad;       /* part of lost while in the bad state */
+    uint32_t    duplicated;
+    uint32_t    reordered;
+    uint32_t    overflow;       /* dropped because the queue was full */
+    uint32_t    depth;          /* datagrams held now */
+};
+
+/**
+ * Opaque handle type
+ */
+struct netsim_t;
+typedef struct netsim_t* netsim_handle_t;
+
+/**
+ * Allocate the impairment queue. No system dependency: it builds on the target and on the host.
+ * @param handle handle pointer that will be allocated
+ * @param config configuration structure
+ * @return 0 upon success, negative value otherwise
+ */
+int netsim_init(netsim_handle_t* handle, struct netsim_config_t const* config);
+
+/**
+ * Release the impairment queue, held datagrams are dropped
+ * @param handle handle pointer that will be released
+ * @return 0 upon success, negative value otherwise
+ */
+int netsim_release(netsim_handle_t* handle);
+
+/**
+ * Hand a datagram to the simulated link
+ * @param handle object handle
+ * @param buffer datagram
+ * @param size size of @p buffer
+ * @param meta caller data of meta_size bytes kept with it, may be null
+ * @param now_us current time, any monotonic clock in us
+ * @return number of copies queued: 0 when lost, 2 when duplicated, negative value on error
+ */
+int netsim_push(netsim_handle_t handle, char const* buffer, size_t size, void const* meta, int64_t now_us);
+
+/**
+ * Take the next datagram whose time has come
+ * @param handle object handle
+ * @param buffer where to put the datagram
+ * @param size size of @p buffer
+ * @param meta where to put its caller data, may be null
+ * @param now_us current time, same clock as netsim_push
+ * @return datagram size, 0 if none is due yet, negative value on error
+ */
+int netsim_pop(netsim_handle_t handle, char* buffer, size_t size, void* meta, int64_t now_us);
+
+/**
+ * Get the time the next datagram is due
+ * @return time in us, negative if the link is empty
+ */
+int64_t netsim_next_due(netsim_handle_t handle);
+
+/**
+ * Get the impairment statistics
+ */
+void netsim_get_stats(netsim_handle_t handle, struct netsim_stats_t* stats);
+
+#endif /*__NETSIM_H__*/
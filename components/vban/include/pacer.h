@@ -0,0 +1,96 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PACER_H__
+#define __PACER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "socket.h"
+
+/**
+ * Number of inter-packet gap histogram buckets.
+ * Bucket i counts gaps below (PACER_GAP_BUCKET_US << i), last one counts the rest.
+ */
+#define PACER_GAP_BUCKETS       8
+#define PACER_GAP_BUCKET_US     500
+
+/**
+ * Pacer configuration structure.
+ * Frames are sent with a token bucket filled at real time rate: each frame costs
+ * its audio duration, and at most @p burst_us of credit can be saved while idle.
+ */
+struct pacer_config_t
+{
+    socket_handle_t     socket;         /* socket frames are written to */
+    unsigned int        depth;          /* send queue depth, oldest frame dropped when full */
+    unsigned int        burst_us;       /* bucket capacity, 0 for one frame */
+    int                 task_stack;
+    int                 task_core;
+    int                 task_prio;
+};
+
+/**
+ * Pacer statistics
+ */
+struct pacer_stats_t
+{
+    uint32_t    depth;                  /* frames currently queued */
+    uint32_t    max_depth;              /* highest queue depth seen */
+    uint32_t    sent;
+    uint32_t    dropped;
+    uint32_t    gap_hist[PACER_GAP_BUCKETS];
+};
+
+/**
+ * Opaque handle type
+ */
+struct pacer_t;
+typedef struct pacer_t* pacer_handle_t;
+
+/**
+ * Allocate the pacer and start its sending task
+ * @param handle handle pointer that will be allocated
+ * @param config configuration structure
+ * @return 0 upon success, negative value otherwise
+ */
+int pacer_init(pacer_handle_t* handle, struct pacer_config_t const* config);
+
+/**
+ * Stop the sending task and release the pacer. Queued frames are dropped.
+ * @param handle handle pointer that will be released
+ * @return 0 upon success, negative value otherwise
+ */
+int pacer_release(pacer_handle_t* handle);
+
+/**
+ * Queue a frame for sending
+ * @param handle object handle
+ * @param buffer pointer holding the packet, copied
+ * @param size size of @p buffer data
+ * @param duration_us audio duration carried by the frame, 0 to send as soon as possible
+ * @return 0 upon success, negative value otherwise
+ */
+int pacer_push(pacer_handle_t handle, char const* buffer, size_t size, uint32_t duration_us);
+
+/**
+ * Get the pacer statistics
+ */
+void pacer_get_stats(pacer_handle_t handle, struct pacer_stats_t* stats);
+
+#endif /*__PACER_H__*/
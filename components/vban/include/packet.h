@@ -25,6 +25,7 @@
 
 /**
  * Check packet content and only return valid return value if this is an audio pcm packet
+ * or an ascii / utf8 text packet or a serial packet
  * @param streamname string pointer holding streamname
  * @param buffer pointer to data to check
  * @param size of the data in buffer;
@@ -72,5 +73,28 @@ int packet_init_header(char* buffer, struct stream_config_t const* stream_config
  */
 int packet_set_new_content(char* buffer, size_t payload_size);
 
+/**
+ * Build a VBAN-TEXT packet.
+ * @param buffer pointer to data, room for VBAN_PROTOCOL_MAX_SIZE bytes
+ * @param streamname string pointer holding streamname
+ * @param nu_frame packet counter
+ * @param text ascii text, not null terminated
+ * @param size size of @p text, cut to VBAN_DATA_MAX_SIZE
+ * @return packet size upon success, negative value otherwise
+ */
+int packet_init_text(char* buffer, char const* streamname, uint32_t nu_frame, char const* text, size_t size);
+
+/**
+ * Init the header of a VBAN-SERIAL packet, the payload follows it
+ * @param buffer pointer to data, room for VBAN_PROTOCOL_MAX_SIZE bytes
+ * @param streamname string pointer holding streamname
+ * @param bps announced speed, 0 or an unlisted value for none
+ * @param stream_type VBanSerialStreamType
+ * @param channel serial port index
+ * @param nu_frame packet counter
+ * @return header size upon success, negative value otherwise
+ */
+int packet_init_serial(char* buffer, char const* streamname, uint32_t bps, uint8_t stream_type, uint8_t channel, uint32_t nu_frame);
+
 #endif /*__PACKET_H__*/
 
@@ -0,0 +1,82 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __RECEIVER_H__
+#define __RECEIVER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vban.h"
+#include "fec.h"
+#include "chmap.h"
+
+/**
+ * Receive path of a VBAN audio stream, shared by the board reader and the host tools.
+ *
+ * The caller owns the socket, the FEC decoder and the channel map. A datagram goes
+ * through receiver_demux, the frames to play (straight or out of fec_decoder_pop)
+ * through receiver_check_format then receiver_payload.
+ */
+
+/**
+ * What receiver_demux did with a datagram
+ */
+enum receiver_verdict
+{
+    RECEIVER_PLAY,          /* audio frame of the stream, to play now */
+    RECEIVER_QUEUED,        /* audio frame given to the FEC decoder, pop it from there */
+    RECEIVER_PARITY,        /* parity frame, given to the FEC decoder if any */
+    RECEIVER_FOREIGN,       /* another stream name, or not audio */
+    RECEIVER_INVALID,       /* not a VBAN packet */
+};
+
+/**
+ * Format of the received stream
+ */
+struct receiver_format_t
+{
+    VBanCodec       codec;
+    unsigned int    channels;   /* in the packets, before the channel map */
+    unsigned int    rates;
+    unsigned int    bits;
+};
+
+/**
+ * Sort a datagram for the stream @p streamname
+ * @param streamname stream to play, VBAN_STREAM_NAME_SIZE characters at most
+ * @param fec_dec FEC decoder, 0 to play frames as they come
+ * @return a receiver_verdict
+ */
+int receiver_demux(char const* streamname, fec_decoder_handle_t fec_dec, char const* buffer, size_t size);
+
+/**
+ * Track the format of a frame of the stream
+ * @param format last format seen, updated
+ * @return 0 when unchanged, 1 when the codec changed, 2 when only the format did, negative errno on error
+ */
+int receiver_check_format(char const* buffer, size_t size, struct receiver_format_t* format);
+
+/**
+ * Write the samples of a frame in the output layout
+ * @param chmap channel map applied to PCM frames, 0 to copy them
+ * @return bytes written, -EINVAL if the payload is shorter than its header says, -ENOSPC if it doesn't fit
+ */
+int receiver_payload(char const* buffer, size_t size, struct chmap_t const* chmap, char* dst, size_t dst_size);
+
+#endif /*__RECEIVER_H__*/
@@ -0,0 +1,113 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __RECORDER_H__
+#define __RECORDER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "capture.h"
+#include "socket.h"
+
+/**
+ * Default size of the datagram ring, a power of two
+ */
+#define RECORDER_RING_SIZE      16384
+
+/**
+ * Packet recorder configuration structure.
+ * Received datagrams go through a single producer single consumer ring: the vban reader
+ * pushes without locking or touching the card, a low priority task writes them to a
+ * capture file. A card slower than the stream loses datagrams, never delays the reader.
+ */
+struct recorder_config_t
+{
+    unsigned int        ring_size;      /* power of two, 0 for RECORDER_RING_SIZE */
+    unsigned int        index_size;     /* capture index entries, 0 for CAPTURE_INDEX_SIZE */
+    int                 task_stack;
+    int                 task_core;
+    int                 task_prio;
+};
+
+/**
+ * Packet recorder statistics
+ */
+struct recorder_stats_t
+{
+    uint32_t    records;
+    uint32_t    bytes;
+    uint32_t    overflow;       /* datagrams dropped because the writer was late */
+    uint32_t    write_errors;   /* captures ended by a failed write, the card was pulled */
+};
+
+/**
+ * Opaque handle type
+ */
+struct recorder_t;
+typedef struct recorder_t* recorder_handle_t;
+
+/**
+ * Allocate the recorder and start its writer task, nothing is recorded yet
+ * @param handle handle pointer that will be allocated
+ * @param config configuration structure
+ * @return 0 upon success, negative value otherwise
+ */
+int recorder_init(recorder_handle_t* handle, struct recorder_config_t const* config);
+
+/**
+ * Stop the writer task and release the recorder, an open capture is closed
+ * @param handle handle pointer that will be released
+ * @return 0 upon success, negative value otherwise
+ */
+int recorder_release(recorder_handle_t* handle);
+
+/**
+ * Start a capture, the file is created by the writer task. A running capture is closed
+ * first, the datagrams pushed until the new file is open are not recorded.
+ * @param handle object handle
+ * @param path capture file, replaced if it exists
+ * @return 0 upon success, negative value otherwise
+ */
+int recorder_start(recorder_handle_t handle, char const* path);
+
+/**
+ * End the capture: the datagrams already pushed are written, then its index
+ * @param handle object handle
+ * @return 0 upon success, negative value otherwise
+ */
+int recorder_stop(recorder_handle_t handle);
+
+/**
+ * Hand a received datagram to the writer, never blocks. Only one task may push.
+ * Does nothing outside a capture.
+ * @param handle object handle
+ * @param buffer datagram
+ * @param size size of @p buffer data
+ * @param time_us arrival time, esp_timer clock
+ * @param from sender of the datagram, may be null
+ * @return 0 upon success, negative value otherwise
+ */
+int recorder_push(recorder_handle_t handle, char const* buffer, size_t size, int64_t time_us,
+                  struct socket_address_t const* from);
+
+/**
+ * Get the recorder statistics
+ */
+void recorder_get_stats(recorder_handle_t handle, struct recorder_stats_t* stats);
+
+#endif /*__RECORDER_H__*/
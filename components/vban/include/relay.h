@@ -0,0 +1,80 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __RELAY_H__
+#define __RELAY_H__
+
+#include <stdint.h>
+#include "socket.h"
+#include "vban.h"
+
+/**
+ * Relay configuration structure.
+ * Frames read on @p in are written to @p out as they are, only the stream name can be patched.
+ */
+struct relay_config_t
+{
+    struct socket_config_t      in;
+    struct socket_config_t      out;
+    struct socket_multicast_t   mcast_cfg;
+    char                        in_stream_name[VBAN_STREAM_NAME_SIZE];     /* stream to forward, empty for any */
+    char                        out_stream_name[VBAN_STREAM_NAME_SIZE];    /* name to re-emit with, empty to keep it */
+    int                         task_stack;
+    int                         task_core;
+    int                         task_prio;
+};
+
+/**
+ * Relay statistics
+ */
+struct relay_stats_t
+{
+    uint32_t    forwarded;
+    uint32_t    dropped;            /* not vban, other stream, or failed to send */
+    uint32_t    hop_last_us;        /* receive to send time of the last frame */
+    uint32_t    hop_avg_us;         /* moving average over 16 frames */
+    uint32_t    hop_max_us;
+};
+
+/**
+ * Opaque handle type
+ */
+struct relay_t;
+typedef struct relay_t* relay_handle_t;
+
+/**
+ * Open both sockets and start forwarding
+ * @param handle handle pointer that will be allocated
+ * @param config configuration structure
+ * @return 0 upon success, negative value otherwise
+ */
+int relay_init(relay_handle_t* handle, struct relay_config_t const* config);
+
+/**
+ * Stop forwarding and release the relay
+ * @param handle handle pointer that will be released
+ * @return 0 upon success, negative value otherwise
+ */
+int relay_release(relay_handle_t* handle);
+
+/**
+ * Get the relay statistics
+ */
+void relay_get_stats(relay_handle_t handle, struct relay_stats_t* stats);
+
+#endif /*__RELAY_H__*/
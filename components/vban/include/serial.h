@@ -0,0 +1,144 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SERIAL_H__
+#define __SERIAL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vban.h"
+#include "socket.h"
+
+/**
+ * Default size of the receive byte ring, a power of two
+ */
+#define SERIAL_RING_SIZE        1024
+
+/**
+ * Serial data handler, called from the serial task with the bytes in order.
+ * A packet may be split in two calls where the ring wraps.
+ */
+typedef void (*serial_handler_t)(char const* data, size_t size, void* context);
+
+/**
+ * Serial link configuration structure.
+ * Received bytes go through a single producer single consumer ring: the vban reader
+ * pushes without locking and a small task hands them to @p handler.
+ * Written bytes are gathered for at most @p coalesce_us before a frame is sent,
+ * so a burst of short messages (MIDI notes) costs one packet. The task also sends
+ * the frames whose window ran out.
+ */
+struct serial_config_t
+{
+    char                streamname[VBAN_STREAM_NAME_SIZE];
+    uint32_t            bps;            /* announced speed, one of VBanBPSList, 0 if none */
+    uint8_t             stream_type;    /* VBanSerialStreamType */
+    uint8_t             channel;        /* serial port index carried by the frames */
+    char                ip_address[SOCKET_IP_ADDRESS_SIZE]; /* destination, empty for the last sender */
+    uint16_t            port;
+    unsigned int        ring_size;      /* power of two, 0 for SERIAL_RING_SIZE */
+    unsigned int        coalesce_us;    /* 0 sends on each write */
+    serial_handler_t    handler;
+    void*               context;
+    int                 task_stack;
+    int                 task_core;
+    int                 task_prio;
+};
+
+/**
+ * Serial link statistics
+ */
+struct serial_stats_t
+{
+    uint32_t    rx_frames;
+    uint32_t    rx_bytes;
+    uint32_t    rx_overflow;    /* bytes dropped because the consumer was late */
+    uint32_t    rx_bps;         /* speed announced by the last received frame */
+    uint32_t    tx_frames;
+    uint32_t    tx_bytes;
+    uint32_t    tx_writes;      /* serial_write calls, tx_writes / tx_frames is the coalescing gain */
+    uint32_t    tx_dropped;     /* frames with no destination or socket yet */
+};
+
+/**
+ * Opaque handle type
+ */
+struct serial_t;
+typedef struct serial_t* serial_handle_t;
+
+/**
+ * Allocate the serial link and start its receive task
+ * @param handle handle pointer that will be allocated
+ * @param config configuration structure
+ * @return 0 upon success, negative value otherwise
+ */
+int serial_init(serial_handle_t* handle, struct serial_config_t const* config);
+
+/**
+ * Stop the receive task and release the serial link. Pending bytes are dropped.
+ * @param handle handle pointer that will be released
+ * @return 0 upon success, negative value otherwise
+ */
+int serial_release(serial_handle_t* handle);
+
+/**
+ * Give the socket frames are sent through
+ * @param handle object handle
+ * @param socket socket handle, null before it is closed
+ * @return 0 upon success, negative value otherwise
+ */
+int serial_attach(serial_handle_t handle, socket_handle_t socket);
+
+/**
+ * Get the stream name the serial frames are carried by
+ */
+char const* serial_get_stream_name(serial_handle_t handle);
+
+/**
+ * Hand a received serial packet to the consumer, never blocks.
+ * Only one task may push.
+ * @param handle object handle
+ * @param buffer pointer holding the packet, already checked by packet_check
+ * @param size size of @p buffer data
+ * @param from sender of the packet
+ * @return 0 upon success, negative value otherwise
+ */
+int serial_push(serial_handle_t handle, char const* buffer, size_t size, struct socket_address_t const* from);
+
+/**
+ * Send serial bytes, coalesced with the writes of the next coalesce_us
+ * @param handle object handle
+ * @param data bytes to send
+ * @param size size of @p data
+ * @return 0 upon success, negative value otherwise
+ */
+int serial_write(serial_handle_t handle, char const* data, size_t size);
+
+/**
+ * Send the gathered bytes now
+ * @param handle object handle
+ * @return 0 upon success, negative value otherwise
+ */
+int serial_flush(serial_handle_t handle);
+
+/**
+ * Get the serial link statistics
+ */
+void serial_get_stats(serial_handle_t handle, struct serial_stats_t* stats);
+
+#endif /*__SERIAL_H__*/
@@ -20,12 +20,29 @@
 #define __SOCKET_H__
 
 #include <stddef.h>
+#include <stdint.h>
+#include "netsim.h"
 
 /**
  * Number of characters for ip address
  */
 #define SOCKET_IP_ADDRESS_SIZE    32
 
+/**
+ * Max number of unicast destinations of an output socket, besides the configured address
+ */
+#define SOCKET_DESTINATIONS_MAX_NB  8
+
+/**
+ * Max number of multicast memberships of a socket
+ */
+#define SOCKET_GROUPS_MAX_NB        8
+
+/**
+ * Room for a raw IPv4 or IPv6 socket address, in 32 bits words
+ */
+#define SOCKET_ADDRESS_WORDS        8
+
 enum socket_direction
 {
     SOCKET_IN,
@@ -34,7 +51,7 @@ enum socket_direction
 
 /**
  * Socket multicast configuration structure.
- * IPv4 or IPv6 only for simple using.
+ * Options apply to every group the socket joins.
  */
 struct socket_multicast_t
 {
@@ -44,15 +61,66 @@ struct socket_multicast_t
     char      multicast_address[SOCKET_IP_ADDRESS_SIZE];
 };
 
+/**
+ * Unicast destination of an output socket
+ */
+struct socket_destination_t
+{
+    char                    ip_address[SOCKET_IP_ADDRESS_SIZE];
+    uint16_t                port;
+};
+
+/**
+ * Multicast group membership, optionally restricted to one source
+ */
+struct socket_group_t
+{
+    char                    group[SOCKET_IP_ADDRESS_SIZE];
+    char                    source[SOCKET_IP_ADDRESS_SIZE];  /* empty for any source */
+};
+
+/**
+ * Membership table entry of a socket
+ */
+struct socket_membership_t
+{
+    struct socket_group_t   group;
+    unsigned int            refs;           /* joins not left yet */
+    int                     stack_filter;   /* 1 when the network stack drops other sources, 0 when socket_read does */
+};
+
+/**
+ * Sender address as written by the stack, kept raw so it is compared without formatting
+ */
+struct socket_address_t
+{
+    unsigned int            len;
+    uint32_t                data[SOCKET_ADDRESS_WORDS];
+};
+
+/**
+ * Socket statistics
+ */
+struct socket_stats_t
+{
+    unsigned int            nb_groups;          /* entries of the membership table */
+    uint32_t                source_rejected;    /* datagrams dropped by the software source filter */
+    struct netsim_stats_t   netsim;             /* simulated impairments, all zero without CONFIG_SOCKET_NETSIM */
+};
+
 /**
  * Socket configuration structure.
  * To be used at init time
  */
 struct socket_config_t
 {
-    enum socket_direction   direction;
-    char                    ip_address[SOCKET_IP_ADDRESS_SIZE];
-    short                   port;
+    enum socket_direction       direction;
+    char                        ip_address[SOCKET_IP_ADDRESS_SIZE];
+    uint16_t                    port;
+    struct socket_destination_t destinations[SOCKET_DESTINATIONS_MAX_NB];   /* output: frames are also sent there */
+    unsigned int                nb_destinations;
+    struct socket_group_t       groups[SOCKET_GROUPS_MAX_NB];   /* joined at open, besides a multicast ip_address */
+    unsigned int                nb_groups;
 };
 
 /**
@@ -69,6 +137,16 @@ typedef struct socket_t* socket_handle_t;
  */
 int socket_init(socket_handle_t* handle, struct socket_config_t const* config, struct socket_multicast_t const* mcast_cfg);
 
+/**
+ * Create a socket sharing the fd of an open socket.
+ * Its writes go to its own destinations, serialized with every write on the shared fd.
+ * @param handle handle pointer that will be allocated
+ * @param config configuration structure, only the destinations are used
+ * @param owner socket owning the fd, must outlive the attached socket
+ * @return 0 upon success, negative value otherwise
+ */
+int socket_attach(socket_handle_t* handle, struct socket_config_t const* config, socket_handle_t owner);
+
 /**
  * Release the socket
  * @param handle handle pointer that will be released
@@ -77,7 +155,21 @@ int socket_init(socket_handle_t* handle, struct socket_config_t const* config, s
 int socket_release(socket_handle_t* handle);
 
 /**
- * Join a multicast group
+ * Address family of the sockets opened for an address
+ * @param ip ip address
+ * @return AF_INET6 for an IPv6 literal, AF_INET otherwise
+ */
+int socket_family(char const* ip);
+
+/**
+ * Tell whether an address is in the multicast range used by the sockets
+ * @param ip ip address
+ * @return 1 if it is, 0 otherwise
+ */
+int socket_is_multicast(char const* ip);
+
+/**
+ * Join a multicast group, from any source
  * @param handle object handle
  * @param multiaddr multicast ip address
  * @return 0 upon success, negative value otherwise
@@ -85,13 +177,75 @@ int socket_release(socket_handle_t* handle);
 int socket_join_group(socket_handle_t handle, const char* multiaddr);
 
 /**
- * Leave a multicast group
+ * Leave a multicast group joined from any source
  * @param handle object handle
  * @param multiaddr multicast ip address
  * @return 0 upon success, negative value otherwise
  */
 int socket_leave_group(socket_handle_t handle, const char* multiaddr);
 
+/**
+ * Join a multicast group, only receiving from one source.
+ * Joins are counted: the membership is dropped once it was left as many times.
+ * When the network stack has no source-specific membership, the group is joined from any
+ * source and socket_read drops datagrams from other senders. It can not tell the group a
+ * datagram was sent to, so a membership from any source lets every sender through.
+ * @param handle object handle
+ * @param multiaddr multicast ip address
+ * @param source source ip address, null or empty for any source
+ * @return 0 upon success, negative value otherwise
+ */
+int socket_join_source_group(socket_handle_t handle, const char* multiaddr, const char* source);
+
+/**
+ * Leave a multicast group joined with socket_join_source_group
+ * @param handle object handle
+ * @param multiaddr multicast ip address
+ * @param source source ip address, null or empty for any source
+ * @return 0 upon success, negative value otherwise
+ */
+int socket_leave_source_group(socket_handle_t handle, const char* multiaddr, const char* source);
+
+/**
+ * Get the membership table
+ * @param handle object handle
+ * @param memberships table to fill
+ * @param max_nb number of entries of @p memberships
+ * @return number of entries filled
+ */
+unsigned int socket_get_memberships(socket_handle_t handle, struct socket_membership_t* memberships, unsigned int max_nb);
+
+/**
+ * Get the socket statistics
+ */
+void socket_get_stats(socket_handle_t handle, struct socket_stats_t* stats);
+
+/**
+ * Add a destination to an output socket. Its address is resolved once, here.
+ * @param handle object handle
+ * @param ip_address destination ip address
+ * @param port destination port
+ * @return 0 upon success, negative value otherwise
+ */
+int socket_add_destination(socket_handle_t handle, const char* ip_address, uint16_t port);
+
+/**
+ * Remove a destination from an output socket
+ * @param handle object handle
+ * @param ip_address destination ip address
+ * @param port destination port
+ * @return 0 upon success, negative value otherwise
+ */
+int socket_remove_destination(socket_handle_t handle, const char* ip_address, uint16_t port);
+
+/**
+ * Bound the time socket_read blocks
+ * @param handle object handle
+ * @param timeout_ms receive timeout, 0 to block forever
+ * @return 0 upon success, negative value otherwise
+ */
+int socket_set_timeout(socket_handle_t handle, int timeout_ms);
+
 /**
  * Read data from the socket
  * @param handle object handle
@@ -102,13 +256,76 @@ int socket_leave_group(socket_handle_t handle, const char* multiaddr);
 int socket_read(socket_handle_t handle, char* buffer, size_t size);
 
 /**
- * Write data to the socket
+ * Read data from the socket with the address of its sender
+ * @param handle object handle
+ * @param buffer pointer where to put the data read
+ * @param size size of @p buffer data
+ * @param from sender address, may be null
+ * @return size read upon success, negative value otherwise
+ */
+int socket_read_from(socket_handle_t handle, char* buffer, size_t size, struct socket_address_t* from);
+
+/**
+ * Get the arrival time of the last datagram returned by socket_read
+ * @param handle object handle
+ * @return esp_timer time in us, 0 before the first datagram
+ */
+int64_t socket_get_rx_time(socket_handle_t handle);
+
+/**
+ * Build the raw address of a host as the socket would see it as a sender
+ * @param handle object handle, its family decides the address layout
+ * @param ip_address host ip address
+ * @param port host port, 0 for any port
+ * @param addr address to fill
+ * @return 0 upon success, negative value otherwise
+ */
+int socket_get_address(socket_handle_t handle, const char* ip_address, uint16_t port, struct socket_address_t* addr);
+
+/**
+ * Tell whether a sender address is an expected one
+ * @param expected expected address, a zero port matches any port
+ * @param from sender address
+ * @return 1 if it is, 0 otherwise
+ */
+int socket_address_match(struct socket_address_t const* expected, struct socket_address_t const* from);
+
+/**
+ * Format a raw address, for display only
+ * @param addr address to format
+ * @param name buffer to fill, SOCKET_IP_ADDRESS_SIZE is large enough
+ * @param size size of @p name
+ * @return @p name
+ */
+char const* socket_address_name(struct socket_address_t const* addr, char* name, size_t size);
+
+/**
+ * Split a raw address into its ip and port, to store it outside of this layer
+ * @param addr address to split
+ * @param ip filled with the address bytes in network order, IPv4 in the first 4
+ * @param port filled with the port in host order
+ * @return 4 or 6 for the ip version, negative value otherwise
+ */
+int socket_address_get_ip(struct socket_address_t const* addr, uint8_t ip[16], uint16_t* port);
+
+/**
+ * Write data to the socket, once per destination
  * @param handle object handle
  * @param buffer pointer holding data to write
  * @param size size of @p buffer data 
- * @return size written upon success, negative value otherwise
+ * @return size written upon success to at least one destination, negative value otherwise
  */
 int socket_write(socket_handle_t handle, char const* buffer, size_t size);
 
+/**
+ * Write data to one host only, such as the sender of a received packet
+ * @param handle object handle
+ * @param buffer pointer holding data to write
+ * @param size size of @p buffer data
+ * @param to address as given by socket_read_from
+ * @return size written upon success, negative value otherwise
+ */
+int socket_write_to(socket_handle_t handle, char const* buffer, size_t size, struct socket_address_t const* to);
+
 #endif /*__SOCKET_H__*/
 
@@ -0,0 +1,150 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SOCKET_ENGINE_H__
+#define __SOCKET_ENGINE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "socket.h"
+#include "directory.h"
+
+/**
+ * Max number of readers of one engine
+ */
+#define SOCKET_ENGINE_READERS_MAX_NB    4
+
+/**
+ * Frames kept for a reader while another reader owns the socket
+ */
+#define SOCKET_ENGINE_PENDING_NB        4
+
+/**
+ * Time a reader blocks on the socket before giving the other readers a turn
+ */
+#define SOCKET_ENGINE_READ_TIMEOUT_MS   100
+
+/**
+ * Engine statistics
+ */
+struct socket_engine_stats_t
+{
+    uint32_t    unmatched;      /* frames no reader was attached for */
+    uint32_t    pending_drop;   /* frames dropped because a reader did not collect them in time */
+};
+
+/**
+ * Opaque handle type.
+ * An engine owns one UDP socket bound to a port, shared by every reader and writer on that port.
+ * There is no receive task: the reader calling socket_engine_read receives in place and only
+ * frames of other readers are copied aside.
+ */
+struct socket_engine_t;
+typedef struct socket_engine_t* socket_engine_handle_t;
+
+/**
+ * Get the engine of a port, opening its socket on first use.
+ * Without dual stack an engine carries one address family, the first user's.
+ * @param handle handle pointer that will be set
+ * @param port port to bind
+ * @param ip_address address of the user, its family picks the engine socket family
+ * @param mcast_cfg multicast configuration, used on first use
+ * @return 0 upon success, -EAFNOSUPPORT if the port is shared in the other family, negative value otherwise
+ */
+int socket_engine_acquire(socket_engine_handle_t* handle, uint16_t port, char const* ip_address,
+                          struct socket_multicast_t const* mcast_cfg);
+
+/**
+ * Drop a reference to the engine, its socket is closed with the last one
+ * @param handle handle pointer that will be reset
+ * @return 0 upon success, negative value otherwise
+ */
+int socket_engine_release(socket_engine_handle_t* handle);
+
+/**
+ * Get the engine socket, for multicast membership
+ */
+socket_handle_t socket_engine_get_socket(socket_engine_handle_t handle);
+
+/**
+ * Register a reader of the frames of a stream
+ * @param handle object handle
+ * @param streamname stream delivered to this reader
+ * @param ip_address address the reader listens on, a multicast group is joined until the reader detaches
+ * @return reader id upon success, negative value otherwise
+ */
+int socket_engine_attach_reader(socket_engine_handle_t handle, char const* streamname, char const* ip_address);
+
+/**
+ * Unregister a reader
+ */
+void socket_engine_detach_reader(socket_engine_handle_t handle, int reader);
+
+/**
+ * Read the next frame of a reader
+ * @param handle object handle
+ * @param reader reader id
+ * @param buffer pointer where to put the frame
+ * @param size size of @p buffer
+ * @param from sender of the frame, may be null
+ * @return frame size upon success, -EAGAIN when nothing came for this reader yet, other negative value on error
+ */
+int socket_engine_read(socket_engine_handle_t handle, int reader, char* buffer, size_t size, struct socket_address_t* from);
+
+/**
+ * Take the next frame set aside for a reader, without receiving nor waiting.
+ * Meant for low rate streams polled by the reader of another stream, such as commands.
+ * @param handle object handle
+ * @param reader reader id
+ * @param buffer pointer where to put the frame
+ * @param size size of @p buffer
+ * @param from sender of the frame, may be null
+ * @return frame size upon success, -EAGAIN when no frame is waiting, other negative value on error
+ */
+int socket_engine_read_pending(socket_engine_handle_t handle, int reader, char* buffer, size_t size, struct socket_address_t* from);
+
+/**
+ * Create a writer socket sending through the engine socket
+ * @param handle object handle
+ * @param config writer destinations
+ * @param socket handle pointer that will be allocated, release it with socket_release
+ * @return 0 upon success, negative value otherwise
+ */
+int socket_engine_attach_writer(socket_engine_handle_t handle, struct socket_config_t const* config, socket_handle_t* socket);
+
+/**
+ * Record every frame received on the engine socket in a directory
+ * @param handle object handle
+ * @param directory directory to update, null to stop
+ */
+void socket_engine_set_directory(socket_engine_handle_t handle, directory_handle_t directory);
+
+/**
+ * Get the arrival time of the last frame returned to a reader, stashed frames keep theirs
+ * @param handle object handle
+ * @param reader reader index
+ * @return esp_timer time in us, 0 before the first frame
+ */
+int64_t socket_engine_get_rx_time(socket_engine_handle_t handle, int reader);
+
+/**
+ * Get the engine statistics
+ */
+void socket_engine_get_stats(socket_engine_handle_t handle, struct socket_engine_stats_t* stats);
+
+#endif /*__SOCKET_ENGINE_H__*/
@@ -22,7 +22,7 @@
 #include <inttypes.h>
 
 #define VBAN_HEADER_SIZE            (4 + 4 + 16 + 4)
-#define VBAN_HEADER_FOURC           'NABV'
+#define VBAN_HEADER_FOURC           0x4E414256u         /* 'NABV', "VBAN" in a little endian header */
 #define VBAN_STREAM_NAME_SIZE       16
 #define VBAN_PROTOCOL_MAX_SIZE      1464
 #define VBAN_DATA_MAX_SIZE          (VBAN_PROTOCOL_MAX_SIZE - VBAN_HEADER_SIZE)
@@ -148,4 +148,17 @@ enum VBanStreamType
     VBAN_TXT_USER           =   0xF0
 };
 
+/********************************************************
+ *              SERIAL SUB PROTOCOL                     *
+ ********************************************************/
+
+/** the bps index of VBanBPSList takes the place of the sample rate index, data type is VBAN_DATATYPE_8BITS */
+#define VBAN_SERIAL_BPS_MASK        0x1F
+enum VBanSerialStreamType
+{
+    VBAN_SERIAL_GENERIC     =   0x00,
+    VBAN_SERIAL_MIDI        =   0x10,
+    VBAN_SERIAL_USER        =   0xF0
+};
+
 #endif /*__VBAN_H__*/
\ No newline at end of file
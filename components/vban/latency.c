@@ -0,0 +1,163 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "latency.h"
+#include <string.h>
+
+static void latency_record(struct latency_t* latency, uint32_t delay_us);
+static uint32_t latency_percentile(struct latency_t const* latency, uint32_t count, unsigned int percent);
+
+void latency_init(struct latency_t* latency)
+{
+    if (latency != 0)
+    {
+        memset(latency, 0, sizeof(struct latency_t));
+    }
+}
+
+void latency_tag(struct latency_t* latency, size_t size, int64_t time_us)
+{
+    uint32_t head = latency->head;
+    uint32_t tail = __atomic_load_n(&latency->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail < LATENCY_TAGS_NB)
+    {
+        latency->tags[head % LATENCY_TAGS_NB].offset = latency->produced;
+        latency->tags[head % LATENCY_TAGS_NB].time_us = time_us;
+        __atomic_store_n(&latency->head, head + 1, __ATOMIC_RELEASE);
+    }
+    else
+    {
+        ++latency->untagged;
+    }
+
+    latency->produced += size;
+}
+
+void latency_resync(struct latency_t* latency)
+{
+    latency->resync_at = latency->produced;
+    __atomic_store_n(&latency->resync_seq, latency->resync_seq + 1, __ATOMIC_RELEASE);
+}
+
+void latency_clear(struct latency_t* latency)
+{
+    __atomic_add_fetch(&latency->clear_seq, 1, __ATOMIC_RELEASE);
+}
+
+void latency_record(struct latency_t* latency, uint32_t delay_us)
+{
+    uint32_t bucket = delay_us / LATENCY_BUCKET_US;
+
+    if ((latency->count == 0) || (delay_us < latency->min_us))
+    {
+        latency->min_us = delay_us;
+    }
+    if (delay_us > latency->max_us)
+    {
+        latency->max_us = delay_us;
+    }
+    ++latency->hist[(bucket < LATENCY_BUCKETS) ? bucket : LATENCY_BUCKETS - 1];
+    ++latency->count;
+}
+
+void latency_consume(struct latency_t* latency, size_t size, int64_t time_us)
+{
+    uint32_t seq;
+    uint32_t head;
+    struct latency_tag_t const* tag;
+
+    seq = __atomic_load_n(&latency->clear_seq, __ATOMIC_ACQUIRE);
+    if (seq != latency->clear_seen)
+    {
+        latency->clear_seen = seq;
+        latency->count = 0;
+        latency->min_us = 0;
+        latency->max_us = 0;
+        memset(latency->hist, 0, sizeof(latency->hist));
+    }
+
+    seq = __atomic_load_n(&latency->resync_seq, __ATOMIC_ACQUIRE);
+    if (seq != latency->resync_seen)
+    {
+        /** the tags before the drop are skipped below without being recorded */
+        latency->resync_seen = seq;
+        latency->consumed = latency->resync_at;
+        head = __atomic_load_n(&latency->head, __ATOMIC_ACQUIRE);
+        while ((latency->tail != head)
+               && ((int32_t)(latency->tags[latency->tail % LATENCY_TAGS_NB].offset - latency->consumed) < 0))
+        {
+            __atomic_store_n(&latency->tail, latency->tail + 1, __ATOMIC_RELEASE);
+        }
+    }
+
+    latency->consumed += size;
+    head = __atomic_load_n(&latency->head, __ATOMIC_ACQUIRE);
+    while (latency->tail != head)
+    {
+        /** offsets wrap, only their difference counts */
+        tag = &latency->tags[latency->tail % LATENCY_TAGS_NB];
+        if ((int32_t)(tag->offset - latency->consumed) >= 0)
+        {
+            break;
+        }
+        latency_record(latency, (time_us > tag->time_us) ? (uint32_t)(time_us - tag->time_us) : 0);
+        __atomic_store_n(&latency->tail, latency->tail + 1, __ATOMIC_RELEASE);
+    }
+}
+
+uint32_t latency_percentile(struct latency_t const* latency, uint32_t count, unsigned int percent)
+{
+    uint32_t rank = (uint32_t)(((uint64_t)count * percent + 99) / 100);
+    uint32_t sum = 0;
+    unsigned int bucket;
+
+    for (bucket = 0; bucket < LATENCY_BUCKETS - 1; ++bucket)
+    {
+        sum += latency->hist[bucket];
+        if (sum >= rank)
+        {
+            /** upper bound of the bucket, never beyond what was seen */
+            uint32_t bound = (bucket + 1) * LATENCY_BUCKET_US;
+            return (bound < latency->max_us) ? bound : latency->max_us;
+        }
+    }
+
+    return latency->max_us;
+}
+
+void latency_get_stats(struct latency_t const* latency, struct latency_stats_t* stats)
+{
+    if ((latency == 0) || (stats == 0))
+    {
+        return;
+    }
+
+    memset(stats, 0, sizeof(struct latency_stats_t));
+    stats->untagged = latency->untagged;
+    stats->count = latency->count;
+    if (stats->count == 0)
+    {
+        return;
+    }
+
+    stats->min_us = latency->min_us;
+    stats->max_us = latency->max_us;
+    stats->p50_us = latency_percentile(latency, stats->count, 50);
+    stats->p99_us = latency_percentile(latency, stats->count, 99);
+}
@@ -0,0 +1,299 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "netsim.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct netsim_slot_t
+{
+    int         used;
+    int64_t     due_us;
+    uint32_t    seq;            /* equal due times leave in arrival order */
+    size_t      size;
+    char*       meta;
+    char*       data;
+};
+
+struct netsim_t
+{
+    struct netsim_config_t  config;
+    struct netsim_stats_t   stats;
+    uint64_t                rng;
+    int                     bad;            /* Gilbert-Elliott state */
+    int64_t                 link_free_us;   /* end of the last datagram on a rate limited link */
+    uint32_t                seq;
+    struct netsim_slot_t*   slots;
+    char*                   storage;
+};
+
+static uint32_t netsim_random(netsim_handle_t handle);
+static int netsim_chance(netsim_handle_t handle, uint32_t ppm);
+static int netsim_queue(netsim_handle_t handle, char const* buffer, size_t size, void const* meta, int64_t due_us);
+
+int netsim_init(netsim_handle_t* handle, struct netsim_config_t const* config)
+{
+    size_t slot_size;
+    unsigned int index;
+
+    if ((handle == 0) || (config == 0) || (config->depth == 0) || (config->max_size == 0))
+    {
+        return -EINVAL;
+    }
+
+    *handle = calloc(1, sizeof(struct netsim_t));
+    if (*handle == 0)
+    {
+        return -ENOMEM;
+    }
+
+    slot_size = config->meta_size + config->max_size;
+    (*handle)->config = *config;
+    (*handle)->slots = calloc(config->depth, sizeof(struct netsim_slot_t));
+    (*handle)->storage = malloc(config->depth * slot_size);
+    if (((*handle)->slots == 0) || ((*handle)->storage == 0))
+    {
+        netsim_release(handle);
+        return -ENOMEM;
+    }
+
+    for (index = 0; index < config->depth; ++index)
+    {
+        (*handle)->slots[index].meta = (*handle)->storage + index * slot_size;
+        (*handle)->slots[index].data = (*handle)->slots[index].meta + config->meta_size;
+    }
+
+    /** xorshift64* never leaves zero, any seed works */
+    (*handle)->rng = ((uint64_t)config->seed << 32) ^ 0x9E3779B97F4A7C15ULL;
+
+    return 0;
+}
+
+int netsim_release(netsim_handle_t* handle)
+{
+    if (handle == 0)
+    {
+        return -EINVAL;
+    }
+
+    if (*handle != 0)
+    {
+        free((*handle)->storage);
+        free((*handle)->slots);
+        free(*handle);
+        *handle = 0;
+    }
+
+    return 0;
+}
+
+uint32_t netsim_random(netsim_handle_t handle)
+{
+    handle->rng ^= handle->rng >> 12;
+    handle->rng ^= handle->rng << 25;
+    handle->rng ^= handle->rng >> 27;
+    return (uint32_t)((handle->rng * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+int netsim_chance(netsim_handle_t handle, uint32_t ppm)
+{
+    /** no draw for a disabled impairment: enabling one doesn't shift the others */
+    if (ppm == 0)
+    {
+        return 0;
+    }
+    return (((uint64_t)netsim_random(handle) * NETSIM_PPM) >> 32) < ppm;
+}
+
+int netsim_queue(netsim_handle_t handle, char const* buffer, size_t size, void const* meta, int64_t due_us)
+{
+    struct netsim_slot_t* slot = 0;
+    unsigned int index;
+
+    for (index = 0; index < handle->config.depth; ++index)
+    {
+        if (!handle->slots[index].used)
+        {
+            slot = &handle->slots[index];
+            break;
+        }
+    }
+
+    if (slot == 0)
+    {
+        ++handle->stats.overflow;
+        return 0;
+    }
+
+    slot->used = 1;
+    slot->due_us = due_us;
+    slot->seq = handle->seq++;
+    slot->size = size;
+    memcpy(slot->data, buffer, size);
+    if (handle->config.meta_size > 0)
+    {
+        if (meta != 0)
+        {
+            memcpy(slot->meta, meta, handle->config.meta_size);
+        }
+        else
+        {
+            memset(slot->meta, 0, handle->config.meta_size);
+        }
+    }
+    ++handle->stats.depth;
+
+    return 1;
+}
+
+int netsim_push(netsim_handle_t handle, char const* buffer, size_t size, void const* meta, int64_t now_us)
+{
+    struct netsim_config_t const* config;
+    int64_t due_us;
+    int copies;
+
+    if ((handle == 0) || (buffer == 0))
+    {
+        return -EINVAL;
+    }
+
+    config = &handle->config;
+    if (size > config->max_size)
+    {
+        return -EMSGSIZE;
+    }
+
+    ++handle->stats.pushed;
+
+    if (config->ge_p_ppm > 0)
+    {
+        handle->bad = handle->bad ? !netsim_chance(handle, config->ge_r_ppm) : netsim_chance(handle, config->ge_p_ppm);
+    }
+    if (netsim_chance(handle, handle->bad ? config->ge_bad_loss_ppm : config->loss_ppm))
+    {
+        ++handle->stats.lost;
+        handle->stats.lost_bad += handle->bad;
+        return 0;
+    }
+
+    due_us = now_us + config->delay_us;
+    if (config->jitter_us > 0)
+    {
+        due_us += ((uint64_t)netsim_random(handle) * (config->jitter_us + 1)) >> 32;
+    }
+    if (netsim_chance(handle, config->reorder_ppm))
+    {
+        due_us += config->reorder_us;
+        ++handle->stats.reordered;
+    }
+    if (config->rate_bps > 0)
+    {
+        /** serialization: a datagram leaves once the previous ones went through */
+        if (due_us < handle->link_free_us)
+        {
+            due_us = handle->link_free_us;
+        }
+        due_us += ((int64_t)size * 8 * 1000000) / config->rate_bps;
+        handle->link_free_us = due_us;
+    }
+
+    copies = netsim_queue(handle, buffer, size, meta, due_us);
+    if ((copies > 0) && netsim_chance(handle, config->duplicate_ppm))
+    {
+        copies += netsim_queue(handle, buffer, size, meta, due_us);
+        ++handle->stats.duplicated;
+    }
+
+    return copies;
+}
+
+int netsim_pop(netsim_handle_t handle, char* buffer, size_t size, void* meta, int64_t now_us)
+{
+    struct netsim_slot_t* next = 0;
+    unsigned int index;
+
+    if ((handle == 0) || (buffer == 0))
+    {
+        return -EINVAL;
+    }
+
+    /** the queue is short, a scan beats keeping it sorted */
+    for (index = 0; index < handle->config.depth; ++index)
+    {
+        struct netsim_slot_t* slot = &handle->slots[index];
+        if (slot->used && (slot->due_us <= now_us)
+            && ((next == 0) || (slot->due_us < next->due_us)
+                || ((slot->due_us == next->due_us) && ((int32_t)(slot->seq - next->seq) < 0))))
+        {
+            next = slot;
+        }
+    }
+
+    if (next == 0)
+    {
+        return 0;
+    }
+
+    next->used = 0;
+    --handle->stats.depth;
+    if (next->size > size)
+    {
+        return -EMSGSIZE;
+    }
+
+    memcpy(buffer, next->data, next->size);
+    if ((meta != 0) && (handle->config.meta_size > 0))
+    {
+        memcpy(meta, next->meta, handle->config.meta_size);
+    }
+    ++handle->stats.popped;
+
+    return (int)next->size;
+}
+
+int64_t netsim_next_due(netsim_handle_t handle)
+{
+    int64_t due_us = -1;
+    unsigned int index;
+
+    if (handle == 0)
+    {
+        return -1;
+    }
+
+    for (index = 0; index < handle->config.depth; ++index)
+    {
+        if (handle->slots[index].used && ((due_us < 0) || (handle->slots[index].due_us < due_us)))
+        {
+            due_us = handle->slots[index].due_us;
+        }
+    }
+
+    return due_us;
+}
+
+void netsim_get_stats(netsim_handle_t handle, struct netsim_stats_t* stats)
+{
+    if ((handle == 0) || (stats == 0))
+    {
+        return;
+    }
+
+    *stats = handle->stats;
+}
@@ -0,0 +1,296 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pacer.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "vban.h"
+
+static const char *TAG = "VBAN_PACER";
+
+struct pacer_item_t
+{
+    size_t          size;
+    uint32_t        duration_us;
+    char            data[VBAN_PROTOCOL_MAX_SIZE];
+};
+
+struct pacer_t
+{
+    struct pacer_config_t   config;
+    struct pacer_stats_t    stats;
+    struct pacer_item_t*    items;
+    unsigned int            head;
+    unsigned int            count;
+    SemaphoreHandle_t       lock;
+    TaskHandle_t            task;
+    SemaphoreHandle_t       exited;
+    esp_timer_handle_t      timer;
+    volatile int            running;
+    int64_t                 credit_us;
+    int64_t                 last_refill;
+    int64_t                 last_sent;
+    struct pacer_item_t     sending;    /* popped frame, only touched by the task */
+};
+
+static void pacer_task(void* arg);
+static void pacer_timer_cb(void* arg);
+static void pacer_wait_us(pacer_handle_t handle, int64_t wait_us);
+
+int pacer_init(pacer_handle_t* handle, struct pacer_config_t const* config)
+{
+    if ((handle == 0) || (config == 0) || (config->socket == 0) || (config->depth == 0))
+    {
+        ESP_LOGE(TAG, "%s: invalid handle or config", __func__);
+        return -EINVAL;
+    }
+
+    *handle = calloc(1, sizeof(struct pacer_t));
+    if (*handle == 0)
+    {
+        ESP_LOGE(TAG, "%s: could not allocate memory", __func__);
+        return -ENOMEM;
+    }
+
+    (*handle)->config = *config;
+    (*handle)->items = calloc(config->depth, sizeof(struct pacer_item_t));
+    (*handle)->lock = xSemaphoreCreateMutex();
+    (*handle)->exited = xSemaphoreCreateBinary();
+    if (((*handle)->items == 0) || ((*handle)->lock == 0) || ((*handle)->exited == 0))
+    {
+        ESP_LOGE(TAG, "%s: could not allocate memory", __func__);
+        pacer_release(handle);
+        return -ENOMEM;
+    }
+
+    esp_timer_create_args_t timer_args = {
+        .callback = pacer_timer_cb,
+        .arg = *handle,
+        .name = "vban_pacer",
+    };
+    if (esp_timer_create(&timer_args, &(*handle)->timer) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "%s: could not create timer", __func__);
+        pacer_release(handle);
+        return -ENOMEM;
+    }
+
+    (*handle)->running = 1;
+    (*handle)->last_refill = esp_timer_get_time();
+    if (xTaskCreatePinnedToCore(pacer_task, "vban_pacer", config->task_stack, *handle,
+                                config->task_prio, &(*handle)->task, config->task_core) != pdPASS)
+    {
+        ESP_LOGE(TAG, "%s: could not create task", __func__);
+        (*handle)->running = 0;
+        pacer_release(handle);
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+int pacer_release(pacer_handle_t* handle)
+{
+    if (handle == 0)
+    {
+        ESP_LOGE(TAG, "%s: null handle pointer", __func__);
+        return -EINVAL;
+    }
+
+    if (*handle == 0)
+    {
+        return 0;
+    }
+
+    if ((*handle)->running)
+    {
+        (*handle)->running = 0;
+        xTaskNotifyGive((*handle)->task);
+        xSemaphoreTake((*handle)->exited, portMAX_DELAY);
+    }
+
+    if ((*handle)->timer != 0)
+    {
+        esp_timer_stop((*handle)->timer);
+        esp_timer_delete((*handle)->timer);
+    }
+    if ((*handle)->lock != 0)
+    {
+        vSemaphoreDelete((*handle)->lock);
+    }
+    if ((*handle)->exited != 0)
+    {
+        vSemaphoreDelete((*handle)->exited);
+    }
+    free((*handle)->items);
+    free(*handle);
+    *handle = 0;
+
+    return 0;
+}
+
+int pacer_push(pacer_handle_t handle, char const* buffer, size_t size, uint32_t duration_us)
+{
+    struct pacer_item_t* item;
+
+    if ((handle == 0) || (buffer == 0) || (size > VBAN_PROTOCOL_MAX_SIZE))
+    {
+        ESP_LOGE(TAG, "%s: invalid argument", __func__);
+        return -EINVAL;
+    }
+
+    xSemaphoreTake(handle->lock, portMAX_DELAY);
+
+    if (handle->count == handle->config.depth)
+    {
+        /** persistent congestion: drop the oldest frame to make room, it is the most likely to arrive too late to play */
+        handle->head = (handle->head + 1) % handle->config.depth;
+        --handle->count;
+        ++handle->stats.dropped;
+    }
+
+    item = &handle->items[(handle->head + handle->count) % handle->config.depth];
+    memcpy(item->data, buffer, size);
+    item->size = size;
+    item->duration_us = duration_us;
+    ++handle->count;
+    if (handle->count > handle->stats.max_depth)
+    {
+        handle->stats.max_depth = handle->count;
+    }
+
+    xSemaphoreGive(handle->lock);
+    xTaskNotifyGive(handle->task);
+
+    return 0;
+}
+
+void pacer_get_stats(pacer_handle_t handle, struct pacer_stats_t* stats)
+{
+    if ((handle == 0) || (stats == 0))
+    {
+        return;
+    }
+
+    xSemaphoreTake(handle->lock, portMAX_DELAY);
+    *stats = handle->stats;
+    stats->depth = handle->count;
+    xSemaphoreGive(handle->lock);
+}
+
+void pacer_timer_cb(void* arg)
+{
+    pacer_handle_t handle = (pacer_handle_t)arg;
+    xTaskNotifyGive(handle->task);
+}
+
+void pacer_wait_us(pacer_handle_t handle, int64_t wait_us)
+{
+    /** tick is far too coarse for frame pacing, wake up from a one shot high resolution timer */
+    if (esp_timer_start_once(handle->timer, wait_us) == ESP_OK)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        esp_timer_stop(handle->timer);
+    }
+    else
+    {
+        vTaskDelay(1);
+    }
+}
+
+void pacer_task(void* arg)
+{
+    pacer_handle_t handle = (pacer_handle_t)arg;
+    struct pacer_item_t* item;
+    uint32_t duration_us = 0;
+    int64_t now;
+    int64_t capacity;
+    unsigned int bucket;
+
+    while (handle->running)
+    {
+        xSemaphoreTake(handle->lock, portMAX_DELAY);
+        item = (handle->count > 0) ? &handle->items[handle->head] : 0;
+        if (item != 0)
+        {
+            duration_us = item->duration_us;
+        }
+        xSemaphoreGive(handle->lock);
+
+        if (item == 0)
+        {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        now = esp_timer_get_time();
+        capacity = (handle->config.burst_us > duration_us) ? handle->config.burst_us : duration_us;
+        handle->credit_us += now - handle->last_refill;
+        if (handle->credit_us > capacity)
+        {
+            handle->credit_us = capacity;
+        }
+        handle->last_refill = now;
+
+        if (handle->credit_us < (int64_t)duration_us)
+        {
+            pacer_wait_us(handle, duration_us - handle->credit_us);
+            continue;
+        }
+
+        /** pop under the lock, send outside of it: pushes must not wait for the network stack */
+        xSemaphoreTake(handle->lock, portMAX_DELAY);
+        item = ((handle->count > 0) && (item == &handle->items[handle->head])) ? &handle->sending : 0;
+        if (item != 0)
+        {
+            memcpy(item->data, handle->items[handle->head].data, handle->items[handle->head].size);
+            item->size = handle->items[handle->head].size;
+            handle->head = (handle->head + 1) % handle->config.depth;
+            --handle->count;
+            ++handle->stats.sent;
+
+            if (handle->last_sent != 0)
+            {
+                bucket = 0;
+                while ((bucket < PACER_GAP_BUCKETS - 1) && ((now - handle->last_sent) >= ((int64_t)PACER_GAP_BUCKET_US << bucket)))
+                {
+                    ++bucket;
+                }
+                ++handle->stats.gap_hist[bucket];
+            }
+            handle->last_sent = now;
+        }
+        xSemaphoreGive(handle->lock);
+
+        if (item != 0)
+        {
+            socket_write(handle->config.socket, item->data, item->size);
+            handle->credit_us -= duration_us;
+        }
+    }
+
+    xSemaphoreGive(handle->exited);
+    vTaskDelete(NULL);
+}
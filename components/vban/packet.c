@@ -25,15 +25,17 @@
 static const char *TAG = "VBAN_PACKET";
 
 static int packet_pcm_check(char const* buffer, size_t size);
+static int packet_text_check(char const* buffer, size_t size);
+static int packet_serial_check(char const* buffer, size_t size);
 static size_t vban_sr_from_value(unsigned int value);
 
 int packet_check(char const* streamname, char const* buffer, size_t size)
 {
     struct VBanHeader const* const hdr = PACKET_HEADER_PTR(buffer);
     VBanProtocol protocol = VBAN_PROTOCOL_UNDEFINED_4;
-    VBanCodec codec = VBAN_BIT_RESOLUTION_MAX;
+    VBanCodec codec = VBAN_CODEC_PCM;
 
-    ESP_LOGD(TAG, "%s: packet is vban: %u, sr: %d, nbs: %d, nbc: %d, bit: %d, name: %s, nu: %u",
+    ESP_LOGD(TAG, "%s: packet is vban: %u, sr: %d, nbs: %d, nbc: %d, bit: %d, name: %.16s, nu: %u",
         __func__, hdr->vban, hdr->format_SR, hdr->format_nbs, hdr->format_nbc, hdr->format_bit, hdr->streamname, hdr->nuFrame);
 
     if ((streamname == 0) || (buffer == 0))
@@ -76,8 +78,12 @@ int packet_check(char const* streamname, char const* buffer, size_t size)
         case VBAN_PROTOCOL_AUDIO:
             return (codec == VBAN_CODEC_PCM) ? packet_pcm_check(buffer, size) : -EINVAL;
 
-        case VBAN_PROTOCOL_SERIAL:
         case VBAN_PROTOCOL_TXT:
+            return packet_text_check(buffer, size);
+
+        case VBAN_PROTOCOL_SERIAL:
+            return packet_serial_check(buffer, size);
+
         case VBAN_PROTOCOL_UNDEFINED_1:
         case VBAN_PROTOCOL_UNDEFINED_2:
         case VBAN_PROTOCOL_UNDEFINED_3:
@@ -106,7 +112,7 @@ static int packet_pcm_check(char const* buffer, size_t size)
     size_t sample_size      = 0;
     size_t payload_size     = 0;
 
-    // ESP_LOGI(TAG, "%s: packet is vban: %u, sr: %d, nbs: %d, nbc: %d, bit: %d, name: %s, nu: %u",
+    // ESP_LOGI(TAG, "%s: packet is vban: %u, sr: %d, nbs: %d, nbc: %d, bit: %d, name: %.16s, nu: %u",
     //     __func__, hdr->vban, hdr->format_SR, hdr->format_nbs, hdr->format_nbc, hdr->format_bit, hdr->streamname, hdr->nuFrame);
 
     if (bit_resolution >= VBAN_BIT_RESOLUTION_MAX)
@@ -126,13 +132,69 @@ static int packet_pcm_check(char const* buffer, size_t size)
 
     if (payload_size != (size - VBAN_HEADER_SIZE))
     {
-        ESP_LOGE(TAG, "%s: invalid payload size, expected %d, got %d", __func__, payload_size, (size - VBAN_HEADER_SIZE));
+        ESP_LOGE(TAG, "%s: invalid payload size, expected %d, got %d", __func__, (int)payload_size, (int)(size - VBAN_HEADER_SIZE));
         return -EINVAL;
     }
     
     return 0;
 }
 
+static int packet_text_check(char const* buffer, size_t size)
+{
+    /** the packet is already a valid vban packet and buffer already checked before */
+
+    struct VBanHeader const* const hdr = PACKET_HEADER_PTR(buffer);
+    int const stream_type = hdr->format_bit & VBAN_STREAMTYPE_MASK;
+
+    if ((hdr->format_bit & VBAN_DATATYPE_MASK) != VBAN_DATATYPE_8BITS)
+    {
+        ESP_LOGE(TAG, "%s: invalid text data type", __func__);
+        return -EINVAL;
+    }
+
+    /** commands are plain text, wide chars are left out */
+    if ((stream_type != VBAN_TXT_ASCII) && (stream_type != VBAN_TXT_UTF8))
+    {
+        ESP_LOGE(TAG, "%s: not supported text stream type", __func__);
+        return -EINVAL;
+    }
+
+    if ((size - VBAN_HEADER_SIZE) > VBAN_DATA_MAX_SIZE)
+    {
+        ESP_LOGE(TAG, "%s: invalid payload size %d", __func__, (int)(size - VBAN_HEADER_SIZE));
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+static int packet_serial_check(char const* buffer, size_t size)
+{
+    /** the packet is already a valid vban packet and buffer already checked before */
+
+    struct VBanHeader const* const hdr = PACKET_HEADER_PTR(buffer);
+
+    if ((hdr->format_bit & VBAN_DATATYPE_MASK) != VBAN_DATATYPE_8BITS)
+    {
+        ESP_LOGE(TAG, "%s: invalid serial data type", __func__);
+        return -EINVAL;
+    }
+
+    if ((hdr->format_SR & VBAN_SERIAL_BPS_MASK) >= VBAN_BPS_MAXNUMBER)
+    {
+        ESP_LOGE(TAG, "%s: invalid bps index", __func__);
+        return -EINVAL;
+    }
+
+    if ((size - VBAN_HEADER_SIZE) > VBAN_DATA_MAX_SIZE)
+    {
+        ESP_LOGE(TAG, "%s: invalid payload size %d", __func__, (int)(size - VBAN_HEADER_SIZE));
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
 int packet_get_max_payload_size(char const* buffer)
 {
     int sample_count = 0;
@@ -214,6 +276,61 @@ int packet_set_new_content(char* buffer, size_t payload_size)
     return 0;
 }
 
+int packet_init_text(char* buffer, char const* streamname, uint32_t nu_frame, char const* text, size_t size)
+{
+    struct VBanHeader* const hdr = PACKET_HEADER_PTR(buffer);
+
+    if ((buffer == 0) || (streamname == 0) || (text == 0))
+    {
+        ESP_LOGE(TAG, "%s: null argument", __func__);
+        return -EINVAL;
+    }
+
+    if (size > VBAN_DATA_MAX_SIZE)
+    {
+        size = VBAN_DATA_MAX_SIZE;
+    }
+
+    /** bps index 0: no serial speed for a text sent over udp */
+    memset(hdr, 0, sizeof(struct VBanHeader));
+    hdr->vban       = VBAN_HEADER_FOURC;
+    hdr->format_SR  = VBAN_PROTOCOL_TXT;
+    hdr->format_bit = VBAN_DATATYPE_8BITS | VBAN_TXT_ASCII;
+    memcpy(hdr->streamname, streamname, strnlen(streamname, VBAN_STREAM_NAME_SIZE));
+    hdr->nuFrame    = nu_frame;
+    memcpy(PACKET_PAYLOAD_PTR(buffer), text, size);
+
+    return VBAN_HEADER_SIZE + size;
+}
+
+int packet_init_serial(char* buffer, char const* streamname, uint32_t bps, uint8_t stream_type, uint8_t channel, uint32_t nu_frame)
+{
+    struct VBanHeader* const hdr = PACKET_HEADER_PTR(buffer);
+    unsigned int index = 0;
+
+    if ((buffer == 0) || (streamname == 0))
+    {
+        ESP_LOGE(TAG, "%s: null argument", __func__);
+        return -EINVAL;
+    }
+
+    while ((index < VBAN_BPS_MAXNUMBER) && (bps != VBanBPSList[index]))
+    {
+        ++index;
+    }
+
+    /** an unlisted speed is sent as index 0: no speed */
+    memset(hdr, 0, sizeof(struct VBanHeader));
+    hdr->vban       = VBAN_HEADER_FOURC;
+    hdr->format_SR  = VBAN_PROTOCOL_SERIAL | ((index < VBAN_BPS_MAXNUMBER) ? index : 0);
+    hdr->format_nbc = channel;
+    hdr->format_bit = VBAN_DATATYPE_8BITS | (stream_type & VBAN_STREAMTYPE_MASK);
+    memcpy(hdr->streamname, streamname, strnlen(streamname, VBAN_STREAM_NAME_SIZE));
+    hdr->nuFrame    = nu_frame;
+
+    return VBAN_HEADER_SIZE;
+}
+
 /** should better be in vban.h header ?*/
 size_t vban_sr_from_value(unsigned int value)
 {
@@ -0,0 +1,127 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "receiver.h"
+#include "packet.h"
+#include "stream.h"
+#include "esp_log.h"
+#include <errno.h>
+#include <string.h>
+
+static const char *TAG = "VBAN_RECEIVER";
+
+int receiver_demux(char const* streamname, fec_decoder_handle_t fec_dec, char const* buffer, size_t size)
+{
+    struct VBanHeader const* const hdr = PACKET_HEADER_PTR(buffer);
+
+    if ((streamname == 0) || (buffer == 0) || (size <= VBAN_HEADER_SIZE) || (hdr->vban != VBAN_HEADER_FOURC))
+    {
+        return RECEIVER_INVALID;
+    }
+
+    if (strncmp(streamname, hdr->streamname, VBAN_STREAM_NAME_SIZE)
+        || ((hdr->format_SR & VBAN_PROTOCOL_MASK) != VBAN_PROTOCOL_AUDIO))
+    {
+        return RECEIVER_FOREIGN;
+    }
+
+    if (fec_is_parity(buffer, size))
+    {
+        if (fec_dec != 0)
+        {
+            fec_decoder_push(fec_dec, buffer, size);
+        }
+        return RECEIVER_PARITY;
+    }
+
+    if (fec_dec != 0)
+    {
+        fec_decoder_push(fec_dec, buffer, size);
+        return RECEIVER_QUEUED;
+    }
+
+    return RECEIVER_PLAY;
+}
+
+int receiver_check_format(char const* buffer, size_t size, struct receiver_format_t* format)
+{
+    struct VBanHeader const* const hdr = PACKET_HEADER_PTR(buffer);
+    VBanCodec codec;
+    unsigned int nb_channels;
+    unsigned int sample_rate;
+    unsigned int bit_fmt;
+
+    if ((buffer == 0) || (format == 0) || (size <= VBAN_HEADER_SIZE))
+    {
+        ESP_LOGE(TAG, "%s: invalid argument", __func__);
+        return -EINVAL;
+    }
+
+    codec       = hdr->format_bit & VBAN_CODEC_MASK;
+    nb_channels = hdr->format_nbc + 1;
+    sample_rate = VBanSRList[hdr->format_SR & VBAN_SR_MASK];
+    bit_fmt     = stream_int_bit_fmt(hdr->format_bit & VBAN_BIT_RESOLUTION_MASK);
+
+    if (format->codec != codec)
+    {
+        format->codec       = codec;
+        format->channels    = nb_channels;
+        format->rates       = sample_rate;
+        format->bits        = bit_fmt;
+        return 1;
+    }
+
+    if ((format->channels != nb_channels) || (format->rates != sample_rate) || (format->bits != bit_fmt))
+    {
+        format->channels    = nb_channels;
+        format->rates       = sample_rate;
+        format->bits        = bit_fmt;
+        return 2;
+    }
+
+    return 0;
+}
+
+int receiver_payload(char const* buffer, size_t size, struct chmap_t const* chmap, char* dst, size_t dst_size)
+{
+    struct VBanHeader const* const hdr = PACKET_HEADER_PTR(buffer);
+    size_t payload_size = PACKET_PAYLOAD_SIZE(size);
+    VBanBitResolution bit_fmt = hdr->format_bit & VBAN_BIT_RESOLUTION_MASK;
+    size_t sample_size;
+
+    if ((chmap == 0) || (chmap->mode == CHMAP_NONE) || ((hdr->format_bit & VBAN_CODEC_MASK) != VBAN_CODEC_PCM))
+    {
+        if (payload_size > dst_size)
+        {
+            return -ENOSPC;
+        }
+        memcpy(dst, PACKET_PAYLOAD_PTR(buffer), payload_size);
+        return payload_size;
+    }
+
+    /** the map trusts the header, a short payload would be read past its end */
+    sample_size = (bit_fmt < VBAN_BIT_RESOLUTION_MAX) ? VBanBitResolutionSize[bit_fmt] : 0;
+    if ((sample_size == 0) || ((size_t)(hdr->format_nbs + 1) * (hdr->format_nbc + 1) * sample_size > payload_size))
+    {
+        return -EINVAL;
+    }
+
+    return chmap_apply(chmap, PACKET_PAYLOAD_PTR(buffer), hdr->format_nbc + 1, bit_fmt, hdr->format_nbs + 1,
+                       dst, dst_size);
+}
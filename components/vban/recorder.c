@@ -0,0 +1,383 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recorder.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "vban.h"
+
+static const char *TAG = "VBAN_RECORDER";
+
+#define RECORDER_PATH_SIZE      64
+
+/** ring item, the datagram follows */
+struct recorder_item_t
+{
+    int64_t                 time_us;
+    struct capture_source_t source;
+    uint16_t                size;
+};
+
+struct recorder_t
+{
+    struct recorder_config_t    config;
+    struct recorder_stats_t     stats;
+
+    /** datagram ring: head only moves in recorder_push, tail only in the writer task */
+    char*                       ring;
+    uint32_t                    mask;
+    uint32_t                    head;
+    uint32_t                    tail;
+    int                         active;     /* pushes are taken */
+    TaskHandle_t                task;
+    SemaphoreHandle_t           exited;
+    volatile int                running;
+
+    /** capture requests, the file is only touched by the writer task */
+    SemaphoreHandle_t           lock;
+    char                        path[RECORDER_PATH_SIZE];
+    int                         requested;
+    uint32_t                    generation; /* bumped by every start */
+    uint32_t                    opened;     /* generation of the open capture */
+    capture_handle_t            capture;
+    char                        packet[VBAN_PROTOCOL_MAX_SIZE];
+};
+
+static void recorder_task(void* arg);
+static void recorder_put(recorder_handle_t handle, uint32_t position, void const* data, uint32_t size);
+static void recorder_get(recorder_handle_t handle, uint32_t position, void* data, uint32_t size);
+static void recorder_open(recorder_handle_t handle);
+static void recorder_close(recorder_handle_t handle);
+
+int recorder_init(recorder_handle_t* handle, struct recorder_config_t const* config)
+{
+    unsigned int ring_size;
+
+    if ((handle == 0) || (config == 0))
+    {
+        ESP_LOGE(TAG, "%s: invalid handle or config", __func__);
+        return -EINVAL;
+    }
+
+    ring_size = (config->ring_size != 0) ? config->ring_size : RECORDER_RING_SIZE;
+    if (((ring_size & (ring_size - 1)) != 0) || (ring_size < sizeof(struct recorder_item_t) + VBAN_PROTOCOL_MAX_SIZE))
+    {
+        ESP_LOGE(TAG, "%s: ring size %u is not a power of two or too small", __func__, ring_size);
+        return -EINVAL;
+    }
+
+    *handle = calloc(1, sizeof(struct recorder_t));
+    if (*handle == 0)
+    {
+        ESP_LOGE(TAG, "%s: could not allocate memory", __func__);
+        return -ENOMEM;
+    }
+
+    (*handle)->config = *config;
+    (*handle)->mask = ring_size - 1;
+    (*handle)->ring = malloc(ring_size);
+    (*handle)->lock = xSemaphoreCreateMutex();
+    (*handle)->exited = xSemaphoreCreateBinary();
+    if (((*handle)->ring == 0) || ((*handle)->lock == 0) || ((*handle)->exited == 0))
+    {
+        ESP_LOGE(TAG, "%s: could not allocate memory", __func__);
+        recorder_release(handle);
+        return -ENOMEM;
+    }
+
+    (*handle)->running = 1;
+    if (xTaskCreatePinnedToCore(recorder_task, "vban_recorder", config->task_stack, *handle,
+                                config->task_prio, &(*handle)->task, config->task_core) != pdPASS)
+    {
+        ESP_LOGE(TAG, "%s: could not create task", __func__);
+        (*handle)->running = 0;
+        recorder_release(handle);
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+int recorder_release(recorder_handle_t* handle)
+{
+    if (handle == 0)
+    {
+        ESP_LOGE(TAG, "%s: null handle pointer", __func__);
+        return -EINVAL;
+    }
+
+    if (*handle == 0)
+    {
+        return 0;
+    }
+
+    if ((*handle)->running)
+    {
+        (*handle)->running = 0;
+        xTaskNotifyGive((*handle)->task);
+        xSemaphoreTake((*handle)->exited, portMAX_DELAY);
+    }
+
+    if ((*handle)->lock != 0)
+    {
+        vSemaphoreDelete((*handle)->lock);
+    }
+    if ((*handle)->exited != 0)
+    {
+        vSemaphoreDelete((*handle)->exited);
+    }
+    free((*handle)->ring);
+    free(*handle);
+    *handle = 0;
+
+    return 0;
+}
+
+int recorder_start(recorder_handle_t handle, char const* path)
+{
+    if ((handle == 0) || (path == 0) || (strlen(path) >= RECORDER_PATH_SIZE))
+    {
+        ESP_LOGE(TAG, "%s: invalid argument", __func__);
+        return -EINVAL;
+    }
+
+    /** a running capture is drained and closed first, then the writer opens the new one */
+    __atomic_store_n(&handle->active, 0, __ATOMIC_RELEASE);
+    xSemaphoreTake(handle->lock, portMAX_DELAY);
+    strcpy(handle->path, path);
+    handle->requested = 1;
+    ++handle->generation;
+    xSemaphoreGive(handle->lock);
+    xTaskNotifyGive(handle->task);
+
+    return 0;
+}
+
+int recorder_stop(recorder_handle_t handle)
+{
+    if (handle == 0)
+    {
+        return -EINVAL;
+    }
+
+    /** nothing more comes in, the writer empties the ring before the index */
+    __atomic_store_n(&handle->active, 0, __ATOMIC_RELEASE);
+    xSemaphoreTake(handle->lock, portMAX_DELAY);
+    handle->requested = 0;
+    xSemaphoreGive(handle->lock);
+    xTaskNotifyGive(handle->task);
+
+    return 0;
+}
+
+void recorder_put(recorder_handle_t handle, uint32_t position, void const* data, uint32_t size)
+{
+    uint32_t offset = position & handle->mask;
+    uint32_t chunk = ((handle->mask + 1) - offset < size) ? (handle->mask + 1) - offset : size;
+
+    memcpy(&handle->ring[offset], data, chunk);
+    memcpy(handle->ring, (char const*)data + chunk, size - chunk);
+}
+
+void recorder_get(recorder_handle_t handle, uint32_t position, void* data, uint32_t size)
+{
+    uint32_t offset = position & handle->mask;
+    uint32_t chunk = ((handle->mask + 1) - offset < size) ? (handle->mask + 1) - offset : size;
+
+    memcpy(data, &handle->ring[offset], chunk);
+    memcpy((char*)data + chunk, handle->ring, size - chunk);
+}
+
+int recorder_push(recorder_handle_t handle, char const* buffer, size_t size, int64_t time_us,
+                  struct socket_address_t const* from)
+{
+    struct recorder_item_t item;
+    uint32_t head;
+    uint32_t tail;
+    int version;
+
+    if ((handle == 0) || (buffer == 0) || (size > VBAN_PROTOCOL_MAX_SIZE))
+    {
+        return -EINVAL;
+    }
+
+    if (!__atomic_load_n(&handle->active, __ATOMIC_ACQUIRE))
+    {
+        return 0;
+    }
+
+    /** single producer: only the writer moves tail, a stale value only means less room */
+    head = handle->head;
+    tail = __atomic_load_n(&handle->tail, __ATOMIC_ACQUIRE);
+    if (sizeof(item) + size > (handle->mask + 1) - (head - tail))
+    {
+        /** a datagram is kept whole or not at all, the capture shows the gap */
+        ++handle->stats.overflow;
+        return 0;
+    }
+
+    memset(&item, 0, sizeof(item));
+    item.time_us = time_us;
+    item.size = size;
+    if (from != 0)
+    {
+        version = socket_address_get_ip(from, item.source.ip, &item.source.port);
+        item.source.ip_version = (version > 0) ? version : 0;
+    }
+    recorder_put(handle, head, &item, sizeof(item));
+    recorder_put(handle, head + sizeof(item), buffer, size);
+    __atomic_store_n(&handle->head, head + sizeof(item) + size, __ATOMIC_RELEASE);
+    xTaskNotifyGive(handle->task);
+
+    return 0;
+}
+
+void recorder_open(recorder_handle_t handle)
+{
+    struct capture_config_t config = {
+        .index_size = handle->config.index_size,
+    };
+    struct timeval tv;
+    char path[RECORDER_PATH_SIZE];
+    uint32_t generation;
+    int ret;
+
+    xSemaphoreTake(handle->lock, portMAX_DELAY);
+    strcpy(path, handle->path);
+    generation = handle->generation;
+    xSemaphoreGive(handle->lock);
+
+    /** wall clock only once SNTP set it, the records keep the boot clock */
+    gettimeofday(&tv, NULL);
+    config.mono_us = esp_timer_get_time();
+    config.wall_us = (tv.tv_sec > 1600000000) ? (int64_t)tv.tv_sec * 1000000 + tv.tv_usec : 0;
+
+    /** a previous capture may have left datagrams behind, the writer owns tail */
+    __atomic_store_n(&handle->tail, __atomic_load_n(&handle->head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+
+    ret = capture_open(&handle->capture, path, &config);
+    if (ret != 0)
+    {
+        ESP_LOGE(TAG, "%s: could not create %s, error %d", __func__, path, ret);
+        return;
+    }
+
+    ESP_LOGI(TAG, "%s: capturing to %s", __func__, path);
+    handle->opened = generation;
+    __atomic_store_n(&handle->active, 1, __ATOMIC_RELEASE);
+}
+
+void recorder_close(recorder_handle_t handle)
+{
+    __atomic_store_n(&handle->active, 0, __ATOMIC_RELEASE);
+    if (capture_close(&handle->capture) != 0)
+    {
+        ESP_LOGE(TAG, "%s: could not write the index, the capture can only be scanned", __func__);
+    }
+    ESP_LOGI(TAG, "%s: capture ended, %u records, %u overflow", __func__, handle->stats.records,
+             handle->stats.overflow);
+}
+
+void recorder_task(void* arg)
+{
+    recorder_handle_t handle = (recorder_handle_t)arg;
+    struct recorder_item_t item;
+    uint32_t head;
+    uint32_t tail;
+    int requested;
+    uint32_t generation;
+
+    while (handle->running)
+    {
+        head = __atomic_load_n(&handle->head, __ATOMIC_ACQUIRE);
+        tail = handle->tail;
+
+        xSemaphoreTake(handle->lock, portMAX_DELAY);
+        requested = handle->requested;
+        generation = handle->generation;
+        xSemaphoreGive(handle->lock);
+
+        if (head == tail)
+        {
+            /** a stop is served once the ring is empty, a restart closes the previous file first */
+            if ((handle->capture != 0) && (!requested || (generation != handle->opened)))
+            {
+                recorder_close(handle);
+            }
+            if ((handle->capture == 0) && requested)
+            {
+                recorder_open(handle);
+                if (handle->capture == 0)
+                {
+                    xSemaphoreTake(handle->lock, portMAX_DELAY);
+                    handle->requested = 0;
+                    xSemaphoreGive(handle->lock);
+                }
+            }
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        recorder_get(handle, tail, &item, sizeof(item));
+        recorder_get(handle, tail + sizeof(item), handle->packet, item.size);
+        __atomic_store_n(&handle->tail, tail + sizeof(item) + item.size, __ATOMIC_RELEASE);
+
+        if (handle->capture == 0)
+        {
+            continue;
+        }
+        if (capture_write(handle->capture, handle->packet, item.size, item.time_us, &item.source) != 0)
+        {
+            /** the card went away, the records written so far stay readable */
+            ESP_LOGE(TAG, "%s: write failed, capture stopped", __func__);
+            ++handle->stats.write_errors;
+            xSemaphoreTake(handle->lock, portMAX_DELAY);
+            handle->requested = 0;
+            xSemaphoreGive(handle->lock);
+            recorder_close(handle);
+            continue;
+        }
+        ++handle->stats.records;
+        handle->stats.bytes += item.size;
+    }
+
+    if (handle->capture != 0)
+    {
+        recorder_close(handle);
+    }
+    xSemaphoreGive(handle->exited);
+    vTaskDelete(NULL);
+}
+
+void recorder_get_stats(recorder_handle_t handle, struct recorder_stats_t* stats)
+{
+    if ((handle == 0) || (stats == 0))
+    {
+        return;
+    }
+
+    *stats = handle->stats;
+}
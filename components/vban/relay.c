@@ -0,0 +1,208 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "relay.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "packet.h"
+
+static const char *TAG = "VBAN_RELAY";
+
+/**
+ * Time the relay task blocks in a read before checking it should stop
+ */
+#define RELAY_READ_TIMEOUT_MS   200
+
+struct relay_t
+{
+    struct relay_config_t   config;
+    struct relay_stats_t    stats;
+    socket_handle_t         in;
+    socket_handle_t         out;
+    TaskHandle_t            task;
+    SemaphoreHandle_t       exited;
+    volatile int            running;
+    char                    buffer[VBAN_PROTOCOL_MAX_SIZE];
+};
+
+static void relay_task(void* arg);
+
+int relay_init(relay_handle_t* handle, struct relay_config_t const* config)
+{
+    int ret = 0;
+    struct socket_config_t in;
+    struct socket_config_t out;
+
+    if ((handle == 0) || (config == 0))
+    {
+        ESP_LOGE(TAG, "%s: null handle or config pointer", __func__);
+        return -EINVAL;
+    }
+
+    *handle = calloc(1, sizeof(struct relay_t));
+    if (*handle == 0)
+    {
+        ESP_LOGE(TAG, "%s: could not allocate memory", __func__);
+        return -ENOMEM;
+    }
+
+    (*handle)->config = *config;
+    in = config->in;
+    in.direction = SOCKET_IN;
+    out = config->out;
+    out.direction = SOCKET_OUT;
+
+    (*handle)->exited = xSemaphoreCreateBinary();
+    if ((*handle)->exited == 0)
+    {
+        ESP_LOGE(TAG, "%s: could not allocate memory", __func__);
+        relay_release(handle);
+        return -ENOMEM;
+    }
+
+    ret = socket_init(&(*handle)->in, &in, &config->mcast_cfg);
+    if (ret == 0)
+    {
+        ret = socket_set_timeout((*handle)->in, RELAY_READ_TIMEOUT_MS);
+    }
+    if (ret == 0)
+    {
+        ret = socket_init(&(*handle)->out, &out, &config->mcast_cfg);
+    }
+    if (ret != 0)
+    {
+        ESP_LOGE(TAG, "%s: could not open sockets", __func__);
+        relay_release(handle);
+        return ret;
+    }
+
+    (*handle)->running = 1;
+    if (xTaskCreatePinnedToCore(relay_task, "vban_relay", config->task_stack, *handle,
+                                config->task_prio, &(*handle)->task, config->task_core) != pdPASS)
+    {
+        ESP_LOGE(TAG, "%s: could not create task", __func__);
+        (*handle)->running = 0;
+        relay_release(handle);
+        return -ENOMEM;
+    }
+
+    ESP_LOGI(TAG, "relaying %s:%d to %s:%d", in.ip_address, in.port, out.ip_address, out.port);
+    return 0;
+}
+
+int relay_release(relay_handle_t* handle)
+{
+    if (handle == 0)
+    {
+        ESP_LOGE(TAG, "%s: null handle pointer", __func__);
+        return -EINVAL;
+    }
+
+    if (*handle == 0)
+    {
+        return 0;
+    }
+
+    if ((*handle)->running)
+    {
+        /** the task notices within one read timeout */
+        (*handle)->running = 0;
+        xSemaphoreTake((*handle)->exited, portMAX_DELAY);
+    }
+
+    socket_release(&(*handle)->in);
+    socket_release(&(*handle)->out);
+    if ((*handle)->exited != 0)
+    {
+        vSemaphoreDelete((*handle)->exited);
+    }
+    free(*handle);
+    *handle = 0;
+
+    return 0;
+}
+
+void relay_get_stats(relay_handle_t handle, struct relay_stats_t* stats)
+{
+    if ((handle == 0) || (stats == 0))
+    {
+        return;
+    }
+
+    *stats = handle->stats;
+}
+
+void relay_task(void* arg)
+{
+    relay_handle_t handle = (relay_handle_t)arg;
+    struct VBanHeader* const hdr = PACKET_HEADER_PTR(handle->buffer);
+    int const rename = (handle->config.out_stream_name[0] != '\0');
+    int const filter = (handle->config.in_stream_name[0] != '\0');
+    int64_t received;
+    uint32_t hop_us;
+    int size;
+
+    while (handle->running)
+    {
+        size = socket_read(handle->in, handle->buffer, VBAN_PROTOCOL_MAX_SIZE);
+        if (size <= 0)
+        {
+            continue;
+        }
+        received = esp_timer_get_time();
+
+        if ((size < VBAN_HEADER_SIZE) || (hdr->vban != VBAN_HEADER_FOURC)
+            || (filter && strncmp(hdr->streamname, handle->config.in_stream_name, VBAN_STREAM_NAME_SIZE)))
+        {
+            ++handle->stats.dropped;
+            continue;
+        }
+
+        /** frame is re-emitted from the receive buffer, only the name is patched in place */
+        if (rename)
+        {
+            strncpy(hdr->streamname, handle->config.out_stream_name, VBAN_STREAM_NAME_SIZE);
+        }
+
+        if (socket_write(handle->out, handle->buffer, size) < 0)
+        {
+            ++handle->stats.dropped;
+            continue;
+        }
+
+        hop_us = (uint32_t)(esp_timer_get_time() - received);
+        handle->stats.hop_last_us = hop_us;
+        handle->stats.hop_avg_us = (handle->stats.forwarded == 0)
+            ? hop_us : handle->stats.hop_avg_us - (handle->stats.hop_avg_us >> 4) + (hop_us >> 4);
+        if (hop_us > handle->stats.hop_max_us)
+        {
+            handle->stats.hop_max_us = hop_us;
+        }
+        ++handle->stats.forwarded;
+    }
+
+    xSemaphoreGive(handle->exited);
+    vTaskDelete(NULL);
+}
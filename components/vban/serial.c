@@ -0,0 +1,419 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "serial.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "packet.h"
+
+static const char *TAG = "VBAN_SERIAL";
+
+struct serial_t
+{
+    struct serial_config_t  config;
+    struct serial_stats_t   stats;
+
+    /** receive ring: head only moves in serial_push, tail only in the serial task */
+    char*                   ring;
+    uint32_t                mask;
+    uint32_t                head;
+    uint32_t                tail;
+    TaskHandle_t            task;
+    SemaphoreHandle_t       exited;
+    volatile int            running;
+
+    /** send side */
+    SemaphoreHandle_t       lock;
+    socket_handle_t         socket;
+    struct socket_address_t to;
+    struct socket_address_t last_from;
+    esp_timer_handle_t      timer;
+    int                     flush;          /* set by the timer, the serial task sends */
+    char                    frame[VBAN_PROTOCOL_MAX_SIZE];
+    size_t                  frame_size;     /* payload bytes gathered */
+    uint32_t                nu_frame;
+};
+
+static void serial_task(void* arg);
+static void serial_timer_cb(void* arg);
+static void serial_sync_cb(void* arg);
+static void serial_timer_sync(SemaphoreHandle_t done);
+static int serial_send(serial_handle_t handle);
+
+int serial_init(serial_handle_t* handle, struct serial_config_t const* config)
+{
+    unsigned int ring_size;
+
+    if ((handle == 0) || (config == 0) || (config->handler == 0) || (config->streamname[0] == '\0'))
+    {
+        ESP_LOGE(TAG, "%s: invalid handle or config", __func__);
+        return -EINVAL;
+    }
+
+    ring_size = (config->ring_size != 0) ? config->ring_size : SERIAL_RING_SIZE;
+    if ((ring_size & (ring_size - 1)) != 0)
+    {
+        ESP_LOGE(TAG, "%s: ring size %u is not a power of two", __func__, ring_size);
+        return -EINVAL;
+    }
+
+    *handle = calloc(1, sizeof(struct serial_t));
+    if (*handle == 0)
+    {
+        ESP_LOGE(TAG, "%s: could not allocate memory", __func__);
+        return -ENOMEM;
+    }
+
+    (*handle)->config = *config;
+    (*handle)->mask = ring_size - 1;
+    (*handle)->ring = malloc(ring_size);
+    (*handle)->lock = xSemaphoreCreateMutex();
+    (*handle)->exited = xSemaphoreCreateBinary();
+    if (((*handle)->ring == 0) || ((*handle)->lock == 0) || ((*handle)->exited == 0))
+    {
+        ESP_LOGE(TAG, "%s: could not allocate memory", __func__);
+        serial_release(handle);
+        return -ENOMEM;
+    }
+
+    esp_timer_create_args_t timer_args = {
+        .callback = serial_timer_cb,
+        .arg = *handle,
+        .name = "vban_serial",
+    };
+    if (esp_timer_create(&timer_args, &(*handle)->timer) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "%s: could not create timer", __func__);
+        serial_release(handle);
+        return -ENOMEM;
+    }
+
+    (*handle)->running = 1;
+    if (xTaskCreatePinnedToCore(serial_task, "vban_serial", config->task_stack, *handle,
+                                config->task_prio, &(*handle)->task, config->task_core) != pdPASS)
+    {
+        ESP_LOGE(TAG, "%s: could not create task", __func__);
+        (*handle)->running = 0;
+        serial_release(handle);
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+int serial_release(serial_handle_t* handle)
+{
+    if (handle == 0)
+    {
+        ESP_LOGE(TAG, "%s: null handle pointer", __func__);
+        return -EINVAL;
+    }
+
+    if (*handle == 0)
+    {
+        return 0;
+    }
+
+    if ((*handle)->timer != 0)
+    {
+        esp_timer_stop((*handle)->timer);
+        serial_timer_sync((*handle)->exited);
+    }
+
+    if ((*handle)->running)
+    {
+        (*handle)->running = 0;
+        xTaskNotifyGive((*handle)->task);
+        xSemaphoreTake((*handle)->exited, portMAX_DELAY);
+    }
+
+    if ((*handle)->timer != 0)
+    {
+        esp_timer_delete((*handle)->timer);
+    }
+    if ((*handle)->lock != 0)
+    {
+        vSemaphoreDelete((*handle)->lock);
+    }
+    if ((*handle)->exited != 0)
+    {
+        vSemaphoreDelete((*handle)->exited);
+    }
+    free((*handle)->ring);
+    free(*handle);
+    *handle = 0;
+
+    return 0;
+}
+
+int serial_attach(serial_handle_t handle, socket_handle_t socket)
+{
+    struct socket_address_t to;
+
+    if (handle == 0)
+    {
+        ESP_LOGE(TAG, "%s: null handle", __func__);
+        return -EINVAL;
+    }
+
+    /** the destination layout follows the socket family, resolve it once */
+    memset(&to, 0, sizeof(to));
+    if ((socket != 0) && (handle->config.ip_address[0] != '\0')
+        && (socket_get_address(socket, handle->config.ip_address, handle->config.port, &to) != 0))
+    {
+        ESP_LOGE(TAG, "%s: bad destination %s, answering the last sender", __func__, handle->config.ip_address);
+    }
+
+    xSemaphoreTake(handle->lock, portMAX_DELAY);
+    handle->socket = socket;
+    handle->to = to;
+    handle->frame_size = 0;
+    xSemaphoreGive(handle->lock);
+
+    return 0;
+}
+
+char const* serial_get_stream_name(serial_handle_t handle)
+{
+    return (handle != 0) ? handle->config.streamname : "";
+}
+
+int serial_push(serial_handle_t handle, char const* buffer, size_t size, struct socket_address_t const* from)
+{
+    struct VBanHeader const* const hdr = PACKET_HEADER_PTR(buffer);
+    char const* payload = PACKET_PAYLOAD_PTR(buffer);
+    uint32_t head;
+    uint32_t tail;
+    uint32_t room;
+    uint32_t offset;
+    uint32_t chunk;
+
+    if ((handle == 0) || (buffer == 0) || (size < VBAN_HEADER_SIZE))
+    {
+        return -EINVAL;
+    }
+
+    size = PACKET_PAYLOAD_SIZE(size);
+    ++handle->stats.rx_frames;
+    handle->stats.rx_bps = VBanBPSList[hdr->format_SR & VBAN_SERIAL_BPS_MASK];
+    if ((from != 0) && ((handle->last_from.len == 0) || !socket_address_match(&handle->last_from, from)))
+    {
+        /** the send side reads it, only a new sender costs the lock */
+        xSemaphoreTake(handle->lock, portMAX_DELAY);
+        handle->last_from = *from;
+        xSemaphoreGive(handle->lock);
+    }
+
+    /** single producer: only the consumer moves tail, a stale value only means less room */
+    head = handle->head;
+    tail = __atomic_load_n(&handle->tail, __ATOMIC_ACQUIRE);
+    room = (handle->mask + 1) - (head - tail);
+    if (size > room)
+    {
+        /** a byte stream can't skip: keep the oldest bytes, drop the end of this packet */
+        handle->stats.rx_overflow += size - room;
+        size = room;
+    }
+
+    offset = head & handle->mask;
+    chunk = ((handle->mask + 1) - offset < size) ? (handle->mask + 1) - offset : size;
+    memcpy(&handle->ring[offset], payload, chunk);
+    memcpy(handle->ring, payload + chunk, size - chunk);
+    __atomic_store_n(&handle->head, head + size, __ATOMIC_RELEASE);
+    handle->stats.rx_bytes += size;
+
+    if (size > 0)
+    {
+        xTaskNotifyGive(handle->task);
+    }
+
+    return 0;
+}
+
+void serial_task(void* arg)
+{
+    serial_handle_t handle = (serial_handle_t)arg;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t offset;
+    uint32_t chunk;
+
+    while (handle->running)
+    {
+        if (__atomic_exchange_n(&handle->flush, 0, __ATOMIC_ACQ_REL) != 0)
+        {
+            serial_flush(handle);
+        }
+
+        head = __atomic_load_n(&handle->head, __ATOMIC_ACQUIRE);
+        tail = handle->tail;
+        if (head == tail)
+        {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        offset = tail & handle->mask;
+        chunk = ((handle->mask + 1) - offset < head - tail) ? (handle->mask + 1) - offset : head - tail;
+        handle->config.handler(&handle->ring[offset], chunk, handle->config.context);
+        __atomic_store_n(&handle->tail, tail + chunk, __ATOMIC_RELEASE);
+    }
+
+    xSemaphoreGive(handle->exited);
+    vTaskDelete(NULL);
+}
+
+int serial_send(serial_handle_t handle)
+{
+    /** lock is held */
+    struct socket_address_t const* to = (handle->to.len != 0) ? &handle->to : &handle->last_from;
+    size_t size = VBAN_HEADER_SIZE + handle->frame_size;
+    int ret = 0;
+
+    if (handle->frame_size == 0)
+    {
+        return 0;
+    }
+
+    handle->frame_size = 0;
+    if ((handle->socket == 0) || (to->len == 0))
+    {
+        ++handle->stats.tx_dropped;
+        return -ENOTCONN;
+    }
+
+    packet_init_serial(handle->frame, handle->config.streamname, handle->config.bps, handle->config.stream_type,
+                       handle->config.channel, handle->nu_frame++);
+    ret = socket_write_to(handle->socket, handle->frame, size, to);
+    if (ret < 0)
+    {
+        ++handle->stats.tx_dropped;
+        return ret;
+    }
+
+    ++handle->stats.tx_frames;
+    handle->stats.tx_bytes += size - VBAN_HEADER_SIZE;
+    return 0;
+}
+
+void serial_timer_cb(void* arg)
+{
+    /** the timer task is shared: no lock nor send here */
+    serial_handle_t handle = (serial_handle_t)arg;
+
+    __atomic_store_n(&handle->flush, 1, __ATOMIC_RELEASE);
+    xTaskNotifyGive(handle->task);
+}
+
+void serial_sync_cb(void* arg)
+{
+    xSemaphoreGive((SemaphoreHandle_t)arg);
+}
+
+void serial_timer_sync(SemaphoreHandle_t done)
+{
+    esp_timer_handle_t timer;
+    esp_timer_create_args_t timer_args = {
+        .callback = serial_sync_cb,
+        .arg = done,
+        .name = "vban_serial_sync",
+    };
+
+    /** a stopped timer may still have its callback on the way: the timer task runs them in order */
+    if (esp_timer_create(&timer_args, &timer) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "%s: could not create timer, waiting a tick instead", __func__);
+        vTaskDelay(1);
+        return;
+    }
+    esp_timer_start_once(timer, 0);
+    xSemaphoreTake(done, portMAX_DELAY);
+    esp_timer_delete(timer);
+}
+
+int serial_write(serial_handle_t handle, char const* data, size_t size)
+{
+    size_t chunk;
+    int ret = 0;
+
+    if ((handle == 0) || (data == 0))
+    {
+        ESP_LOGE(TAG, "%s: invalid argument", __func__);
+        return -EINVAL;
+    }
+
+    xSemaphoreTake(handle->lock, portMAX_DELAY);
+    ++handle->stats.tx_writes;
+    while (size > 0)
+    {
+        if ((handle->frame_size == 0) && (handle->config.coalesce_us > 0))
+        {
+            /** the first byte of a frame starts the window, later writes ride along */
+            esp_timer_stop(handle->timer);
+            esp_timer_start_once(handle->timer, handle->config.coalesce_us);
+        }
+
+        chunk = VBAN_DATA_MAX_SIZE - handle->frame_size;
+        chunk = (size < chunk) ? size : chunk;
+        memcpy(PACKET_PAYLOAD_PTR(handle->frame) + handle->frame_size, data, chunk);
+        handle->frame_size += chunk;
+        data += chunk;
+        size -= chunk;
+
+        if ((handle->frame_size == VBAN_DATA_MAX_SIZE) || (handle->config.coalesce_us == 0))
+        {
+            ret = serial_send(handle);
+        }
+    }
+    xSemaphoreGive(handle->lock);
+
+    return ret;
+}
+
+int serial_flush(serial_handle_t handle)
+{
+    int ret;
+
+    if (handle == 0)
+    {
+        return -EINVAL;
+    }
+
+    xSemaphoreTake(handle->lock, portMAX_DELAY);
+    ret = serial_send(handle);
+    xSemaphoreGive(handle->lock);
+
+    return ret;
+}
+
+void serial_get_stats(serial_handle_t handle, struct serial_stats_t* stats)
+{
+    if ((handle == 0) || (stats == 0))
+    {
+        return;
+    }
+
+    *stats = handle->stats;
+}
@@ -30,159 +30,141 @@
 #include "esp_log.h"
 #include "esp_wifi.h"
 #include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 
 #include "lwip/err.h"
 #include "lwip/sockets.h"
 #include "lwip/sys.h"
 #include <lwip/netdb.h>
 
+/**
+ * Output destination with its address resolved once
+ */
+struct socket_peer_t
+{
+    struct socket_destination_t dest;
+    struct sockaddr_storage     addr;
+    socklen_t                   addrlen;
+};
+
+/**
+ * Multicast membership with its source resolved once
+ */
+struct socket_member_t
+{
+    struct socket_membership_t  info;
+    struct sockaddr_storage     source;     /* only used by the software source filter */
+};
+
 struct socket_t
 {
     struct socket_config_t    config;
     struct socket_multicast_t mcast_cfg;
     int                       fd;
+    int                       family;
+    struct socket_peer_t      peers[SOCKET_DESTINATIONS_MAX_NB + 1];
+    unsigned int              nb_peers;
+    SemaphoreHandle_t         lock;
+    struct socket_t*          owner;    /* fd and lock are borrowed from this socket */
+    struct socket_member_t    members[SOCKET_GROUPS_MAX_NB];
+    unsigned int              nb_members;
+    unsigned int              nb_soft_sources;  /* members whose source socket_read has to check */
+    struct socket_stats_t     stats;
+    int64_t                   rx_time_us;   /* arrival of the last datagram socket_read returned */
+    netsim_handle_t           netsim;       /* impaired link in front of the application, CONFIG_SOCKET_NETSIM */
+    char*                     netsim_frame; /* output: delayed datagrams leave through it */
+    unsigned int              attach_nu;    /* owner: writers attached so far, attached: its rank, seeds its link */
 };
 
-#define MULTICAST_LOOPBACK CONFIG_EXAMPLE_LOOPBACK
+static const char *TAG = "socket";
 
-#define MULTICAST_TTL CONFIG_EXAMPLE_MULTICAST_TTL
-
-#define USE_DEFAULT_IF CONFIG_EXAMPLE_MULTICAST_LISTEN_DEFAULT_IF
-
-#ifdef CONFIG_SOCKET_IPV6
-static const char *TAG = "socket-ipv6";
+/**
+ * IPv6 sockets also carry IPv4 traffic, as IPv4-mapped addresses
+ */
+#ifdef CONFIG_SOCKET_DUAL_STACK
+#define SOCKET_V6ONLY   0
 #else
-static const char *TAG = "socket-ipv4";
+#define SOCKET_V6ONLY   1
 #endif
 
+/**
+ * Largest datagram the impairment simulator holds, an ethernet frame
+ */
+#define SOCKET_NETSIM_MAX_SIZE  1500
+
 static int socket_open(socket_handle_t handle);
 static int socket_close(socket_handle_t handle);
 static int socket_is_multi_address(char const* ip);
+static int socket_resolve(struct socket_peer_t* peer, int family, const char* ip_address, uint16_t port);
+static int socket_find_peer(socket_handle_t handle, const char* ip_address, uint16_t port);
+static int socket_open_peers(socket_handle_t handle);
+static int socket_addr_equal(struct sockaddr const* a, struct sockaddr const* b);
+static uint16_t socket_addr_port(struct sockaddr const* addr);
+static char const* socket_addr_name(struct sockaddr_storage const* addr, char* name, size_t size);
+static int socket_find_member(socket_handle_t handle, const char* multiaddr, const char* source);
+static int socket_group_joined(socket_handle_t handle, const char* multiaddr);
+static int socket_source_allowed(socket_handle_t handle, struct sockaddr_storage const* raddr);
+static int socket_send_peers(socket_handle_t handle, char const* buffer, size_t size);
+#ifdef CONFIG_SOCKET_NETSIM
+static int socket_netsim_open(socket_handle_t handle);
+static int socket_netsim_read(socket_handle_t handle, char* buffer, size_t size, struct socket_address_t* from);
+static int socket_netsim_write(socket_handle_t handle, char const* buffer, size_t size);
+#endif
 
-static int socket_add_ipv4_multicast_group(int sock, uint8_t dif, const char* multi_ipv4, bool assign_source_if);
-static int socket_drop_ipv4_multicast_group(int sock, uint8_t dif, const char* multi_ipv4);
-static int create_socket(bool socket_in, int port);
-static int join_multi_group(int sock, uint8_t dif, uint8_t mttl, uint8_t loopback, const char* multiaddr);
-static int leave_multi_group(int sock, uint8_t dif, const char* multiaddr);
-
-// #define CONFIG_SOCKET_IPV6
-
-/* Add a socket, either IPV4-only or IPV6 dual mode, to the IPV4
-   multicast group */
-int socket_add_ipv4_multicast_group(int sock, uint8_t dif, const char* multi_ipv4, bool assign_source_if)
-{
-    struct ip_mreq imreq = { 0 };
-    struct in_addr iaddr = { 0 };
-    int err = 0;
-    // Configure source interface
-    if (dif) {
-        imreq.imr_interface.s_addr = IPADDR_ANY;
-    } else {
-        tcpip_adapter_ip_info_t ip_info = { 0 };
-        err = tcpip_adapter_get_ip_info(TCPIP_ADAPTER_IF_STA, &ip_info);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to get IP address info. Error 0x%x", err);
-            goto err;
-        }
-        inet_addr_from_ip4addr(&iaddr, &ip_info.ip);
-    }
-    // Configure multicast address to listen to
-    err = inet_aton(multi_ipv4, &imreq.imr_multiaddr.s_addr);
-    if (err != 1) {
-        ESP_LOGE(TAG, "Configured IPV4 multicast address '%s' is invalid.", multi_ipv4);
-        goto err;
-    }
-    ESP_LOGI(TAG, "Configured IPV4 Multicast address %s", inet_ntoa(imreq.imr_multiaddr.s_addr));
-    if (!IP_MULTICAST(ntohl(imreq.imr_multiaddr.s_addr))) {
-        ESP_LOGW(TAG, "Configured IPV4 multicast address '%s' is not a valid multicast address. This will probably not work.", multi_ipv4);
-    }
-
-    if (assign_source_if) {
-        // Assign the IPv4 multicast source interface, via its IP
-        // (only necessary if this socket is IPV4 only)
-        err = setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, &iaddr,
-                         sizeof(struct in_addr));
-        if (err < 0) {
-            ESP_LOGE(TAG, "Failed to set IP_MULTICAST_IF. Error %d", errno);
-            goto err;
-        }
-    }
-
-    err = setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP,
-                         &imreq, sizeof(struct ip_mreq));
-    if (err < 0) {
-        ESP_LOGE(TAG, "Failed to set IP_ADD_MEMBERSHIP. Error %d", errno);
-        goto err;
-    }
-
- err:
-    return err;
-}
+static int create_socket(int family, bool socket_in, int port);
+static int set_multicast_options(int sock, int family, uint8_t dif, uint8_t mttl, uint8_t loopback);
+static int get_if_addr(uint8_t dif, struct in_addr* if_addr);
+static int set_membership(int sock, uint8_t dif, const char* multiaddr, bool join);
+static int set_source_membership(int sock, uint8_t dif, const char* multiaddr, const char* source, bool join);
 
-int socket_drop_ipv4_multicast_group(int sock, uint8_t dif, const char* multi_ipv4)
+int socket_family(char const* ip)
 {
-    struct ip_mreq imreq = { 0 };
-    int err = 0;
-    // Configure source interface
-    if (dif) {
-        imreq.imr_interface.s_addr = IPADDR_ANY;
-    } else {
-        tcpip_adapter_ip_info_t ip_info = { 0 };
-        err = tcpip_adapter_get_ip_info(TCPIP_ADAPTER_IF_STA, &ip_info);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to get IP address info. Error 0x%x", err);
-            goto err;
-        }
-        imreq.imr_interface.s_addr = &ip_info.ip;
-    }
-    // Configure multicast address to listen to
-    err = inet_aton(multi_ipv4, &imreq.imr_multiaddr.s_addr);
-    if (err != 1) {
-        ESP_LOGE(TAG, "Configured IPV4 multicast address '%s' is invalid.", multi_ipv4);
-        goto err;
-    }
-    ESP_LOGI(TAG, "Configured IPV4 Multicast address %s", inet_ntoa(imreq.imr_multiaddr.s_addr));
-    if (!IP_MULTICAST(ntohl(imreq.imr_multiaddr.s_addr))) {
-        ESP_LOGW(TAG, "Configured IPV4 multicast address '%s' is not a valid multicast address. This will probably not work.", multi_ipv4);
-    }
-
-    err = setsockopt(sock, IPPROTO_IP, IP_DROP_MEMBERSHIP,
-                         &imreq, sizeof(struct ip_mreq));
-    if (err < 0) {
-        ESP_LOGE(TAG, "Failed to set IP_DROP_MEMBERSHIP. Error %d", errno);
-        goto err;
-    }
-    return 0;
-
- err:
-    return err;
+    /** only IPv6 literals hold a colon, names resolve as IPv4 */
+    return ((ip != 0) && (strchr(ip, ':') != 0)) ? AF_INET6 : AF_INET;
 }
 
-#ifdef CONFIG_SOCKET_IPV6
-int create_socket(bool socket_in, int port)
+int create_socket(int family, bool socket_in, int port)
 {
-    struct sockaddr_in6 saddr = { 0 };
+    struct sockaddr_storage saddr = { 0 };
+    socklen_t saddr_len;
     int sock = -1;
     int err = 0;
 
-    sock = socket(PF_INET6, SOCK_DGRAM, IPPROTO_IPV6);
+    sock = socket(family, SOCK_DGRAM, 0);
     if (sock < 0) {
         ESP_LOGE(TAG, "Failed to create socket. Error %d", errno);
         return -1;
     }
-    
+
+    if (family == AF_INET6) {
+        int only = SOCKET_V6ONLY;
+        err = setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &only, sizeof(int));
+        if (err < 0) {
+            ESP_LOGW(TAG, "Failed to set IPV6_V6ONLY. Error %d", errno);
+        }
+        struct sockaddr_in6 *saddr6 = (struct sockaddr_in6 *)&saddr;
+        saddr6->sin6_family = AF_INET6;
+        saddr6->sin6_port = htons(port);
+        saddr_len = sizeof(struct sockaddr_in6);
+    } else {
+        struct sockaddr_in *saddr4 = (struct sockaddr_in *)&saddr;
+        saddr4->sin_family = AF_INET;
+        saddr4->sin_port = htons(port);
+        saddr4->sin_addr.s_addr = htonl(INADDR_ANY);
+        saddr_len = sizeof(struct sockaddr_in);
+    }
+
     if (socket_in) {
         // Bind the socket to any address
-        saddr.sin6_family = AF_INET6;
-        saddr.sin6_port = htons(port);
-        bzero(&saddr.sin6_addr.un, sizeof(saddr.sin6_addr.un));
-        err = bind(sock, (struct sockaddr *)&saddr, sizeof(struct sockaddr_in6));
+        err = bind(sock, (struct sockaddr *)&saddr, saddr_len);
         if (err < 0) {
             ESP_LOGE(TAG, "Failed to bind socket. Error %d", errno);
             goto err;
         }
     }
-    ESP_LOGI(TAG, "Socket set IPV6-only");
+    ESP_LOGI(TAG, "Socket set %s", (family == AF_INET) ? "IPV4" : SOCKET_V6ONLY ? "IPV6-only" : "IPV6 dual stack");
 
     // All set, socket is configured for sending and receiving
     return sock;
@@ -192,257 +174,225 @@ err:
     return -1;
 }
 
-int join_multi_group(int sock, uint8_t dif, uint8_t mttl, uint8_t loopback, const char* multiaddr)
+int set_multicast_options(int sock, int family, uint8_t dif, uint8_t mttl, uint8_t loopback)
 {
-    struct in6_addr if_inaddr = { 0 };
-    struct ip6_addr if_ipaddr = { 0 };
-    struct ip6_mreq v6imreq = { 0 };
+    uint8_t ttl = mttl;
+    uint8_t loopback_val = loopback;
     int err = 0;
-    
-    // Selct the interface to use as multicast source for this socket.
-    if (dif) {
-        bzero(&if_inaddr.un, sizeof(if_inaddr.un));
-    } else {
-        // Read interface adapter link-local address and use it
-        // to bind the multicast IF to this socket.
-        //
-        // (Note the interface may have other non-LL IPV6 addresses as well,
-        // but it doesn't matter in this context as the address is only
-        // used to identify the interface.)
-        err = tcpip_adapter_get_ip6_linklocal(TCPIP_ADAPTER_IF_STA, &if_ipaddr);
-        inet6_addr_from_ip6addr(&if_inaddr, &if_ipaddr);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to get IPV6 LL address. Error 0x%x", err);
-            goto err;
+
+    if (family == AF_INET6) {
+        struct in6_addr if_inaddr = { 0 };
+        struct ip6_addr if_ipaddr = { 0 };
+
+        // Select the interface to use as multicast source for this socket.
+        if (!dif) {
+            err = tcpip_adapter_get_ip6_linklocal(TCPIP_ADAPTER_IF_STA, &if_ipaddr);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to get IPV6 LL address. Error 0x%x", err);
+                return -1;
+            }
+            inet6_addr_from_ip6addr(&if_inaddr, &if_ipaddr);
+        }
+        err = setsockopt(sock, IPPROTO_IPV6, IPV6_MULTICAST_IF, &if_inaddr, sizeof(struct in6_addr));
+        if (err < 0) {
+            ESP_LOGE(TAG, "Failed to set IPV6_MULTICAST_IF. Error %d", errno);
+            return err;
         }
+        // Assign multicast TTL (set separately from normal interface TTL)
+        err = setsockopt(sock, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &ttl, sizeof(uint8_t));
+        if (err < 0) {
+            ESP_LOGE(TAG, "Failed to set IPV6_MULTICAST_HOPS. Error %d", errno);
+            return err;
+        }
+        if (loopback) {
+            // select whether multicast traffic should be received by this device, too
+            // (if setsockopt() is not called, the default is no)
+            err = setsockopt(sock, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &loopback_val, sizeof(uint8_t));
+            if (err < 0) {
+                ESP_LOGE(TAG, "Failed to set IPV6_MULTICAST_LOOP. Error %d", errno);
+                return err;
+            }
+        }
+        return 0;
     }
 
-    // Assign the multicast source interface, via its IP
-    err = setsockopt(sock, IPPROTO_IPV6, IPV6_MULTICAST_IF, &if_inaddr,
-                     sizeof(struct in6_addr));
+    struct in_addr iaddr = { 0 };
+    if (!dif) {
+        tcpip_adapter_ip_info_t ip_info = { 0 };
+        err = tcpip_adapter_get_ip_info(TCPIP_ADAPTER_IF_STA, &ip_info);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to get IP address info. Error 0x%x", err);
+            return -1;
+        }
+        inet_addr_from_ip4addr(&iaddr, &ip_info.ip);
+    }
+    err = setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, &iaddr, sizeof(struct in_addr));
     if (err < 0) {
-        ESP_LOGE(TAG, "Failed to set IPV6_MULTICAST_IF. Error %d", errno);
-        goto err;
+        ESP_LOGE(TAG, "Failed to set IP_MULTICAST_IF. Error %d", errno);
+        return err;
     }
-
-    // Assign multicast TTL (set separately from normal interface TTL)
-    uint8_t ttl = mttl;
-    setsockopt(sock, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &ttl, sizeof(uint8_t));
+    err = setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(uint8_t));
     if (err < 0) {
-        ESP_LOGE(TAG, "Failed to set IPV6_MULTICAST_HOPS. Error %d", errno);
-        goto err;
+        ESP_LOGE(TAG, "Failed to set IP_MULTICAST_TTL. Error %d", errno);
+        return err;
     }
-
     if (loopback) {
-        // select whether multicast traffic should be received by this device, too
-        // (if setsockopt() is not called, the default is no)
-        uint8_t loopback_val = loopback;
-        err = setsockopt(sock, IPPROTO_IPV6, IPV6_MULTICAST_LOOP,
-                        &loopback_val, sizeof(uint8_t));
+        err = setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loopback_val, sizeof(uint8_t));
         if (err < 0) {
-            ESP_LOGE(TAG, "Failed to set IPV6_MULTICAST_LOOP. Error %d", errno);
-            goto err;
+            ESP_LOGE(TAG, "Failed to set IP_MULTICAST_LOOP. Error %d", errno);
+            return err;
         }
     }
+    return 0;
+}
 
-    // Configure source interface
+/* IPv4 address of the interface carrying the multicast traffic, any when dif is set */
+int get_if_addr(uint8_t dif, struct in_addr* if_addr)
+{
     if (dif) {
-        v6imreq.ipv6mr_interface = if_inaddr;//IPADDR_ANY;
-    } else {
-        inet6_addr_from_ip6addr(&v6imreq.ipv6mr_interface, &if_ipaddr);
-    }
-
-    // Configure multicast address to listen to
-    err = inet6_aton(multiaddr, &v6imreq.ipv6mr_multiaddr);
-    if (err != 1) {
-        ESP_LOGE(TAG, "Configured IPV6 multicast address '%s' is invalid.", multiaddr);
-        goto err;
-    }
-    ESP_LOGI(TAG, "Configured IPV6 Multicast address %s", inet6_ntoa(v6imreq.ipv6mr_multiaddr));
-    ip6_addr_t multi_addr;
-    inet6_addr_to_ip6addr(&multi_addr, &v6imreq.ipv6mr_multiaddr);
-    if (!ip6_addr_ismulticast(&multi_addr)) {
-        ESP_LOGW(TAG, "Configured IPV6 multicast address '%s' is not a valid multicast address. This will probably not work.", multiaddr);
-    }
-
-    err = setsockopt(sock, IPPROTO_IPV6, IPV6_ADD_MEMBERSHIP,
-                     &v6imreq, sizeof(struct ip6_mreq));
-    if (err < 0) {
-        ESP_LOGE(TAG, "Failed to set IPV6_ADD_MEMBERSHIP. Error %d", errno);
-        goto err;
-    }
-
-#if CONFIG_SOCKET_IPV4_V6
-    // Add the common IPV4 config options
-    err = socket_add_ipv4_multicast_group(sock, dif, multiaddr, false);
-    if (err < 0) {
-        goto err;
+        if_addr->s_addr = IPADDR_ANY;
+        return 0;
     }
 
-    int only = 0;
-#else
-    int only = 1; /* IPV6-only socket */
-    ESP_LOGI(TAG, "Socket set IPV6-only");
-#endif
-    err = setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &only, sizeof(int));
-    if (err < 0) {
-        ESP_LOGE(TAG, "Failed to set IPV6_V6ONLY. Error %d", errno);
-        goto err;
+    tcpip_adapter_ip_info_t ip_info = { 0 };
+    int err = tcpip_adapter_get_ip_info(TCPIP_ADAPTER_IF_STA, &ip_info);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to get IP address info. Error 0x%x", err);
+        return -1;
     }
-
-    // All set, socket is configured for sending and receiving
+    inet_addr_from_ip4addr(if_addr, &ip_info.ip);
     return 0;
-
-err:
-    close(sock);
-    return -1;
 }
 
-int leave_multi_group(int sock, uint8_t dif, const char* multiaddr)
+/* Add or drop the membership of a group of either family. An IPv4 group can
+   be joined from a dual stack IPv6 socket too. */
+int set_membership(int sock, uint8_t dif, const char* multiaddr, bool join)
 {
-    struct in6_addr if_inaddr = { 0 };
-    struct ip6_addr if_ipaddr = { 0 };
-    struct ip6_mreq v6imreq = { 0 };
     int err = 0;
 
-    // Configure source interface
-    if (dif) {
-        bzero(&if_inaddr.un, sizeof(if_inaddr.un));
-        v6imreq.ipv6mr_interface = if_inaddr;//IPADDR_ANY;
-    } else {
-        err = tcpip_adapter_get_ip6_linklocal(TCPIP_ADAPTER_IF_STA, &if_ipaddr);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to get IPV6 LL address. Error 0x%x", err);
-            goto err;
+    if (socket_family(multiaddr) == AF_INET6) {
+        struct ip6_addr if_ipaddr = { 0 };
+        struct ip6_mreq v6imreq = { 0 };
+
+        // Configure source interface
+        if (!dif) {
+            err = tcpip_adapter_get_ip6_linklocal(TCPIP_ADAPTER_IF_STA, &if_ipaddr);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to get IPV6 LL address. Error 0x%x", err);
+                return -1;
+            }
+            inet6_addr_from_ip6addr(&v6imreq.ipv6mr_interface, &if_ipaddr);
+        }
+        // Configure multicast address to listen to
+        if (inet6_aton(multiaddr, &v6imreq.ipv6mr_multiaddr) != 1) {
+            ESP_LOGE(TAG, "Configured IPV6 multicast address '%s' is invalid.", multiaddr);
+            return -1;
         }
-        inet6_addr_from_ip6addr(&v6imreq.ipv6mr_interface, &if_ipaddr);
+        ESP_LOGI(TAG, "Configured IPV6 Multicast address %s", inet6_ntoa(v6imreq.ipv6mr_multiaddr));
+        err = setsockopt(sock, IPPROTO_IPV6, join ? IPV6_ADD_MEMBERSHIP : IPV6_DROP_MEMBERSHIP,
+                         &v6imreq, sizeof(struct ip6_mreq));
+        if (err < 0) {
+            ESP_LOGE(TAG, "Failed to set %s. Error %d", join ? "IPV6_ADD_MEMBERSHIP" : "IPV6_DROP_MEMBERSHIP", errno);
+            return err;
+        }
+        return 0;
     }
 
-    // Configure multicast address to listen to
-    err = inet6_aton(multiaddr, &v6imreq.ipv6mr_multiaddr);
-    if (err != 1) {
-        ESP_LOGE(TAG, "Configured IPV6 multicast address '%s' is invalid.", multiaddr);
-        goto err;
-    }
-    ESP_LOGI(TAG, "Configured IPV6 Multicast address %s", inet6_ntoa(v6imreq.ipv6mr_multiaddr));
-    ip6_addr_t multi_addr;
-    inet6_addr_to_ip6addr(&multi_addr, &v6imreq.ipv6mr_multiaddr);
-    if (!ip6_addr_ismulticast(&multi_addr)) {
-        ESP_LOGW(TAG, "Configured IPV6 multicast address '%s' is not a valid multicast address. This will probably not work.", multiaddr);
+    struct ip_mreq imreq = { 0 };
+    // Configure source interface
+    if (get_if_addr(dif, &imreq.imr_interface) < 0) {
+        return -1;
     }
-
-    err = setsockopt(sock, IPPROTO_IPV6, IPV6_DROP_MEMBERSHIP,
-                     &v6imreq, sizeof(struct ip6_mreq));
-    if (err < 0) {
-        ESP_LOGE(TAG, "Failed to set IPV6_DROP_MEMBERSHIP. Error %d", errno);
-        goto err;
+    // Configure multicast address to listen to
+    if (inet_aton(multiaddr, &imreq.imr_multiaddr.s_addr) != 1) {
+        ESP_LOGE(TAG, "Configured IPV4 multicast address '%s' is invalid.", multiaddr);
+        return -1;
     }
-
-#if CONFIG_SOCKET_IPV4_V6
-    // Add the common IPV4 config options
-    err = socket_drop_ipv4_multicast_group(sock, dif, multiaddr);
+    ESP_LOGI(TAG, "Configured IPV4 Multicast address %s", inet_ntoa(imreq.imr_multiaddr.s_addr));
+    err = setsockopt(sock, IPPROTO_IP, join ? IP_ADD_MEMBERSHIP : IP_DROP_MEMBERSHIP,
+                     &imreq, sizeof(struct ip_mreq));
     if (err < 0) {
-        goto err;
+        ESP_LOGE(TAG, "Failed to set %s. Error %d", join ? "IP_ADD_MEMBERSHIP" : "IP_DROP_MEMBERSHIP", errno);
+        return err;
     }
-#endif
-
-    // All set, socket is configured for sending and receiving
     return 0;
-err:
-    return err;
 }
 
-#else
-
-int create_socket(bool socket_in, int port)
+/* Source-specific membership, -ENOPROTOOPT when the stack only has any-source joins
+   (lwIP implements IGMPv2 and MLDv1). */
+int set_source_membership(int sock, uint8_t dif, const char* multiaddr, const char* source, bool join)
 {
-    struct sockaddr_in saddr = { 0 };
-    int sock = -1;
-    int err = 0;
-
-    sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_IP);
-    if (sock < 0) {
-        ESP_LOGE(TAG, "Failed to create socket. Error %d", errno);
-        return -1;
-    }
-    if (socket_in) {
-        // Bind the socket to any address
-        saddr.sin_family = PF_INET;
-        saddr.sin_port = htons(port);
-        saddr.sin_addr.s_addr = htonl(INADDR_ANY);
-        err = bind(sock, (struct sockaddr *)&saddr, sizeof(struct sockaddr_in));
+#ifdef IP_ADD_SOURCE_MEMBERSHIP
+    if ((socket_family(multiaddr) == AF_INET) && (socket_family(source) == AF_INET)) {
+        struct ip_mreq_source imreq = { 0 };
+        if (get_if_addr(dif, &imreq.imr_interface) < 0) {
+            return -1;
+        }
+        if ((inet_aton(multiaddr, &imreq.imr_multiaddr) != 1) || (inet_aton(source, &imreq.imr_sourceaddr) != 1)) {
+            ESP_LOGE(TAG, "Configured IPV4 source membership '%s' from '%s' is invalid.", multiaddr, source);
+            return -1;
+        }
+        int err = setsockopt(sock, IPPROTO_IP, join ? IP_ADD_SOURCE_MEMBERSHIP : IP_DROP_SOURCE_MEMBERSHIP,
+                             &imreq, sizeof(struct ip_mreq_source));
         if (err < 0) {
-            ESP_LOGE(TAG, "Failed to bind socket. Error %d", errno);
-            goto err;
+            ESP_LOGW(TAG, "Failed to set %s. Error %d", join ? "IP_ADD_SOURCE_MEMBERSHIP" : "IP_DROP_SOURCE_MEMBERSHIP", errno);
+            return err;
         }
+        return 0;
     }
-
-    // All set, socket is configured for sending and receiving
-    return sock;
-
-err:
-    close(sock);
-    return -1;
+#endif
+    return -ENOPROTOOPT;
 }
 
-int join_multi_group(int sock, uint8_t dif, uint8_t mttl, uint8_t loopback, const char* multiaddr)
+int socket_init(socket_handle_t* handle, struct socket_config_t const* config, struct socket_multicast_t const* mcast_cfg)
 {
-    int err = 0;
+    int ret = 0;
 
-    // Assign multicast TTL (set separately from normal interface TTL)
-    uint8_t ttl = mttl;
-    setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(uint8_t));
-    if (err < 0) {
-        ESP_LOGE(TAG, "Failed to set IP_MULTICAST_TTL. Error %d", errno);
-        goto err;
+    if ((handle == 0) || (config == 0))
+    {
+        ESP_LOGE(TAG, "%s: null handle or config pointer", __func__);
+        return -EINVAL;
     }
 
-    if (loopback) {
-        // select whether multicast traffic should be received by this device, too
-        // (if setsockopt() is not called, the default is no)
-        uint8_t loopback_val = loopback;
-        err = setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP,
-                        &loopback_val, sizeof(uint8_t));
-        if (err < 0) {
-            ESP_LOGE(TAG, "Failed to set IP_MULTICAST_LOOP. Error %d", errno);
-            goto err;
-        }
+    *handle = calloc(1, sizeof(struct socket_t));
+    if (*handle == 0)
+    {
+        ESP_LOGE(TAG, "%s: could not allocate memory", __func__);
+        return -ENOMEM;
     }
 
-    // this is also a listening socket, so add it to the multicast
-    // group for listening...
-    err = socket_add_ipv4_multicast_group(sock, dif, multiaddr, true);
-    if (err < 0) {
-        goto err;
+    (*handle)->config = *config;
+    (*handle)->mcast_cfg = *mcast_cfg;
+    (*handle)->lock = xSemaphoreCreateMutex();
+    if ((*handle)->lock == 0)
+    {
+        ESP_LOGE(TAG, "%s: could not allocate memory", __func__);
+        socket_release(handle);
+        return -ENOMEM;
     }
 
-    // All set, socket is configured for sending and receiving
-    return 0;
-
-err:
-    close(sock);
-    return -1;
-}
-
-int leave_multi_group(int sock, uint8_t dif, const char* multiaddr)
-{
-    if (socket_is_multi_address(multiaddr) == 0) {
-        return socket_drop_ipv4_multicast_group(sock, dif, multiaddr);
-    } else {
-        ESP_LOGE(TAG, "%s: error multicast ip(%s) format, should start with 239.xxx", __func__, multiaddr);
+    ret = socket_open(*handle);
+#ifdef CONFIG_SOCKET_NETSIM
+    if (ret == 0)
+    {
+        ret = socket_netsim_open(*handle);
     }
-    return -1;
-}
-
 #endif
+    if (ret != 0)
+    {
+        socket_release(handle);
+    }
 
-int socket_init(socket_handle_t* handle, struct socket_config_t const* config, struct socket_multicast_t const* mcast_cfg)
+    return ret;
+}
+
+int socket_attach(socket_handle_t* handle, struct socket_config_t const* config, socket_handle_t owner)
 {
     int ret = 0;
 
-    if ((handle == 0) || (config == 0))
+    if ((handle == 0) || (config == 0) || (owner == 0) || (owner->fd == 0) || (owner->owner != 0))
     {
-        ESP_LOGE(TAG, "%s: null handle or config pointer", __func__);
+        ESP_LOGE(TAG, "%s: invalid handle, config or owner", __func__);
         return -EINVAL;
     }
 
@@ -454,9 +404,24 @@ int socket_init(socket_handle_t* handle, struct socket_config_t const* config, s
     }
 
     (*handle)->config = *config;
-    (*handle)->mcast_cfg = *mcast_cfg;
-
-    ret = socket_open(*handle);
+    (*handle)->config.direction = SOCKET_OUT;
+    (*handle)->mcast_cfg = owner->mcast_cfg;
+    (*handle)->owner = owner;
+    (*handle)->fd = owner->fd;
+    (*handle)->family = owner->family;
+    (*handle)->lock = owner->lock;
+    xSemaphoreTake(owner->lock, portMAX_DELAY);
+    (*handle)->attach_nu = ++owner->attach_nu;
+    xSemaphoreGive(owner->lock);
+
+    ret = socket_open_peers(*handle);
+#ifdef CONFIG_SOCKET_NETSIM
+    if (ret == 0)
+    {
+        /** writers sharing the owner fd still get an impaired link each */
+        ret = socket_netsim_open(*handle);
+    }
+#endif
     if (ret != 0)
     {
         socket_release(handle);
@@ -478,6 +443,12 @@ int socket_release(socket_handle_t* handle)
     if (*handle != 0)
     {
         ret = socket_close(*handle);
+        if (((*handle)->lock != 0) && ((*handle)->owner == 0))
+        {
+            vSemaphoreDelete((*handle)->lock);
+        }
+        netsim_release(&(*handle)->netsim);
+        free((*handle)->netsim_frame);
         free(*handle);
         *handle = 0;
     }
@@ -485,19 +456,32 @@ int socket_release(socket_handle_t* handle)
     return ret;
 }
 
+int socket_is_multicast(char const* ip)
+{
+    return (ip != 0) && (socket_is_multi_address(ip) == 0);
+}
+
 int socket_is_multi_address(char const* ip)
 {
-#ifdef CONFIG_SOCKET_IPV6
-    char* multi_start = "ff00::ef";
-#else
-    char* multi_start = "239";
-#endif
-    return strncmp(ip, multi_start, strlen(multi_start));
+    struct in_addr addr4;
+
+    if (socket_family(ip) == AF_INET6)
+    {
+        return strncasecmp(ip, "ff", 2);
+    }
+
+    if ((inet_aton(ip, &addr4) == 1) && IP_MULTICAST(ntohl(addr4.s_addr)))
+    {
+        return 0;
+    }
+
+    return -1;
 }
 
 int socket_open(socket_handle_t handle)
 {
     int ret = 0;
+    unsigned int index;
 
     if (handle == 0)
     {
@@ -517,7 +501,8 @@ int socket_open(socket_handle_t handle)
         }
     }
 
-    handle->fd = create_socket(handle->config.direction == SOCKET_IN, handle->config.port);
+    handle->family = socket_family(handle->config.ip_address);
+    handle->fd = create_socket(handle->family, handle->config.direction == SOCKET_IN, handle->config.port);
     if (handle->fd < 0)
     {
         ESP_LOGE(TAG, "%s: unable to create socket", __func__);
@@ -527,12 +512,7 @@ int socket_open(socket_handle_t handle)
     }
 
     if (socket_is_multi_address(handle->config.ip_address) == 0) {
-        //save the multi_address into config.
-        strncpy(handle->mcast_cfg.multicast_address, handle->config.ip_address, strlen(handle->config.ip_address));
-        // handle->mcast_cfg.default_if = 1;
-        // handle->mcast_cfg.loopback = 0;
-        // handle->mcast_cfg.ttl = 1;
-        ret = join_multi_group(handle->fd, handle->mcast_cfg.default_if, handle->mcast_cfg.ttl, handle->mcast_cfg.loopback, handle->mcast_cfg.multicast_address);
+        ret = socket_join_group(handle, handle->config.ip_address);
         if (ret < 0) {
             ESP_LOGE(TAG, "%s: unable to join group %s", __func__, handle->config.ip_address);
             socket_close(handle);
@@ -540,12 +520,49 @@ int socket_open(socket_handle_t handle)
         }
     }
 
-    ESP_LOGI(TAG, "%s with port: %d, fd=%d", __func__, handle->config.port, handle->fd);
-
-    return 0;
-}
+    for (index = 0; index < handle->config.nb_groups; ++index)
+    {
+        socket_join_source_group(handle, handle->config.groups[index].group, handle->config.groups[index].source);
+    }
 
-int socket_close(socket_handle_t handle)
+    ret = socket_open_peers(handle);
+    if (ret != 0)
+    {
+        socket_close(handle);
+        return ret;
+    }
+
+    ESP_LOGI(TAG, "%s with port: %d, fd=%d", __func__, handle->config.port, handle->fd);
+
+    return 0;
+}
+
+int socket_open_peers(socket_handle_t handle)
+{
+    int ret = 0;
+    unsigned int index;
+
+    if (handle->config.direction != SOCKET_OUT)
+    {
+        return 0;
+    }
+
+    handle->nb_peers = 0;
+    ret = socket_add_destination(handle, handle->config.ip_address, handle->config.port);
+    if (ret != 0)
+    {
+        return ret;
+    }
+    for (index = 0; index < handle->config.nb_destinations; ++index)
+    {
+        socket_add_destination(handle, handle->config.destinations[index].ip_address,
+                               handle->config.destinations[index].port);
+    }
+
+    return 0;
+}
+
+int socket_close(socket_handle_t handle)
 {
     int ret = 0;
 
@@ -557,6 +574,17 @@ int socket_close(socket_handle_t handle)
 
     ESP_LOGI(TAG, "%s: closing socket with port %d", __func__, handle->config.port);
 
+    if (handle->owner != 0)
+    {
+        /** the fd belongs to the owner, it is closed with it */
+        handle->fd = 0;
+        return 0;
+    }
+
+    /** memberships are dropped with the fd */
+    handle->nb_members = 0;
+    handle->nb_soft_sources = 0;
+
     if (handle->fd != 0)
     {
         shutdown(handle->fd, 0);
@@ -574,46 +602,525 @@ int socket_close(socket_handle_t handle)
 
 int socket_join_group(socket_handle_t handle, const char* multiaddr)
 {
-    if (socket_is_multi_address(multiaddr) != 0 && strlen(multiaddr) < SOCKET_IP_ADDRESS_SIZE) {
-        ESP_LOGE(TAG, "%s: error multi cast ip(%s) format", __func__, multiaddr);
-        return -1;
+    return socket_join_source_group(handle, multiaddr, 0);
+}
+
+int socket_leave_group(socket_handle_t handle, const char* multiaddr)
+{
+    return socket_leave_source_group(handle, multiaddr, 0);
+}
+
+int socket_find_member(socket_handle_t handle, const char* multiaddr, const char* source)
+{
+    unsigned int index;
+
+    for (index = 0; index < handle->nb_members; ++index)
+    {
+        if ((strncmp(handle->members[index].info.group.group, multiaddr, SOCKET_IP_ADDRESS_SIZE) == 0)
+            && (strncmp(handle->members[index].info.group.source, source, SOCKET_IP_ADDRESS_SIZE) == 0))
+        {
+            return index;
+        }
     }
 
-    int ret = join_multi_group(handle->fd, handle->mcast_cfg.default_if, handle->mcast_cfg.ttl, handle->mcast_cfg.loopback, multiaddr);
-    if (ret >= 0) {
-        //save the new multicast group.
-        strncpy(handle->mcast_cfg.multicast_address, multiaddr, strlen(multiaddr));
+    return -1;
+}
+
+int socket_group_joined(socket_handle_t handle, const char* multiaddr)
+{
+    unsigned int index;
+
+    /** any-source membership of the stack, shared by the software filtered members of a group */
+    for (index = 0; index < handle->nb_members; ++index)
+    {
+        if (!handle->members[index].info.stack_filter
+            && (strncmp(handle->members[index].info.group.group, multiaddr, SOCKET_IP_ADDRESS_SIZE) == 0))
+        {
+            return 1;
+        }
     }
-    return ret;
+
+    return 0;
 }
-int socket_leave_group(socket_handle_t handle, const char* multiaddr)
+
+int socket_join_source_group(socket_handle_t handle, const char* multiaddr, const char* source)
 {
-    if (socket_is_multi_address(multiaddr) != 0 && strlen(multiaddr) < SOCKET_IP_ADDRESS_SIZE) {
-        ESP_LOGE(TAG, "%s: error multi cast ip(%s) format", __func__, multiaddr);
-        return -1;
+    struct socket_peer_t resolved = { 0 };
+    struct socket_member_t* member;
+    int ret = 0;
+
+    if (source == 0)
+    {
+        source = "";
+    }
+
+    if ((handle == 0) || (multiaddr == 0) || (strlen(multiaddr) >= SOCKET_IP_ADDRESS_SIZE)
+        || (strlen(source) >= SOCKET_IP_ADDRESS_SIZE) || (socket_is_multi_address(multiaddr) != 0))
+    {
+        ESP_LOGE(TAG, "%s: error multi cast ip(%s) format", __func__, (multiaddr != 0) ? multiaddr : "");
+        return -EINVAL;
     }
 
-    if (strncmp(handle->mcast_cfg.multicast_address, multiaddr, strlen(multiaddr)) != 0) {
-        ESP_LOGE(TAG, "%s: this multicast ip(%s) isn't in group(%s)", __func__, multiaddr, handle->mcast_cfg.multicast_address);
+    /** memberships belong to the socket owning the fd */
+    if (handle->owner != 0)
+    {
+        handle = handle->owner;
+    }
+
+    if (handle->fd == 0)
+    {
+        ESP_LOGE(TAG, "%s: socket is not open", __func__);
+        return -ENODEV;
+    }
+
+    if (source[0] != '\0')
+    {
+        ret = socket_resolve(&resolved, handle->family, source, 0);
+        if (ret != 0)
+        {
+            return ret;
+        }
+    }
+
+    xSemaphoreTake(handle->lock, portMAX_DELAY);
+    ret = socket_find_member(handle, multiaddr, source);
+    if (ret >= 0)
+    {
+        ++handle->members[ret].info.refs;
+        xSemaphoreGive(handle->lock);
         return 0;
     }
 
-    int ret = leave_multi_group(handle->fd, handle->mcast_cfg.default_if, multiaddr);
-    if (ret >= 0) {
-        //save the new multicast group.
-        // handle->mcast_cfg.multicast_address = multiaddr;
-        strncpy(handle->mcast_cfg.multicast_address, "", SOCKET_IP_ADDRESS_SIZE-1);
+    if (handle->nb_members == SOCKET_GROUPS_MAX_NB)
+    {
+        ESP_LOGE(TAG, "%s: no room left for %s", __func__, multiaddr);
+        xSemaphoreGive(handle->lock);
+        return -ENOSPC;
+    }
+
+    member = &handle->members[handle->nb_members];
+    memset(member, 0, sizeof(struct socket_member_t));
+    strncpy(member->info.group.group, multiaddr, SOCKET_IP_ADDRESS_SIZE-1);
+    strncpy(member->info.group.source, source, SOCKET_IP_ADDRESS_SIZE-1);
+
+    // multicast options follow the socket family, membership follows the group family.
+    ret = set_multicast_options(handle->fd, handle->family, handle->mcast_cfg.default_if, handle->mcast_cfg.ttl, handle->mcast_cfg.loopback);
+    if ((ret == 0) && (source[0] != '\0'))
+    {
+        member->info.stack_filter = (set_source_membership(handle->fd, handle->mcast_cfg.default_if, multiaddr, source, true) == 0);
     }
+    if ((ret == 0) && !member->info.stack_filter && !socket_group_joined(handle, multiaddr))
+    {
+        ret = set_membership(handle->fd, handle->mcast_cfg.default_if, multiaddr, true);
+    }
+
+    if (ret == 0)
+    {
+        member->info.refs = 1;
+        if ((source[0] != '\0') && !member->info.stack_filter)
+        {
+            member->source = resolved.addr;
+            ++handle->nb_soft_sources;
+        }
+        ++handle->nb_members;
+        ESP_LOGI(TAG, "%s: joined %s from %s%s", __func__, multiaddr, (source[0] != '\0') ? source : "any source",
+                 ((source[0] != '\0') && !member->info.stack_filter) ? ", filtered by socket_read" : "");
+    }
+    xSemaphoreGive(handle->lock);
+
+    return (ret < 0) ? ret : 0;
+}
+
+int socket_leave_source_group(socket_handle_t handle, const char* multiaddr, const char* source)
+{
+    struct socket_member_t member;
+    int index;
+    int ret = 0;
+
+    if (source == 0)
+    {
+        source = "";
+    }
+
+    if ((handle == 0) || (multiaddr == 0))
+    {
+        ESP_LOGE(TAG, "%s: invalid argument", __func__);
+        return -EINVAL;
+    }
+
+    if (handle->owner != 0)
+    {
+        handle = handle->owner;
+    }
+
+    xSemaphoreTake(handle->lock, portMAX_DELAY);
+    index = socket_find_member(handle, multiaddr, source);
+    if (index < 0)
+    {
+        ESP_LOGE(TAG, "%s: this multicast ip(%s) isn't in the group table", __func__, multiaddr);
+        xSemaphoreGive(handle->lock);
+        return -ENOENT;
+    }
+
+    if (--handle->members[index].info.refs > 0)
+    {
+        xSemaphoreGive(handle->lock);
+        return 0;
+    }
+
+    member = handle->members[index];
+    handle->members[index] = handle->members[--handle->nb_members];
+    if ((source[0] != '\0') && !member.info.stack_filter)
+    {
+        --handle->nb_soft_sources;
+    }
+
+    if (member.info.stack_filter)
+    {
+        ret = set_source_membership(handle->fd, handle->mcast_cfg.default_if, multiaddr, source, false);
+    }
+    else if (!socket_group_joined(handle, multiaddr))
+    {
+        ret = set_membership(handle->fd, handle->mcast_cfg.default_if, multiaddr, false);
+    }
+    xSemaphoreGive(handle->lock);
+
+    return (ret < 0) ? ret : 0;
+}
+
+unsigned int socket_get_memberships(socket_handle_t handle, struct socket_membership_t* memberships, unsigned int max_nb)
+{
+    unsigned int index;
+
+    if ((handle == 0) || (memberships == 0))
+    {
+        return 0;
+    }
+
+    if (handle->owner != 0)
+    {
+        handle = handle->owner;
+    }
+
+    xSemaphoreTake(handle->lock, portMAX_DELAY);
+    for (index = 0; (index < handle->nb_members) && (index < max_nb); ++index)
+    {
+        memberships[index] = handle->members[index].info;
+    }
+    xSemaphoreGive(handle->lock);
+
+    return index;
+}
+
+void socket_get_stats(socket_handle_t handle, struct socket_stats_t* stats)
+{
+    if ((handle == 0) || (stats == 0))
+    {
+        return;
+    }
+
+    if (handle->owner != 0)
+    {
+        handle = handle->owner;
+    }
+
+    *stats = handle->stats;
+    stats->nb_groups = handle->nb_members;
+    netsim_get_stats(handle->netsim, &stats->netsim);
+}
+
+int socket_addr_equal(struct sockaddr const* a, struct sockaddr const* b)
+{
+    if (a->sa_family != b->sa_family)
+    {
+        return 0;
+    }
+
+    if (a->sa_family == AF_INET6)
+    {
+        return memcmp(&((struct sockaddr_in6 const*)a)->sin6_addr, &((struct sockaddr_in6 const*)b)->sin6_addr,
+                      sizeof(struct in6_addr)) == 0;
+    }
+
+    return ((struct sockaddr_in const*)a)->sin_addr.s_addr == ((struct sockaddr_in const*)b)->sin_addr.s_addr;
+}
+
+uint16_t socket_addr_port(struct sockaddr const* addr)
+{
+    return (addr->sa_family == AF_INET6) ? ((struct sockaddr_in6 const*)addr)->sin6_port : ((struct sockaddr_in const*)addr)->sin_port;
+}
+
+char const* socket_addr_name(struct sockaddr_storage const* addr, char* name, size_t size)
+{
+    name[0] = '\0';
+    if (addr->ss_family == AF_INET6) {
+        inet6_ntoa_r(((struct sockaddr_in6 const*)addr)->sin6_addr, name, size-1);
+    } else if (addr->ss_family == AF_INET) {
+        inet_ntoa_r(((struct sockaddr_in const*)addr)->sin_addr.s_addr, name, size-1);
+    }
+    return name;
+}
+
+int socket_get_address(socket_handle_t handle, const char* ip_address, uint16_t port, struct socket_address_t* addr)
+{
+    struct socket_peer_t peer;
+    int ret = 0;
+
+    if ((handle == 0) || (ip_address == 0) || (addr == 0))
+    {
+        ESP_LOGE(TAG, "%s: invalid argument", __func__);
+        return -EINVAL;
+    }
+
+    /** same layout as recvfrom gives, IPv4 hosts are mapped on dual stack sockets */
+    ret = socket_resolve(&peer, handle->family, ip_address, port);
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    memset(addr, 0, sizeof(struct socket_address_t));
+    addr->len = (peer.addrlen < sizeof(addr->data)) ? peer.addrlen : sizeof(addr->data);
+    memcpy(addr->data, &peer.addr, addr->len);
+
+    return 0;
+}
+
+int socket_address_match(struct socket_address_t const* expected, struct socket_address_t const* from)
+{
+    struct sockaddr const* const a = (struct sockaddr const*)expected->data;
+    struct sockaddr const* const b = (struct sockaddr const*)from->data;
+
+    if ((expected->len == 0) || (from->len == 0))
+    {
+        return 0;
+    }
+
+    return socket_addr_equal(a, b) && ((socket_addr_port(a) == 0) || (socket_addr_port(a) == socket_addr_port(b)));
+}
+
+char const* socket_address_name(struct socket_address_t const* addr, char* name, size_t size)
+{
+    struct sockaddr_storage raddr = { 0 };
+
+    memcpy(&raddr, addr->data, (addr->len < sizeof(raddr)) ? addr->len : sizeof(raddr));
+    return socket_addr_name(&raddr, name, size);
+}
+
+int socket_address_get_ip(struct socket_address_t const* addr, uint8_t ip[16], uint16_t* port)
+{
+    struct sockaddr_storage raddr = { 0 };
+
+    if ((addr == 0) || (ip == 0) || (port == 0))
+    {
+        return -EINVAL;
+    }
+
+    memset(ip, 0, 16);
+    memcpy(&raddr, addr->data, (addr->len < sizeof(raddr)) ? addr->len : sizeof(raddr));
+    *port = ntohs(socket_addr_port((struct sockaddr const*)&raddr));
+    if (raddr.ss_family == AF_INET6)
+    {
+        memcpy(ip, &((struct sockaddr_in6 const*)&raddr)->sin6_addr, 16);
+        return 6;
+    }
+    if (raddr.ss_family == AF_INET)
+    {
+        memcpy(ip, &((struct sockaddr_in const*)&raddr)->sin_addr, 4);
+        return 4;
+    }
+
+    return -EAFNOSUPPORT;
+}
+
+int socket_source_allowed(socket_handle_t handle, struct sockaddr_storage const* raddr)
+{
+    unsigned int index;
+    int allowed = 0;
+
+    /** the group a datagram was sent to is unknown here, any-source members let every sender through */
+    xSemaphoreTake(handle->lock, portMAX_DELAY);
+    for (index = 0; (index < handle->nb_members) && !allowed; ++index)
+    {
+        allowed = (handle->members[index].info.group.source[0] == '\0')
+            || (!handle->members[index].info.stack_filter && socket_addr_equal((struct sockaddr const*)&handle->members[index].source,
+                                                                       (struct sockaddr const*)raddr));
+    }
+    xSemaphoreGive(handle->lock);
+
+    return allowed;
+}
+
+int socket_resolve(struct socket_peer_t* peer, int family, const char* ip_address, uint16_t port)
+{
+    struct addrinfo hints = {
+        .ai_flags = AI_PASSIVE,
+        .ai_socktype = SOCK_DGRAM,
+        .ai_family = AF_UNSPEC,
+    };
+    struct addrinfo *res;
+
+    int err = getaddrinfo(ip_address, NULL, &hints, &res);
+    if ((err != 0) || (res == 0))
+    {
+        ESP_LOGE(TAG, "%s: getaddrinfo() failed for %s, error: %d", __func__, ip_address, err);
+        return -EINVAL;
+    }
+
+    memset(peer, 0, sizeof(struct socket_peer_t));
+    if ((res->ai_family == AF_INET) && (family == AF_INET6))
+    {
+        /** IPv4 destination of a dual stack socket, as an IPv4-mapped address */
+        struct sockaddr_in6* addr6 = (struct sockaddr_in6 *)&peer->addr;
+        addr6->sin6_family = AF_INET6;
+        addr6->sin6_addr.s6_addr[10] = 0xff;
+        addr6->sin6_addr.s6_addr[11] = 0xff;
+        memcpy(&addr6->sin6_addr.s6_addr[12], &((struct sockaddr_in *)res->ai_addr)->sin_addr, 4);
+        peer->addrlen = sizeof(struct sockaddr_in6);
+    }
+    else if (res->ai_family == family)
+    {
+        memcpy(&peer->addr, res->ai_addr, res->ai_addrlen);
+        peer->addrlen = res->ai_addrlen;
+    }
+    freeaddrinfo(res);
+
+    if (peer->addrlen == 0)
+    {
+        ESP_LOGE(TAG, "%s: %s can't be reached from an IPv4 socket", __func__, ip_address);
+        return -EAFNOSUPPORT;
+    }
+
+    if (family == AF_INET6)
+    {
+        ((struct sockaddr_in6 *)&peer->addr)->sin6_port = htons(port);
+    }
+    else
+    {
+        ((struct sockaddr_in *)&peer->addr)->sin_port = htons(port);
+    }
+    strncpy(peer->dest.ip_address, ip_address, SOCKET_IP_ADDRESS_SIZE-1);
+    peer->dest.port = port;
+
+    return 0;
+}
+
+int socket_find_peer(socket_handle_t handle, const char* ip_address, uint16_t port)
+{
+    unsigned int index;
+
+    for (index = 0; index < handle->nb_peers; ++index)
+    {
+        if ((handle->peers[index].dest.port == port)
+            && (strncmp(handle->peers[index].dest.ip_address, ip_address, SOCKET_IP_ADDRESS_SIZE) == 0))
+        {
+            return index;
+        }
+    }
+
+    return -1;
+}
+
+int socket_add_destination(socket_handle_t handle, const char* ip_address, uint16_t port)
+{
+    struct socket_peer_t peer;
+    int ret = 0;
+
+    if ((handle == 0) || (ip_address == 0) || (strlen(ip_address) >= SOCKET_IP_ADDRESS_SIZE))
+    {
+        ESP_LOGE(TAG, "%s: invalid argument", __func__);
+        return -EINVAL;
+    }
+
+    if (handle->config.direction != SOCKET_OUT)
+    {
+        ESP_LOGE(TAG, "%s: not an output socket", __func__);
+        return -EINVAL;
+    }
+
+    /** resolve outside of the lock, writers keep sending meanwhile */
+    ret = socket_resolve(&peer, handle->family, ip_address, port);
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    xSemaphoreTake(handle->lock, portMAX_DELAY);
+    if (socket_find_peer(handle, ip_address, port) >= 0)
+    {
+        ret = 0;
+    }
+    else if (handle->nb_peers == SOCKET_DESTINATIONS_MAX_NB + 1)
+    {
+        ESP_LOGE(TAG, "%s: no room left for %s:%d", __func__, ip_address, port);
+        ret = -ENOSPC;
+    }
+    else
+    {
+        handle->peers[handle->nb_peers++] = peer;
+        ESP_LOGI(TAG, "%s: sending to %s:%d", __func__, ip_address, port);
+    }
+    xSemaphoreGive(handle->lock);
+
     return ret;
 }
 
+int socket_remove_destination(socket_handle_t handle, const char* ip_address, uint16_t port)
+{
+    int index;
+
+    if ((handle == 0) || (ip_address == 0))
+    {
+        ESP_LOGE(TAG, "%s: invalid argument", __func__);
+        return -EINVAL;
+    }
+
+    xSemaphoreTake(handle->lock, portMAX_DELAY);
+    index = socket_find_peer(handle, ip_address, port);
+    if (index >= 0)
+    {
+        handle->peers[index] = handle->peers[--handle->nb_peers];
+        ESP_LOGI(TAG, "%s: stopped sending to %s:%d", __func__, ip_address, port);
+    }
+    xSemaphoreGive(handle->lock);
+
+    return (index >= 0) ? 0 : -ENOENT;
+}
+
+int socket_set_timeout(socket_handle_t handle, int timeout_ms)
+{
+    struct timeval tv = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_usec = (timeout_ms % 1000) * 1000,
+    };
+
+    if ((handle == 0) || (handle->fd == 0) || (timeout_ms < 0))
+    {
+        ESP_LOGE(TAG, "%s: invalid argument", __func__);
+        return -EINVAL;
+    }
+
+    if (setsockopt(handle->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0)
+    {
+        ESP_LOGE(TAG, "%s: failed to set SO_RCVTIMEO. Error %d", __func__, errno);
+        return -errno;
+    }
+
+    return 0;
+}
+
 int socket_read(socket_handle_t handle, char* buffer, size_t size)
+{
+    return socket_read_from(handle, buffer, size, 0);
+}
+
+int socket_read_from(socket_handle_t handle, char* buffer, size_t size, struct socket_address_t* from)
 {
     int ret = 0;
 
-    struct sockaddr_in6 raddr; // Large enough for both IPv4 or IPv6
+    struct sockaddr_storage raddr; // Large enough for both IPv4 or IPv6
     socklen_t socklen = sizeof(raddr);
-    char raddr_name[SOCKET_IP_ADDRESS_SIZE] = { 0 };
+    char raddr_name[SOCKET_IP_ADDRESS_SIZE];
 
     ESP_LOGD(TAG, "%s invoked, fd=%d", __func__, handle->fd);
 
@@ -631,43 +1138,70 @@ int socket_read(socket_handle_t handle, char* buffer, size_t size)
         return -ENODEV;
     }
 
-// again:
+again:
+#ifdef CONFIG_SOCKET_NETSIM
+    if (handle->netsim != 0)
+    {
+        ret = socket_netsim_read(handle, buffer, size, from);
+        if (ret != 0)
+        {
+            return ret;
+        }
+    }
+#endif
+    socklen = sizeof(raddr);
     ret = recvfrom(handle->fd, buffer, size, 0, (struct sockaddr *)&raddr, &socklen);
     if (ret < 0)
     {
-        if (errno != EINTR)
+        if ((errno != EINTR) && (errno != EAGAIN) && (errno != EWOULDBLOCK))
         {
             ESP_LOGE(TAG, "%s: recvfrom error %d %s", __func__, errno, strerror(errno));
         }
         return ret;
     }
 
-    // Get the sender's address as a string
+    // the sender's address is only formatted when debug logs are built in
+    ESP_LOGD(TAG, "received %d bytes from %s", ret, socket_addr_name(&raddr, raddr_name, sizeof(raddr_name)));
 
-#ifdef CONFIG_SOCKET_IPV6
-    if (raddr.sin6_family == PF_INET6) {
-        inet6_ntoa_r(raddr.sin6_addr, raddr_name, sizeof(raddr_name)-1);
+    if ((handle->nb_soft_sources > 0) && !socket_source_allowed(handle, &raddr))
+    {
+        ESP_LOGD(TAG, "%s: packet received from wrong source %s", __func__, socket_addr_name(&raddr, raddr_name, sizeof(raddr_name)));
+        ++handle->stats.source_rejected;
+        goto again;
     }
-#else
-    if (raddr.sin6_family == PF_INET) {
-        inet_ntoa_r(((struct sockaddr_in *)&raddr)->sin_addr.s_addr,
-                    raddr_name, sizeof(raddr_name)-1);
+
+#ifdef CONFIG_SOCKET_NETSIM
+    if (handle->netsim != 0)
+    {
+        /** the sender travels with the datagram, it comes out of socket_netsim_read */
+        struct socket_address_t sender;
+        sender.len = (socklen < sizeof(sender.data)) ? socklen : sizeof(sender.data);
+        memcpy(sender.data, &raddr, sender.len);
+        netsim_push(handle->netsim, buffer, ret, &sender, esp_timer_get_time());
+        goto again;
     }
 #endif
-    ESP_LOGD(TAG, "received %d bytes from %s:", ret, raddr_name);
 
-    // if (strncmp(handle->config.ip_address, raddr_name, SOCKET_IP_ADDRESS_SIZE))
-    // {
-    //     ESP_LOGD(TAG, "%s: packet received from wrong ip", __func__);
-    //     goto again;
-    // }
+    /** monotonic, taken as soon as the datagram is out of the stack */
+    handle->rx_time_us = esp_timer_get_time();
+
+    if (from != 0)
+    {
+        from->len = (socklen < sizeof(from->data)) ? socklen : sizeof(from->data);
+        memcpy(from->data, &raddr, from->len);
+    }
 
     return ret;
 }
 
+int64_t socket_get_rx_time(socket_handle_t handle)
+{
+    return (handle != 0) ? handle->rx_time_us : 0;
+}
+
 int socket_write(socket_handle_t handle, char const* buffer, size_t size)
 {
-    int ret = 0;
+    int ret;
 
     ESP_LOGD(TAG, "%s invoked", __func__);
 
@@ -682,67 +1216,185 @@ int socket_write(socket_handle_t handle, char const* buffer, size_t size)
         ESP_LOGE(TAG, "%s: socket is not open", __func__);
         return -ENODEV;
     }
-#if 1
-    struct addrinfo hints = {
-        .ai_flags = AI_PASSIVE,
-        .ai_socktype = SOCK_DGRAM,
-    };
-    struct addrinfo *res;
 
-#ifdef CONFIG_SOCKET_IPV6 // Send an IPv6 multicast packet
-    hints.ai_family = AF_INET6;
-    hints.ai_protocol = 0;
-#else // Send an IPv4 multicast packet
-    hints.ai_family = AF_INET; // For an IPv4 socket
+    xSemaphoreTake(handle->lock, portMAX_DELAY);
+#ifdef CONFIG_SOCKET_NETSIM
+    if (handle->netsim_frame != 0)
+    {
+        ret = socket_netsim_write(handle, buffer, size);
+    }
+    else
 #endif
-    int err = getaddrinfo(handle->config.ip_address,
-                            NULL,
-                            &hints,
-                            &res);
-    if (err < 0) {
-        ESP_LOGE(TAG, "getaddrinfo() failed for IP destination address. error: %d", err);
-        return err;
+    {
+        ret = socket_send_peers(handle, buffer, size);
     }
+    xSemaphoreGive(handle->lock);
 
-    char addrbuf[SOCKET_IP_ADDRESS_SIZE] = { 0 };
-#ifdef CONFIG_SOCKET_IPV6
-    struct sockaddr_in6 *s6addr = (struct sockaddr_in6 *)res->ai_addr;
-    s6addr->sin6_port = htons(handle->config.port);
-    inet6_ntoa_r(s6addr->sin6_addr, addrbuf, sizeof(addrbuf)-1);
-    ESP_LOGD(TAG, "Sending to IPV6 multicast address %s port %d...",  addrbuf, s6addr->sin6_port);
-#else // Send an IPv4 multicast packet
-    ((struct sockaddr_in *)res->ai_addr)->sin_port = htons(handle->config.port);
-    inet_ntoa_r(((struct sockaddr_in *)res->ai_addr)->sin_addr, addrbuf, sizeof(addrbuf)-1);
-    ESP_LOGD(TAG, "Sending to IPV4 multicast address %s:%d...",  addrbuf, ((struct sockaddr_in *)res->ai_addr)->sin_port);
-#endif
+    return ret;
+}
 
-    ret = sendto(handle->fd, buffer, size, 0, res->ai_addr, res->ai_addrlen);
-    freeaddrinfo(res);
-    if (ret < 0) {
-        if (errno != EINTR)
+int socket_send_peers(socket_handle_t handle, char const* buffer, size_t size)
+{
+    /** lock is held */
+    int ret = -ENOTCONN;
+    int sent;
+    unsigned int index;
+
+    /** the same prebuilt frame goes to every destination, addresses were resolved when added */
+    for (index = 0; index < handle->nb_peers; ++index)
+    {
+        sent = sendto(handle->fd, buffer, size, 0, (struct sockaddr *)&handle->peers[index].addr,
+                      handle->peers[index].addrlen);
+        if (sent < 0)
         {
-            ESP_LOGD(TAG, "IPV4 or IPV6 sendto failed. errno: %d -> %s", errno, strerror(errno));
+            if (errno != EINTR)
+            {
+                ESP_LOGD(TAG, "sendto %s:%d failed. errno: %d -> %s", handle->peers[index].dest.ip_address,
+                         handle->peers[index].dest.port, errno, strerror(errno));
+            }
+            if (ret < 0)
+            {
+                ret = sent;
+            }
+        }
+        else
+        {
+            ret = sent;
         }
     }
 
-#else //1
-    struct sockaddr_in si_other;
-    socklen_t slen = sizeof(si_other);
-    memset(&si_other, 0, sizeof(si_other));
-    si_other.sin_family        = AF_INET;
-    si_other.sin_port          = htons(handle->config.port);
-    si_other.sin_addr.s_addr   = inet_addr(handle->config.ip_address);
+    return ret;
+}
 
-    ret = sendto(handle->fd, buffer, size, 0, (struct sockaddr*)&si_other, slen);
-    if (ret < 0)
+int socket_write_to(socket_handle_t handle, char const* buffer, size_t size, struct socket_address_t const* to)
+{
+    int ret;
+
+    if ((handle == 0) || (buffer == 0) || (to == 0) || (to->len == 0))
+    {
+        ESP_LOGE(TAG, "%s: one parameter is a null pointer", __func__);
+        return -EINVAL;
+    }
+
+    if (handle->fd == 0)
     {
-        if (errno != EINTR)
+        ESP_LOGE(TAG, "%s: socket is not open", __func__);
+        return -ENODEV;
+    }
+
+    xSemaphoreTake(handle->lock, portMAX_DELAY);
+    ret = sendto(handle->fd, buffer, size, 0, (struct sockaddr const*)to->data, to->len);
+    xSemaphoreGive(handle->lock);
+    if ((ret < 0) && (errno != EINTR))
+    {
+        ESP_LOGD(TAG, "%s: sendto failed. errno: %d -> %s", __func__, errno, strerror(errno));
+    }
+
+    return ret;
+}
+
+#ifdef CONFIG_SOCKET_NETSIM
+int socket_netsim_open(socket_handle_t handle)
+{
+    struct netsim_config_t config = {
+        .seed = CONFIG_SOCKET_NETSIM_SEED,
+        .loss_ppm = CONFIG_SOCKET_NETSIM_LOSS_PPM,
+        .ge_p_ppm = CONFIG_SOCKET_NETSIM_BURST_ENTER_PPM,
+        .ge_r_ppm = CONFIG_SOCKET_NETSIM_BURST_LEAVE_PPM,
+        .ge_bad_loss_ppm = CONFIG_SOCKET_NETSIM_BURST_LOSS_PPM,
+        .duplicate_ppm = CONFIG_SOCKET_NETSIM_DUPLICATE_PPM,
+        .delay_us = CONFIG_SOCKET_NETSIM_DELAY_US,
+        .jitter_us = CONFIG_SOCKET_NETSIM_JITTER_US,
+        .reorder_ppm = CONFIG_SOCKET_NETSIM_REORDER_PPM,
+        .reorder_us = CONFIG_SOCKET_NETSIM_REORDER_US,
+        .rate_bps = CONFIG_SOCKET_NETSIM_RATE_BPS,
+        .depth = CONFIG_SOCKET_NETSIM_DEPTH,
+        .max_size = SOCKET_NETSIM_MAX_SIZE,
+        .meta_size = sizeof(struct socket_address_t),
+    };
+    int ret;
+
+    /** each socket draws its own sequence: input and output of a board stay independent */
+    config.seed += handle->config.port + handle->config.direction + handle->attach_nu;
+    ret = netsim_init(&handle->netsim, &config);
+    if ((ret == 0) && (handle->config.direction == SOCKET_OUT))
+    {
+        handle->netsim_frame = malloc(SOCKET_NETSIM_MAX_SIZE);
+        ret = (handle->netsim_frame != 0) ? 0 : -ENOMEM;
+    }
+    if (ret != 0)
+    {
+        ESP_LOGE(TAG, "%s: could not allocate the impairment queue", __func__);
+        return ret;
+    }
+
+    ESP_LOGW(TAG, "%s: %s:%d goes through a simulated link, seed %u", __func__, handle->config.ip_address,
+             handle->config.port, config.seed);
+    return 0;
+}
+
+int socket_netsim_read(socket_handle_t handle, char* buffer, size_t size, struct socket_address_t* from)
+{
+    struct socket_address_t sender;
+    struct pollfd pfd = { .fd = handle->fd, .events = POLLIN };
+    int64_t now;
+    int64_t due;
+    int ret;
+
+    while (1)
+    {
+        now = esp_timer_get_time();
+        ret = netsim_pop(handle->netsim, buffer, size, &sender, now);
+        if (ret != 0)
         {
-            ESP_LOGE(TAG, "%s: sendto error %d %s", __func__, errno, strerror(errno));
+            break;
+        }
+
+        /** nothing due: a datagram arriving before the next one is due still has to be taken in */
+        due = netsim_next_due(handle->netsim);
+        if (due < 0)
+        {
+            return 0;
+        }
+        ret = poll(&pfd, 1, (int)((due - now + 999) / 1000));
+        if (ret != 0)
+        {
+            return (ret > 0) ? 0 : ret;
         }
-        return ret;
     }
-#endif
+
+    if (ret < 0)
+    {
+        ESP_LOGD(TAG, "%s: datagram larger than the buffer, dropped", __func__);
+        errno = -ret;
+        return -1;
+    }
+
+    /** the application sees the datagram arrive when the simulated link delivers it */
+    handle->rx_time_us = now;
+    if (from != 0)
+    {
+        *from = sender;
+    }
+
     return ret;
 }
 
+int socket_netsim_write(socket_handle_t handle, char const* buffer, size_t size)
+{
+    /** lock is held */
+    int64_t now = esp_timer_get_time();
+    int ret;
+
+    netsim_push(handle->netsim, buffer, size, 0, now);
+
+    /** no timer: delayed datagrams leave on a later write, the stream cadence bounds the error */
+    while ((ret = netsim_pop(handle->netsim, handle->netsim_frame, SOCKET_NETSIM_MAX_SIZE, 0, now)) > 0)
+    {
+        socket_send_peers(handle, handle->netsim_frame, ret);
+    }
+
+    /** the caller handed its frame over, a loss on the link is no error for it */
+    return size;
+}
+#endif
@@ -0,0 +1,533 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "socket_engine.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "lwip/sockets.h"
+#include "packet.h"
+
+static const char *TAG = "VBAN_ENGINE";
+
+/**
+ * Addresses an engine socket listens on, per family
+ */
+#define SOCKET_ENGINE_ANY_ADDRESS   "0.0.0.0"
+#define SOCKET_ENGINE_ANY_ADDRESS6  "::"
+
+struct socket_engine_frame_t
+{
+    size_t                  size;
+    struct socket_address_t from;
+    int64_t                 rx_time_us;
+    char                    data[VBAN_PROTOCOL_MAX_SIZE];
+};
+
+struct socket_engine_reader_t
+{
+    int                             used;
+    char                            streamname[VBAN_STREAM_NAME_SIZE];
+    char                            group[SOCKET_IP_ADDRESS_SIZE];  /* left on detach, empty if none was joined */
+    struct socket_engine_frame_t*   pending;    /* only allocated once several readers share the engine */
+    unsigned int                    head;
+    unsigned int                    count;
+    int64_t                         rx_time_us; /* arrival of the last frame handed to this reader */
+};
+
+struct socket_engine_t
+{
+    uint16_t                        port;
+    int                             family;
+    int                             refs;
+    socket_handle_t                 socket;
+    SemaphoreHandle_t               rx_lock;
+    struct socket_engine_reader_t   readers[SOCKET_ENGINE_READERS_MAX_NB];
+    struct socket_engine_stats_t    stats;
+    directory_handle_t              directory;
+    struct socket_engine_t*         next;
+};
+
+static struct socket_engine_t* engines = 0;
+static portMUX_TYPE engines_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static struct socket_engine_t* socket_engine_find(uint16_t port);
+static int socket_engine_family(char const* ip_address);
+static void socket_engine_free(struct socket_engine_t* engine);
+static int socket_engine_stash(socket_engine_handle_t handle, char const* buffer, size_t size, struct socket_address_t const* from);
+
+struct socket_engine_t* socket_engine_find(uint16_t port)
+{
+    struct socket_engine_t* engine;
+
+    for (engine = engines; engine != 0; engine = engine->next)
+    {
+        if (engine->port == port)
+        {
+            return engine;
+        }
+    }
+
+    return 0;
+}
+
+int socket_engine_family(char const* ip_address)
+{
+#ifdef CONFIG_SOCKET_DUAL_STACK
+    /** an IPv6 socket carries both families */
+    (void)ip_address;
+    return AF_INET6;
+#else
+    return socket_family(ip_address);
+#endif
+}
+
+void socket_engine_free(struct socket_engine_t* engine)
+{
+    unsigned int index;
+
+    socket_release(&engine->socket);
+    if (engine->rx_lock != 0)
+    {
+        vSemaphoreDelete(engine->rx_lock);
+    }
+    for (index = 0; index < SOCKET_ENGINE_READERS_MAX_NB; ++index)
+    {
+        free(engine->readers[index].pending);
+    }
+    free(engine);
+}
+
+int socket_engine_acquire(socket_engine_handle_t* handle, uint16_t port, char const* ip_address,
+                          struct socket_multicast_t const* mcast_cfg)
+{
+    struct socket_engine_t* engine;
+    int family = socket_engine_family(ip_address);
+    struct socket_config_t config = {
+        .direction = SOCKET_IN,
+        .ip_address = SOCKET_ENGINE_ANY_ADDRESS,
+        .port = port,
+    };
+    int ret = 0;
+
+    if ((handle == 0) || (mcast_cfg == 0))
+    {
+        ESP_LOGE(TAG, "%s: null handle or config pointer", __func__);
+        return -EINVAL;
+    }
+    if (family == AF_INET6)
+    {
+        strcpy(config.ip_address, SOCKET_ENGINE_ANY_ADDRESS6);
+    }
+
+    portENTER_CRITICAL(&engines_mux);
+    engine = socket_engine_find(port);
+    if ((engine != 0) && (engine->family == family))
+    {
+        ++engine->refs;
+    }
+    portEXIT_CRITICAL(&engines_mux);
+
+    if (engine != 0)
+    {
+        if (engine->family != family)
+        {
+            /** its socket can neither join nor send to this address */
+            ESP_LOGE(TAG, "%s: port %d is shared in the other address family, %s can't use it", __func__, port,
+                     (ip_address != 0) ? ip_address : "");
+            return -EAFNOSUPPORT;
+        }
+        *handle = engine;
+        return 0;
+    }
+
+    engine = calloc(1, sizeof(struct socket_engine_t));
+    if (engine == 0)
+    {
+        ESP_LOGE(TAG, "%s: could not allocate memory", __func__);
+        return -ENOMEM;
+    }
+    engine->port = port;
+    engine->family = family;
+    engine->refs = 1;
+    engine->rx_lock = xSemaphoreCreateMutex();
+    if (engine->rx_lock == 0)
+    {
+        ESP_LOGE(TAG, "%s: could not allocate memory", __func__);
+        socket_engine_free(engine);
+        return -ENOMEM;
+    }
+
+    ret = socket_init(&engine->socket, &config, mcast_cfg);
+    if (ret == 0)
+    {
+        ret = socket_set_timeout(engine->socket, SOCKET_ENGINE_READ_TIMEOUT_MS);
+    }
+
+    portENTER_CRITICAL(&engines_mux);
+    *handle = socket_engine_find(port);
+    if ((*handle != 0) && ((*handle)->family != family))
+    {
+        /** lost the race with a first user of the other family */
+        *handle = 0;
+        ret = -EAFNOSUPPORT;
+    }
+    else if (*handle != 0)
+    {
+        /** lost the race with another first user, its bind won */
+        ++(*handle)->refs;
+    }
+    else if (ret == 0)
+    {
+        engine->next = engines;
+        engines = engine;
+        *handle = engine;
+        engine = 0;
+    }
+    portEXIT_CRITICAL(&engines_mux);
+
+    if (engine != 0)
+    {
+        socket_engine_free(engine);
+    }
+
+    if (*handle == 0)
+    {
+        ESP_LOGE(TAG, "%s: could not open socket on port %d", __func__, port);
+        return (ret != 0) ? ret : -ENODEV;
+    }
+
+    ESP_LOGI(TAG, "%s: port %d", __func__, port);
+    return 0;
+}
+
+int socket_engine_release(socket_engine_handle_t* handle)
+{
+    struct socket_engine_t** link;
+    struct socket_engine_t* engine = 0;
+
+    if (handle == 0)
+    {
+        ESP_LOGE(TAG, "%s: null handle pointer", __func__);
+        return -EINVAL;
+    }
+
+    if (*handle == 0)
+    {
+        return 0;
+    }
+
+    portENTER_CRITICAL(&engines_mux);
+    if (--(*handle)->refs == 0)
+    {
+        for (link = &engines; *link != 0; link = &(*link)->next)
+        {
+            if (*link == *handle)
+            {
+                *link = (*handle)->next;
+                break;
+            }
+        }
+        engine = *handle;
+    }
+    portEXIT_CRITICAL(&engines_mux);
+
+    if (engine != 0)
+    {
+        ESP_LOGI(TAG, "%s: port %d", __func__, engine->port);
+        socket_engine_free(engine);
+    }
+    *handle = 0;
+
+    return 0;
+}
+
+socket_handle_t socket_engine_get_socket(socket_engine_handle_t handle)
+{
+    return (handle != 0) ? handle->socket : 0;
+}
+
+int socket_engine_attach_reader(socket_engine_handle_t handle, char const* streamname, char const* ip_address)
+{
+    int reader = -ENOSPC;
+    int nb_readers = 0;
+    unsigned int index;
+
+    if ((handle == 0) || (streamname == 0))
+    {
+        ESP_LOGE(TAG, "%s: invalid argument", __func__);
+        return -EINVAL;
+    }
+
+    xSemaphoreTake(handle->rx_lock, portMAX_DELAY);
+    for (index = 0; index < SOCKET_ENGINE_READERS_MAX_NB; ++index)
+    {
+        if ((reader < 0) && !handle->readers[index].used)
+        {
+            reader = index;
+            handle->readers[index].used = 1;
+            handle->readers[index].head = 0;
+            handle->readers[index].count = 0;
+            strncpy(handle->readers[index].streamname, streamname, VBAN_STREAM_NAME_SIZE);
+        }
+        nb_readers += handle->readers[index].used;
+    }
+
+    /** frames only need to be set aside once a second reader shares the socket */
+    for (index = 0; (nb_readers > 1) && (index < SOCKET_ENGINE_READERS_MAX_NB); ++index)
+    {
+        if (handle->readers[index].used && (handle->readers[index].pending == 0))
+        {
+            handle->readers[index].pending = calloc(SOCKET_ENGINE_PENDING_NB, sizeof(struct socket_engine_frame_t));
+            if (handle->readers[index].pending == 0)
+            {
+                ESP_LOGW(TAG, "%s: no memory to hold frames of %.16s", __func__, handle->readers[index].streamname);
+            }
+        }
+    }
+    xSemaphoreGive(handle->rx_lock);
+
+    if (reader < 0)
+    {
+        ESP_LOGE(TAG, "%s: no reader slot left for %.16s", __func__, streamname);
+        return reader;
+    }
+
+    if (socket_is_multicast(ip_address))
+    {
+        if (socket_join_group(handle->socket, ip_address) == 0)
+        {
+            /** joins are counted by the socket, readers of the same group share its membership */
+            strncpy(handle->readers[reader].group, ip_address, SOCKET_IP_ADDRESS_SIZE-1);
+        }
+        else
+        {
+            ESP_LOGE(TAG, "%s: could not join %s, %.16s gets no multicast frames", __func__, ip_address, streamname);
+        }
+    }
+
+    return reader;
+}
+
+void socket_engine_detach_reader(socket_engine_handle_t handle, int reader)
+{
+    if ((handle == 0) || (reader < 0) || (reader >= SOCKET_ENGINE_READERS_MAX_NB))
+    {
+        return;
+    }
+
+    if (handle->readers[reader].group[0] != '\0')
+    {
+        socket_leave_group(handle->socket, handle->readers[reader].group);
+    }
+
+    xSemaphoreTake(handle->rx_lock, portMAX_DELAY);
+    handle->readers[reader].used = 0;
+    handle->readers[reader].group[0] = '\0';
+    handle->readers[reader].count = 0;
+    free(handle->readers[reader].pending);
+    handle->readers[reader].pending = 0;
+    xSemaphoreGive(handle->rx_lock);
+}
+
+int socket_engine_stash(socket_engine_handle_t handle, char const* buffer, size_t size, struct socket_address_t const* from)
+{
+    struct VBanHeader const* const hdr = PACKET_HEADER_PTR(buffer);
+    struct socket_engine_reader_t* reader;
+    struct socket_engine_frame_t* frame;
+    unsigned int index;
+
+    for (index = 0; index < SOCKET_ENGINE_READERS_MAX_NB; ++index)
+    {
+        reader = &handle->readers[index];
+        if (!reader->used || strncmp(reader->streamname, hdr->streamname, VBAN_STREAM_NAME_SIZE))
+        {
+            continue;
+        }
+
+        if (reader->pending == 0)
+        {
+            ++handle->stats.pending_drop;
+            return 0;
+        }
+
+        if (reader->count == SOCKET_ENGINE_PENDING_NB)
+        {
+            reader->head = (reader->head + 1) % SOCKET_ENGINE_PENDING_NB;
+            --reader->count;
+            ++handle->stats.pending_drop;
+        }
+        frame = &reader->pending[(reader->head + reader->count) % SOCKET_ENGINE_PENDING_NB];
+        memcpy(frame->data, buffer, size);
+        frame->size = size;
+        frame->from = *from;
+        frame->rx_time_us = socket_get_rx_time(handle->socket);
+        ++reader->count;
+        return 0;
+    }
+
+    ++handle->stats.unmatched;
+    return -ENOENT;
+}
+
+int socket_engine_read(socket_engine_handle_t handle, int reader, char* buffer, size_t size, struct socket_address_t* from)
+{
+    struct socket_engine_reader_t* self;
+    struct socket_engine_frame_t* frame;
+    struct socket_address_t sender;
+    int ret = 0;
+
+    if ((handle == 0) || (buffer == 0) || (reader < 0) || (reader >= SOCKET_ENGINE_READERS_MAX_NB)
+        || (size < VBAN_PROTOCOL_MAX_SIZE))
+    {
+        ESP_LOGE(TAG, "%s: invalid argument", __func__);
+        return -EINVAL;
+    }
+
+    if (xSemaphoreTake(handle->rx_lock, pdMS_TO_TICKS(SOCKET_ENGINE_READ_TIMEOUT_MS)) != pdTRUE)
+    {
+        return -EAGAIN;
+    }
+
+    self = &handle->readers[reader];
+    if (self->count > 0)
+    {
+        frame = &self->pending[self->head];
+        memcpy(buffer, frame->data, frame->size);
+        ret = frame->size;
+        self->rx_time_us = frame->rx_time_us;
+        if (from != 0)
+        {
+            *from = frame->from;
+        }
+        self->head = (self->head + 1) % SOCKET_ENGINE_PENDING_NB;
+        --self->count;
+        xSemaphoreGive(handle->rx_lock);
+        return ret;
+    }
+
+    /** receive in place, a frame of another reader is set aside and the lock handed over */
+    ret = socket_read_from(handle->socket, buffer, size, &sender);
+    if ((ret > 0) && (handle->directory != 0))
+    {
+        directory_update(handle->directory, buffer, ret, &sender);
+    }
+    if (ret < 0)
+    {
+        ret = ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? -EAGAIN : ret;
+    }
+    else if ((ret > VBAN_HEADER_SIZE) && (PACKET_HEADER_PTR(buffer)->vban == VBAN_HEADER_FOURC)
+             && strncmp(self->streamname, PACKET_HEADER_PTR(buffer)->streamname, VBAN_STREAM_NAME_SIZE))
+    {
+        socket_engine_stash(handle, buffer, ret, &sender);
+        ret = -EAGAIN;
+    }
+    else
+    {
+        self->rx_time_us = socket_get_rx_time(handle->socket);
+        if (from != 0)
+        {
+            *from = sender;
+        }
+    }
+    xSemaphoreGive(handle->rx_lock);
+
+    return ret;
+}
+
+int socket_engine_read_pending(socket_engine_handle_t handle, int reader, char* buffer, size_t size, struct socket_address_t* from)
+{
+    struct socket_engine_reader_t* self;
+    struct socket_engine_frame_t* frame;
+    int ret = -EAGAIN;
+
+    if ((handle == 0) || (buffer == 0) || (reader < 0) || (reader >= SOCKET_ENGINE_READERS_MAX_NB)
+        || (size < VBAN_PROTOCOL_MAX_SIZE))
+    {
+        ESP_LOGE(TAG, "%s: invalid argument", __func__);
+        return -EINVAL;
+    }
+
+    /** never waits: the socket is left to the readers of audio streams */
+    if (xSemaphoreTake(handle->rx_lock, 0) != pdTRUE)
+    {
+        return -EAGAIN;
+    }
+
+    self = &handle->readers[reader];
+    if (self->count > 0)
+    {
+        frame = &self->pending[self->head];
+        memcpy(buffer, frame->data, frame->size);
+        ret = frame->size;
+        self->rx_time_us = frame->rx_time_us;
+        if (from != 0)
+        {
+            *from = frame->from;
+        }
+        self->head = (self->head + 1) % SOCKET_ENGINE_PENDING_NB;
+        --self->count;
+    }
+    xSemaphoreGive(handle->rx_lock);
+
+    return ret;
+}
+
+int socket_engine_attach_writer(socket_engine_handle_t handle, struct socket_config_t const* config, socket_handle_t* socket)
+{
+    if ((handle == 0) || (config == 0) || (socket == 0))
+    {
+        ESP_LOGE(TAG, "%s: invalid argument", __func__);
+        return -EINVAL;
+    }
+
+    return socket_attach(socket, config, handle->socket);
+}
+
+void socket_engine_set_directory(socket_engine_handle_t handle, directory_handle_t directory)
+{
+    if (handle != 0)
+    {
+        handle->directory = directory;
+    }
+}
+
+int64_t socket_engine_get_rx_time(socket_engine_handle_t handle, int reader)
+{
+    if ((handle == 0) || (reader < 0) || (reader >= SOCKET_ENGINE_READERS_MAX_NB))
+    {
+        return 0;
+    }
+
+    return handle->readers[reader].rx_time_us;
+}
+
+void socket_engine_get_stats(socket_engine_handle_t handle, struct socket_engine_stats_t* stats)
+{
+    if ((handle == 0) || (stats == 0))
+    {
+        return;
+    }
+
+    *stats = handle->stats;
+}
@@ -0,0 +1,144 @@
+/*
+ * ESPRESSIF MIT License
+ *
+ * Copyright (c) 2020 INFOMEDIA
+ *
+ * Permission is hereby granted for use on all ESPRESSIF SYSTEMS products, in which case,
+ * it is free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "boot_profile.h"
+
+static const char *TAG = "BOOT_PROFILE";
+
+static const char *s_milestone_name[BOOT_MILESTONE_NB] = {
+    "app_main",
+    "nvs",
+    "codec",
+    "wifi",
+    "sntp",
+    "pipeline_run",
+    "first_packet",
+    "first_sample",
+};
+
+// reached again after a reconnection, the others only happen once per boot.
+static const bool s_milestone_recurs[BOOT_MILESTONE_NB] = {
+    [BOOT_WIFI] = true,
+    [BOOT_PIPELINE_RUN] = true,
+    [BOOT_FIRST_PACKET] = true,
+    [BOOT_FIRST_SAMPLE] = true,
+};
+
+// esp_timer counts from boot, 0 means not reached.
+static int64_t s_milestone_us[BOOT_MILESTONE_NB];
+static portMUX_TYPE s_profile_mux = portMUX_INITIALIZER_UNLOCKED;
+
+void boot_profile_mark(boot_milestone_t milestone)
+{
+    if (milestone < 0 || milestone >= BOOT_MILESTONE_NB) {
+        return;
+    }
+    // called per packet by the reader, the lock is only taken until it is marked.
+    if (s_milestone_us[milestone] != 0) {
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&s_profile_mux);
+    if (s_milestone_us[milestone] == 0) {
+        s_milestone_us[milestone] = now;
+    }
+    portEXIT_CRITICAL(&s_profile_mux);
+}
+
+void boot_profile_rearm(boot_milestone_t milestone)
+{
+    if (milestone < 0 || milestone >= BOOT_MILESTONE_NB) {
+        return;
+    }
+
+    portENTER_CRITICAL(&s_profile_mux);
+    for (int i = milestone; i < BOOT_MILESTONE_NB; i++) {
+        if (s_milestone_recurs[i]) {
+            s_milestone_us[i] = 0;
+        }
+    }
+    portEXIT_CRITICAL(&s_profile_mux);
+}
+
+void boot_profile_get(int64_t table[BOOT_MILESTONE_NB])
+{
+    portENTER_CRITICAL(&s_profile_mux);
+    memcpy(table, s_milestone_us, sizeof(s_milestone_us));
+    portEXIT_CRITICAL(&s_profile_mux);
+}
+
+int boot_profile_export(char *buffer, size_t size)
+{
+    int64_t table[BOOT_MILESTONE_NB];
+    int64_t previous = 0;
+    int len = 0;
+
+    if (buffer == NULL || size == 0) {
+        return 0;
+    }
+    buffer[0] = '\0';
+    boot_profile_get(table);
+
+    for (int i = 0; i < BOOT_MILESTONE_NB; i++) {
+        // phases run in parallel, a milestone may come before the previous one.
+        int64_t delta = (table[i] != 0 && previous != 0) ? table[i] - previous : 0;
+        int ret = snprintf(buffer + len, (len < (int)size) ? size - len : 0, "%s,%lld,%lld\n",
+                           s_milestone_name[i], (long long)table[i], (long long)delta);
+        if (ret < 0) {
+            break;
+        }
+        len += ret;
+        if (table[i] != 0) {
+            previous = table[i];
+        }
+    }
+
+    return len;
+}
+
+void boot_profile_dump(void)
+{
+    int64_t table[BOOT_MILESTONE_NB];
+    int64_t previous = 0;
+
+    boot_profile_get(table);
+    ESP_LOGI(TAG, "startup breakdown, ms from boot (+ms from the previous milestone):");
+    for (int i = 0; i < BOOT_MILESTONE_NB; i++) {
+        if (table[i] == 0) {
+            ESP_LOGI(TAG, "  %-12s      -", s_milestone_name[i]);
+            continue;
+        }
+        ESP_LOGI(TAG, "  %-12s %6d (%+d)", s_milestone_name[i], (int)(table[i] / 1000),
+                 previous ? (int)((table[i] - previous) / 1000) : 0);
+        previous = table[i];
+    }
+}
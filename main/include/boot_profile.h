@@ -0,0 +1,97 @@
+/*
+ * ESPRESSIF MIT License
+ *
+ * Copyright (c) 2020 INFOMEDIA
+ *
+ * Permission is hereby granted for use on all ESPRESSIF SYSTEMS products, in which case,
+ * it is free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _BOOT_PROFILE_H_
+#define _BOOT_PROFILE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Startup milestones, in the order they are expected
+ */
+typedef enum {
+    BOOT_APP_MAIN = 0,      /*!< app_main entry */
+    BOOT_NVS,               /*!< nvs_flash_init done */
+    BOOT_CODEC,             /*!< codec chip started */
+    BOOT_WIFI,              /*!< WiFi connected */
+    BOOT_SNTP,              /*!< clock set, SNTP started */
+    BOOT_PIPELINE_RUN,      /*!< playback pipeline running */
+    BOOT_FIRST_PACKET,      /*!< first audio packet accepted by the vban reader */
+    BOOT_FIRST_SAMPLE,      /*!< first sample handed to the I2S writer */
+    BOOT_MILESTONE_NB,
+} boot_milestone_t;
+
+/**
+ * @brief      Record a milestone, only its first time counts
+ *
+ *             Safe from any task, no allocation: a few words of a static table.
+ *
+ * @param      milestone  The milestone reached
+ */
+void boot_profile_mark(boot_milestone_t milestone);
+
+/**
+ * @brief      Forget a milestone and the ones after it, to time a reconnection
+ *
+ *             Only the milestones a reconnection reaches again are forgotten: wifi,
+ *             pipeline_run, first_packet and first_sample. The others are kept, the
+ *             next dump shows the phases of the restart against them.
+ *
+ * @param      milestone  The first milestone to forget, if it recurs
+ */
+void boot_profile_rearm(boot_milestone_t milestone);
+
+/**
+ * @brief      Copy the milestone table
+ *
+ * @param      table  Receives the time from boot of each milestone in us, 0 if not reached
+ */
+void boot_profile_get(int64_t table[BOOT_MILESTONE_NB]);
+
+/**
+ * @brief      Format the milestone table as "name,us_from_boot,us_from_previous" lines
+ *
+ * @param      buffer  The output text, always null terminated
+ * @param      size    The size of buffer
+ *
+ * @return     Length of the text, as snprintf
+ */
+int boot_profile_export(char *buffer, size_t size);
+
+/**
+ * @brief      Log the startup breakdown of this board
+ */
+void boot_profile_dump(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
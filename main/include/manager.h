@@ -66,6 +66,7 @@
 #include "vban.h"
 #include "packet.h"
 #include "vban_stream.h"
+#include "relay.h"
 
 #include "service.h"
 
@@ -0,0 +1,69 @@
+/*
+ * ESPRESSIF MIT License
+ *
+ * Copyright (c) 2020 INFOMEDIA
+ *
+ * Permission is hereby granted for use on all ESPRESSIF SYSTEMS products, in which case,
+ * it is free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _TASK_PROFILE_H_
+#define _TASK_PROFILE_H_
+
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if CONFIG_FREERTOS_UNICORE
+#define TASK_PROFILE_CORE(core)     (0)
+#else
+#define TASK_PROFILE_CORE(core)     (core)
+#endif
+
+/**
+ * Scheduling profile of each role, from menuconfig
+ */
+#define TASK_NET_CORE               TASK_PROFILE_CORE(CONFIG_TASK_NET_CORE)
+#define TASK_NET_PRIO               (CONFIG_TASK_NET_PRIO)
+#define TASK_NET_STACK              (CONFIG_TASK_NET_STACK)
+#define TASK_VBAN_CORE              TASK_PROFILE_CORE(CONFIG_TASK_VBAN_CORE)
+#define TASK_VBAN_PRIO              (CONFIG_TASK_VBAN_PRIO)
+#define TASK_VBAN_STACK             (CONFIG_TASK_VBAN_STACK)
+#define TASK_I2S_CORE               TASK_PROFILE_CORE(CONFIG_TASK_I2S_CORE)
+#define TASK_I2S_PRIO               (CONFIG_TASK_I2S_PRIO)
+#define TASK_I2S_STACK              (CONFIG_TASK_I2S_STACK)
+#define TASK_SESSION_CORE           TASK_PROFILE_CORE(CONFIG_TASK_SESSION_CORE)
+#define TASK_SESSION_PRIO           (CONFIG_TASK_SESSION_PRIO)
+#define TASK_SESSION_STACK          (CONFIG_TASK_SESSION_STACK)
+
+/**
+ * @brief      Log the core, priority, CPU load and free stack of every task
+ *
+ *             The load is the share of one core used since the previous call,
+ *             the first call counts from boot. Each IDLE task line is the free
+ *             time of its core.
+ */
+void task_profile_report(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
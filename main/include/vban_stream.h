@@ -29,6 +29,14 @@
 #include "audio_element.h"
 #include "audio_common.h"
 #include "packet.h"
+#include "pacer.h"
+#include "chmap.h"
+#include "directory.h"
+#include "command.h"
+#include "serial.h"
+#include "recorder.h"
+#include "latency.h"
+#include "task_profile.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -40,25 +48,118 @@ extern "C" {
 typedef struct {
     audio_stream_type_t     type;           /*!< Stream type */
     int                     buf_sz;         /*!< Audio Element Buffer size */
-    int                     out_rb_size;    /*!< Size of output ringbuffer */
+    int                     out_rb_size;    /*!< Size of output ringbuffer, upper bound of out_rb_ms for every format */
+    int                     out_rb_ms;      /*!< Reader ringbuffer depth in ms, resized on format change, 0 to fill it all */
+    int                     max_rates;      /*!< Highest sample rate the out_rb_ms ringbuffer is allocated for */
+    int                     max_channels;   /*!< Most channels the out_rb_ms ringbuffer is allocated for */
+    int                     max_bits;       /*!< Widest sample the out_rb_ms ringbuffer is allocated for */
     int                     task_stack;     /*!< Task stack size */
     int                     task_core;      /*!< Task running in core (0 or 1) */
     int                     task_prio;      /*!< Task priority (based on freeRTOS priority) */
+    int                     fec_group_size; /*!< Data frames per XOR parity frame, 0 to disable FEC */
+    int                     pace_depth;     /*!< Paced send queue depth in frames, 0 to send frames as they come */
+    int                     pace_burst_us;  /*!< Pacing credit saved while idle in us, 0 for one frame */
+    int                     latency_ms;     /*!< End-to-end latency target, 0 to use buf_sz and out_rb_size as they are */
+    bool                    shared_socket;  /*!< Share one socket per port with the other vban elements */
+    int                     source_timeout_ms;  /*!< Reader silence before following another sender of the stream, 0 to accept every sender */
 } vban_stream_cfg_t;
 
+/**
+ * @brief   Buffer sizes derived from a latency target for a given stream format
+ *
+ * The target is split in VBAN_STREAM_LATENCY_FRAMES frames: one for packetization on
+ * the writer, VBAN_STREAM_JITTER_FRAMES in the reader ringbuffer, and the rest in I2S DMA.
+ */
+typedef struct {
+    int                     latency_ms;         /*!< Requested latency target */
+    int                     samples_per_frame;  /*!< Samples per VBAN frame */
+    int                     frame_bytes;        /*!< Payload size of one frame */
+    int                     frame_us;           /*!< Audio duration of one frame */
+    int                     jitter_frames;      /*!< Frames the reader buffers to absorb network jitter */
+    int                     buf_sz;             /*!< Element buffer size */
+    int                     out_rb_size;        /*!< Reader output ringbuffer size */
+    int                     i2s_dma_buf_count;  /*!< I2S DMA buffer count */
+    int                     i2s_dma_buf_len;    /*!< I2S DMA buffer length in samples */
+    int                     budget_us;          /*!< Resulting end-to-end latency budget */
+} vban_stream_latency_plan_t;
+
+/**
+ * @brief   VBan Stream statistics
+ */
+typedef struct {
+    uint32_t                fec_parity_sent;        /*!< Parity frames sent by the writer */
+    uint32_t                fec_parity_received;    /*!< Parity frames used by the reader */
+    uint32_t                fec_recovered;          /*!< Lost frames rebuilt from parity */
+    uint32_t                fec_unrecoverable;      /*!< Lost frames that could not be rebuilt */
+    uint32_t                format_changes;         /*!< Stream format changes seen */
+    uint32_t                handover_last_us;       /*!< Output interruption of the last format change */
+    uint32_t                handover_max_us;        /*!< Longest output interruption on a format change */
+    uint32_t                handover_timeouts;      /*!< Format changes not acknowledged in time by the sink */
+    uint32_t                rb_depth;               /*!< Reader ringbuffer depth in bytes for the current format */
+    uint32_t                rb_overflow;            /*!< Frames dropped because the ringbuffer depth was reached */
+    uint32_t                groups;                 /*!< Multicast memberships of the socket */
+    uint32_t                source_rejected;        /*!< Datagrams dropped because their source was not joined */
+    uint32_t                foreign_rejected;       /*!< Frames of the stream dropped because another sender is locked */
+    uint32_t                source_switches;        /*!< Times the reader followed a new sender */
+    uint32_t                commands;               /*!< Commands run from the VBAN-TEXT control stream */
+    uint32_t                commands_rejected;      /*!< Command packets dropped because of their sender */
+    uint32_t                rebinds;                /*!< Sockets reopened after a network change */
+    uint32_t                latency_count;          /*!< Frames whose socket to sink latency was measured */
+    uint32_t                latency_untagged;       /*!< Frames not measured, too many in flight */
+    uint32_t                latency_min_us;         /*!< Lowest socket to sink latency of the stream */
+    uint32_t                latency_p50_us;         /*!< Median socket to sink latency, LATENCY_BUCKET_US resolution */
+    uint32_t                latency_p99_us;         /*!< 99th percentile socket to sink latency, LATENCY_BUCKET_US resolution */
+    uint32_t                latency_max_us;         /*!< Highest socket to sink latency of the stream */
+    uint32_t                pace_depth;             /*!< Frames waiting in the paced send queue */
+    uint32_t                pace_max_depth;         /*!< Highest paced send queue depth */
+    uint32_t                pace_sent;              /*!< Frames sent by the pacer */
+    uint32_t                pace_dropped;           /*!< Oldest frames dropped on persistent congestion */
+    uint32_t                pace_gap_hist[PACER_GAP_BUCKETS];   /*!< Inter-packet gaps, bucket i is below PACER_GAP_BUCKET_US << i */
+} vban_stream_stats_t;
+
 
 #define VBAN_STREAM_BUF_SIZE            (1024)
-#define VBAN_STREAM_TASK_STACK          (6 * 1024)
-#define VBAN_STREAM_TASK_CORE           (0)
-#define VBAN_STREAM_TASK_PRIO           (4)
+#define VBAN_STREAM_TASK_STACK          (TASK_VBAN_STACK)
+#define VBAN_STREAM_TASK_CORE           (TASK_VBAN_CORE)
+#define VBAN_STREAM_TASK_PRIO           (TASK_VBAN_PRIO)
 #define VBAN_STREAM_RINGBUFFER_SIZE     (10 * 1024)
+#define VBAN_STREAM_RINGBUFFER_MS       (0)
+#define VBAN_STREAM_MAX_RATE            (48000)
+#define VBAN_STREAM_MAX_CHANNELS        (2)
+#define VBAN_STREAM_MAX_BITS            (16)
+#define VBAN_STREAM_FEC_GROUP_SIZE      (0)
+#define VBAN_STREAM_PACE_DEPTH          (0)
+#define VBAN_STREAM_PACE_BURST_US       (0)
+#define VBAN_STREAM_PACE_TASK_STACK     (3 * 1024)
+#define VBAN_STREAM_PACE_TASK_PRIO      (VBAN_STREAM_TASK_PRIO + 1)
+#define VBAN_STREAM_DRAIN_TIMEOUT_MS    (100)
+#define VBAN_STREAM_HANDOVER_TIMEOUT_MS (200)
+#define VBAN_STREAM_LATENCY_MS          (0)
+#define VBAN_STREAM_LATENCY_FRAMES      (4)
+#define VBAN_STREAM_JITTER_FRAMES       (2)
+#define VBAN_STREAM_NOMINAL_RATE        (48000)
+#define VBAN_STREAM_NOMINAL_CHANNELS    (2)
+#define VBAN_STREAM_NOMINAL_BITS        (16)
+#define VBAN_STREAM_SHARED_SOCKET       (false)
+#define VBAN_STREAM_SOURCE_TIMEOUT_MS   (0)
+#define VBAN_STREAM_READ_TIMEOUT_MS     (100)
 
 #define VBAN_STREAM_CFG_DEFAULT() {\
     .task_prio = VBAN_STREAM_TASK_PRIO, \
     .task_core = VBAN_STREAM_TASK_CORE, \
     .task_stack = VBAN_STREAM_TASK_STACK, \
     .out_rb_size = VBAN_STREAM_RINGBUFFER_SIZE, \
+    .out_rb_ms = VBAN_STREAM_RINGBUFFER_MS, \
+    .max_rates = VBAN_STREAM_MAX_RATE, \
+    .max_channels = VBAN_STREAM_MAX_CHANNELS, \
+    .max_bits = VBAN_STREAM_MAX_BITS, \
     .buf_sz = VBAN_STREAM_BUF_SIZE, \
+    .fec_group_size = VBAN_STREAM_FEC_GROUP_SIZE, \
+    .pace_depth = VBAN_STREAM_PACE_DEPTH, \
+    .pace_burst_us = VBAN_STREAM_PACE_BURST_US, \
+    .latency_ms = VBAN_STREAM_LATENCY_MS, \
+    .shared_socket = VBAN_STREAM_SHARED_SOCKET, \
+    .source_timeout_ms = VBAN_STREAM_SOURCE_TIMEOUT_MS, \
 }
 
 /**
@@ -76,6 +177,260 @@ esp_err_t vban_stream_join_group(audio_element_handle_t self, const char* multi_
 
 esp_err_t vban_stream_leave_group(audio_element_handle_t self, const char* multi_ip);
 
+/**
+ * @brief      Add a multicast group to the memberships of a vban element
+ *
+ *             Several groups can be joined, at most SOCKET_GROUPS_MAX_NB. With a source,
+ *             only its datagrams are received: the network stack drops the others when
+ *             it supports source-specific membership, the socket does otherwise. A
+ *             multicast uri is joined from any source, so give a "0.0.0.0" uri to
+ *             receive from joined sources only. Can be called before the element is
+ *             opened or while it runs.
+ *
+ * @param      self      The vban element handle
+ * @param      multi_ip  Multicast group address
+ * @param      source    Source address, NULL for any source
+ *
+ * @return     ESP_OK on success, ESP_FAIL otherwise
+ */
+esp_err_t vban_stream_join_source_group(audio_element_handle_t self, const char *multi_ip, const char *source);
+
+/**
+ * @brief      Remove a multicast group from the memberships of a vban element
+ *
+ * @param      self      The vban element handle
+ * @param      multi_ip  Multicast group address
+ * @param      source    Source address it was joined with, NULL for any source
+ *
+ * @return     ESP_OK on success, ESP_FAIL if the group was not joined
+ */
+esp_err_t vban_stream_leave_source_group(audio_element_handle_t self, const char *multi_ip, const char *source);
+
+/**
+ * @brief      Also send the frames of a vban writer to a unicast destination
+ *
+ *             Frames are built once and sent to the uri address and to every added
+ *             destination, at most SOCKET_DESTINATIONS_MAX_NB. Can be called before
+ *             the element is opened or while it runs.
+ *
+ * @param      self  The vban writer element handle
+ * @param      ip    Destination ip address
+ * @param      port  Destination port
+ *
+ * @return     ESP_OK on success, ESP_FAIL otherwise
+ */
+esp_err_t vban_stream_add_destination(audio_element_handle_t self, const char *ip, int port);
+
+/**
+ * @brief      Stop sending the frames of a vban writer to a destination
+ *
+ * @param      self  The vban writer element handle
+ * @param      ip    Destination ip address
+ * @param      port  Destination port
+ *
+ * @return     ESP_OK on success, ESP_FAIL if the destination was not found
+ */
+esp_err_t vban_stream_remove_destination(audio_element_handle_t self, const char *ip, int port);
+
+/**
+ * @brief      Only accept the frames of a vban reader stream from one sender
+ *
+ *             Without it, a reader with a source timeout locks onto the first sender
+ *             of its stream. Senders are compared on their raw socket address.
+ *
+ * @param      self  The vban reader element handle
+ * @param      ip    Sender ip address, NULL to lock onto the first sender again
+ * @param      port  Sender port, 0 for any port
+ *
+ * @return     ESP_OK on success, ESP_FAIL otherwise
+ */
+esp_err_t vban_stream_set_source(audio_element_handle_t self, const char *ip, int port);
+
+/**
+ * @brief      Record every vban stream a reader sees on its port in a directory
+ *
+ * @param      self       The vban reader element handle
+ * @param      directory  The directory to update, NULL to stop
+ *
+ * @return     ESP_OK on success, ESP_FAIL otherwise
+ */
+esp_err_t vban_stream_set_directory(audio_element_handle_t self, directory_handle_t directory);
+
+/**
+ * @brief      Switch a vban reader to another stream of its port
+ *
+ *             The stream format is reported again with its first frame. Can be called
+ *             before the element is opened or while it runs, the switch is then done by
+ *             the reader task on its next read.
+ *
+ * @param      self  The vban reader element handle
+ * @param      name  The stream name, up to VBAN_STREAM_NAME_SIZE characters
+ *
+ * @return     ESP_OK on success, ESP_FAIL otherwise
+ */
+esp_err_t vban_stream_set_stream_name(audio_element_handle_t self, const char *name);
+
+/**
+ * @brief      Let a vban reader be retuned by VBAN-TEXT packets of its port
+ *
+ *             Text packets of the command stream are parsed in the reader task, without
+ *             allocation (see command.h). The reader runs "stream" and "latency" itself and
+ *             answers "stats" to the sender, at most once a second. Commands are only taken
+ *             from the controller, or without one from the sender the stream is locked to.
+ *             Every command is then passed to the handler, which owns what the reader can't
+ *             reach: volume and mute. A new latency resizes the ringbuffer depth only, I2S DMA
+ *             buffers keep their size until reopened.
+ *
+ * @param      self         The vban reader element handle
+ * @param      stream_name  The command stream name, NULL to ignore commands
+ * @param      handler      Called for each command, may be NULL
+ * @param      context      Passed to the handler
+ *
+ * @return     ESP_OK on success, ESP_FAIL otherwise
+ */
+esp_err_t vban_stream_set_command_handler(audio_element_handle_t self, const char *stream_name,
+                                          command_handler_t handler, void *context);
+
+/**
+ * @brief      Only take the commands of a vban reader from one host
+ *
+ * @param      self  The vban reader element handle, not opened yet
+ * @param      ip    Controller ip address, any port. NULL to fall back to the stream source
+ *
+ * @return     ESP_OK on success, ESP_FAIL otherwise
+ */
+esp_err_t vban_stream_set_command_controller(audio_element_handle_t self, const char *ip);
+
+/**
+ * @brief      Carry a serial link (MIDI or other serial data) next to the audio of a reader
+ *
+ *             VBAN-SERIAL packets of the link stream name are pushed to its byte ring from
+ *             the reader task, and the link sends through the reader socket while it is open.
+ *
+ * @param      self    The vban reader element handle, not opened yet
+ * @param      serial  The serial link, NULL to drop serial packets
+ *
+ * @return     ESP_OK on success, ESP_FAIL otherwise
+ */
+esp_err_t vban_stream_set_serial(audio_element_handle_t self, serial_handle_t serial);
+
+/**
+ * @brief      Hand every datagram the reader receives to a packet recorder
+ *
+ *             Datagrams are pushed as they leave the socket, with their arrival time
+ *             and sender, before any check: a capture replays what the network gave.
+ *             The recorder decides whether a capture is running.
+ *
+ * @param      self      The vban reader element handle, not opened yet
+ * @param      recorder  The packet recorder, NULL to record nothing
+ *
+ * @return     ESP_OK on success, ESP_FAIL otherwise
+ */
+esp_err_t vban_stream_set_recorder(audio_element_handle_t self, recorder_handle_t recorder);
+
+/**
+ * @brief      Reopen the socket of a running vban reader, after a network change
+ *
+ *             The reader closes and reopens its socket on its next read, keeping its
+ *             buffers, task and pipeline. A socket shared by the engine is only
+ *             recreated once no other element holds it. Read errors no longer end
+ *             the reader, it waits for this call instead.
+ *
+ * @param      self  The vban reader element handle
+ *
+ * @return     ESP_OK on success, ESP_FAIL otherwise
+ */
+esp_err_t vban_stream_rebind(audio_element_handle_t self);
+
+/**
+ * @brief      Tell a vban reader the sink now runs the last reported format
+ *
+ *             On a format change the reader drains (or after VBAN_STREAM_DRAIN_TIMEOUT_MS
+ *             discards) old format data, reports the music info, then holds new format
+ *             data back until this is called, at most VBAN_STREAM_HANDOVER_TIMEOUT_MS.
+ *             Call it right after reclocking the I2S writer.
+ *
+ * @param      self  The vban element handle
+ *
+ * @return     ESP_OK on success, ESP_FAIL otherwise
+ */
+esp_err_t vban_stream_format_applied(audio_element_handle_t self);
+
+/**
+ * @brief      Tell a vban reader the sink took bytes from its output ringbuffer
+ *
+ *             Each received frame is dated on arrival in the socket; when the sink reaches
+ *             its first byte, the delay goes to the latency histogram of the stream. Call it
+ *             from the sink read, with the bytes it got. The histogram restarts on a stream
+ *             change and excludes the I2S DMA buffers.
+ *
+ * @param      self  The vban reader element handle
+ * @param      size  Bytes read by the sink
+ *
+ * @return     ESP_OK on success, ESP_FAIL otherwise
+ */
+esp_err_t vban_stream_sink_consumed(audio_element_handle_t self, int size);
+
+/**
+ * @brief      Keep only a subset of the received channels, in a given order
+ *
+ *             Output channel i of the reader is input channel map[i]. Other channels
+ *             of the packet are never copied, and the reported channel count becomes
+ *             out_channels. A running reader swaps the map in on its next read.
+ *
+ * @param      self          The vban reader element handle
+ * @param      map           Input channel index for each output channel
+ * @param      out_channels  Number of output channels, 0 to pass all channels through
+ *
+ * @return     ESP_OK on success, ESP_FAIL otherwise
+ */
+esp_err_t vban_stream_set_channel_map(audio_element_handle_t self, const uint16_t *map, int out_channels);
+
+/**
+ * @brief      Mix the received channels through a gain matrix
+ *
+ * @param      self          The vban reader element handle
+ * @param      gains         Q15 gains (CHMAP_GAIN_UNITY is 1.0), out_channels rows of in_channels values
+ * @param      in_channels   Number of input channels covered by a row
+ * @param      out_channels  Number of output channels, 0 to pass all channels through
+ *
+ * @return     ESP_OK on success, ESP_FAIL otherwise
+ */
+esp_err_t vban_stream_set_channel_mix(audio_element_handle_t self, const int16_t *gains, int in_channels, int out_channels);
+
+/**
+ * @brief      Derive frame and buffer sizes from a latency target
+ *
+ * @param      latency_ms   The end-to-end latency target
+ * @param      sample_rate  The stream sample rate
+ * @param      channels     The stream channel count
+ * @param      bits         The stream bits per sample
+ * @param      plan         The plan to fill
+ *
+ * @return     ESP_OK on success, ESP_FAIL otherwise
+ */
+esp_err_t vban_stream_plan_latency(int latency_ms, int sample_rate, int channels, int bits, vban_stream_latency_plan_t *plan);
+
+/**
+ * @brief      Get the latency plan currently applied by a vban stream
+ *
+ * @param      self  The vban element handle
+ * @param      plan  The plan to fill
+ *
+ * @return     ESP_OK on success, ESP_FAIL if the stream has no latency target
+ */
+esp_err_t vban_stream_get_latency_plan(audio_element_handle_t self, vban_stream_latency_plan_t *plan);
+
+/**
+ * @brief      Get the statistics of a vban stream
+ *
+ * @param      self   The vban element handle
+ * @param      stats  The statistics to fill
+ *
+ * @return     ESP_OK on success, ESP_FAIL otherwise
+ */
+esp_err_t vban_stream_get_stats(audio_element_handle_t self, vban_stream_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
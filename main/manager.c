@@ -28,28 +28,98 @@
 #include <string.h>
 
 #include "esp_err.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
 #include "manager.h"
+#include "boot_profile.h"
+#include "task_profile.h"
 
 static const char *TAG = "TAG_Manager";
 
+// requests the callbacks post to the session task, apart from the element and periph ids.
+#define SESSION_SOURCE_TYPE     (AUDIO_ELEMENT_TYPE_SERVICE + 0x7E)
+#define SESSION_QUEUE_SIZE      8
+#define SESSION_PIPELINES       2   // play and rec
+#define SESSION_ELEMENTS        2   // per pipeline, each posts through its own queue
+#define SESSION_QUEUE_MARGIN    4
+// the set must hold every item of every queue in it: the callbacks queue, the periph set
+// queue and the queues of the pipeline elements, the last two of the default size.
+#define SESSION_QUEUE_SET_SIZE  (SESSION_QUEUE_SIZE + DEFAULT_AUDIO_EVENT_IFACE_SIZE \
+                                 + SESSION_PIPELINES * SESSION_ELEMENTS * DEFAULT_AUDIO_EVENT_IFACE_SIZE \
+                                 + SESSION_QUEUE_MARGIN)
+
+typedef enum {
+    SESSION_CMD_WIFI = 1,       // data holds the wifi service event type
+    SESSION_CMD_STOP,
+    SESSION_CMD_LOAD_REPORT,
+    SESSION_CMD_STREAM,         // data holds a copy of the stream name, freed by the session task
+} session_cmd_t;
+
+typedef enum {
+    SESSION_IDLE = 0,
+    SESSION_RUNNING,
+    SESSION_PARKED,             // paused across a network loss, buffers and tasks kept
+} session_state_t;
+
+typedef struct {
+    session_state_t state;
+    audio_pipeline_handle_t pipeline;
+    audio_element_handle_t first;   // element at the head of the pipeline
+    audio_element_handle_t last;    // element at the tail, its stop ends the session
+} session_t;
+
+typedef struct {
+    ringbuf_handle_t rb;            // input of the i2s writer, hidden by the read callback
+    audio_element_handle_t reader;  // vban reader feeding it
+} i2s_tap_t;
+
 typedef struct service_manager {
     periph_service_handle_t wifi_service;
     display_service_handle_t disp_service;
     esp_periph_set_handle_t periph_set;
+    audio_event_iface_handle_t session_evt;     // the one queue set the session task waits on
+    audio_event_iface_handle_t session_cmd;     // what the callbacks post to it
+    TaskHandle_t session_task;
+    esp_timer_handle_t load_timer;
+    SemaphoreHandle_t session_exited;
     bool wifi_setting_flag;
-    bool stream_play_flag;
     bool time_synced;
-    bool play_runing;
-    bool rec_runing;
+    session_t play;
+    session_t rec;
+    relay_handle_t relay;
+    directory_handle_t directory;
+    serial_handle_t serial;
+    recorder_handle_t recorder;
+    bool codec_ready;
+    bool wifi_connected;
+    bool sd_mounted;
+    bool first_sample;
+    i2s_tap_t i2s_tap;
+    char play_stream[VBAN_STREAM_NAME_SIZE + 1];
 } service_manager_t;
 
 static service_manager_t *g_service_manager = NULL;
 
-static void service_play_task(void * parm);
-static void service_rec_task(void * parm);
+static void session_task(void *parm);
 
 static void set_time(void);
-static esp_err_t periph_callback(audio_event_iface_msg_t *event, void *context);
+static void start_relay(void);
+static void report_relay(void);
+static void stop_relay(void);
+static void select_next_stream(void);
+static void start_play(void);
+static void park_play(void);
+static void resume_play(void);
+static void start_play_pipeline(void);
+static void start_rec(void);
+static void stop_session(session_t *session);
+static void handle_command(struct command_t const *command, void *context);
+static void handle_serial(char const *data, size_t size, void *context);
+static void start_serial(audio_element_handle_t vban_stream_reader);
+static void start_capture(audio_element_handle_t vban_stream_reader);
+static void handle_periph_event(audio_event_iface_msg_t *event);
+static void handle_wifi_event(int type);
+static void handle_element_event(audio_event_iface_msg_t *msg);
 static esp_err_t wifi_service_cb(periph_service_handle_t handle, periph_service_event_t *evt, void *ctx);
 
 void set_time(void)
@@ -70,9 +140,10 @@ void set_time(void)
 
     setenv("TZ", "CST-8", 1);
     tzset();
+    boot_profile_mark(BOOT_SNTP);
 }
 
-esp_err_t periph_callback(audio_event_iface_msg_t *event, void *context)
+void handle_periph_event(audio_event_iface_msg_t *event)
 {
     ESP_LOGD(TAG, "Periph Event received: src_type:%x, source:%p cmd:%d, data:%p, data_len:%d",
              event->source_type, event->source, event->cmd, event->data, event->data_len);
@@ -80,15 +151,14 @@ esp_err_t periph_callback(audio_event_iface_msg_t *event, void *context)
         case PERIPH_ID_BUTTON: {
             if ((int)event->data == get_input_rec_id() && event->cmd == PERIPH_BUTTON_PRESSED) {
                     ESP_LOGI(TAG, "[ * ] [Rec] button tap event");
-                    g_service_manager->stream_play_flag = false;
-                    if (g_service_manager->rec_runing == false) {
-                        xTaskCreate(service_rec_task, "service_rec_task", 4096, NULL, 3, NULL);
+                    if (g_service_manager->rec.state == SESSION_IDLE) {
+                        start_rec();
                     } else {
-                        // set rec as false in order to stop recording task.
-                        g_service_manager->rec_runing = false;
+                        stop_session(&g_service_manager->rec);
                     }
                 } else if ((int)event->data == get_input_mode_id() && event->cmd == PERIPH_BUTTON_PRESSED) {
                     ESP_LOGI(TAG, "[ * ] [Mode] button tap event");
+                    select_next_stream();
                 }
                 break;
             }
@@ -130,17 +200,48 @@ esp_err_t periph_callback(audio_event_iface_msg_t *event, void *context)
             }
             break;
         }
+        case PERIPH_ID_SDCARD: {
+            // SD card features follow the mount state, nothing waits for it.
+            if (event->cmd == SDCARD_STATUS_MOUNTED) {
+                ESP_LOGI(TAG, "[ * ] SD card mounted %d ms after boot", (int)(esp_timer_get_time() / 1000));
+                g_service_manager->sd_mounted = true;
+                if (g_service_manager->recorder) {
+                    recorder_start(g_service_manager->recorder, CONFIG_VBAN_CAPTURE_FILE);
+                }
+            } else if (event->cmd == SDCARD_STATUS_UNMOUNTED) {
+                ESP_LOGI(TAG, "[ * ] SD card removed");
+                g_service_manager->sd_mounted = false;
+                if (g_service_manager->recorder) {
+                    recorder_stop(g_service_manager->recorder);
+                }
+            }
+            break;
+        }
         default:
             break;
     }
-    return ESP_OK;
 }
 
 esp_err_t wifi_service_cb(periph_service_handle_t handle, periph_service_event_t *evt, void *ctx)
 {
     ESP_LOGD(TAG, "event type:%d,source:%p, data:%p,len:%d,ctx:%p",
              evt->type, evt->source, evt->data, evt->len, ctx);
-    if (evt->type == WIFI_SERV_EVENT_CONNECTED) {
+    // runs in the wifi service task: the session task acts on it.
+    audio_event_iface_msg_t msg = {
+        .source_type = SESSION_SOURCE_TYPE,
+        .cmd = SESSION_CMD_WIFI,
+        .data = (void *)evt->type,
+    };
+    if (audio_event_iface_sendout(g_service_manager->session_cmd, &msg) != ESP_OK) {
+        ESP_LOGE(TAG, "session queue full, wifi event %d lost", evt->type);
+    }
+
+    return ESP_OK;
+}
+
+void handle_wifi_event(int type)
+{
+    if (type == WIFI_SERV_EVENT_CONNECTED) {
         ESP_LOGI(TAG, "PERIPH_WIFI_CONNECTED [%d]", __LINE__);
         if (g_service_manager->time_synced == false) {
             set_time();
@@ -148,20 +249,328 @@ esp_err_t wifi_service_cb(periph_service_handle_t handle, periph_service_event_t
         }
         display_service_set_pattern(g_service_manager->disp_service, DISPLAY_PATTERN_WIFI_CONNECTED, 0);
         g_service_manager->wifi_setting_flag = false;
-        if (g_service_manager->play_runing == false) {
-            xTaskCreate(service_play_task, "service_play_task", 4096, NULL, 3, NULL);
+        boot_profile_mark(BOOT_WIFI);
+        if (g_service_manager->wifi_connected == false) {
+            ESP_LOGI(TAG, "[ * ] Network ready %d ms after boot", (int)(esp_timer_get_time() / 1000));
         }
-    } else if (evt->type == WIFI_SERV_EVENT_DISCONNECTED) {
+        g_service_manager->wifi_connected = true;
+#if CONFIG_VBAN_RELAY
+        start_relay();
+#else
+        start_play();
+#endif
+    } else if (type == WIFI_SERV_EVENT_DISCONNECTED) {
         ESP_LOGI(TAG, "PERIPH_WIFI_DISCONNECTED [%d]", __LINE__);
         display_service_set_pattern(g_service_manager->disp_service, DISPLAY_PATTERN_WIFI_DISCONNECTED, 0);
-    } else if (evt->type == WIFI_SERV_EVENT_SETTING_TIMEOUT) {
+        g_service_manager->wifi_connected = false;
+        // time the reconnection, from the network up to the first sample.
+        boot_profile_rearm(BOOT_WIFI);
+        g_service_manager->first_sample = false;
+        stop_relay();
+        park_play();
+    } else if (type == WIFI_SERV_EVENT_SETTING_TIMEOUT) {
         g_service_manager->wifi_setting_flag = false;
     }
+}
 
-    return ESP_OK;
+void start_play(void)
+{
+    // audio only waits for the codec and the network, whatever the other peripherals.
+    session_t *play = &g_service_manager->play;
+    if (!g_service_manager->codec_ready || !g_service_manager->wifi_connected) {
+        return;
+    }
+    if (play->state == SESSION_PARKED) {
+        resume_play();
+    } else if (play->state == SESSION_IDLE) {
+        start_play_pipeline();
+    }
+}
+
+void park_play(void)
+{
+    // keep the pipeline, its tasks and ringbuffers across the disconnection.
+    session_t *play = &g_service_manager->play;
+    if (play->state != SESSION_RUNNING) {
+        return;
+    }
+    ESP_LOGI(TAG, "[ * ] Park the playback pipeline");
+    audio_pipeline_pause(play->pipeline);
+    play->state = SESSION_PARKED;
+}
+
+void resume_play(void)
+{
+    session_t *play = &g_service_manager->play;
+    if (play->state != SESSION_PARKED) {
+        return;
+    }
+    ESP_LOGI(TAG, "[ * ] Resume the playback pipeline on a new socket");
+    vban_stream_rebind(play->first);
+    audio_pipeline_reset_ringbuffer(play->pipeline);
+    audio_pipeline_resume(play->pipeline);
+    boot_profile_mark(BOOT_PIPELINE_RUN);
+    play->state = SESSION_RUNNING;
+}
+
+void stop_session(session_t *session)
+{
+    // terminate waits a bounded time for each element task.
+    if (session->state == SESSION_IDLE) {
+        return;
+    }
+    ESP_LOGI(TAG, "[ 8 ] Stop audio_pipeline");
+    audio_pipeline_terminate(session->pipeline);
+
+    audio_pipeline_unregister(session->pipeline, session->first);
+    audio_pipeline_unregister(session->pipeline, session->last);
+
+    /* Terminate the pipeline before removing the listener */
+    audio_pipeline_remove_listener(session->pipeline);
+
+    /* Release all resources */
+    audio_pipeline_deinit(session->pipeline);
+    audio_element_deinit(session->first);
+    audio_element_deinit(session->last);
+
+    memset(session, 0, sizeof(session_t));
+}
+
+void start_relay(void)
+{
+#if CONFIG_VBAN_RELAY
+    if (g_service_manager->relay != NULL) {
+        return;
+    }
+
+    struct relay_config_t relay_cfg = {
+        .task_stack = TASK_NET_STACK,
+        .task_core = TASK_NET_CORE,
+        .task_prio = TASK_NET_PRIO,
+    };
+#if CONFIG_SOCKET_DUAL_STACK
+    strncpy(relay_cfg.in.ip_address, "::", SOCKET_IP_ADDRESS_SIZE-1);
+#else
+    strncpy(relay_cfg.in.ip_address, "0.0.0.0", SOCKET_IP_ADDRESS_SIZE-1);
+#endif
+    relay_cfg.in.port = CONFIG_SOCKET_PORT;
+    strncpy(relay_cfg.out.ip_address, CONFIG_VBAN_RELAY_OUT_ADDR, SOCKET_IP_ADDRESS_SIZE-1);
+    relay_cfg.out.port = CONFIG_SOCKET_PORT;
+    relay_cfg.mcast_cfg.default_if = CONFIG_SOCKET_MULTICAST_DEFAULT_IF;
+    relay_cfg.mcast_cfg.loopback = CONFIG_SOCKET_MULTICAST_LOOPBACK;
+    relay_cfg.mcast_cfg.ttl = CONFIG_SOCKET_MULTICAST_TTL;
+    strncpy(relay_cfg.in_stream_name, CONFIG_APP_STREAM_NAME, VBAN_STREAM_NAME_SIZE-1);
+    strncpy(relay_cfg.out_stream_name, CONFIG_VBAN_RELAY_STREAM_NAME, VBAN_STREAM_NAME_SIZE-1);
+
+    if (relay_init(&g_service_manager->relay, &relay_cfg) != 0) {
+        ESP_LOGE(TAG, "Failed to start the relay");
+    }
+#endif
+}
+
+void report_relay(void)
+{
+    if (g_service_manager->relay == NULL) {
+        return;
+    }
+
+    struct relay_stats_t stats;
+    relay_get_stats(g_service_manager->relay, &stats);
+    ESP_LOGI(TAG, "relay: forwarded=%u dropped=%u hop_us=%u/%u/%u (last/avg/max)",
+             stats.forwarded, stats.dropped, stats.hop_last_us, stats.hop_avg_us, stats.hop_max_us);
+}
+
+void stop_relay(void)
+{
+    // its sockets are bound to the lost interface, start_relay opens new ones.
+    report_relay();
+    relay_release(&g_service_manager->relay);
+}
+
+void select_next_stream(void)
+{
+#if CONFIG_VBAN_DIRECTORY
+    static struct directory_entry_t entries[DIRECTORY_ENTRIES_NB];
+    char source[SOCKET_IP_ADDRESS_SIZE];
+
+    if (g_service_manager->directory == NULL || g_service_manager->play.state == SESSION_IDLE) {
+        return;
+    }
+
+    int nb = directory_list(g_service_manager->directory, entries, DIRECTORY_ENTRIES_NB);
+    int current = -1;
+    for (int index = 0; index < nb; index++) {
+        ESP_LOGI(TAG, "stream %-16s from %s, %u Hz %u ch, %u pkt/s", entries[index].streamname,
+                 socket_address_name(&entries[index].source, source, sizeof(source)),
+                 entries[index].sample_rate, entries[index].channels, entries[index].packet_rate);
+        if (current < 0 && strncmp(entries[index].streamname, g_service_manager->play_stream, VBAN_STREAM_NAME_SIZE) == 0) {
+            current = index;
+        }
+    }
+
+    // play the next audio stream of the directory, wrapping around.
+    for (int step = 1; step <= nb; step++) {
+        struct directory_entry_t *entry = &entries[(current + step + nb) % nb];
+        if (entry->protocol == VBAN_PROTOCOL_AUDIO
+            && strncmp(entry->streamname, g_service_manager->play_stream, VBAN_STREAM_NAME_SIZE) != 0) {
+            strncpy(g_service_manager->play_stream, entry->streamname, VBAN_STREAM_NAME_SIZE);
+            vban_stream_set_stream_name(g_service_manager->play.first, g_service_manager->play_stream);
+            return;
+        }
+    }
+    ESP_LOGI(TAG, "no other stream to play than %s", g_service_manager->play_stream);
+#endif
 }
 
-void service_play_task(void * parm)
+void handle_command(struct command_t const *command, void *context)
+{
+    // runs in the vban reader task, stream and latency were already applied by the reader.
+    audio_board_handle_t bhd = audio_board_get_handle();
+    switch (command->id) {
+        case COMMAND_VOLUME:
+            ESP_LOGI(TAG, "[ * ] remote volume: %d", command->value);
+            audio_hal_set_volume(bhd->audio_hal, command->value);
+            break;
+        case COMMAND_MUTE:
+            ESP_LOGI(TAG, "[ * ] remote mute: %s", command->value ? "on" : "off");
+            audio_hal_set_mute(bhd->audio_hal, command->value != 0);
+            break;
+        case COMMAND_STREAM: {
+            ESP_LOGI(TAG, "[ * ] remote stream: %s", command->text);
+            // play_stream belongs to the session task.
+            audio_event_iface_msg_t msg = {
+                .source_type = SESSION_SOURCE_TYPE,
+                .cmd = SESSION_CMD_STREAM,
+                .data = strndup(command->text, VBAN_STREAM_NAME_SIZE),
+            };
+            if (msg.data == NULL || audio_event_iface_sendout(g_service_manager->session_cmd, &msg) != ESP_OK) {
+                ESP_LOGE(TAG, "session queue full, stream %s not recorded", command->text);
+                free(msg.data);
+            }
+            break;
+        }
+        case COMMAND_LATENCY:
+            ESP_LOGI(TAG, "[ * ] remote latency: %d ms", command->value);
+            break;
+        default:
+            break;
+    }
+}
+
+void handle_serial(char const *data, size_t size, void *context)
+{
+    // runs in the serial task: hand the bytes to the MIDI or UART consumer of the board.
+    ESP_LOG_BUFFER_HEXDUMP(TAG, data, size, ESP_LOG_DEBUG);
+}
+
+void start_serial(audio_element_handle_t vban_stream_reader)
+{
+    if (strlen(CONFIG_VBAN_SERIAL_STREAM) == 0) {
+        return;
+    }
+
+    if (g_service_manager->serial == NULL) {
+        struct serial_config_t serial_cfg = {
+            .stream_type = VBAN_SERIAL_MIDI,
+            .bps = 31250,
+            .coalesce_us = CONFIG_VBAN_SERIAL_COALESCE_US,
+            .handler = handle_serial,
+            .task_stack = TASK_NET_STACK,
+            .task_core = TASK_NET_CORE,
+            .task_prio = TASK_NET_PRIO,
+        };
+        strncpy(serial_cfg.streamname, CONFIG_VBAN_SERIAL_STREAM, VBAN_STREAM_NAME_SIZE-1);
+        strncpy(serial_cfg.ip_address, CONFIG_VBAN_SERIAL_ADDR, SOCKET_IP_ADDRESS_SIZE-1);
+        serial_cfg.port = CONFIG_SOCKET_PORT;
+        if (serial_init(&g_service_manager->serial, &serial_cfg) != 0) {
+            ESP_LOGE(TAG, "Failed to start the serial link");
+            return;
+        }
+    }
+    vban_stream_set_serial(vban_stream_reader, g_service_manager->serial);
+}
+
+void start_capture(audio_element_handle_t vban_stream_reader)
+{
+#if CONFIG_VBAN_CAPTURE
+    if (g_service_manager->recorder == NULL) {
+        // the writer waits on the card, below the streaming tasks.
+        struct recorder_config_t recorder_cfg = {
+            .ring_size = CONFIG_VBAN_CAPTURE_RING_SIZE,
+            .task_stack = TASK_SESSION_STACK,
+            .task_core = TASK_SESSION_CORE,
+            .task_prio = TASK_SESSION_PRIO,
+        };
+        if (recorder_init(&g_service_manager->recorder, &recorder_cfg) != 0) {
+            ESP_LOGE(TAG, "Failed to start the packet recorder");
+            return;
+        }
+        // the card may have been mounted before the first pipeline.
+        if (g_service_manager->sd_mounted) {
+            recorder_start(g_service_manager->recorder, CONFIG_VBAN_CAPTURE_FILE);
+        }
+    }
+    vban_stream_set_recorder(vban_stream_reader, g_service_manager->recorder);
+#endif
+}
+
+static void apply_task_profile(i2s_stream_cfg_t *i2s_cfg)
+{
+    i2s_cfg->task_stack = TASK_I2S_STACK;
+    i2s_cfg->task_core = TASK_I2S_CORE;
+    i2s_cfg->task_prio = TASK_I2S_PRIO;
+}
+
+static void apply_latency_plan(i2s_stream_cfg_t *i2s_cfg)
+{
+    vban_stream_latency_plan_t plan;
+    if (CONFIG_VBAN_LATENCY_MS <= 0
+        || vban_stream_plan_latency(CONFIG_VBAN_LATENCY_MS, VBAN_STREAM_NOMINAL_RATE, VBAN_STREAM_NOMINAL_CHANNELS,
+                                    VBAN_STREAM_NOMINAL_BITS, &plan) != ESP_OK) {
+        return;
+    }
+    i2s_cfg->i2s_config.dma_buf_count = plan.i2s_dma_buf_count;
+    i2s_cfg->i2s_config.dma_buf_len = plan.i2s_dma_buf_len;
+    i2s_cfg->out_rb_size = plan.out_rb_size;
+}
+
+static void apply_channel_map(audio_element_handle_t vban_stream_reader)
+{
+    uint16_t map[CHMAP_OUT_MAX_NB];
+    int out_channels = 0;
+    const char *str = CONFIG_VBAN_CHANNEL_MAP;
+    char *end = NULL;
+
+    while (*str && out_channels < CHMAP_OUT_MAX_NB) {
+        long channel = strtol(str, &end, 10);
+        if (end == str || channel < 0 || channel >= VBAN_CHANNELS_MAX_NB) {
+            ESP_LOGE(TAG, "bad channel map \"%s\"", CONFIG_VBAN_CHANNEL_MAP);
+            return;
+        }
+        map[out_channels++] = (uint16_t)channel;
+        str = (*end == ',') ? end + 1 : end;
+    }
+
+    if (out_channels > 0) {
+        vban_stream_set_channel_map(vban_stream_reader, map, out_channels);
+    }
+}
+
+static int i2s_read_tap(audio_element_handle_t self, char *buffer, int len, TickType_t ticks_to_wait, void *context)
+{
+    // stands for the ringbuffer read of the i2s writer, to time the first sample and each frame.
+    i2s_tap_t *tap = (i2s_tap_t *)context;
+    int ret = rb_read(tap->rb, buffer, len, ticks_to_wait);
+    vban_stream_sink_consumed(tap->reader, ret);
+    if (ret > 0 && !g_service_manager->first_sample) {
+        g_service_manager->first_sample = true;
+        boot_profile_mark(BOOT_FIRST_SAMPLE);
+        boot_profile_dump();
+    }
+    return ret;
+}
+
+void start_play_pipeline(void)
 {
     audio_pipeline_handle_t pipeline;
     audio_element_handle_t vban_stream_reader, i2s_stream_writer;
@@ -173,12 +582,44 @@ void service_play_task(void * parm)
     ESP_LOGI(TAG, "[2.1] Create i2s stream to write data to codec chip");
     i2s_stream_cfg_t i2s_cfg = I2S_STREAM_CFG_DEFAULT();
     i2s_cfg.type = AUDIO_STREAM_WRITER;
+    apply_task_profile(&i2s_cfg);
+    apply_latency_plan(&i2s_cfg);
     i2s_stream_writer = i2s_stream_init(&i2s_cfg);
 
     ESP_LOGI(TAG, "[2.2] Create VBan stream to read data");
     vban_stream_cfg_t vban_cfg = VBAN_STREAM_CFG_DEFAULT();
     vban_cfg.type = AUDIO_STREAM_READER;
+    vban_cfg.out_rb_ms = CONFIG_VBAN_RINGBUFFER_MS;
+    vban_cfg.max_rates = CONFIG_VBAN_RINGBUFFER_MAX_RATE;
+    vban_cfg.max_channels = CONFIG_VBAN_RINGBUFFER_MAX_CHANNELS;
+    vban_cfg.max_bits = CONFIG_VBAN_RINGBUFFER_MAX_BITS;
+    vban_cfg.fec_group_size = CONFIG_VBAN_FEC_GROUP_SIZE;
+    vban_cfg.latency_ms = CONFIG_VBAN_LATENCY_MS;
+    vban_cfg.source_timeout_ms = CONFIG_VBAN_SOURCE_TIMEOUT_MS;
+#if CONFIG_VBAN_SHARED_SOCKET
+    vban_cfg.shared_socket = true;
+#endif
     vban_stream_reader = vban_stream_init(&vban_cfg);
+    apply_channel_map(vban_stream_reader);
+#if CONFIG_VBAN_DIRECTORY
+    if (g_service_manager->directory == NULL
+        && directory_init(&g_service_manager->directory, CONFIG_VBAN_DIRECTORY_EXPIRY_MS) != 0) {
+        ESP_LOGE(TAG, "Failed to create the stream directory");
+    }
+    vban_stream_set_directory(vban_stream_reader, g_service_manager->directory);
+    vban_stream_set_stream_name(vban_stream_reader, g_service_manager->play_stream);
+#endif
+    if (strlen(CONFIG_VBAN_SOURCE_ADDR) > 0) {
+        vban_stream_set_source(vban_stream_reader, CONFIG_VBAN_SOURCE_ADDR, 0);
+    }
+    if (strlen(CONFIG_VBAN_COMMAND_STREAM) > 0) {
+        vban_stream_set_command_handler(vban_stream_reader, CONFIG_VBAN_COMMAND_STREAM, handle_command, NULL);
+        if (strlen(CONFIG_VBAN_COMMAND_CONTROLLER) > 0) {
+            vban_stream_set_command_controller(vban_stream_reader, CONFIG_VBAN_COMMAND_CONTROLLER);
+        }
+    }
+    start_serial(vban_stream_reader);
+    start_capture(vban_stream_reader);
 
     ESP_LOGI(TAG, "[3.1] Register all elements to audio pipeline");
     audio_pipeline_register(pipeline, vban_stream_reader, "vban");
@@ -186,91 +627,52 @@ void service_play_task(void * parm)
 
     ESP_LOGI(TAG, "[3.2] Link it together [UDP]-->vban_stream_reader-->i2s_stream_writer-->[codec_chip]");
     audio_pipeline_link(pipeline, (const char *[]) {"vban", "i2s"}, 2);
+    // after the link, which creates the ringbuffer: the read callback shares its slot in the element.
+    g_service_manager->i2s_tap.rb = audio_element_get_input_ringbuf(i2s_stream_writer);
+    g_service_manager->i2s_tap.reader = vban_stream_reader;
+    audio_element_set_read_cb(i2s_stream_writer, i2s_read_tap, &g_service_manager->i2s_tap);
 
     ESP_LOGI(TAG, "[3.3] Set up  uri (and default output is i2s)");
     audio_element_set_uri(vban_stream_reader, "192.168.20.158:6980");
 
-    ESP_LOGI(TAG, "[ 4 ] Initialize peripherals");
-    esp_periph_set_handle_t set = g_service_manager->periph_set;
-
-
-    ESP_LOGI(TAG, "[4.2] Start all peripherals");
-
-    ESP_LOGI(TAG, "[ 5 ] Set up  event listener");
-    audio_event_iface_cfg_t evt_cfg = AUDIO_EVENT_IFACE_DEFAULT_CFG();
-    audio_event_iface_handle_t evt = audio_event_iface_init(&evt_cfg);
-
-    ESP_LOGI(TAG, "[5.1] Listening event from all elements of pipeline");
-    audio_pipeline_set_listener(pipeline, evt);
-
-    ESP_LOGI(TAG, "[5.2] Listening event from peripherals");
-    audio_event_iface_set_listener(esp_periph_set_get_event_iface(set), evt);
+    ESP_LOGI(TAG, "[ 5 ] Listening event from all elements of pipeline");
+    audio_pipeline_set_listener(pipeline, g_service_manager->session_evt);
 
     ESP_LOGI(TAG, "[ 6 ] Start audio_pipeline");
+    session_t *play = &g_service_manager->play;
+    play->pipeline = pipeline;
+    play->first = vban_stream_reader;
+    play->last = i2s_stream_writer;
+    play->state = SESSION_RUNNING;
     audio_pipeline_run(pipeline);
+    boot_profile_mark(BOOT_PIPELINE_RUN);
+}
 
-    ESP_LOGI(TAG, "[ 7 ] Listen for all pipeline events");
-    g_service_manager->play_runing = true;
-
-    while (1) {
-        audio_event_iface_msg_t msg;
-        esp_err_t ret = audio_event_iface_listen(evt, &msg, portMAX_DELAY);
-        if (ret != ESP_OK) {
-            ESP_LOGE(TAG, "[ * ] Event interface error : %d", ret);
-            continue;
-        }
-
-        if (msg.source_type == AUDIO_ELEMENT_TYPE_ELEMENT && msg.source == (void *) vban_stream_reader
-            && msg.cmd == AEL_MSG_CMD_REPORT_MUSIC_INFO) {
-            audio_element_info_t music_info = {0};
-            audio_element_getinfo(vban_stream_reader, &music_info);
-
-            ESP_LOGI(TAG, "[ * ] Receive music info from VBan, sample_rates=%d, bits=%d, ch=%d, codec=%d",
-                     music_info.sample_rates, music_info.bits, music_info.channels, music_info.reserve_data.user_data_0);
-            if (music_info.reserve_data.user_data_0 == VBAN_CODEC_OPUS) {
-                ESP_LOGI(TAG, "[ * ] Should use the opus decoder!! TODO");
-            }
 
-            audio_element_setinfo(i2s_stream_writer, &music_info);
-            i2s_stream_set_clk(i2s_stream_writer, music_info.sample_rates, music_info.bits, music_info.channels);
-            continue;
+static void apply_destinations(audio_element_handle_t vban_stream_writer)
+{
+    char ip[SOCKET_IP_ADDRESS_SIZE];
+    const char *str = CONFIG_VBAN_DESTINATIONS;
+
+    while (*str) {
+        const char *sep = strchr(str, ',');
+        const char *end = sep ? sep : str + strlen(str);
+        const char *colon = end;
+        while (colon > str && *colon != ':') {
+            colon--;
         }
-
-        /* Stop when the last pipeline element (i2s_stream_writer in this case) receives stop event */
-        if (msg.source_type == AUDIO_ELEMENT_TYPE_ELEMENT && msg.source == (void *) i2s_stream_writer
-            && msg.cmd == AEL_MSG_CMD_REPORT_STATUS && (int) msg.data == AEL_STATUS_STATE_STOPPED) {
-            ESP_LOGW(TAG, "[ * ] Stop event received");
-            break;
+        if (colon == str || colon - str >= SOCKET_IP_ADDRESS_SIZE) {
+            ESP_LOGE(TAG, "bad destination list \"%s\"", CONFIG_VBAN_DESTINATIONS);
+            return;
         }
+        memcpy(ip, str, colon - str);
+        ip[colon - str] = '\0';
+        vban_stream_add_destination(vban_stream_writer, ip, atoi(colon + 1));
+        str = sep ? sep + 1 : end;
     }
-
-    ESP_LOGI(TAG, "[ 8 ] Stop audio_pipeline");
-    audio_pipeline_terminate(pipeline);
-
-    audio_pipeline_unregister(pipeline, vban_stream_reader);
-    audio_pipeline_unregister(pipeline, i2s_stream_writer);
-
-    /* Terminate the pipeline before removing the listener */
-    audio_pipeline_remove_listener(pipeline);
-
-    /* Stop all peripherals before removing the listener */
-    // esp_periph_set_stop_all(set); //donot stop periph set.
-    audio_event_iface_remove_listener(esp_periph_set_get_event_iface(set), evt);
-
-    /* Make sure audio_pipeline_remove_listener & audio_event_iface_remove_listener are called before destroying event_iface */
-    audio_event_iface_destroy(evt);
-
-    /* Release all resources */
-    audio_pipeline_deinit(pipeline);
-    audio_element_deinit(vban_stream_reader);
-    audio_element_deinit(i2s_stream_writer);
-
-    g_service_manager->play_runing = false;
-    vTaskDelete(NULL);
 }
 
-
-void service_rec_task(void * parm)
+void start_rec(void)
 {
     audio_pipeline_handle_t pipeline;
     audio_element_handle_t vban_stream_writer, i2s_stream_reader;
@@ -283,12 +685,21 @@ void service_rec_task(void * parm)
     ESP_LOGI(TAG, "[2.1] Create i2s stream to write data to codec chip");
     i2s_stream_cfg_t i2s_cfg = I2S_STREAM_CFG_DEFAULT();
     i2s_cfg.type = AUDIO_STREAM_READER;
+    apply_task_profile(&i2s_cfg);
+    apply_latency_plan(&i2s_cfg);
     i2s_stream_reader = i2s_stream_init(&i2s_cfg);
 
     ESP_LOGI(TAG, "[2.2] Create VBan stream to read data");
     vban_stream_cfg_t vban_cfg = VBAN_STREAM_CFG_DEFAULT();
     vban_cfg.type = AUDIO_STREAM_WRITER;
+    vban_cfg.fec_group_size = CONFIG_VBAN_FEC_GROUP_SIZE;
+    vban_cfg.latency_ms = CONFIG_VBAN_LATENCY_MS;
+    vban_cfg.pace_depth = CONFIG_VBAN_PACE_QUEUE_DEPTH;
+#if CONFIG_VBAN_SHARED_SOCKET
+    vban_cfg.shared_socket = true;
+#endif
     vban_stream_writer = vban_stream_init(&vban_cfg);
+    apply_destinations(vban_stream_writer);
 
     ESP_LOGI(TAG, "[3.1] Register all elements to audio pipeline");
     audio_pipeline_register(pipeline, i2s_stream_reader, "i2s");
@@ -301,85 +712,98 @@ void service_rec_task(void * parm)
     // audio_element_set_uri(vban_stream_reader, "0.0.0.0:6980");
     audio_element_set_uri(vban_stream_writer, "192.168.20.158:6980");
 
-    ESP_LOGI(TAG, "[ 4 ] Initialize peripherals");
-    esp_periph_set_handle_t set = g_service_manager->periph_set;
-
+    ESP_LOGI(TAG, "[ 5 ] Listening event from all elements of pipeline");
+    audio_pipeline_set_listener(pipeline, g_service_manager->session_evt);
 
-    ESP_LOGI(TAG, "[4.2] Start all peripherals");
+    ESP_LOGI(TAG, "[ 6 ] Start audio_pipeline");
+    session_t *rec = &g_service_manager->rec;
+    rec->pipeline = pipeline;
+    rec->first = i2s_stream_reader;
+    rec->last = vban_stream_writer;
+    rec->state = SESSION_RUNNING;
+    audio_pipeline_run(pipeline);
+}
 
-    // ESP_LOGI(TAG, "[ 5 ] Set up  event listener");
-    audio_event_iface_cfg_t evt_cfg = AUDIO_EVENT_IFACE_DEFAULT_CFG();
-    audio_event_iface_handle_t evt = audio_event_iface_init(&evt_cfg);
+void handle_element_event(audio_event_iface_msg_t *msg)
+{
+    session_t *play = &g_service_manager->play;
+    session_t *rec = &g_service_manager->rec;
+
+    if (play->state != SESSION_IDLE && msg->source == (void *) play->first
+        && msg->cmd == AEL_MSG_CMD_REPORT_MUSIC_INFO) {
+        audio_element_info_t music_info = {0};
+        audio_element_getinfo(play->first, &music_info);
+
+        ESP_LOGI(TAG, "[ * ] Receive music info from VBan, sample_rates=%d, bits=%d, ch=%d, codec=%d",
+                 music_info.sample_rates, music_info.bits, music_info.channels, music_info.reserve_data.user_data_0);
+        if (music_info.reserve_data.user_data_0 == VBAN_CODEC_OPUS) {
+            ESP_LOGI(TAG, "[ * ] Should use the opus decoder!! TODO");
+        }
 
-    ESP_LOGI(TAG, "[5.1] Listening event from all elements of pipeline");
-    audio_pipeline_set_listener(pipeline, evt);
+        audio_element_setinfo(play->last, &music_info);
+        i2s_stream_set_clk(play->last, music_info.sample_rates, music_info.bits, music_info.channels);
+        vban_stream_format_applied(play->first);
+        return;
+    }
 
-    ESP_LOGI(TAG, "[5.2] Listening event from peripherals");
-    audio_event_iface_set_listener(esp_periph_set_get_event_iface(set), evt);
+    if (rec->state != SESSION_IDLE && msg->source == (void *) rec->last
+        && msg->cmd == AEL_MSG_CMD_REPORT_MUSIC_INFO) {
+        audio_element_info_t music_info = {0};
+        audio_element_getinfo(rec->last, &music_info);
 
-    ESP_LOGI(TAG, "[ 6 ] Start audio_pipeline");
-    audio_pipeline_run(pipeline);
+        ESP_LOGI(TAG, "[ *REC ] Receive music info from VBan, sample_rates=%d, bits=%d, ch=%d, codec=%d",
+                 music_info.sample_rates, music_info.bits, music_info.channels, music_info.reserve_data.user_data_0);
 
-    ESP_LOGI(TAG, "[ 7 ] Listen for all pipeline events");
-    g_service_manager->rec_runing = true;
+        audio_element_setinfo(rec->first, &music_info);
+        i2s_stream_set_clk(rec->first, music_info.sample_rates, music_info.bits, music_info.channels);
+        return;
+    }
 
-    while (g_service_manager->rec_runing == true) {
-        // vTaskDelay(2000 / portTICK_PERIOD_MS);
+    /* Stop a session when its i2s element receives stop event */
+    if (msg->cmd == AEL_MSG_CMD_REPORT_STATUS && (int) msg->data == AEL_STATUS_STATE_STOPPED) {
+        if (play->state != SESSION_IDLE && msg->source == (void *) play->last) {
+            ESP_LOGW(TAG, "[ * ] Stop event received");
+            stop_session(play);
+        } else if (rec->state != SESSION_IDLE && msg->source == (void *) rec->first) {
+            ESP_LOGW(TAG, "[ *REC ] Stop event received");
+            stop_session(rec);
+        }
+    }
+}
 
+void session_task(void *parm)
+{
+    // owns every pipeline: buttons, wifi and element events come through one queue set.
+    while (1) {
         audio_event_iface_msg_t msg;
-        // esp_err_t ret = audio_event_iface_listen(evt, &msg, portMAX_DELAY);
-        esp_err_t ret = audio_event_iface_listen(evt, &msg, 100);
+        esp_err_t ret = audio_event_iface_listen(g_service_manager->session_evt, &msg, portMAX_DELAY);
         if (ret != ESP_OK) {
-            // ESP_LOGE(TAG, "[ * ] Event interface error : %d", ret);
             continue;
         }
 
-        if (msg.source_type == AUDIO_ELEMENT_TYPE_ELEMENT && msg.source == (void *) vban_stream_writer
-            && msg.cmd == AEL_MSG_CMD_REPORT_MUSIC_INFO) {
-            audio_element_info_t music_info = {0};
-            audio_element_getinfo(vban_stream_writer, &music_info);
-
-            ESP_LOGI(TAG, "[ *REC ] Receive music info from VBan, sample_rates=%d, bits=%d, ch=%d, codec=%d",
-                     music_info.sample_rates, music_info.bits, music_info.channels, music_info.reserve_data.user_data_0);
-            if (music_info.reserve_data.user_data_0 == VBAN_CODEC_OPUS) {
-                ESP_LOGI(TAG, "[ *REC ] Should use the opus decoder!! TODO");
+        if (msg.source_type == SESSION_SOURCE_TYPE) {
+            if (msg.cmd == SESSION_CMD_STOP) {
+                break;
             }
-
-            audio_element_setinfo(i2s_stream_reader, &music_info);
-            i2s_stream_set_clk(i2s_stream_reader, music_info.sample_rates, music_info.bits, music_info.channels);
-            continue;
-        }
-
-        /* Stop when the last pipeline element (i2s_stream_reader in this case) receives stop event */
-        if (msg.source_type == AUDIO_ELEMENT_TYPE_ELEMENT && msg.source == (void *) i2s_stream_reader
-            && msg.cmd == AEL_MSG_CMD_REPORT_STATUS && (int) msg.data == AEL_STATUS_STATE_STOPPED) {
-            ESP_LOGW(TAG, "[ * ] Stop event received");
-            break;
+            if (msg.cmd == SESSION_CMD_WIFI) {
+                handle_wifi_event((int) msg.data);
+            } else if (msg.cmd == SESSION_CMD_LOAD_REPORT) {
+                task_profile_report();
+                report_relay();
+            } else if (msg.cmd == SESSION_CMD_STREAM) {
+                strncpy(g_service_manager->play_stream, (char *)msg.data, VBAN_STREAM_NAME_SIZE);
+                free(msg.data);
+            }
+        } else if (msg.source_type == AUDIO_ELEMENT_TYPE_ELEMENT) {
+            handle_element_event(&msg);
+        } else {
+            handle_periph_event(&msg);
         }
     }
 
-    ESP_LOGI(TAG, "[ 8 ] Stop audio_pipeline");
-    audio_pipeline_terminate(pipeline);
-
-    audio_pipeline_unregister(pipeline, vban_stream_writer);
-    audio_pipeline_unregister(pipeline, i2s_stream_reader);
-
-    /* Terminate the pipeline before removing the listener */
-    audio_pipeline_remove_listener(pipeline);
-
-    /* Stop all peripherals before removing the listener */
-    // esp_periph_set_stop_all(set); //donot stop periph set.
-    audio_event_iface_remove_listener(esp_periph_set_get_event_iface(set), evt);
-
-    /* Make sure audio_pipeline_remove_listener & audio_event_iface_remove_listener are called before destroying event_iface */
-    audio_event_iface_destroy(evt);
-
-    /* Release all resources */
-    audio_pipeline_deinit(pipeline);
-    audio_element_deinit(vban_stream_writer);
-    audio_element_deinit(i2s_stream_reader);
-
-    g_service_manager->rec_runing = false;
+    stop_session(&g_service_manager->play);
+    stop_session(&g_service_manager->rec);
+    xSemaphoreGive(g_service_manager->session_exited);
     vTaskDelete(NULL);
 }
 
@@ -388,45 +812,130 @@ void init_board_codec()
     ESP_LOGI(TAG, "[ 0 ] Start codec chip");
     audio_board_handle_t board_handle = audio_board_init();
     audio_hal_ctrl_codec(board_handle->audio_hal, AUDIO_HAL_CODEC_MODE_BOTH, AUDIO_HAL_CTRL_START);
+    boot_profile_mark(BOOT_CODEC);
+}
+
+#if CONFIG_TASK_LOAD_REPORT_S > 0
+static void post_load_report(void *arg)
+{
+    // the report walks every task, the session task runs it out of the timer task.
+    audio_event_iface_msg_t msg = {
+        .source_type = SESSION_SOURCE_TYPE,
+        .cmd = SESSION_CMD_LOAD_REPORT,
+    };
+    audio_event_iface_sendout(g_service_manager->session_cmd, &msg);
+}
+#endif
+
+static void release_manager(void)
+{
+    if (g_service_manager->load_timer != NULL) {
+        esp_timer_stop(g_service_manager->load_timer);
+        esp_timer_delete(g_service_manager->load_timer);
+    }
+    if (g_service_manager->wifi_service != NULL) {
+        wifi_service_destory2(g_service_manager->wifi_service);
+    }
+    if (g_service_manager->disp_service != NULL) {
+        display_service_destory(g_service_manager->disp_service);
+    }
+    if (g_service_manager->periph_set != NULL) {
+        esp_periph_set_stop_all(g_service_manager->periph_set);
+        audio_event_iface_remove_listener(esp_periph_set_get_event_iface(g_service_manager->periph_set),
+                                          g_service_manager->session_evt);
+        esp_periph_set_destroy(g_service_manager->periph_set);
+    }
+    if (g_service_manager->session_cmd != NULL) {
+        audio_event_iface_remove_listener(g_service_manager->session_cmd, g_service_manager->session_evt);
+        audio_event_iface_destroy(g_service_manager->session_cmd);
+    }
+    if (g_service_manager->session_evt != NULL) {
+        audio_event_iface_destroy(g_service_manager->session_evt);
+    }
+    if (g_service_manager->session_exited != NULL) {
+        vSemaphoreDelete(g_service_manager->session_exited);
+    }
+
+    stop_relay();
+    directory_release(&g_service_manager->directory);
+    serial_release(&g_service_manager->serial);
+    recorder_release(&g_service_manager->recorder);
+    free(g_service_manager);
+    g_service_manager = NULL;
 }
 
 esp_err_t manager_start_service()
 {
-    esp_periph_set_handle_t set = periph_set_init(periph_callback);
+    // allocated first: periph and wifi callbacks may run as soon as their service exists.
+    g_service_manager = calloc(1, sizeof(service_manager_t));
+    if (g_service_manager == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    strncpy(g_service_manager->play_stream, CONFIG_APP_STREAM_NAME, VBAN_STREAM_NAME_SIZE);
+
+    // the set holds the queues of both pipelines, the peripherals and the callbacks.
+    audio_event_iface_cfg_t evt_cfg = AUDIO_EVENT_IFACE_DEFAULT_CFG();
+    evt_cfg.queue_set_size = SESSION_QUEUE_SET_SIZE;
+    g_service_manager->session_evt = audio_event_iface_init(&evt_cfg);
+    audio_event_iface_cfg_t cmd_cfg = AUDIO_EVENT_IFACE_DEFAULT_CFG();
+    cmd_cfg.external_queue_size = SESSION_QUEUE_SIZE;
+    cmd_cfg.queue_set_size = 0;
+    g_service_manager->session_cmd = audio_event_iface_init(&cmd_cfg);
+    g_service_manager->session_exited = xSemaphoreCreateBinary();
+    if (g_service_manager->session_evt == NULL || g_service_manager->session_cmd == NULL
+        || g_service_manager->session_exited == NULL) {
+        ESP_LOGE(TAG, "Error create session queues!");
+        release_manager();
+        return ESP_ERR_NO_MEM;
+    }
+    audio_event_iface_set_listener(g_service_manager->session_cmd, g_service_manager->session_evt);
+
+    esp_periph_set_handle_t set = periph_set_init(NULL);
     if (set == NULL) {
         ESP_LOGE(TAG, "Error create periph set!");
+        release_manager();
         return ESP_FAIL;
     }
+    g_service_manager->periph_set = set;
+    audio_event_iface_set_listener(esp_periph_set_get_event_iface(set), g_service_manager->session_evt);
 
     display_service_handle_t disp = display_service_init();
     if (disp == NULL) {
         ESP_LOGE(TAG, "Error create display service!");
-        esp_periph_set_destroy(set);
+        release_manager();
         return ESP_FAIL;
     }
+    g_service_manager->disp_service = disp;
 
     periph_service_handle_t wifi = wifi_service_init(wifi_service_cb);
     if (wifi == NULL) {
         ESP_LOGE(TAG, "Error create wifi service!");
-        display_service_destory(disp);
-        esp_periph_set_destroy(set);
+        release_manager();
         return ESP_FAIL;
     }
-
-    g_service_manager = calloc(1, sizeof(service_manager_t));
-    if (g_service_manager == NULL) {
-        return ESP_ERR_NO_MEM;
-    }
-    g_service_manager->periph_set = set;
-    g_service_manager->disp_service = disp;
     g_service_manager->wifi_service = wifi;
-    g_service_manager->wifi_setting_flag = false;
-    g_service_manager->stream_play_flag = false;
-    g_service_manager->time_synced = false;
-    g_service_manager->play_runing = false;
-    g_service_manager->rec_runing = false;
 
+    // wifi events queue up meanwhile, the session task starts once the codec is ready.
     init_board_codec();
+    ESP_LOGI(TAG, "[ * ] Codec ready %d ms after boot", (int)(esp_timer_get_time() / 1000));
+    g_service_manager->codec_ready = true;
+
+    if (xTaskCreatePinnedToCore(session_task, "service_session_task", TASK_SESSION_STACK, NULL, TASK_SESSION_PRIO,
+                                &g_service_manager->session_task, TASK_SESSION_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Error create session task!");
+        release_manager();
+        return ESP_FAIL;
+    }
+
+#if CONFIG_TASK_LOAD_REPORT_S > 0
+    esp_timer_create_args_t timer_args = {
+        .callback = post_load_report,
+        .name = "load_report",
+    };
+    if (esp_timer_create(&timer_args, &g_service_manager->load_timer) == ESP_OK) {
+        esp_timer_start_periodic(g_service_manager->load_timer, CONFIG_TASK_LOAD_REPORT_S * 1000000LL);
+    }
+#endif
 
     periph_start_handle(set);
 
@@ -439,18 +948,17 @@ esp_err_t manager_stop_service()
         return ESP_OK;
     }
 
-    if (g_service_manager->disp_service != NULL) {
-        display_service_destory(g_service_manager->disp_service);
-    }
-    if (g_service_manager->wifi_service != NULL) {
-        wifi_service_destory2(g_service_manager->wifi_service);
-    }
-    if (g_service_manager->periph_set != NULL) {
-        esp_periph_set_stop_all(g_service_manager->periph_set);
-        esp_periph_set_destroy(g_service_manager->periph_set);
+    // the session task tears its pipelines down before it exits.
+    audio_event_iface_msg_t msg = {
+        .source_type = SESSION_SOURCE_TYPE,
+        .cmd = SESSION_CMD_STOP,
+    };
+    while (audio_event_iface_sendout(g_service_manager->session_cmd, &msg) != ESP_OK) {
+        vTaskDelay(10 / portTICK_PERIOD_MS);
     }
+    xSemaphoreTake(g_service_manager->session_exited, portMAX_DELAY);
 
-    free(g_service_manager);
+    release_manager();
 
     return ESP_OK;
-}
\ No newline at end of file
+}
@@ -0,0 +1,98 @@
+/*
+ * ESPRESSIF MIT License
+ *
+ * Copyright (c) 2020 INFOMEDIA
+ *
+ * Permission is hereby granted for use on all ESPRESSIF SYSTEMS products, in which case,
+ * it is free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "task_profile.h"
+
+static const char *TAG = "TASK_PROFILE";
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY && CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+
+// the status array of the previous report, to turn its counters into a load over the period.
+static TaskStatus_t *s_samples;
+static int s_sample_nb;
+static uint32_t s_total_time;
+
+static uint32_t previous_run_time(TaskHandle_t handle)
+{
+    for (int i = 0; i < s_sample_nb; i++) {
+        if (s_samples[i].xHandle == handle) {
+            return s_samples[i].ulRunTimeCounter;
+        }
+    }
+    return 0;
+}
+
+void task_profile_report(void)
+{
+    // uxTaskGetSystemState fills nothing when the array is too small: leave room for tasks created meanwhile.
+    UBaseType_t size = uxTaskGetNumberOfTasks() + 4;
+    TaskStatus_t *status = calloc(size, sizeof(TaskStatus_t));
+    if (status == NULL) {
+        ESP_LOGE(TAG, "no memory for the load report");
+        return;
+    }
+
+    uint32_t total_time = 0;
+    int nb = uxTaskGetSystemState(status, size, &total_time);
+    if (nb == 0) {
+        ESP_LOGW(TAG, "more than %d tasks, no load report", (int)size);
+        free(status);
+        return;
+    }
+    uint32_t elapsed = total_time - s_total_time;
+
+    ESP_LOGI(TAG, "%-16s core prio  load  free stack", "task");
+    for (int i = 0; i < nb; i++) {
+        // counters wrap, the unsigned difference stays right over one period.
+        uint32_t run_time = status[i].ulRunTimeCounter - previous_run_time(status[i].xHandle);
+        int load = elapsed ? (int)((uint64_t)run_time * 100 / elapsed) : 0;
+#if CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID
+        int core = (status[i].xCoreID == tskNO_AFFINITY) ? -1 : (int)status[i].xCoreID;
+#else
+        int core = -1;
+#endif
+        ESP_LOGI(TAG, "%-16s %4d %4d %4d%% %6d", status[i].pcTaskName, core, (int)status[i].uxCurrentPriority,
+                 load, (int)status[i].usStackHighWaterMark);
+    }
+
+    free(s_samples);
+    s_samples = status;
+    s_sample_nb = nb;
+    s_total_time = total_time;
+}
+
+#else
+
+void task_profile_report(void)
+{
+    ESP_LOGW(TAG, "enable FREERTOS_USE_TRACE_FACILITY and FREERTOS_GENERATE_RUN_TIME_STATS for the load report");
+}
+
+#endif
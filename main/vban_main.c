@@ -41,6 +41,7 @@
 #include "vban_stream.h"
 
 #include "manager.h"
+#include "boot_profile.h"
 
 /* The examples use simple WiFi configuration that you can set via
    'make menuconfig'.
@@ -124,7 +125,9 @@ static void wait_for_ip()
 
 void app_main()
 {
+    boot_profile_mark(BOOT_APP_MAIN);
     ESP_ERROR_CHECK( nvs_flash_init() );
+    boot_profile_mark(BOOT_NVS);
 
     // esp_log_level_set("*", ESP_LOG_ERROR);
     esp_log_level_set("*", ESP_LOG_INFO);
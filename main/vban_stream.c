@@ -32,10 +32,12 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 #include "freertos/task.h"
+#include "esp_timer.h"
 
 #include "audio_common.h"
 #include "audio_mem.h"
 #include "audio_element.h"
+#include "ringbuf.h"
 #include "wav_head.h"
 #include "esp_log.h"
 
@@ -46,7 +48,11 @@
 
 #include "i2s_stream.h"
 #include "vban_stream.h"
+#include "boot_profile.h"
 #include "socket.h"
+#include "fec.h"
+#include "receiver.h"
+#include "socket_engine.h"
 
 static const char *TAG = "VBAN_STREAM";
 
@@ -57,13 +63,8 @@ static const char *TAG = "VBAN_STREAM";
 #define SOCKET_MULTICAST_TTL        CONFIG_SOCKET_MULTICAST_TTL
 #define SOCKET_MULTICAST_ADDR       CONFIG_SOCKET_MULTICAST_ADDR
 
-struct stream_info_t
-{
-    VBanCodec               codec;
-    unsigned int            channels;
-    unsigned int            rates;
-    unsigned int            bits;
-};
+#define VBAN_STREAM_CHMAP_LOG_EVERY 256
+#define VBAN_STREAM_STATS_REPLY_MS  1000
 
 typedef struct vban_stream {
     audio_stream_type_t         type;
@@ -73,51 +74,347 @@ typedef struct vban_stream {
     struct socket_multicast_t   mcast_cfg;
     char                        stream_name[VBAN_STREAM_NAME_SIZE];
     bool                        is_init;
-    struct stream_info_t        stream_info;
+    struct receiver_format_t    stream_info;
+    fec_encoder_handle_t        fec_enc;
+    fec_decoder_handle_t        fec_dec;
+    pacer_handle_t              pacer;
+    struct pacer_config_t       pacer_cfg;
+    int                         latency_ms;
+    vban_stream_latency_plan_t  plan;
+    int                         out_rb_ms;
+    int                         rb_depth;
+    uint32_t                    rb_overflow;
+    SemaphoreHandle_t           format_ack;
+    uint32_t                    format_changes;
+    uint32_t                    handover_last_us;
+    uint32_t                    handover_max_us;
+    uint32_t                    handover_timeouts;
+    struct chmap_t              chmap;
+    struct chmap_t              pending_chmap;
+    volatile bool               remap;
+    uint32_t                    chmap_drops;
+    bool                        shared_socket;
+    socket_engine_handle_t      engine;
+    int                         engine_reader;
+    int                         source_timeout_ms;
+    char                        source_ip[SOCKET_IP_ADDRESS_SIZE];
+    int                         source_port;
+    struct socket_address_t     source;
+    char                        pending_source_ip[SOCKET_IP_ADDRESS_SIZE];
+    int                         pending_source_port;
+    volatile bool               relock;
+    int64_t                     source_last_us;
+    uint32_t                    foreign_rejected;
+    uint32_t                    source_switches;
+    directory_handle_t          directory;
+    char                        command_name[VBAN_STREAM_NAME_SIZE];
+    int                         command_reader;
+    command_handler_t           command_handler;
+    void                        *command_context;
+    uint32_t                    commands;
+    uint32_t                    commands_rejected;
+    uint32_t                    command_nu;
+    char                        controller_ip[SOCKET_IP_ADDRESS_SIZE];
+    struct socket_address_t     controller;
+    int64_t                     stats_reply_us;
+    volatile bool               rebind;
+    char                        pending_name[VBAN_STREAM_NAME_SIZE];
+    volatile bool               rename;
+    uint32_t                    rebinds;
+    serial_handle_t             serial;
+    int                         serial_reader;
+    int64_t                     rx_time_us;
+    struct latency_t            latency;
+    recorder_handle_t           recorder;
 } vban_stream_t;
 
-int check_info(char const* streamname, char const* buffer, struct stream_info_t* info)
+struct vban_command_ctx_t
+{
+    audio_element_handle_t          self;
+    vban_stream_t                   *vban;
+    struct socket_address_t const   *from;
+};
+
+static bool is_stream_packet(char const* streamname, char const* buffer, int size)
 {
     struct VBanHeader const* const hdr = PACKET_HEADER_PTR(buffer);
 
-    if ((streamname == 0) || (buffer == 0))
-    {
-        ESP_LOGE(TAG, "%s: null pointer argument", __func__);
-        return -EINVAL;
+    return (size > VBAN_HEADER_SIZE) && (hdr->vban == VBAN_HEADER_FOURC)
+        && (strncmp(streamname, hdr->streamname, VBAN_STREAM_NAME_SIZE) == 0);
+}
+
+esp_err_t vban_stream_plan_latency(int latency_ms, int sample_rate, int channels, int bits, vban_stream_latency_plan_t *plan)
+{
+    AUDIO_NULL_CHECK(TAG, plan, return ESP_FAIL);
+    if (latency_ms <= 0 || sample_rate <= 0 || channels <= 0 || bits <= 0) {
+        ESP_LOGE(TAG, "invalid latency plan: %d ms, rate:%d, channel:%d, bits:%d", latency_ms, sample_rate, channels, bits);
+        return ESP_FAIL;
+    }
+
+    VBanBitResolution bit_fmt = stream_parse_int_fmt(bits);
+    int sample_bytes = channels * VBanBitResolutionSize[bit_fmt < VBAN_BITFMT_64_FLOAT ? bit_fmt : VBAN_BITFMT_32_INT];
+    int samples = (int)(((int64_t)sample_rate * latency_ms) / (VBAN_STREAM_LATENCY_FRAMES * 1000));
+    if (samples > VBAN_SAMPLES_MAX_NB) {
+        samples = VBAN_SAMPLES_MAX_NB;
+    }
+    if (samples > VBAN_DATA_MAX_SIZE / sample_bytes) {
+        samples = VBAN_DATA_MAX_SIZE / sample_bytes;
+    }
+    if (samples < 1) {
+        samples = 1;
+    }
+
+    memset(plan, 0, sizeof(vban_stream_latency_plan_t));
+    plan->latency_ms = latency_ms;
+    plan->samples_per_frame = samples;
+    plan->frame_bytes = samples * sample_bytes;
+    plan->frame_us = (int)(((int64_t)samples * 1000000) / sample_rate);
+    plan->jitter_frames = VBAN_STREAM_JITTER_FRAMES;
+    plan->buf_sz = plan->frame_bytes;
+    plan->out_rb_size = plan->jitter_frames * plan->frame_bytes;
+
+    // whatever is left of the target goes to the DMA, in 2 buffers so one is always filling.
+    int dma_frames = VBAN_STREAM_LATENCY_FRAMES - 1 - VBAN_STREAM_JITTER_FRAMES;
+    plan->i2s_dma_buf_count = 2;
+    plan->i2s_dma_buf_len = (dma_frames * samples) / plan->i2s_dma_buf_count;
+    if (plan->i2s_dma_buf_len < 8) {
+        plan->i2s_dma_buf_len = 8;
+    } else if (plan->i2s_dma_buf_len > 1024) {
+        plan->i2s_dma_buf_len = 1024;
+    }
+
+    plan->budget_us = (1 + plan->jitter_frames) * plan->frame_us
+                      + (int)(((int64_t)plan->i2s_dma_buf_count * plan->i2s_dma_buf_len * 1000000) / sample_rate);
+
+    ESP_LOGI(TAG, "latency plan %d ms at %d Hz: %d samples/frame (%d us), jitter %d frames, rb %d, i2s dma %dx%d, budget %d us",
+             latency_ms, sample_rate, plan->samples_per_frame, plan->frame_us, plan->jitter_frames,
+             plan->out_rb_size, plan->i2s_dma_buf_count, plan->i2s_dma_buf_len, plan->budget_us);
+    return ESP_OK;
+}
+
+static void _vban_build_header(vban_stream_t *vban, audio_element_info_t const *info)
+{
+    struct stream_config_t stream_config;
+    stream_config.sample_rate = info->sample_rates;
+    stream_config.nb_channels = info->channels;
+    stream_config.bit_fmt = stream_parse_int_fmt(info->bits);
+
+    if (vban->latency_ms > 0) {
+        vban_stream_plan_latency(vban->latency_ms, info->sample_rates, info->channels, info->bits, &vban->plan);
+    }
+
+    // keep counting frames across a rebuild, receivers track losses with nuFrame.
+    uint32_t nu_frame = PACKET_HEADER_PTR(vban->buffer)->nuFrame;
+    packet_init_header(vban->buffer, &stream_config, vban->stream_name);
+    PACKET_HEADER_PTR(vban->buffer)->nuFrame = nu_frame;
+
+    vban->stream_info.rates = info->sample_rates;
+    vban->stream_info.channels = info->channels;
+    vban->stream_info.bits = info->bits;
+}
+
+static int _vban_open_shared(vban_stream_t *vban)
+{
+    // one socket per port for all vban elements: readers get their stream from it, writers send through it.
+    int ret = socket_engine_acquire(&vban->engine, vban->socket_cfg.port, vban->socket_cfg.ip_address, &vban->mcast_cfg);
+    if (ret != 0) {
+        return ret;
+    }
+
+    if (vban->type == AUDIO_STREAM_READER) {
+        vban->engine_reader = socket_engine_attach_reader(vban->engine, vban->stream_name, vban->socket_cfg.ip_address);
+        ret = vban->engine_reader < 0 ? vban->engine_reader : 0;
+        if (ret == 0 && vban->command_name[0]) {
+            // command frames are set aside by the engine and polled by this reader.
+            vban->command_reader = socket_engine_attach_reader(vban->engine, vban->command_name, NULL);
+            if (vban->command_reader < 0) {
+                ESP_LOGW(TAG, "no engine slot for command stream %s, commands ignored", vban->command_name);
+            }
+        }
+        if (ret == 0 && vban->serial) {
+            vban->serial_reader = socket_engine_attach_reader(vban->engine, serial_get_stream_name(vban->serial), NULL);
+            if (vban->serial_reader < 0) {
+                ESP_LOGW(TAG, "no engine slot for serial stream %s, serial data ignored", serial_get_stream_name(vban->serial));
+            }
+        }
+    } else {
+        ret = socket_engine_attach_writer(vban->engine, &vban->socket_cfg, &vban->socket);
+    }
+    if (ret != 0) {
+        socket_engine_release(&vban->engine);
+        return ret;
+    }
+    if (vban->directory) {
+        socket_engine_set_directory(vban->engine, vban->directory);
+    }
+
+    // extra groups are joined on the engine socket, its joins are counted per element.
+    unsigned int index;
+    for (index = 0; index < vban->socket_cfg.nb_groups; index++) {
+        socket_join_source_group(socket_engine_get_socket(vban->engine), vban->socket_cfg.groups[index].group,
+                                 vban->socket_cfg.groups[index].source);
+    }
+    return 0;
+}
+
+static void _vban_close_shared(vban_stream_t *vban)
+{
+    if (vban->engine == NULL) {
+        return;
+    }
+    unsigned int index;
+    for (index = 0; index < vban->socket_cfg.nb_groups; index++) {
+        socket_leave_source_group(socket_engine_get_socket(vban->engine), vban->socket_cfg.groups[index].group,
+                                  vban->socket_cfg.groups[index].source);
+    }
+    if (vban->type == AUDIO_STREAM_READER) {
+        socket_engine_detach_reader(vban->engine, vban->engine_reader);
+        socket_engine_detach_reader(vban->engine, vban->command_reader);
+        vban->command_reader = -1;
+        socket_engine_detach_reader(vban->engine, vban->serial_reader);
+        vban->serial_reader = -1;
+    } else {
+        socket_release(&vban->socket);
+    }
+    socket_engine_release(&vban->engine);
+}
+
+static socket_handle_t _vban_socket(vban_stream_t *vban)
+{
+    return (vban->engine && vban->type == AUDIO_STREAM_READER) ? socket_engine_get_socket(vban->engine) : vban->socket;
+}
+
+static void _vban_lock_source(vban_stream_t *vban)
+{
+    memset(&vban->source, 0, sizeof(struct socket_address_t));
+    socket_handle_t socket = _vban_socket(vban);
+    if (vban->source_ip[0] && socket
+        && socket_get_address(socket, vban->source_ip, vban->source_port, &vban->source) != 0) {
+        ESP_LOGE(TAG, "bad source %s, locking onto the first sender", vban->source_ip);
+    }
+    memset(&vban->controller, 0, sizeof(struct socket_address_t));
+    if (vban->controller_ip[0] && socket
+        && socket_get_address(socket, vban->controller_ip, 0, &vban->controller) != 0) {
+        ESP_LOGE(TAG, "bad controller %s, commands ignored", vban->controller_ip);
     }
+}
 
-    if (hdr->vban != VBAN_HEADER_FOURC)
-    {
-        ESP_LOGE(TAG, "%s: invalid vban magic fourc", __func__);
-        return -EINVAL;
+static void _vban_swap_chmap(vban_stream_t *vban)
+{
+    vban->remap = false;
+    vban->chmap = vban->pending_chmap;
+    // forget the channel count so the next packet reports the mapped format.
+    vban->stream_info.channels = 0;
+}
+
+static void _vban_stage_chmap(vban_stream_t *vban)
+{
+    if (vban->is_init) {
+        // the reader task maps every payload, it swaps the map on its next read.
+        vban->remap = true;
+    } else {
+        _vban_swap_chmap(vban);
     }
+}
 
-    if (strncmp(streamname, hdr->streamname, VBAN_STREAM_NAME_SIZE))
-    {
-        ESP_LOGE(TAG, "%s: different streamname", __func__);
-        return -EINVAL;
+static bool _vban_accept_source(vban_stream_t *vban, struct socket_address_t const *from)
+{
+    int64_t now = esp_timer_get_time();
+
+    if (vban->source.len != 0 && !socket_address_match(&vban->source, from)) {
+        if (vban->source_ip[0] || now - vban->source_last_us < (int64_t)vban->source_timeout_ms * 1000) {
+            vban->foreign_rejected++;
+            return false;
+        }
+        // the locked sender went silent, follow the one that took over.
+        vban->source_switches++;
+        vban->source.len = 0;
+        ESP_LOGW(TAG, "stream %.16s switched to another sender", vban->stream_name);
     }
 
-    VBanCodec codec = hdr->format_bit & VBAN_CODEC_MASK;
-    unsigned int nb_channels = hdr->format_nbc + 1;
-    unsigned int sample_rate = VBanSRList[hdr->format_SR & VBAN_SR_MASK];
-    unsigned int bit_fmt = stream_int_bit_fmt(hdr->format_bit & VBAN_BIT_RESOLUTION_MASK);
-    if (info->codec != codec) {
-        info->codec = codec;
-        info->channels = nb_channels;
-        info->rates = sample_rate;
-        info->bits = bit_fmt;
-        return 1;
-    } else if (info->channels != nb_channels || info->rates != sample_rate || info->bits != bit_fmt) {
-        info->channels = nb_channels;
-        info->rates = sample_rate;
-        info->bits = bit_fmt;
-        return 2;
+    if (vban->source.len == 0) {
+        vban->source = *from;
     }
+    vban->source_last_us = now;
+    return true;
+}
 
+static int _vban_open_socket(vban_stream_t *vban)
+{
+    int ret = vban->shared_socket ? _vban_open_shared(vban)
+              : socket_init(&(vban->socket), &(vban->socket_cfg), &(vban->mcast_cfg));
+    if (ret == -EAFNOSUPPORT) {
+        // the port is shared in the other family, this element keeps a socket of its own.
+        ESP_LOGW(TAG, "%s:%d not shared, opening its own socket", vban->socket_cfg.ip_address, vban->socket_cfg.port);
+        ret = socket_init(&(vban->socket), &(vban->socket_cfg), &(vban->mcast_cfg));
+    }
+    if (ret != 0) {
+        return ret;
+    }
+
+    if (vban->type == AUDIO_STREAM_READER) {
+        if (vban->engine == NULL) {
+            // come back from recv now and then, to notice a pause or a rebind.
+            socket_set_timeout(vban->socket, VBAN_STREAM_READ_TIMEOUT_MS);
+        }
+        _vban_lock_source(vban);
+        if (vban->serial) {
+            serial_attach(vban->serial, _vban_socket(vban));
+        }
+    }
     return 0;
 }
 
+static void _vban_close_socket(vban_stream_t *vban)
+{
+    if (vban->serial) {
+        serial_attach(vban->serial, NULL);
+    }
+    _vban_close_shared(vban);
+    socket_release(&(vban->socket));
+}
+
+static void _vban_rebind(vban_stream_t *vban)
+{
+    // the elements, buffers and tasks stay, only the socket follows the new network.
+    _vban_close_socket(vban);
+    if (_vban_open_socket(vban) != 0) {
+        ESP_LOGE(TAG, "rebind failed, retrying");
+        vTaskDelay(pdMS_TO_TICKS(VBAN_STREAM_READ_TIMEOUT_MS));
+        return;
+    }
+    if (vban->fec_dec) {
+        fec_decoder_reset(vban->fec_dec);
+    }
+    // the ringbuffer was reset while parked.
+    latency_resync(&vban->latency);
+    vban->rebind = false;
+    vban->rebinds++;
+    ESP_LOGI(TAG, "socket rebound on %s:%d", vban->socket_cfg.ip_address, vban->socket_cfg.port);
+}
+
+static void _vban_switch_stream(vban_stream_t *vban)
+{
+    // names fill all VBAN_STREAM_NAME_SIZE bytes, with no terminator when 16 long.
+    memcpy(vban->stream_name, vban->pending_name, VBAN_STREAM_NAME_SIZE);
+    vban->rename = false;
+    // the new stream is reported again and its first sender locked.
+    vban->stream_info.channels = 0;
+    latency_clear(&vban->latency);
+    if (vban->is_init) {
+        _vban_lock_source(vban);
+        if (vban->engine) {
+            socket_engine_detach_reader(vban->engine, vban->engine_reader);
+            vban->engine_reader = socket_engine_attach_reader(vban->engine, vban->stream_name, vban->socket_cfg.ip_address);
+            if (vban->engine_reader < 0) {
+                ESP_LOGE(TAG, "could not switch to stream %.16s", vban->stream_name);
+                return;
+            }
+        }
+    }
+    ESP_LOGI(TAG, "playing stream %.16s", vban->stream_name);
+}
+
 static esp_err_t _vban_open(audio_element_handle_t self)
 {
     vban_stream_t *vban = (vban_stream_t *)audio_element_getdata(self);
@@ -130,22 +427,33 @@ static esp_err_t _vban_open(audio_element_handle_t self)
     }
     ESP_LOGI(TAG, "_vban_open, uri:%s", uri);
 
-    const char* lcolon = strchr(uri, ':');
+    /* the port follows the last colon, an IPV6 address is written in brackets: [ADDR]:PORT */
+    const char* lcolon = strrchr(uri, ':');
     if (!lcolon || lcolon == uri || !lcolon[1]) {
         ESP_LOGE(TAG, "parse port: bad format: expected ADDR:PORT");
         return ESP_FAIL;
     }
 
     const char* addr = NULL;
+    const char* addr_begin = uri;
+    const char* addr_end = lcolon;
+    if (*uri == '[') {
+        if (lcolon[-1] != ']') {
+            ESP_LOGE(TAG, "parse port: bad format: expected [ADDR]:PORT");
+            return ESP_FAIL;
+        }
+        ++addr_begin;
+        --addr_end;
+    }
 
     char addr_buf[256] = {};
-    if ((lcolon - uri) > sizeof(addr_buf) - 1) {
+    if ((addr_end - addr_begin) > sizeof(addr_buf) - 1) {
         ESP_LOGE(TAG, "parse port: bad address: too long");
         return ESP_FAIL;
     }
 
-    memcpy(addr_buf, uri, (lcolon - uri));
-    addr_buf[lcolon - uri] = '\0';
+    memcpy(addr_buf, addr_begin, (addr_end - addr_begin));
+    addr_buf[addr_end - addr_begin] = '\0';
     addr = addr_buf;
 
     const char* port = &lcolon[1];
@@ -170,18 +478,12 @@ static esp_err_t _vban_open(audio_element_handle_t self)
 
     ESP_LOGI(TAG, "_vban_open, ip:%s, port=%d", addr, (int)port_num);
 
-    strncpy(vban->stream_name, APP_STREAM_NAME, VBAN_STREAM_NAME_SIZE-1);
     strncpy(vban->socket_cfg.ip_address, addr, SOCKET_IP_ADDRESS_SIZE-1);
     vban->socket_cfg.port = (int)port_num;
     vban->socket_cfg.direction = vban->type == AUDIO_STREAM_READER ? SOCKET_IN : SOCKET_OUT;
     if (vban->type == AUDIO_STREAM_WRITER) {
-        struct stream_config_t stream_config;
-        stream_config.sample_rate = info.sample_rates;
-        stream_config.nb_channels = info.channels;
-        stream_config.bit_fmt = stream_parse_int_fmt(info.bits);
-        ESP_LOGI(TAG, "open %s rate:%d, channel:%d, bits:%d", vban->stream_name, info.sample_rates, info.channels, info.bits);
-
-        packet_init_header(vban->buffer, &stream_config, vban->stream_name);
+        ESP_LOGI(TAG, "open %.16s rate:%d, channel:%d, bits:%d", vban->stream_name, info.sample_rates, info.channels, info.bits);
+        _vban_build_header(vban, &info);
     }
 
     vban->mcast_cfg.default_if = SOCKET_MULTICAST_DEFAULT_IF;
@@ -189,16 +491,280 @@ static esp_err_t _vban_open(audio_element_handle_t self)
     vban->mcast_cfg.ttl = SOCKET_MULTICAST_TTL;
     strncpy(vban->mcast_cfg.multicast_address, SOCKET_MULTICAST_ADDR, SOCKET_IP_ADDRESS_SIZE-1);
 
-    int ret = socket_init(&(vban->socket), &(vban->socket_cfg), &(vban->mcast_cfg));
+    int ret = _vban_open_socket(vban);
     if (ret != 0) {
         ESP_LOGE(TAG, "Failed to open vban socket");
         return ESP_FAIL;
     }
 
+    if (vban->type == AUDIO_STREAM_WRITER && vban->pacer_cfg.depth > 0) {
+        vban->pacer_cfg.socket = vban->socket;
+        ret = pacer_init(&vban->pacer, &vban->pacer_cfg);
+        if (ret != 0) {
+            ESP_LOGW(TAG, "Failed to start pacer, frames will be sent unpaced");
+        }
+    }
+
     vban->is_init = true;
     return audio_element_setinfo(self, &info);
 }
 
+static void _vban_send(vban_stream_t *vban, char const *packet, int size, int sample_rate)
+{
+    if (vban->pacer == NULL) {
+        // Just send buffer to UDP, nomatter what it's OK or not.
+        socket_write(vban->socket, packet, size);
+        return;
+    }
+
+    struct VBanHeader const* const hdr = PACKET_HEADER_PTR(packet);
+    uint32_t duration_us = 0;
+    if (!fec_is_parity(packet, size) && sample_rate > 0) {
+        duration_us = (uint32_t)(((uint64_t)(hdr->format_nbs + 1) * 1000000) / sample_rate);
+    }
+    pacer_push(vban->pacer, packet, size, duration_us);
+}
+
+static void _vban_size_ringbuf(audio_element_handle_t self, vban_stream_t *vban, audio_element_info_t *info)
+{
+    ringbuf_handle_t rb = audio_element_get_output_ringbuf(self);
+    if (rb == NULL) {
+        return;
+    }
+
+    int depth = 0;
+    if (vban->latency_ms > 0) {
+        depth = vban->plan.out_rb_size;
+    } else if (vban->out_rb_ms > 0) {
+        int frame_size = info->channels * (info->bits / 8);
+        depth = (int)(((int64_t)info->sample_rates * vban->out_rb_ms) / 1000) * frame_size;
+    }
+
+    // a single packet larger than the depth would be dropped every time.
+    if (depth > 0 && depth < VBAN_DATA_MAX_SIZE) {
+        ESP_LOGW(TAG, "ringbuffer depth %d for %d Hz %d ch %d bits raised to one packet, %d",
+                 depth, info->sample_rates, info->channels, info->bits, VBAN_DATA_MAX_SIZE);
+        depth = VBAN_DATA_MAX_SIZE;
+    }
+
+    // the ringbuffer is shared with the next element and can't be swapped under it:
+    // its allocation is the ceiling, only the used depth follows the format.
+    int capacity = rb_get_size(rb);
+    if (depth > capacity) {
+        ESP_LOGW(TAG, "ringbuffer depth %d for %d Hz %d ch %d bits capped to %d",
+                 depth, info->sample_rates, info->channels, info->bits, capacity);
+        depth = capacity;
+    }
+    vban->rb_depth = depth;
+    ESP_LOGI(TAG, "ringbuffer depth %d/%d bytes", depth, capacity);
+}
+
+static void _vban_handover(audio_element_handle_t self, vban_stream_t *vban)
+{
+    int64_t start = esp_timer_get_time();
+
+    // old format samples must not be clocked out at the new rate: let the sink drain them.
+    ringbuf_handle_t rb = audio_element_get_output_ringbuf(self);
+    if (rb) {
+        TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(VBAN_STREAM_DRAIN_TIMEOUT_MS);
+        while (rb_bytes_filled(rb) > 0 && (int)(deadline - xTaskGetTickCount()) > 0) {
+            vTaskDelay(1);
+        }
+        if (rb_bytes_filled(rb) > 0) {
+            ESP_LOGW(TAG, "format change: %d old format bytes discarded", rb_bytes_filled(rb));
+            rb_reset(rb);
+            latency_resync(&vban->latency);
+        }
+    }
+
+    xSemaphoreTake(vban->format_ack, 0);
+    audio_element_report_info(self);
+    if (xSemaphoreTake(vban->format_ack, pdMS_TO_TICKS(VBAN_STREAM_HANDOVER_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGW(TAG, "format change not acknowledged by the sink");
+        vban->handover_timeouts++;
+    }
+
+    vban->format_changes++;
+    vban->handover_last_us = (uint32_t)(esp_timer_get_time() - start);
+    if (vban->handover_last_us > vban->handover_max_us) {
+        vban->handover_max_us = vban->handover_last_us;
+    }
+    ESP_LOGI(TAG, "format change handover took %u us", vban->handover_last_us);
+}
+
+static void _vban_get_stats(vban_stream_t *vban, vban_stream_stats_t *stats)
+{
+    struct fec_stats_t fec_stats = {0};
+    if (vban->fec_enc) {
+        fec_encoder_get_stats(vban->fec_enc, &fec_stats);
+    } else if (vban->fec_dec) {
+        fec_decoder_get_stats(vban->fec_dec, &fec_stats);
+    }
+
+    memset(stats, 0, sizeof(vban_stream_stats_t));
+    stats->fec_parity_sent = fec_stats.parity_sent;
+    stats->fec_parity_received = fec_stats.parity_received;
+    stats->fec_recovered = fec_stats.recovered;
+    stats->fec_unrecoverable = fec_stats.unrecoverable;
+
+    stats->format_changes = vban->format_changes;
+    stats->handover_last_us = vban->handover_last_us;
+    stats->handover_max_us = vban->handover_max_us;
+    stats->handover_timeouts = vban->handover_timeouts;
+    stats->rb_depth = vban->rb_depth;
+    stats->rb_overflow = vban->rb_overflow;
+    stats->foreign_rejected = vban->foreign_rejected;
+    stats->source_switches = vban->source_switches;
+    stats->commands = vban->commands;
+    stats->commands_rejected = vban->commands_rejected;
+    stats->rebinds = vban->rebinds;
+    struct latency_stats_t latency;
+    latency_get_stats(&vban->latency, &latency);
+    stats->latency_count = latency.count;
+    stats->latency_untagged = latency.untagged;
+    stats->latency_min_us = latency.min_us;
+    stats->latency_p50_us = latency.p50_us;
+    stats->latency_p99_us = latency.p99_us;
+    stats->latency_max_us = latency.max_us;
+
+    socket_handle_t socket = _vban_socket(vban);
+    if (socket) {
+        struct socket_stats_t socket_stats;
+        socket_get_stats(socket, &socket_stats);
+        stats->groups = socket_stats.nb_groups;
+        stats->source_rejected = socket_stats.source_rejected;
+    }
+
+    if (vban->pacer) {
+        struct pacer_stats_t pacer_stats;
+        pacer_get_stats(vban->pacer, &pacer_stats);
+        stats->pace_depth = pacer_stats.depth;
+        stats->pace_max_depth = pacer_stats.max_depth;
+        stats->pace_sent = pacer_stats.sent;
+        stats->pace_dropped = pacer_stats.dropped;
+        memcpy(stats->pace_gap_hist, pacer_stats.gap_hist, sizeof(stats->pace_gap_hist));
+    }
+}
+
+static bool _vban_is_serial(vban_stream_t *vban, char const *packet, int size)
+{
+    return vban->serial && is_stream_packet(serial_get_stream_name(vban->serial), packet, size)
+           && (PACKET_HEADER_PTR(packet)->format_SR & VBAN_PROTOCOL_MASK) == VBAN_PROTOCOL_SERIAL;
+}
+
+static void _vban_serial(vban_stream_t *vban, char const *packet, int size, struct socket_address_t const *from)
+{
+    if (packet_check(serial_get_stream_name(vban->serial), packet, size) == 0) {
+        serial_push(vban->serial, packet, size, from);
+    }
+}
+
+static bool _vban_is_command(vban_stream_t *vban, char const *packet, int size)
+{
+    return vban->command_name[0] && is_stream_packet(vban->command_name, packet, size)
+           && (PACKET_HEADER_PTR(packet)->format_SR & VBAN_PROTOCOL_MASK) == VBAN_PROTOCOL_TXT;
+}
+
+static void _vban_reply_stats(vban_stream_t *vban, struct socket_address_t const *to)
+{
+    // a text packet can come back much larger than the request, don't let it be pumped.
+    int64_t now = esp_timer_get_time();
+    if (vban->stats_reply_us != 0 && now - vban->stats_reply_us < VBAN_STREAM_STATS_REPLY_MS * 1000) {
+        return;
+    }
+    vban->stats_reply_us = now;
+
+    char reply[VBAN_HEADER_SIZE + 256];
+    char text[256];
+    vban_stream_stats_t stats;
+    _vban_get_stats(vban, &stats);
+
+    int size = snprintf(text, sizeof(text),
+                        "stream=%.16s rate=%u channels=%u bits=%u latency=%d rb_depth=%u rb_overflow=%u "
+                        "fec_recovered=%u fec_unrecoverable=%u format_changes=%u foreign_rejected=%u "
+                        "source_switches=%u source_rejected=%u commands=%u/%u latency_us=%u/%u/%u/%u",
+                        vban->stream_name, vban->stream_info.rates, vban->stream_info.channels, vban->stream_info.bits,
+                        vban->latency_ms, stats.rb_depth, stats.rb_overflow, stats.fec_recovered, stats.fec_unrecoverable,
+                        stats.format_changes, stats.foreign_rejected, stats.source_switches, stats.source_rejected,
+                        stats.commands, stats.commands_rejected, stats.latency_min_us, stats.latency_p50_us, stats.latency_p99_us,
+                        stats.latency_max_us);
+    if (size < 0) {
+        return;
+    }
+    if (size >= sizeof(text)) {
+        size = sizeof(text) - 1;
+    }
+
+    size = packet_init_text(reply, vban->command_name, vban->command_nu++, text, size);
+    if (size > 0 && socket_write_to(_vban_socket(vban), reply, size, to) < 0) {
+        ESP_LOGW(TAG, "could not answer stats request");
+    }
+}
+
+static void _vban_set_latency(audio_element_handle_t self, vban_stream_t *vban, int latency_ms)
+{
+    audio_element_info_t info;
+    audio_element_getinfo(self, &info);
+
+    vban->latency_ms = latency_ms;
+    if (latency_ms > 0 && vban->stream_info.channels > 0) {
+        vban_stream_plan_latency(latency_ms, info.sample_rates, info.channels, info.bits, &vban->plan);
+    }
+    _vban_size_ringbuf(self, vban, &info);
+}
+
+static void _vban_on_command(struct command_t const *command, void *context)
+{
+    struct vban_command_ctx_t *ctx = (struct vban_command_ctx_t *)context;
+    vban_stream_t *vban = ctx->vban;
+
+    switch (command->id) {
+        case COMMAND_STREAM:
+            vban_stream_set_stream_name(ctx->self, command->text);
+            break;
+        case COMMAND_LATENCY:
+            _vban_set_latency(ctx->self, vban, command->value);
+            break;
+        case COMMAND_STATS:
+            _vban_reply_stats(vban, ctx->from);
+            break;
+        default:
+            break;
+    }
+    vban->commands++;
+
+    if (vban->command_handler) {
+        vban->command_handler(command, vban->command_context);
+    }
+}
+
+static bool _vban_accept_command(vban_stream_t *vban, struct socket_address_t const *from)
+{
+    // the controller if there is one, else the sender the stream is locked to, else anyone.
+    if (vban->controller_ip[0]) {
+        return vban->controller.len != 0 && socket_address_match(&vban->controller, from);
+    }
+    if ((vban->source_timeout_ms > 0 || vban->source_ip[0]) && vban->source.len != 0) {
+        return socket_address_match(&vban->source, from);
+    }
+    return true;
+}
+
+static void _vban_command(audio_element_handle_t self, vban_stream_t *vban, char const *packet, int size,
+                          struct socket_address_t const *from)
+{
+    if (packet_check(vban->command_name, packet, size) != 0) {
+        return;
+    }
+    if (!_vban_accept_command(vban, from)) {
+        vban->commands_rejected++;
+        return;
+    }
+
+    struct vban_command_ctx_t ctx = { self, vban, from };
+    command_parse(PACKET_PAYLOAD_PTR(packet), PACKET_PAYLOAD_SIZE(size), _vban_on_command, &ctx);
+}
+
 static int _vban_read(audio_element_handle_t self, char *buffer, int len, TickType_t ticks_to_wait, void *context)
 {
     vban_stream_t *vban = (vban_stream_t *)audio_element_getdata(self);
@@ -207,13 +773,110 @@ static int _vban_read(audio_element_handle_t self, char *buffer, int len, TickTy
     ESP_LOGD(TAG, "read len=%d, pos=%d/%d", len, (int)info.byte_pos, (int)info.total_bytes);
 
     int payload_size = 0;
-    int size = socket_read(vban->socket, vban->buffer, VBAN_PROTOCOL_MAX_SIZE);
-    if (size < 0) {
-        ESP_LOGE(TAG, "socket_read failed: errno %d", errno);
-        return 0;
+    int size = 0;
+    char const* packet = vban->buffer;
+    struct socket_address_t from;
+
+    if (vban->rebind) {
+        _vban_rebind(vban);
+        if (vban->rebind) {
+            return AEL_IO_TIMEOUT;
+        }
+    }
+    if (vban->rename) {
+        _vban_switch_stream(vban);
+    }
+    if (vban->remap) {
+        _vban_swap_chmap(vban);
+    }
+    if (vban->relock) {
+        vban->relock = false;
+        memcpy(vban->source_ip, vban->pending_source_ip, SOCKET_IP_ADDRESS_SIZE);
+        vban->source_port = vban->pending_source_port;
+        _vban_lock_source(vban);
+    }
+
+    if (vban->engine && vban->command_reader >= 0) {
+        // bounded by the engine pending frames, commands are rare.
+        while ((size = socket_engine_read_pending(vban->engine, vban->command_reader, vban->buffer,
+                                                  VBAN_PROTOCOL_MAX_SIZE, &from)) > 0) {
+            if (vban->recorder) {
+                recorder_push(vban->recorder, vban->buffer, size, esp_timer_get_time(), &from);
+            }
+            _vban_command(self, vban, vban->buffer, size, &from);
+        }
     }
+    if (vban->engine && vban->serial_reader >= 0) {
+        while ((size = socket_engine_read_pending(vban->engine, vban->serial_reader, vban->buffer,
+                                                  VBAN_PROTOCOL_MAX_SIZE, &from)) > 0) {
+            if (vban->recorder) {
+                recorder_push(vban->recorder, vban->buffer, size, esp_timer_get_time(), &from);
+            }
+            _vban_serial(vban, vban->buffer, size, &from);
+        }
+    }
+
+    while (1) {
+        if (vban->fec_dec) {
+            size_t fec_size = 0;
+            packet = fec_decoder_pop(vban->fec_dec, &fec_size);
+            if (packet) {
+                size = fec_size;
+                break;
+            }
+            packet = vban->buffer;
+        }
+
+        if (vban->engine) {
+            size = socket_engine_read(vban->engine, vban->engine_reader, vban->buffer, VBAN_PROTOCOL_MAX_SIZE, &from);
+            if (size == -EAGAIN) {
+                // nothing for this stream yet, the socket is shared.
+                return AEL_IO_TIMEOUT;
+            }
+            vban->rx_time_us = socket_engine_get_rx_time(vban->engine, vban->engine_reader);
+        } else {
+            size = socket_read_from(vban->socket, vban->buffer, VBAN_PROTOCOL_MAX_SIZE, &from);
+            if (vban->directory && size > 0) {
+                directory_update(vban->directory, vban->buffer, size, &from);
+            }
+            vban->rx_time_us = socket_get_rx_time(vban->socket);
+        }
+        if (size < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return AEL_IO_TIMEOUT;
+            }
+            // the network went away under the socket: keep the element, a rebind brings it back.
+            ESP_LOGE(TAG, "socket_read failed: errno %d", errno);
+            vTaskDelay(pdMS_TO_TICKS(VBAN_STREAM_READ_TIMEOUT_MS));
+            return AEL_IO_TIMEOUT;
+        }
+        if (vban->recorder) {
+            // does nothing outside a capture, never waits for the card.
+            recorder_push(vban->recorder, vban->buffer, size, vban->rx_time_us, &from);
+        }
 
-    int ret = check_info(vban->stream_name, vban->buffer, &(vban->stream_info));
+        if (_vban_is_command(vban, vban->buffer, size)) {
+            _vban_command(self, vban, vban->buffer, size, &from);
+            continue;
+        }
+        if (_vban_is_serial(vban, vban->buffer, size)) {
+            _vban_serial(vban, vban->buffer, size, &from);
+            continue;
+        }
+
+        if ((vban->source_timeout_ms > 0 || vban->source_ip[0])
+            && is_stream_packet(vban->stream_name, vban->buffer, size) && !_vban_accept_source(vban, &from)) {
+            // same stream name from another host, its frames would interleave with the locked sender.
+            continue;
+        }
+
+        // the frames given to the FEC decoder come out of it at the top of the loop.
+        if (receiver_demux(vban->stream_name, vban->fec_dec, vban->buffer, size) == RECEIVER_PLAY) {
+            break;
+        }
+    }
+
+    int ret = receiver_check_format(packet, size, &(vban->stream_info));
     if (ret < 0) {
         ESP_LOGE(TAG, "socket read invalid stream");
         return 0;
@@ -224,8 +887,15 @@ static int _vban_read(audio_element_handle_t self, char *buffer, int len, TickTy
         info.byte_pos += payload_size;
         if (ret > 0) {
             info.sample_rates = vban->stream_info.rates;
-            info.channels = vban->stream_info.channels;
+            info.channels = vban->chmap.mode != CHMAP_NONE ? vban->chmap.out_channels : vban->stream_info.channels;
             info.bits = vban->stream_info.bits;
+            if (vban->fec_dec) {
+                fec_decoder_reset(vban->fec_dec);
+            }
+            if (vban->latency_ms > 0) {
+                vban_stream_plan_latency(vban->latency_ms, info.sample_rates, info.channels, info.bits, &vban->plan);
+            }
+            _vban_size_ringbuf(self, vban, &info);
             if (ret == 1 && vban->stream_info.codec != VBAN_CODEC_PCM) {
                 info.reserve_data.user_data_0 = VBAN_CODEC_OPUS;
             }
@@ -234,11 +904,21 @@ static int _vban_read(audio_element_handle_t self, char *buffer, int len, TickTy
         }
 
         if (report) {
-            audio_element_report_info(self);
+            _vban_handover(self, vban);
         }
 
-        //copy the received data to buffer
-        memcpy(buffer, PACKET_PAYLOAD_PTR(vban->buffer), payload_size);
+        // only the mapped channels leave the packet, straight into the output layout.
+        payload_size = receiver_payload(packet, size, &vban->chmap, buffer, len);
+        if (payload_size == -ENOSPC) {
+            ESP_LOGW(TAG, "payload %d doesn't fit in element buffer %d, dropped", (int)PACKET_PAYLOAD_SIZE(size), len);
+            return AEL_IO_TIMEOUT;
+        } else if (payload_size < 0) {
+            if ((vban->chmap_drops++ % VBAN_STREAM_CHMAP_LOG_EVERY) == 0) {
+                ESP_LOGW(TAG, "channel map failed on %d channels, %u dropped so far", vban->stream_info.channels,
+                         vban->chmap_drops);
+            }
+            return AEL_IO_TIMEOUT;
+        }
     }
     // if (packet_check(vban->stream_name, vban->buffer, size) == 0) {
     //     struct stream_config_t stream_config;
@@ -258,6 +938,10 @@ static int _vban_read(audio_element_handle_t self, char *buffer, int len, TickTy
     //     payload_size = PACKET_PAYLOAD_SIZE(size);
     //     memcpy(buffer, PACKET_PAYLOAD_PTR(vban->buffer), payload_size);
     // }
+    if (payload_size > 0) {
+        // a no-op once marked, rearmed on reconnection.
+        boot_profile_mark(BOOT_FIRST_PACKET);
+    }
     return payload_size;
 }
 
@@ -267,13 +951,33 @@ static int _vban_write(audio_element_handle_t self, char *buffer, int len, TickT
     audio_element_info_t info;
     audio_element_getinfo(self, &info);
 
-    memcpy(PACKET_PAYLOAD_PTR(vban->buffer), buffer, len);
-    packet_set_new_content(vban->buffer, len);
+    // upstream was reclocked: relabel the frames from now on, without restarting.
+    if (info.sample_rates != vban->stream_info.rates || info.channels != vban->stream_info.channels
+        || info.bits != vban->stream_info.bits) {
+        ESP_LOGI(TAG, "format change %.16s rate:%d, channel:%d, bits:%d", vban->stream_name, info.sample_rates, info.channels, info.bits);
+        _vban_build_header(vban, &info);
+        vban->format_changes++;
+    }
 
-    int packet_size = len + sizeof(struct VBanHeader);
-    if (packet_check(vban->stream_name, vban->buffer, packet_size) == 0) {
-        // Just send buffer to UDP, nomatter what it's OK or not.
-        socket_write(vban->socket, vban->buffer, packet_size);
+    // split the upstream buffer in frames of the planned size, or as big as VBAN allows.
+    int frame_bytes = vban->plan.frame_bytes > 0 ? vban->plan.frame_bytes : packet_get_max_payload_size(vban->buffer);
+    for (int offset = 0; offset < len; offset += frame_bytes) {
+        int chunk = (len - offset) > frame_bytes ? frame_bytes : (len - offset);
+        memcpy(PACKET_PAYLOAD_PTR(vban->buffer), buffer + offset, chunk);
+        packet_set_new_content(vban->buffer, chunk);
+
+        int packet_size = chunk + sizeof(struct VBanHeader);
+        if (packet_check(vban->stream_name, vban->buffer, packet_size) != 0) {
+            continue;
+        }
+        _vban_send(vban, vban->buffer, packet_size, info.sample_rates);
+
+        if (vban->fec_enc) {
+            int parity_size = fec_encoder_add(vban->fec_enc, vban->buffer, packet_size);
+            if (parity_size > 0) {
+                _vban_send(vban, fec_encoder_parity(vban->fec_enc), parity_size, info.sample_rates);
+            }
+        }
     }
 
     info.byte_pos += len;
@@ -290,8 +994,21 @@ static int _vban_process(audio_element_handle_t self, char *in_buffer, int in_le
     int w_size = 0;
     if (bytes_one > 0 || bytes_two > 0) {
         int r_size = bytes_one > bytes_two ? bytes_one : bytes_two;
+        vban_stream_t *vban = (vban_stream_t *)audio_element_getdata(self);
+        ringbuf_handle_t rb = audio_element_get_output_ringbuf(self);
+        if (vban->type == AUDIO_STREAM_READER && vban->rb_depth > 0 && rb
+            && rb_bytes_filled(rb) + r_size > vban->rb_depth) {
+            // beyond the depth for this format: drop instead of piling up latency.
+            vban->rb_overflow++;
+            return r_size;
+        }
         w_size = audio_element_output(self, in_buffer, r_size);
         audio_element_multi_output(self, in_buffer, r_size, 0);
+        if (vban->type == AUDIO_STREAM_READER && w_size > 0) {
+            // only the bytes that reached the ringbuffer are seen by the consumer,
+            // a frame rebuilt by FEC is dated by the last arrival.
+            latency_tag(&vban->latency, w_size, vban->rx_time_us);
+        }
     } else {
         w_size = bytes_one > bytes_two ? bytes_two : bytes_one;
     }
@@ -306,6 +1023,8 @@ static esp_err_t _vban_close(audio_element_handle_t self)
     if (vban->is_init) {
         vban->is_init = false;
     }
+    pacer_release(&vban->pacer);
+    _vban_close_socket(vban);
     if (AEL_STATE_PAUSED != audio_element_get_state(self)) {
         audio_element_info_t info = {0};
         audio_element_getinfo(self, &info);
@@ -319,7 +1038,13 @@ static esp_err_t _vban_destroy(audio_element_handle_t self)
 {
     vban_stream_t *vban = (vban_stream_t *)audio_element_getdata(self);
 
-    socket_release(&(vban->socket));
+    pacer_release(&vban->pacer);
+    _vban_close_socket(vban);
+    if (vban->format_ack) {
+        vSemaphoreDelete(vban->format_ack);
+    }
+    fec_encoder_release(&(vban->fec_enc));
+    fec_decoder_release(&(vban->fec_dec));
     audio_free(vban);
     return ESP_OK;
 }
@@ -347,11 +1072,52 @@ audio_element_handle_t vban_stream_init(vban_stream_cfg_t *config)
         cfg.buffer_len = VBAN_STREAM_BUF_SIZE;
     }
 
+    vban->latency_ms = config->latency_ms;
+    if (config->latency_ms > 0
+        && vban_stream_plan_latency(config->latency_ms, VBAN_STREAM_NOMINAL_RATE, VBAN_STREAM_NOMINAL_CHANNELS,
+                                    VBAN_STREAM_NOMINAL_BITS, &vban->plan) == ESP_OK) {
+        // the reader stages one whole packet whatever its size, only the ringbuffer adds latency.
+        cfg.buffer_len = config->type == AUDIO_STREAM_WRITER ? vban->plan.buf_sz : VBAN_DATA_MAX_SIZE;
+        // room for the jitter frames of any format, the used depth is set per format.
+        cfg.out_rb_size = vban->plan.jitter_frames * VBAN_DATA_MAX_SIZE;
+    } else if (config->type == AUDIO_STREAM_READER && config->out_rb_ms > 0) {
+        // the allocation can't follow the stream, make it hold out_rb_ms of the largest expected format.
+        int max_size = (int)(((int64_t)config->max_rates * config->out_rb_ms) / 1000)
+                       * config->max_channels * (config->max_bits / 8);
+        if (max_size > cfg.out_rb_size) {
+            cfg.out_rb_size = max_size;
+        }
+    }
+    vban->out_rb_ms = config->out_rb_ms;
+    vban->shared_socket = config->shared_socket;
+    strncpy(vban->stream_name, APP_STREAM_NAME, VBAN_STREAM_NAME_SIZE-1);
+    vban->source_timeout_ms = config->source_timeout_ms;
+    vban->engine_reader = -1;
+    vban->command_reader = -1;
+    vban->serial_reader = -1;
+
     vban->type = config->type;
     if (config->type == AUDIO_STREAM_WRITER) {
         cfg.write = _vban_write;
     } else {
         cfg.read = _vban_read;
+        vban->format_ack = xSemaphoreCreateBinary();
+        AUDIO_MEM_CHECK(TAG, vban->format_ack, goto _vban_init_exit);
+    }
+
+    vban->pacer_cfg.depth = config->pace_depth;
+    vban->pacer_cfg.burst_us = config->pace_burst_us;
+    vban->pacer_cfg.task_stack = VBAN_STREAM_PACE_TASK_STACK;
+    vban->pacer_cfg.task_core = config->task_core;
+    vban->pacer_cfg.task_prio = VBAN_STREAM_PACE_TASK_PRIO;
+
+    if (config->fec_group_size > 0) {
+        int ret = (config->type == AUDIO_STREAM_WRITER)
+                  ? fec_encoder_init(&vban->fec_enc, config->fec_group_size)
+                  : fec_decoder_init(&vban->fec_dec, config->fec_group_size);
+        if (ret < 0) {
+            ESP_LOGW(TAG, "FEC disabled, invalid group size %d", config->fec_group_size);
+        }
     }
     ESP_LOGI(TAG, "vban_stream_init");
     el = audio_element_init(&cfg);
@@ -360,29 +1126,380 @@ audio_element_handle_t vban_stream_init(vban_stream_cfg_t *config)
     audio_element_setdata(el, vban);
     return el;
 _vban_init_exit:
+    if (vban->format_ack) {
+        vSemaphoreDelete(vban->format_ack);
+    }
+    fec_encoder_release(&vban->fec_enc);
+    fec_decoder_release(&vban->fec_dec);
     audio_free(vban);
     return NULL;
 }
 
+static int _vban_find_group(struct socket_config_t *cfg, const char *multi_ip, const char *source)
+{
+    unsigned int index;
+    for (index = 0; index < cfg->nb_groups; index++) {
+        if (strncmp(cfg->groups[index].group, multi_ip, SOCKET_IP_ADDRESS_SIZE) == 0
+            && strncmp(cfg->groups[index].source, source, SOCKET_IP_ADDRESS_SIZE) == 0) {
+            return index;
+        }
+    }
+    return -1;
+}
+
 esp_err_t vban_stream_join_group(audio_element_handle_t self, const char* multi_ip)
+{
+    return vban_stream_join_source_group(self, multi_ip, NULL);
+}
+
+esp_err_t vban_stream_leave_group(audio_element_handle_t self, const char* multi_ip)
+{
+    return vban_stream_leave_source_group(self, multi_ip, NULL);
+}
+
+esp_err_t vban_stream_join_source_group(audio_element_handle_t self, const char *multi_ip, const char *source)
 {
     vban_stream_t *vban = (vban_stream_t *)audio_element_getdata(self);
+    AUDIO_NULL_CHECK(TAG, vban, return ESP_FAIL);
+    AUDIO_NULL_CHECK(TAG, multi_ip, return ESP_FAIL);
+    if (source == NULL) {
+        source = "";
+    }
+
+    if (!socket_is_multicast(multi_ip) || strlen(multi_ip) >= SOCKET_IP_ADDRESS_SIZE || strlen(source) >= SOCKET_IP_ADDRESS_SIZE) {
+        ESP_LOGE(TAG, "invalid group %s from %s", multi_ip, source);
+        return ESP_FAIL;
+    }
+
+    struct socket_config_t *cfg = &vban->socket_cfg;
+    if (_vban_find_group(cfg, multi_ip, source) >= 0) {
+        return ESP_OK;
+    }
+    if (cfg->nb_groups == SOCKET_GROUPS_MAX_NB) {
+        ESP_LOGE(TAG, "no room left for group %s", multi_ip);
+        return ESP_FAIL;
+    }
 
-    int ret = socket_join_group(vban->socket, multi_ip);
+    // kept in the socket config too, so the membership survives a socket reopen.
+    socket_handle_t socket = _vban_socket(vban);
+    int ret = socket ? socket_join_source_group(socket, multi_ip, source) : 0;
     if (ret < 0) {
         ESP_LOGE(TAG, "join group failed: %d", ret);
+        return ESP_FAIL;
     }
+    memset(&cfg->groups[cfg->nb_groups], 0, sizeof(struct socket_group_t));
+    strncpy(cfg->groups[cfg->nb_groups].group, multi_ip, SOCKET_IP_ADDRESS_SIZE-1);
+    strncpy(cfg->groups[cfg->nb_groups].source, source, SOCKET_IP_ADDRESS_SIZE-1);
+    cfg->nb_groups++;
     return ESP_OK;
 }
 
-esp_err_t vban_stream_leave_group(audio_element_handle_t self, const char* multi_ip)
+esp_err_t vban_stream_leave_source_group(audio_element_handle_t self, const char *multi_ip, const char *source)
 {
     vban_stream_t *vban = (vban_stream_t *)audio_element_getdata(self);
+    AUDIO_NULL_CHECK(TAG, vban, return ESP_FAIL);
+    AUDIO_NULL_CHECK(TAG, multi_ip, return ESP_FAIL);
+    if (source == NULL) {
+        source = "";
+    }
 
-    int ret = socket_leave_group(vban->socket, multi_ip);
+    struct socket_config_t *cfg = &vban->socket_cfg;
+    int index = _vban_find_group(cfg, multi_ip, source);
+    if (index < 0) {
+        ESP_LOGE(TAG, "group %s from %s was not joined", multi_ip, source);
+        return ESP_FAIL;
+    }
+    cfg->groups[index] = cfg->groups[--cfg->nb_groups];
+
+    socket_handle_t socket = _vban_socket(vban);
+    int ret = socket ? socket_leave_source_group(socket, multi_ip, source) : 0;
     if (ret < 0) {
         ESP_LOGE(TAG, "leave group failed: %d", ret);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t vban_stream_add_destination(audio_element_handle_t self, const char *ip, int port)
+{
+    vban_stream_t *vban = (vban_stream_t *)audio_element_getdata(self);
+    AUDIO_NULL_CHECK(TAG, vban, return ESP_FAIL);
+    AUDIO_NULL_CHECK(TAG, ip, return ESP_FAIL);
+
+    if (vban->type != AUDIO_STREAM_WRITER || port <= 0 || port > 65535 || strlen(ip) >= SOCKET_IP_ADDRESS_SIZE) {
+        ESP_LOGE(TAG, "invalid destination %s:%d", ip, port);
+        return ESP_FAIL;
+    }
+
+    struct socket_config_t *cfg = &vban->socket_cfg;
+    unsigned int index;
+    for (index = 0; index < cfg->nb_destinations; index++) {
+        if (cfg->destinations[index].port == port
+            && strncmp(cfg->destinations[index].ip_address, ip, SOCKET_IP_ADDRESS_SIZE) == 0) {
+            return ESP_OK;
+        }
+    }
+    if (cfg->nb_destinations == SOCKET_DESTINATIONS_MAX_NB) {
+        ESP_LOGE(TAG, "no room left for destination %s:%d", ip, port);
+        return ESP_FAIL;
+    }
+
+    // kept in the socket config too, so the destination survives a socket reopen.
+    if (vban->socket && socket_add_destination(vban->socket, ip, port) != 0) {
+        return ESP_FAIL;
+    }
+    memset(&cfg->destinations[cfg->nb_destinations], 0, sizeof(struct socket_destination_t));
+    strncpy(cfg->destinations[cfg->nb_destinations].ip_address, ip, SOCKET_IP_ADDRESS_SIZE-1);
+    cfg->destinations[cfg->nb_destinations].port = port;
+    cfg->nb_destinations++;
+    return ESP_OK;
+}
+
+esp_err_t vban_stream_remove_destination(audio_element_handle_t self, const char *ip, int port)
+{
+    vban_stream_t *vban = (vban_stream_t *)audio_element_getdata(self);
+    AUDIO_NULL_CHECK(TAG, vban, return ESP_FAIL);
+    AUDIO_NULL_CHECK(TAG, ip, return ESP_FAIL);
+
+    struct socket_config_t *cfg = &vban->socket_cfg;
+    bool found = false;
+    unsigned int index;
+    for (index = 0; index < cfg->nb_destinations; index++) {
+        if (cfg->destinations[index].port == port
+            && strncmp(cfg->destinations[index].ip_address, ip, SOCKET_IP_ADDRESS_SIZE) == 0) {
+            cfg->destinations[index] = cfg->destinations[--cfg->nb_destinations];
+            found = true;
+            break;
+        }
+    }
+
+    // the socket only holds destinations of the config, both have to drop it.
+    if (found && vban->socket && socket_remove_destination(vban->socket, ip, port) != 0) {
+        ESP_LOGW(TAG, "destination %s:%d was not in the socket", ip, port);
+        found = false;
+    }
+    return found ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t vban_stream_set_source(audio_element_handle_t self, const char *ip, int port)
+{
+    vban_stream_t *vban = (vban_stream_t *)audio_element_getdata(self);
+    AUDIO_NULL_CHECK(TAG, vban, return ESP_FAIL);
+
+    if (vban->type != AUDIO_STREAM_READER || port < 0 || port > 65535 || (ip && strlen(ip) >= SOCKET_IP_ADDRESS_SIZE)) {
+        ESP_LOGE(TAG, "invalid source %s:%d", ip ? ip : "", port);
+        return ESP_FAIL;
+    }
+
+    memset(vban->pending_source_ip, 0, sizeof(vban->pending_source_ip));
+    if (ip) {
+        strncpy(vban->pending_source_ip, ip, SOCKET_IP_ADDRESS_SIZE-1);
+    }
+    vban->pending_source_port = port;
+    if (vban->is_init) {
+        // the reader task checks senders against the lock, it relocks on its next read.
+        vban->relock = true;
+    } else {
+        memcpy(vban->source_ip, vban->pending_source_ip, SOCKET_IP_ADDRESS_SIZE);
+        vban->source_port = port;
+    }
+    return ESP_OK;
+}
+
+esp_err_t vban_stream_set_directory(audio_element_handle_t self, directory_handle_t directory)
+{
+    vban_stream_t *vban = (vban_stream_t *)audio_element_getdata(self);
+    AUDIO_NULL_CHECK(TAG, vban, return ESP_FAIL);
+
+    if (vban->type != AUDIO_STREAM_READER) {
+        ESP_LOGE(TAG, "only readers see the streams of the port");
+        return ESP_FAIL;
+    }
+    vban->directory = directory;
+    if (vban->engine) {
+        socket_engine_set_directory(vban->engine, directory);
+    }
+    return ESP_OK;
+}
+
+esp_err_t vban_stream_set_stream_name(audio_element_handle_t self, const char *name)
+{
+    vban_stream_t *vban = (vban_stream_t *)audio_element_getdata(self);
+    AUDIO_NULL_CHECK(TAG, vban, return ESP_FAIL);
+    AUDIO_NULL_CHECK(TAG, name, return ESP_FAIL);
+
+    if (vban->type != AUDIO_STREAM_READER) {
+        ESP_LOGE(TAG, "stream name of a writer is set at open");
+        return ESP_FAIL;
+    }
+
+    memset(vban->pending_name, 0, sizeof(vban->pending_name));
+    memcpy(vban->pending_name, name, strnlen(name, VBAN_STREAM_NAME_SIZE));
+    if (vban->is_init) {
+        // the reader task owns the stream state, it switches on its next read.
+        vban->rename = true;
+    } else {
+        _vban_switch_stream(vban);
     }
+    return ESP_OK;
+}
+
+esp_err_t vban_stream_set_command_handler(audio_element_handle_t self, const char *stream_name,
+                                          command_handler_t handler, void *context)
+{
+    vban_stream_t *vban = (vban_stream_t *)audio_element_getdata(self);
+    AUDIO_NULL_CHECK(TAG, vban, return ESP_FAIL);
+
+    if (vban->type != AUDIO_STREAM_READER) {
+        ESP_LOGE(TAG, "only readers take commands");
+        return ESP_FAIL;
+    }
+
+    if (vban->engine) {
+        socket_engine_detach_reader(vban->engine, vban->command_reader);
+        vban->command_reader = -1;
+    }
+    memset(vban->command_name, 0, sizeof(vban->command_name));
+    if (stream_name) {
+        strncpy(vban->command_name, stream_name, VBAN_STREAM_NAME_SIZE-1);
+    }
+    vban->command_handler = handler;
+    vban->command_context = context;
+
+    if (vban->engine && vban->command_name[0]) {
+        vban->command_reader = socket_engine_attach_reader(vban->engine, vban->command_name, NULL);
+        if (vban->command_reader < 0) {
+            ESP_LOGE(TAG, "no engine slot for command stream %s", vban->command_name);
+            return ESP_FAIL;
+        }
+    }
+    if (vban->command_name[0]) {
+        ESP_LOGI(TAG, "commands accepted on stream %s", vban->command_name);
+    }
+    return ESP_OK;
+}
+
+esp_err_t vban_stream_set_command_controller(audio_element_handle_t self, const char *ip)
+{
+    vban_stream_t *vban = (vban_stream_t *)audio_element_getdata(self);
+    AUDIO_NULL_CHECK(TAG, vban, return ESP_FAIL);
+
+    if (vban->type != AUDIO_STREAM_READER || vban->is_init || (ip && strlen(ip) >= SOCKET_IP_ADDRESS_SIZE)) {
+        ESP_LOGE(TAG, "invalid controller %s", ip ? ip : "");
+        return ESP_FAIL;
+    }
+
+    memset(vban->controller_ip, 0, sizeof(vban->controller_ip));
+    if (ip) {
+        strncpy(vban->controller_ip, ip, SOCKET_IP_ADDRESS_SIZE-1);
+    }
+    return ESP_OK;
+}
+
+esp_err_t vban_stream_set_serial(audio_element_handle_t self, serial_handle_t serial)
+{
+    vban_stream_t *vban = (vban_stream_t *)audio_element_getdata(self);
+    AUDIO_NULL_CHECK(TAG, vban, return ESP_FAIL);
+
+    if (vban->type != AUDIO_STREAM_READER || vban->is_init) {
+        ESP_LOGE(TAG, "serial link is set on a reader before it opens");
+        return ESP_FAIL;
+    }
+    vban->serial = serial;
+    return ESP_OK;
+}
+
+esp_err_t vban_stream_set_recorder(audio_element_handle_t self, recorder_handle_t recorder)
+{
+    vban_stream_t *vban = (vban_stream_t *)audio_element_getdata(self);
+    AUDIO_NULL_CHECK(TAG, vban, return ESP_FAIL);
+
+    if (vban->type != AUDIO_STREAM_READER || vban->is_init) {
+        ESP_LOGE(TAG, "recorder is set on a reader before it opens");
+        return ESP_FAIL;
+    }
+    vban->recorder = recorder;
+    return ESP_OK;
+}
+
+esp_err_t vban_stream_rebind(audio_element_handle_t self)
+{
+    vban_stream_t *vban = (vban_stream_t *)audio_element_getdata(self);
+    AUDIO_NULL_CHECK(TAG, vban, return ESP_FAIL);
+
+    if (vban->type != AUDIO_STREAM_READER) {
+        ESP_LOGE(TAG, "only readers are rebound");
+        return ESP_FAIL;
+    }
+    // done by the reader task itself, on its next read.
+    vban->rebind = vban->is_init;
+    return ESP_OK;
+}
+
+esp_err_t vban_stream_format_applied(audio_element_handle_t self)
+{
+    vban_stream_t *vban = (vban_stream_t *)audio_element_getdata(self);
+    AUDIO_NULL_CHECK(TAG, vban, return ESP_FAIL);
+    AUDIO_NULL_CHECK(TAG, vban->format_ack, return ESP_FAIL);
+
+    xSemaphoreGive(vban->format_ack);
+    return ESP_OK;
+}
+
+esp_err_t vban_stream_sink_consumed(audio_element_handle_t self, int size)
+{
+    vban_stream_t *vban = (vban_stream_t *)audio_element_getdata(self);
+    AUDIO_NULL_CHECK(TAG, vban, return ESP_FAIL);
+
+    if (size > 0) {
+        latency_consume(&vban->latency, size, esp_timer_get_time());
+    }
+    return ESP_OK;
+}
+
+esp_err_t vban_stream_set_channel_map(audio_element_handle_t self, const uint16_t *map, int out_channels)
+{
+    vban_stream_t *vban = (vban_stream_t *)audio_element_getdata(self);
+    AUDIO_NULL_CHECK(TAG, vban, return ESP_FAIL);
+
+    if (out_channels < 0 || chmap_set_gather(&vban->pending_chmap, out_channels, map) != 0) {
+        return ESP_FAIL;
+    }
+    _vban_stage_chmap(vban);
+    return ESP_OK;
+}
+
+esp_err_t vban_stream_set_channel_mix(audio_element_handle_t self, const int16_t *gains, int in_channels, int out_channels)
+{
+    vban_stream_t *vban = (vban_stream_t *)audio_element_getdata(self);
+    AUDIO_NULL_CHECK(TAG, vban, return ESP_FAIL);
+
+    if (in_channels < 0 || out_channels < 0 || chmap_set_mix(&vban->pending_chmap, in_channels, out_channels, gains) != 0) {
+        return ESP_FAIL;
+    }
+    _vban_stage_chmap(vban);
+    return ESP_OK;
+}
+
+esp_err_t vban_stream_get_latency_plan(audio_element_handle_t self, vban_stream_latency_plan_t *plan)
+{
+    vban_stream_t *vban = (vban_stream_t *)audio_element_getdata(self);
+    AUDIO_NULL_CHECK(TAG, vban, return ESP_FAIL);
+    AUDIO_NULL_CHECK(TAG, plan, return ESP_FAIL);
+
+    if (vban->latency_ms <= 0) {
+        return ESP_FAIL;
+    }
+    *plan = vban->plan;
+    return ESP_OK;
+}
+
+esp_err_t vban_stream_get_stats(audio_element_handle_t self, vban_stream_stats_t *stats)
+{
+    vban_stream_t *vban = (vban_stream_t *)audio_element_getdata(self);
+    AUDIO_NULL_CHECK(TAG, vban, return ESP_FAIL);
+    AUDIO_NULL_CHECK(TAG, stats, return ESP_FAIL);
 
+    _vban_get_stats(vban, stats);
     return ESP_OK;
 }
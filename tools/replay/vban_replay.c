@@ -0,0 +1,977 @@
+/*
+ *  This file is part of vban.
+ *  Copyright (c) 2020 by INFOMEDIA
+ *
+ *  vban is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vban is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vban.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Replay recorded VBAN traffic, on a host.
+ *
+ * Reads a capture file written by the board recorder or a pcap file, then either sends
+ * the datagrams to a receiver over UDP, or runs them through the receive path of the
+ * board built for the host: validation, stream demux, FEC, format tracking, channel map
+ * and a jitter buffer drained at the stream sample rate.
+ *
+ * The jitter buffer runs on the capture timeline, not on the host clock: underruns and
+ * latency come out the same at any replay speed. At maximum speed the tool reports the
+ * packets per second and the CPU time per packet of the whole path.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "vban.h"
+#include "packet.h"
+#include "stream.h"
+#include "fec.h"
+#include "chmap.h"
+#include "latency.h"
+#include "capture.h"
+#include "netsim.h"
+#include "receiver.h"
+
+int replay_log_level = 1;
+
+#define REPLAY_PORT_DEFAULT     6980
+#define REPLAY_LATENCY_DEFAULT  40
+#define REPLAY_NETSIM_DEPTH     64
+
+#define PCAP_MAGIC_US           0xA1B2C3D4
+#define PCAP_MAGIC_NS           0xA1B23C4D
+#define PCAP_LINK_NULL          0
+#define PCAP_LINK_ETHERNET      1
+#define PCAP_LINK_RAW           101
+#define PCAP_LINK_LOOP          108
+#define PCAP_LINK_SLL           113
+#define PCAP_LINK_SLL2          276
+
+/** a datagram to replay, its data points into the mapped file */
+struct replay_packet_t
+{
+    int64_t                 time_us;
+    char const*             data;
+    size_t                  size;
+    struct capture_source_t source;
+};
+
+struct replay_config_t
+{
+    char const*         input;
+    char const*         output;         /* convert to a capture file */
+    char const*         udp;            /* host:port to send to, direct receive path otherwise */
+    char                stream[VBAN_STREAM_NAME_SIZE + 1];
+    double              speed;          /* 1 original timing, 0 as fast as possible */
+    int                 port;           /* pcap: udp destination port, 0 for any */
+    int                 latency_ms;
+    int                 fec_group;
+    unsigned int        loops;
+    unsigned int        out_channels;
+    uint16_t            map[CHMAP_OUT_MAX_NB];
+    int                 netsim;
+    struct netsim_config_t netsim_cfg;
+};
+
+/** the receive path of the board, fed in capture time */
+struct replay_receiver_t
+{
+    char                    stream[VBAN_STREAM_NAME_SIZE + 1];
+    int                     latency_ms;
+    fec_decoder_handle_t    fec_dec;
+    struct chmap_t          chmap;
+    struct latency_t        latency;
+
+    /** current format */
+    struct receiver_format_t format;
+    unsigned int            frame_bytes;    /* one sample of every output channel */
+    uint64_t                byte_rate;
+
+    /** jitter buffer, the element ringbuffer in front of I2S */
+    char*                   ring;
+    size_t                  ring_size;
+    size_t                  head;
+    size_t                  fill;
+    size_t                  prefill;
+    int                     playing;
+    int64_t                 play_start_us;
+    uint64_t                drained;        /* bytes taken since play_start_us */
+    char                    out[VBAN_CHANNELS_MAX_NB * VBAN_SAMPLES_MAX_NB * 4];
+
+    /** counters */
+    uint32_t                packets;
+    uint32_t                accepted;
+    uint32_t                foreign;
+    uint32_t                invalid;
+    uint32_t                parity;
+    uint32_t                format_changes;
+    uint32_t                overflows;
+    uint32_t                underruns;
+    uint64_t                played;
+};
+
+struct replay_t
+{
+    struct replay_config_t      config;
+    struct replay_receiver_t    rx;
+    netsim_handle_t             netsim;
+    int                         fd;
+    struct sockaddr_storage     to;
+    socklen_t                   tolen;
+    uint32_t                    sent;
+    uint32_t                    send_errors;
+    struct timespec             start;
+    int64_t                     first_us;
+};
+
+static int64_t replay_now_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* ---- input ---- */
+
+static uint16_t replay_be16(unsigned char const* p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t replay_u32(unsigned char const* p, int swap)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return swap ? __builtin_bswap32(value) : value;
+}
+
+static int replay_add(struct replay_packet_t** packets, size_t* count, size_t* capacity, struct replay_packet_t const* packet)
+{
+    if (*count == *capacity)
+    {
+        size_t size = (*capacity != 0) ? *capacity * 2 : 4096;
+        struct replay_packet_t* grown = realloc(*packets, size * sizeof(struct replay_packet_t));
+        if (grown == 0)
+        {
+            return -ENOMEM;
+        }
+        *packets = grown;
+        *capacity = size;
+    }
+    (*packets)[(*count)++] = *packet;
+    return 0;
+}
+
+/** from the link layer to the udp payload, 0 for anything else than unfragmented udp */
+static int replay_pcap_udp(unsigned char const* frame, size_t size, int link, int port, struct replay_packet_t* packet)
+{
+    unsigned char const* ip = frame;
+    size_t left = size;
+    unsigned char const* udp;
+    size_t ip_header;
+    int version;
+
+    switch (link)
+    {
+    case PCAP_LINK_ETHERNET:
+        if (left < 14)
+        {
+            return 0;
+        }
+        ip += 14;
+        left -= 14;
+        if ((replay_be16(frame + 12) == 0x8100) && (left >= 4))
+        {
+            ip += 4;
+            left -= 4;
+        }
+        break;
+    case PCAP_LINK_SLL:
+        if (left < 16)
+        {
+            return 0;
+        }
+        ip += 16;
+        left -= 16;
+        break;
+    case PCAP_LINK_SLL2:
+        if (left < 20)
+        {
+            return 0;
+        }
+        ip += 20;
+        left -= 20;
+        break;
+    case PCAP_LINK_NULL:
+    case PCAP_LINK_LOOP:
+        if (left < 4)
+        {
+            return 0;
+        }
+        ip += 4;
+        left -= 4;
+        break;
+    case PCAP_LINK_RAW:
+        break;
+    default:
+        return 0;
+    }
+
+    if (left < 1)
+    {
+        return 0;
+    }
+    version = ip[0] >> 4;
+    memset(&packet->source, 0, sizeof(packet->source));
+    if (version == 4)
+    {
+        ip_header = (ip[0] & 0x0F) * 4;
+        /** a fragment carries part of a datagram, VBAN never needs them */
+        if ((left < 20) || (ip_header < 20) || (left < ip_header) || (ip[9] != 17)
+            || ((replay_be16(ip + 6) & 0x3FFF) != 0))
+        {
+            return 0;
+        }
+        packet->source.ip_version = 4;
+        memcpy(packet->source.ip, ip + 12, 4);
+    }
+    else if (version == 6)
+    {
+        ip_header = 40;
+        if ((left < ip_header) || (ip[6] != 17))
+        {
+            return 0;
+        }
+        packet->source.ip_version = 6;
+        memcpy(packet->source.ip, ip + 8, 16);
+    }
+    else
+    {
+        return 0;
+    }
+
+    udp = ip + ip_header;
+    left -= ip_header;
+    if ((left < 8) || (replay_be16(udp + 4) < 8))
+    {
+        return 0;
+    }
+    if ((port != 0) && (replay_be16(udp + 2) != port))
+    {
+        return 0;
+    }
+    packet->source.port = replay_be16(udp);
+    packet->data = (char const*)udp + 8;
+    packet->size = replay_be16(udp + 4) - 8;
+    if (packet->size > left - 8)
+    {
+        /** cut by the capture snap length */
+        return 0;
+    }
+
+    return 1;
+}
+
+static int replay_load_pcap(char const* base, size_t size, int port, struct replay_packet_t** packets, size_t* count)
+{
+    unsigned char const* file = (unsigned char const*)base;
+    size_t capacity = 0;
+    size_t offset = 24;
+    uint32_t magic;
+    int swap = 0;
+    int nano = 0;
+    int link;
+
+    magic = replay_u32(file, 0);
+    if ((magic == PCAP_MAGIC_US) || (magic == PCAP_MAGIC_NS))
+    {
+        nano = (magic == PCAP_MAGIC_NS);
+    }
+    else if ((magic == __builtin_bswap32(PCAP_MAGIC_US)) || (magic == __builtin_bswap32(PCAP_MAGIC_NS)))
+    {
+        swap = 1;
+        nano = (magic == __builtin_bswap32(PCAP_MAGIC_NS));
+    }
+    else
+    {
+        return -EINVAL;
+    }
+    link = replay_u32(file + 20, swap) & 0xFFFF;
+
+    while (offset + 16 <= size)
+    {
+        struct replay_packet_t packet;
+        uint32_t seconds = replay_u32(file + offset, swap);
+        uint32_t fraction = replay_u32(file + offset + 4, swap);
+        uint32_t length = replay_u32(file + offset + 8, swap);
+
+        offset += 16;
+        if (offset + length > size)
+        {
+            break;
+        }
+        packet.time_us = (int64_t)seconds * 1000000 + (nano ? fraction / 1000 : fraction);
+        if (replay_pcap_udp(file + offset, length, link, port, &packet)
+            && (replay_add(packets, count, &capacity, &packet) != 0))
+        {
+            return -ENOMEM;
+        }
+        offset += length;
+    }
+
+    return 0;
+}
+
+static int replay_load_capture(char const* base, size_t size, struct replay_packet_t** packets, size_t* count)
+{
+    struct capture_file_t file;
+    struct capture_record_t record;
+    size_t capacity = 0;
+    size_t offset;
+    int ret;
+
+    ret = capture_map(&file, base, size);
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    offset = file.first;
+    while ((ret = capture_next(&file, &offset, &record)) > 0)
+    {
+        struct replay_packet_t packet = {
+            .time_us = record.time_us,
+            .data = record.data,
+            .size = record.size,
+            .source = record.source,
+        };
+        if (replay_add(packets, count, &capacity, &packet) != 0)
+        {
+            return -ENOMEM;
+        }
+    }
+
+    return ret;
+}
+
+/* ---- receive path ---- */
+
+static void replay_receiver_reset(struct replay_receiver_t* rx)
+{
+    rx->head = 0;
+    rx->fill = 0;
+    rx->playing = 0;
+    latency_resync(&rx->latency);
+}
+
+static int replay_receiver_init(struct replay_receiver_t* rx, struct replay_config_t const* config)
+{
+    memset(rx, 0, sizeof(struct replay_receiver_t));
+    memcpy(rx->stream, config->stream, sizeof(rx->stream));
+    rx->latency_ms = config->latency_ms;
+    latency_init(&rx->latency);
+    if ((config->out_channels > 0) && (chmap_set_gather(&rx->chmap, config->out_channels, config->map) != 0))
+    {
+        return -EINVAL;
+    }
+    if ((config->fec_group > 0) && (fec_decoder_init(&rx->fec_dec, config->fec_group) != 0))
+    {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static void replay_receiver_release(struct replay_receiver_t* rx)
+{
+    fec_decoder_release(&rx->fec_dec);
+    free(rx->ring);
+    rx->ring = 0;
+}
+
+/** the I2S side: take what the sample clock played since the buffer started */
+static void replay_drain(struct replay_receiver_t* rx, int64_t now_us)
+{
+    uint64_t due;
+    size_t size;
+
+    if (!rx->playing || (now_us <= rx->play_start_us))
+    {
+        return;
+    }
+
+    due = (uint64_t)(now_us - rx->play_start_us) * rx->byte_rate / 1000000;
+    due -= due % rx->frame_bytes;
+    size = (size_t)(due - rx->drained);
+    if (size > rx->fill)
+    {
+        /** ran dry before this arrival, the buffer fills up again before playing */
+        ++rx->underruns;
+        size = rx->fill;
+        rx->playing = 0;
+    }
+
+    rx->fill -= size;
+    rx->drained += size;
+    rx->played += size;
+    latency_consume(&rx->latency, size, now_us);
+}
+
+static void replay_format(struct replay_receiver_t* rx, char const* packet, size_t size)
+{
+    unsigned int out_channels;
+    size_t target;
+
+    if (receiver_check_format(packet, size, &rx->format) <= 0)
+    {
+        return;
+    }
+
+    /** same as the board: the buffer is sized again and restarts empty */
+    ++rx->format_changes;
+    out_channels = (rx->chmap.mode != CHMAP_NONE) ? rx->chmap.out_channels : rx->format.channels;
+    rx->frame_bytes = out_channels * (rx->format.bits / 8);
+    rx->byte_rate = (uint64_t)rx->format.rates * rx->frame_bytes;
+    target = (size_t)(rx->byte_rate * rx->latency_ms / 1000);
+    target -= target % rx->frame_bytes;
+    rx->prefill = (target > 0) ? target : rx->frame_bytes;
+    rx->ring_size = rx->prefill * 2 + sizeof(rx->out);
+    free(rx->ring);
+    rx->ring = malloc(rx->ring_size);
+    if (rx->fec_dec != 0)
+    {
+        fec_decoder_reset(rx->fec_dec);
+    }
+    replay_receiver_reset(rx);
+}
+
+static void replay_play(struct replay_receiver_t* rx, char const* packet, size_t size, int64_t now_us)
+{
+    size_t payload_size;
+    size_t chunk;
+    int ret;
+
+    replay_format(rx, packet, size);
+    if (rx->ring == 0)
+    {
+        return;
+    }
+
+    ret = receiver_payload(packet, size, &rx->chmap, rx->out, sizeof(rx->out));
+    if (ret < 0)
+    {
+        ++rx->invalid;
+        return;
+    }
+    payload_size = ret;
+
+    replay_drain(rx, now_us);
+    if (rx->fill + payload_size > rx->ring_size)
+    {
+        /** the writer blocks on the board, a frame that waits that long is as good as lost */
+        ++rx->overflows;
+        return;
+    }
+
+    chunk = (rx->ring_size - rx->head < payload_size) ? rx->ring_size - rx->head : payload_size;
+    memcpy(rx->ring + rx->head, rx->out, chunk);
+    memcpy(rx->ring, rx->out + chunk, payload_size - chunk);
+    rx->head = (rx->head + payload_size) % rx->ring_size;
+    rx->fill += payload_size;
+    ++rx->accepted;
+    latency_tag(&rx->latency, payload_size, now_us);
+
+    if (!rx->playing && (rx->fill >= rx->prefill))
+    {
+        rx->playing = 1;
+        rx->play_start_us = now_us;
+        rx->drained = 0;
+    }
+}
+
+static void replay_receive(struct replay_receiver_t* rx, char const* packet, size_t size, int64_t now_us)
+{
+    struct VBanHeader const* const hdr = PACKET_HEADER_PTR(packet);
+    char const* rebuilt;
+    size_t rebuilt_size;
+
+    ++rx->packets;
+
+    /** demux: the first audio stream seen is played when none was named */
+    if ((rx->stream[0] == '\0') && (size > VBAN_HEADER_SIZE) && (hdr->vban == VBAN_HEADER_FOURC)
+        && ((hdr->format_SR & VBAN_PROTOCOL_MASK) == VBAN_PROTOCOL_AUDIO))
+    {
+        memcpy(rx->stream, hdr->streamname, VBAN_STREAM_NAME_SIZE);
+    }
+
+    /** the same path as the board reader from here */
+    switch (receiver_demux(rx->stream, rx->fec_dec, packet, size))
+    {
+        case RECEIVER_PLAY:
+            replay_play(rx, packet, size, now_us);
+            return;
+
+        case RECEIVER_PARITY:
+            ++rx->parity;
+            break;
+
+        case RECEIVER_FOREIGN:
+            ++rx->foreign;
+            return;
+
+        case RECEIVER_INVALID:
+            ++rx->invalid;
+            return;
+
+        default:
+            break;
+    }
+
+    if (rx->fec_dec == 0)
+    {
+        return;
+    }
+    while ((rebuilt = fec_decoder_pop(rx->fec_dec, &rebuilt_size)) != 0)
+    {
+        replay_play(rx, rebuilt, rebuilt_size, now_us);
+    }
+}
+
+/* ---- replay ---- */
+
+static void replay_wait(struct replay_t* replay, int64_t time_us)
+{
+    struct timespec due;
+    int64_t offset_ns;
+
+    if (replay->config.speed <= 0)
+    {
+        return;
+    }
+
+    offset_ns = (int64_t)((double)(time_us - replay->first_us) * 1000.0 / replay->config.speed);
+    due.tv_sec = replay->start.tv_sec + (replay->start.tv_nsec + offset_ns) / 1000000000;
+    due.tv_nsec = (replay->start.tv_nsec + offset_ns) % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR)
+    {
+    }
+}
+
+static void replay_deliver(struct replay_t* replay, char const* data, size_t size, int64_t time_us)
+{
+    replay_wait(replay, time_us);
+    if (replay->fd < 0)
+    {
+        replay_receive(&replay->rx, data, size, time_us);
+        return;
+    }
+
+    if (sendto(replay->fd, data, size, 0, (struct sockaddr const*)&replay->to, replay->tolen) < 0)
+    {
+        ++replay->send_errors;
+        return;
+    }
+    ++replay->sent;
+}
+
+static void replay_netsim_flush(struct replay_t* replay, int64_t until_us)
+{
+    char buffer[VBAN_PROTOCOL_MAX_SIZE];
+    int64_t due;
+    int size;
+
+    while (((due = netsim_next_due(replay->netsim)) >= 0) && (due <= until_us))
+    {
+        size = netsim_pop(replay->netsim, buffer, sizeof(buffer), 0, due);
+        if (size > 0)
+        {
+            replay_deliver(replay, buffer, size, due);
+        }
+    }
+}
+
+static void replay_run(struct replay_t* replay, struct replay_packet_t const* packets, size_t count)
+{
+    size_t index;
+
+    clock_gettime(CLOCK_MONOTONIC, &replay->start);
+    replay->first_us = packets[0].time_us;
+    for (index = 0; index < count; ++index)
+    {
+        if (replay->netsim == 0)
+        {
+            replay_deliver(replay, packets[index].data, packets[index].size, packets[index].time_us);
+            continue;
+        }
+        /** impairments on the capture timeline: delayed datagrams leave at their due time */
+        replay_netsim_flush(replay, packets[index].time_us);
+        if (packets[index].size <= VBAN_PROTOCOL_MAX_SIZE)
+        {
+            netsim_push(replay->netsim, packets[index].data, packets[index].size, 0, packets[index].time_us);
+        }
+        replay_netsim_flush(replay, packets[index].time_us);
+    }
+    if (replay->netsim != 0)
+    {
+        replay_netsim_flush(replay, INT64_MAX);
+    }
+}
+
+static int replay_open_udp(struct replay_t* replay)
+{
+    struct addrinfo hints = { .ai_socktype = SOCK_DGRAM };
+    struct addrinfo* result;
+    char host[256];
+    char const* port;
+    char const* colon;
+    size_t length;
+
+    /** host:port, [v6]:port */
+    colon = strrchr(replay->config.udp, ':');
+    if ((colon == 0) || (colon == replay->config.udp))
+    {
+        return -EINVAL;
+    }
+    port = colon + 1;
+    length = colon - replay->config.udp;
+    if ((replay->config.udp[0] == '[') && (colon[-1] == ']'))
+    {
+        memcpy(host, replay->config.udp + 1, length - 2);
+        host[length - 2] = '\0';
+    }
+    else
+    {
+        if (length >= sizeof(host))
+        {
+            return -EINVAL;
+        }
+        memcpy(host, replay->config.udp, length);
+        host[length] = '\0';
+    }
+
+    if (getaddrinfo(host, port, &hints, &result) != 0)
+    {
+        return -EINVAL;
+    }
+    replay->fd = socket(result->ai_family, SOCK_DGRAM, 0);
+    memcpy(&replay->to, result->ai_addr, result->ai_addrlen);
+    replay->tolen = result->ai_addrlen;
+    freeaddrinfo(result);
+
+    return (replay->fd >= 0) ? 0 : -errno;
+}
+
+static int replay_convert(char const* path, struct replay_packet_t const* packets, size_t count)
+{
+    struct capture_config_t config = { 0 };
+    capture_handle_t capture;
+    size_t index;
+    int ret;
+
+    /** pcap times are wall clock times, they are kept as the record clock */
+    if (count > 0)
+    {
+        config.wall_us = packets[0].time_us;
+        config.mono_us = packets[0].time_us;
+    }
+    ret = capture_open(&capture, path, &config);
+    if (ret != 0)
+    {
+        return ret;
+    }
+    for (index = 0; (index < count) && (ret == 0); ++index)
+    {
+        ret = capture_write(capture, packets[index].data, packets[index].size, packets[index].time_us,
+                            &packets[index].source);
+    }
+    if (capture_close(&capture) != 0)
+    {
+        ret = -EIO;
+    }
+    return ret;
+}
+
+static void replay_report(struct replay_t* replay, size_t count, int64_t wall_ns, int64_t cpu_ns)
+{
+    struct replay_receiver_t const* rx = &replay->rx;
+    struct latency_stats_t latency;
+    struct netsim_stats_t netsim;
+    uint64_t delivered = (uint64_t)count * replay->config.loops;
+
+    if (replay->fd >= 0)
+    {
+        printf("sent %u datagrams, %u errors\n", replay->sent, replay->send_errors);
+    }
+    else
+    {
+        latency_get_stats(&rx->latency, &latency);
+        printf("stream '%.*s' %u Hz %u ch %u bits, %u format changes\n", VBAN_STREAM_NAME_SIZE, rx->stream,
+               rx->format.rates, rx->format.channels, rx->format.bits, rx->format_changes);
+        printf("packets %u: accepted %u foreign %u invalid %u parity %u\n", rx->packets, rx->accepted, rx->foreign,
+               rx->invalid, rx->parity);
+        printf("jitter buffer %d ms: %u underruns %u overflows, %.3f s played\n", rx->latency_ms, rx->underruns,
+               rx->overflows, rx->byte_rate ? (double)rx->played / rx->byte_rate : 0.0);
+        printf("latency us min/p50/p99/max %u/%u/%u/%u over %u frames\n", latency.min_us, latency.p50_us,
+               latency.p99_us, latency.max_us, latency.count);
+        if (rx->fec_dec != 0)
+        {
+            struct fec_stats_t fec;
+            fec_decoder_get_stats(rx->fec_dec, &fec);
+            printf("fec: %u recovered %u unrecoverable %u late\n", fec.recovered, fec.unrecoverable, fec.late);
+        }
+    }
+
+    if (replay->netsim != 0)
+    {
+        netsim_get_stats(replay->netsim, &netsim);
+        printf("netsim: %u lost (%u in bursts) %u duplicated %u reordered %u overflow\n", netsim.lost,
+               netsim.lost_bad, netsim.duplicated, netsim.reordered, netsim.overflow);
+    }
+
+    if ((replay->config.speed <= 0) && (delivered > 0) && (wall_ns > 0))
+    {
+        printf("%llu packets in %.3f s: %.0f packets/s, %.0f ns cpu/packet\n", (unsigned long long)delivered,
+               wall_ns / 1e9, delivered * 1e9 / wall_ns, (double)cpu_ns / delivered);
+    }
+}
+
+static void replay_usage(char const* name)
+{
+    fprintf(stderr,
+            "usage: %s [options] FILE\n"
+            "FILE is a capture file of the board recorder or a pcap file\n"
+            "  -s NAME      stream to play, the first audio stream by default\n"
+            "  -x SPEED     1 original timing (default), 2 twice as fast, 0 as fast as possible\n"
+            "  -u HOST:PORT send the datagrams over UDP instead of the receive path\n"
+            "  -w FILE      write the datagrams to a capture file and exit\n"
+            "  -p PORT      pcap: UDP destination port, 0 for any (default %d)\n"
+            "  -l MS        jitter buffer latency (default %d)\n"
+            "  -f N         FEC group size, 0 to ignore parity frames (default 0)\n"
+            "  -c A,B,...   channel map, output channel i plays input channel A, B...\n"
+            "  -n LOOPS     replay the file LOOPS times (default 1)\n"
+            "  -L PPM       netsim: random loss\n"
+            "  -B P,R,L     netsim: Gilbert-Elliott burst enter, leave and loss PPM\n"
+            "  -J US        netsim: delay jitter\n"
+            "  -R PPM,US    netsim: reordering chance and extra delay\n"
+            "  -D PPM       netsim: duplication\n"
+            "  -S SEED      netsim: seed (default 1)\n"
+            "  -v           more logs, repeat for more\n",
+            name, REPLAY_PORT_DEFAULT, REPLAY_LATENCY_DEFAULT);
+}
+
+static int replay_parse(struct replay_config_t* config, int argc, char* argv[])
+{
+    int option;
+    char* next;
+
+    memset(config, 0, sizeof(struct replay_config_t));
+    config->speed = 1.0;
+    config->port = REPLAY_PORT_DEFAULT;
+    config->latency_ms = REPLAY_LATENCY_DEFAULT;
+    config->loops = 1;
+    config->netsim_cfg.seed = 1;
+    config->netsim_cfg.depth = REPLAY_NETSIM_DEPTH;
+    config->netsim_cfg.max_size = VBAN_PROTOCOL_MAX_SIZE;
+
+    while ((option = getopt(argc, argv, "s:x:u:w:p:l:f:c:n:L:B:J:R:D:S:vh")) != -1)
+    {
+        switch (option)
+        {
+        case 's':
+            strncpy(config->stream, optarg, VBAN_STREAM_NAME_SIZE);
+            break;
+        case 'x':
+            config->speed = atof(optarg);
+            break;
+        case 'u':
+            config->udp = optarg;
+            break;
+        case 'w':
+            config->output = optarg;
+            break;
+        case 'p':
+            config->port = atoi(optarg);
+            break;
+        case 'l':
+            config->latency_ms = atoi(optarg);
+            break;
+        case 'f':
+            config->fec_group = atoi(optarg);
+            break;
+        case 'c':
+            for (next = optarg; (*next != '\0') && (config->out_channels < CHMAP_OUT_MAX_NB); ++next)
+            {
+                config->map[config->out_channels++] = strtoul(next, &next, 10);
+                if (*next != ',')
+                {
+                    break;
+                }
+            }
+            break;
+        case 'n':
+            config->loops = (atoi(optarg) > 0) ? atoi(optarg) : 1;
+            break;
+        case 'L':
+            config->netsim_cfg.loss_ppm = atoi(optarg);
+            config->netsim = 1;
+            break;
+        case 'B':
+            if (sscanf(optarg, "%u,%u,%u", &config->netsim_cfg.ge_p_ppm, &config->netsim_cfg.ge_r_ppm,
+                       &config->netsim_cfg.ge_bad_loss_ppm) != 3)
+            {
+                return -EINVAL;
+            }
+            config->netsim = 1;
+            break;
+        case 'J':
+            config->netsim_cfg.jitter_us = atoi(optarg);
+            config->netsim = 1;
+            break;
+        case 'R':
+            if (sscanf(optarg, "%u,%u", &config->netsim_cfg.reorder_ppm, &config->netsim_cfg.reorder_us) != 2)
+            {
+                return -EINVAL;
+            }
+            config->netsim = 1;
+            break;
+        case 'D':
+            config->netsim_cfg.duplicate_ppm = atoi(optarg);
+            config->netsim = 1;
+            break;
+        case 'S':
+            config->netsim_cfg.seed = strtoul(optarg, 0, 0);
+            break;
+        case 'v':
+            ++replay_log_level;
+            break;
+        default:
+            return -EINVAL;
+        }
+    }
+
+    if (optind != argc - 1)
+    {
+        return -EINVAL;
+    }
+    config->input = argv[optind];
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    struct replay_t replay;
+    struct replay_packet_t* packets = 0;
+    size_t count = 0;
+    struct stat st;
+    char const* base;
+    int64_t wall_ns;
+    int64_t cpu_ns;
+    unsigned int loop;
+    int fd;
+    int ret;
+
+    memset(&replay, 0, sizeof(replay));
+    replay.fd = -1;
+    if (replay_parse(&replay.config, argc, argv) != 0)
+    {
+        replay_usage(argv[0]);
+        return 1;
+    }
+
+    fd = open(replay.config.input, O_RDONLY);
+    if ((fd < 0) || (fstat(fd, &st) != 0) || (st.st_size < 24))
+    {
+        fprintf(stderr, "%s: cannot read %s\n", argv[0], replay.config.input);
+        return 1;
+    }
+    base = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED)
+    {
+        fprintf(stderr, "%s: cannot map %s\n", argv[0], replay.config.input);
+        return 1;
+    }
+
+    ret = (memcmp(base, CAPTURE_MAGIC, 4) == 0) ? replay_load_capture(base, st.st_size, &packets, &count)
+                                                : replay_load_pcap(base, st.st_size, replay.config.port, &packets, &count);
+    if (ret != 0)
+    {
+        fprintf(stderr, "%s: %s is not a capture or pcap file, or is damaged (%d)\n", argv[0], replay.config.input, ret);
+        return 1;
+    }
+    if (count == 0)
+    {
+        fprintf(stderr, "%s: no datagram to replay\n", argv[0]);
+        return 1;
+    }
+
+    if (replay.config.output != 0)
+    {
+        ret = replay_convert(replay.config.output, packets, count);
+        printf("%zu datagrams written to %s (%d)\n", count, replay.config.output, ret);
+        return (ret == 0) ? 0 : 1;
+    }
+
+    if ((replay.config.udp != 0) && (replay_open_udp(&replay) != 0))
+    {
+        fprintf(stderr, "%s: cannot send to %s\n", argv[0], replay.config.udp);
+        return 1;
+    }
+
+    wall_ns = replay_now_ns(CLOCK_MONOTONIC);
+    cpu_ns = replay_now_ns(CLOCK_PROCESS_CPUTIME_ID);
+    for (loop = 0; loop < replay.config.loops; ++loop)
+    {
+        /** each loop starts from a fresh receiver, the report shows the last one */
+        if (loop > 0)
+        {
+            replay_receiver_release(&replay.rx);
+            netsim_release(&replay.netsim);
+        }
+        if (replay_receiver_init(&replay.rx, &replay.config) != 0)
+        {
+            fprintf(stderr, "%s: bad channel map or FEC group size\n", argv[0]);
+            return 1;
+        }
+        if (replay.config.netsim && (netsim_init(&replay.netsim, &replay.config.netsim_cfg) != 0))
+        {
+            fprintf(stderr, "%s: bad netsim settings\n", argv[0]);
+            return 1;
+        }
+        replay_run(&replay, packets, count);
+    }
+    wall_ns = replay_now_ns(CLOCK_MONOTONIC) - wall_ns;
+    cpu_ns = replay_now_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_ns;
+
+    replay_report(&replay, count, wall_ns, cpu_ns);
+
+    replay_receiver_release(&replay.rx);
+    netsim_release(&replay.netsim);
+    if (replay.fd >= 0)
+    {
+        close(replay.fd);
+    }
+    free(packets);
+    munmap((void*)base, st.st_size);
+    close(fd);
+
+    return 0;
+}